@@ -49,7 +49,7 @@ readmetadata(struct capacity_reader * M)
 		goto err1;
 
 	/* Send the request. */
-	if ((M->http_cookie = dynamodb_request(M->addrs, M->key_id,
+	if ((M->http_cookie = dynamodb_request(NULL, NULL, M->addrs, M->key_id,
 	    M->key_secret, M->rname, "DescribeTable",
 	    (const uint8_t *)M->ddbreq, strlen(M->ddbreq), 4096,
 	    callback_readmetadata, M)) == NULL)
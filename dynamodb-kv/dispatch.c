@@ -1,13 +1,18 @@
+#include <sys/time.h>
+
 #include <assert.h>
 #include <fcntl.h>
 #include <stdlib.h>
 #include <unistd.h>
 
+#include "dynamodb_batch.h"
 #include "dynamodb_kv.h"
 #include "dynamodb_request_queue.h"
 #include "http.h"
+#include "monoclock.h"
 #include "netbuf.h"
 #include "network.h"
+#include "opstats.h"
 #include "proto_dynamodb_kv.h"
 #include "warnp.h"
 #include "wire.h"
@@ -21,6 +26,9 @@ struct request {
 	struct request * next;		/* Next request or NULL. */
 	struct proto_ddbkv_request R;	/* kivaloo-dynamodb-kv request. */
 	char * body;			/* DynamoDB request body. */
+	struct dynamodb_batch * B;	/* Batch operation, or NULL. */
+	struct timeval t_arrive;	/* When the request was read. */
+	struct timeval t_start;		/* When it was sent to DynamoDB. */
 };
 
 /* State of the work dispatcher. */
@@ -32,6 +40,9 @@ struct dispatch_state {
 	/* Target table. */
 	const char * table;
 
+	/* Request latency statistics. */
+	struct opstats * stats;
+
 	/* In-progress requests. */
 	struct request * ip_head;
 	struct request * ip_tail;
@@ -46,6 +57,73 @@ struct dispatch_state {
 
 static int callback_accept(void *, int);
 static int callback_response(void *, struct http_response *);
+static int callback_batch(void *, int);
+static int callback_batch_get(void *, int, const uint8_t * const *,
+    const uint32_t *);
+
+/*
+ * Record that a request of type ${type} which arrived at ${t_arrive} and was
+ * passed to a DynamoDB request queue at ${t_start} has been completed.
+ */
+static int
+record(struct dispatch_state * D, uint32_t type,
+    const struct timeval * t_arrive, const struct timeval * t_start)
+{
+	struct timeval t_done;
+
+	/* What time is it now? */
+	if (monoclock_get(&t_done))
+		goto err0;
+
+	/* Record the request latency. */
+	if (opstats_record(D->stats, type, t_arrive, t_start, &t_done))
+		goto err0;
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Answer the STATS request ${R} and free it. */
+static int
+sendstats(struct dispatch_state * D, struct request * R)
+{
+	uint8_t * buf;
+	size_t buflen;
+
+	/* Serialize the statistics we have so far. */
+	if (opstats_serialize(D->stats, &buf, &buflen))
+		goto err1;
+
+	/* Send the response. */
+	if (proto_dynamodb_kv_response_stats(D->writeq, R->R.ID,
+	    buflen, buf))
+		goto err2;
+
+	/* Record the request latency. */
+	if (record(D, PROTO_DDBKV_STATS, &R->t_arrive, &R->t_arrive))
+		goto err2;
+
+	/* Free the serialized statistics and the request. */
+	free(buf);
+	proto_dynamodb_kv_request_free(&R->R);
+	free(R);
+
+	/* Success! */
+	return (0);
+
+err2:
+	free(buf);
+err1:
+	proto_dynamodb_kv_request_free(&R->R);
+	free(R);
+
+	/* Failure! */
+	return (-1);
+}
 
 /* Remove a request from the in-progress list. */
 static void
@@ -55,6 +133,10 @@ request_dequeue(struct dispatch_state * D, struct request * R)
 	/* Sanity-check linked list. */
 	assert(D == R->D);
 
+	/* Cancel any batch operation which is still in progress. */
+	if (R->B != NULL)
+		dynamodb_batch_cancel(R->B);
+
 	/* Free the contents of the kivaloo-dynamodb-kv request. */
 	proto_dynamodb_kv_request_free(&R->R);
 
@@ -109,17 +191,104 @@ dropconnection(void * cookie)
 	return (0);
 }
 
-/* Read and dispatch incoming request(s). */
+/* Translate the request ${R} into DynamoDB request(s) and queue them. */
 static int
-gotrequest(void * cookie, int status)
+sendreq(struct dispatch_state * D, struct request * R)
 {
-	struct dispatch_state * D = cookie;
-	struct request * R;
 	struct dynamodb_request_queue * Q;
 	const char * op;
 	size_t maxrlen;
 	int prio;
 
+	/* No DynamoDB request body or batch operation yet. */
+	R->body = NULL;
+	R->B = NULL;
+
+	/* Requests with multiple keys become batch operations. */
+	switch (R->R.type) {
+	case PROTO_DDBKV_MPUT:
+		if ((R->B = dynamodb_batch_put(D->QW, 0, D->table,
+		    R->R.nkeys, R->R.keys, R->R.bufs, R->R.lens,
+		    callback_batch, R)) == NULL)
+			goto err0;
+		return (0);
+	case PROTO_DDBKV_MGET:
+	case PROTO_DDBKV_MGETC:
+		if ((R->B = dynamodb_batch_get(D->QR, 0, D->table,
+		    R->R.type == PROTO_DDBKV_MGETC, R->R.nkeys, R->R.keys,
+		    callback_batch_get, R)) == NULL)
+			goto err0;
+		return (0);
+	case PROTO_DDBKV_MDELETE:
+		if ((R->B = dynamodb_batch_delete(D->QW, 1, D->table,
+		    R->R.nkeys, R->R.keys, callback_batch, R)) == NULL)
+			goto err0;
+		return (0);
+	}
+
+	/* Translate this to a DynamoDB request. */
+	switch (R->R.type) {
+	case PROTO_DDBKV_PUT:
+		Q = D->QW;
+		op = "PutItem";
+		maxrlen = 1024;
+		prio = 0;
+		if ((R->body = dynamodb_kv_put(D->table, R->R.key,
+		    R->R.buf, R->R.len)) == NULL)
+			goto err0;
+		break;
+	case PROTO_DDBKV_GET:
+		Q = D->QR;
+		op = "GetItem";
+		prio = 0;
+		maxrlen = 1048576;
+		if ((R->body = dynamodb_kv_get(D->table, R->R.key)) == NULL)
+			goto err0;
+		break;
+	case PROTO_DDBKV_GETC:
+		Q = D->QR;
+		op = "GetItem";
+		prio = 0;
+		maxrlen = 1048576;
+		if ((R->body = dynamodb_kv_getc(D->table, R->R.key)) == NULL)
+			goto err0;
+		break;
+	case PROTO_DDBKV_DELETE:
+		Q = D->QW;
+		op = "DeleteItem";
+		maxrlen = 1024;
+		prio = 1;
+		if ((R->body = dynamodb_kv_delete(D->table, R->R.key)) == NULL)
+			goto err0;
+		break;
+	default:
+		/* proto_dynamodb_kv_request_read broke. */
+		assert(0);
+	}
+
+	/* Add the request to the appropriate DynamoDB queue. */
+	if (dynamodb_request_queue(Q, prio, op, R->body, maxrlen,
+	    R->R.key, callback_response, R))
+		goto err1;
+
+	/* Success! */
+	return (0);
+
+err1:
+	free(R->body);
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Read and dispatch incoming request(s). */
+static int
+gotrequest(void * cookie, int status)
+{
+	struct dispatch_state * D = cookie;
+	struct request * R;
+	struct timeval t_arrive;
+
 	/* We're no longer waiting for a packet to arrive. */
 	D->read_cookie = NULL;
 
@@ -127,6 +296,10 @@ gotrequest(void * cookie, int status)
 	if (status)
 		goto drop;
 
+	/* Requests read now are considered to have arrived now. */
+	if (monoclock_get(&t_arrive))
+		goto err0;
+
 	/* Read packets until there are no more or an error occurs. */
 	do {
 		/* Allocate space for a request. */
@@ -141,54 +314,20 @@ gotrequest(void * cookie, int status)
 		/* If we have no request, stop looping. */
 		if (R->R.type == PROTO_DDBKV_NONE)
 			break;
+		R->t_arrive = t_arrive;
 
-		/* Translate this to a DynamoDB request. */
-		switch (R->R.type) {
-		case PROTO_DDBKV_PUT:
-			Q = D->QW;
-			op = "PutItem";
-			maxrlen = 1024;
-			prio = 0;
-			if ((R->body = dynamodb_kv_put(D->table, R->R.key,
-			    R->R.buf, R->R.len)) == NULL)
-				goto err1;
-			break;
-		case PROTO_DDBKV_GET:
-			Q = D->QR;
-			op = "GetItem";
-			prio = 0;
-			maxrlen = 1048576;
-			if ((R->body =
-			    dynamodb_kv_get(D->table, R->R.key)) == NULL)
-				goto err1;
-			break;
-		case PROTO_DDBKV_GETC:
-			Q = D->QR;
-			op = "GetItem";
-			prio = 0;
-			maxrlen = 1048576;
-			if ((R->body =
-			    dynamodb_kv_getc(D->table, R->R.key)) == NULL)
-				goto err1;
-			break;
-		case PROTO_DDBKV_DELETE:
-			Q = D->QW;
-			op = "DeleteItem";
-			maxrlen = 1024;
-			prio = 1;
-			if ((R->body =
-			    dynamodb_kv_delete(D->table, R->R.key)) == NULL)
-				goto err1;
-			break;
-		default:
-			/* proto_dynamodb_kv_request_read broke. */
-			assert(0);
+		/* STATS requests are answered immediately. */
+		if (R->R.type == PROTO_DDBKV_STATS) {
+			if (sendstats(D, R))
+				goto err0;
+			continue;
 		}
 
-		/* Add the request to the appropriate DynamoDB queue. */
-		if (dynamodb_request_queue(Q, prio, op, R->body, maxrlen,
-		    R->R.key, callback_response, R))
-			goto err2;
+		/* Send the request to DynamoDB. */
+		if (monoclock_get(&R->t_start))
+			goto err1;
+		if (sendreq(D, R))
+			goto err1;
 
 		/* Add to the linked list. */
 		if ((R->prev = D->ip_tail) == NULL) {
@@ -222,9 +361,8 @@ drop:
 	/* All is good. */
 	return (0);
 
-err2:
-	free(R->body);
 err1:
+	proto_dynamodb_kv_request_free(&R->R);
 	free(R);
 err0:
 	/* Failure! */
@@ -273,6 +411,10 @@ callback_response(void * cookie, struct http_response * res)
 		break;
 	}
 
+	/* Record the request latency. */
+	if (record(D, R->R.type, &R->t_arrive, &R->t_start))
+		goto err1;
+
 	/* Free the response body buffer. */
 	free(res->body);
 
@@ -292,15 +434,81 @@ err1:
 	return (-1);
 }
 
+/* A batch operation (MPUT or MDELETE) has completed. */
+static int
+callback_batch(void * cookie, int status)
+{
+	struct request * R = cookie;
+	struct dispatch_state * D = R->D;
+
+	/* The batch operation is finished. */
+	R->B = NULL;
+
+	/* Send a response back to the client. */
+	if (proto_dynamodb_kv_response_status(D->writeq, R->R.ID, status))
+		goto err1;
+
+	/* Record the request latency. */
+	if (record(D, R->R.type, &R->t_arrive, &R->t_start))
+		goto err1;
+
+	/* Remove this request from the in-progress list. */
+	request_dequeue(D, R);
+
+	/* Success! */
+	return (0);
+
+err1:
+	request_dequeue(D, R);
+
+	/* Failure! */
+	return (-1);
+}
+
+/* A batch operation (MGET or MGETC) has completed. */
+static int
+callback_batch_get(void * cookie, int status, const uint8_t * const * bufs,
+    const uint32_t * lens)
+{
+	struct request * R = cookie;
+	struct dispatch_state * D = R->D;
+
+	/* The batch operation is finished. */
+	R->B = NULL;
+
+	/* Send a response back to the client. */
+	if (proto_dynamodb_kv_response_mget(D->writeq, R->R.ID, status,
+	    R->R.nkeys, bufs, lens))
+		goto err1;
+
+	/* Record the request latency. */
+	if (record(D, R->R.type, &R->t_arrive, &R->t_start))
+		goto err1;
+
+	/* Remove this request from the in-progress list. */
+	request_dequeue(D, R);
+
+	/* Success! */
+	return (0);
+
+err1:
+	request_dequeue(D, R);
+
+	/* Failure! */
+	return (-1);
+}
+
 /**
- * dispatch_accept(QW, QR, table, s):
+ * dispatch_accept(QW, QR, table, s, S):
  * Accept a connection from the listening socket ${s} and return a dispatch
  * state for sending requests to the DynamoDB queues ${QW} (writes/deletes)
- * and ${QR} (reads) for operations on table ${table}.
+ * and ${QR} (reads) for operations on table ${table}.  Request latencies are
+ * recorded in ${S}.
  */
 struct dispatch_state *
 dispatch_accept(struct dynamodb_request_queue * QW,
-    struct dynamodb_request_queue * QR, const char * table, int s)
+    struct dynamodb_request_queue * QR, const char * table, int s,
+    struct opstats * S)
 {
 	struct dispatch_state * D;
 
@@ -312,6 +520,7 @@ dispatch_accept(struct dynamodb_request_queue * QW,
 	D->QW = QW;
 	D->QR = QR;
 	D->table = table;
+	D->stats = S;
 	D->ip_head = D->ip_tail = NULL;
 
 	/* Accept a connection. */
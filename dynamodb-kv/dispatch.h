@@ -3,17 +3,19 @@
 
 #include <stdint.h>
 
-/* Opaque type. */
+/* Opaque types. */
 struct dynamodb_request_queue;
+struct opstats;
 
 /**
- * dispatch_accept(QW, QR, table, s):
+ * dispatch_accept(QW, QR, table, s, S):
  * Accept a connection from the listening socket ${s} and return a dispatch
  * state for sending requests to the DynamoDB queues ${QW} (writes/deletes)
- * and ${QR} (reads) for operations on table ${table}.
+ * and ${QR} (reads) for operations on table ${table}.  Request latencies are
+ * recorded in ${S}.
  */
 struct dispatch_state * dispatch_accept(struct dynamodb_request_queue *,
-    struct dynamodb_request_queue *, const char *, int);
+    struct dynamodb_request_queue *, const char *, int, struct opstats *);
 
 /**
  * dispatch_alive(D):
@@ -12,6 +12,7 @@
 #include "getopt.h"
 #include "insecure_memzero.h"
 #include "logging.h"
+#include "opstats.h"
 #include "serverpool.h"
 #include "sock.h"
 #include "warnp.h"
@@ -45,6 +46,7 @@ main(int argc, char * argv[])
 	struct dynamodb_request_queue * QW;
 	struct dynamodb_request_queue * QR;
 	struct dispatch_state * D;
+	struct opstats * S;
 	int s;
 
 	/* Command-line parameters. */
@@ -200,12 +202,22 @@ main(int argc, char * argv[])
 			warnp("Cannot open log file");
 			exit(1);
 		}
+		if (logging_buffer(logfile, 65536)) {
+			warnp("Cannot allocate log buffer");
+			exit(1);
+		}
 		dynamodb_request_queue_log(QW, logfile);
 		dynamodb_request_queue_log(QR, logfile);
 	} else {
 		logfile = NULL;
 	}
 
+	/* Create request latency statistics (kept across connections). */
+	if ((S = opstats_init()) == NULL) {
+		warnp("Cannot initialize request statistics");
+		exit(1);
+	}
+
 	/* Daemonize and write pid. */
 	if (opt_p == NULL) {
 		if (asprintf(&opt_p, "%s.pid", opt_s) == -1) {
@@ -221,7 +233,7 @@ main(int argc, char * argv[])
 	/* Handle connections, one at once. */
 	do {
 		/* accept a connection. */
-		if ((D = dispatch_accept(QW, QR, opt_t, s)) == NULL) {
+		if ((D = dispatch_accept(QW, QR, opt_t, s, S)) == NULL) {
 			warnp("Error accepting new connection");
 			exit(1);
 		}
@@ -256,6 +268,9 @@ main(int argc, char * argv[])
 	dynamodb_request_queue_free(QR);
 	dynamodb_request_queue_free(QW);
 
+	/* Free the request statistics. */
+	opstats_free(S);
+
 	/* Stop DNS lookups. */
 	serverpool_free(SP);
 
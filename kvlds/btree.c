@@ -134,20 +134,28 @@ err0:
 }
 
 /**
- * btree_init(Q_lbs, npages, npagebytes, keylen, vallen, Scost):
+ * btree_init(Q_lbs, npages, npagebytes, keylen, vallen, Scost, capfrac,
+ *     gceil, costbenefit):
  * Initialize a B+Tree with backing store accessible by sending requests via
  * the request queue ${Q_lbs}.  Aim to keep (in order of preference) at most
  * ${npages}, ${npagebytes} / pagelen, or 1024 nodes of the tree in RAM at a
  * time.  Verify that keys of length ${keylen} and values of length ${vallen}
  * can be used with the available page size; or set the variables to sensible
  * default values.  Storing a GB of data for a month costs roughly ${Scost}
- * times as much as performing 10^6 I/Os.
+ * times as much as performing 10^6 I/Os.  If ${capfrac} is non-zero, limit
+ * background cleaning to that fraction of the rate at which modifying
+ * requests are dirtying pages.
+ * If ${gceil} is non-zero, defer cleaning until the daemon is idle unless
+ * more than that fraction of the storage is garbage.  If ${costbenefit} is
+ * non-zero, track the liveness of each segment of storage, free segments
+ * which contain no live pages, and clean by cost-benefit.
  *
  * This function may call events_run internally.
  */
 struct btree *
 btree_init(struct wire_requestqueue * Q_lbs, uint64_t npages,
-    uint64_t npagebytes, uint64_t * keylen, uint64_t * vallen, double Scost)
+    uint64_t npagebytes, uint64_t * keylen, uint64_t * vallen, double Scost,
+    double capfrac, double gceil, int costbenefit)
 {
 	struct btree * T;
 	struct node * C;
@@ -164,6 +172,13 @@ btree_init(struct wire_requestqueue * Q_lbs, uint64_t npages,
 	/* Attach LBS request queue to the tree. */
 	T->LBS = Q_lbs;
 
+	/* We don't have a cleaner yet. */
+	T->cstate = NULL;
+
+	/* We haven't read any pages yet. */
+	T->nfetches = 0;
+	T->fetchusec = 0;
+
 	/* Issue a PARAMS2 request. */
 	PC.T = T;
 	PC.failed = PC.done = 0;
@@ -365,7 +380,8 @@ gotroot:
 	}
 
 	/* Start background cleaning. */
-	if ((T->cstate = btree_cleaning_start(T, Scost)) == NULL) {
+	if ((T->cstate = btree_cleaning_start(T, Scost, capfrac, gceil,
+	    costbenefit)) == NULL) {
 		warnp("Cannot start background cleaning");
 		exit(1);
 	}
@@ -35,22 +35,33 @@ struct btree {
 	struct cleaner * cstate;	/* Cleaner state. */
 	uint64_t nnodes;		/* Size of the dirty tree. */
 	uint64_t npages;		/* # pages of storage used. */
+
+	/* Page reads, for tuning request concurrency. */
+	uint64_t nfetches;		/* # pages read from the LBS. */
+	uint64_t fetchusec;		/* Total microseconds taken. */
 };
 
 /**
- * btree_init(Q_lbs, npages, npagebytes, keylen, vallen, Scost):
+ * btree_init(Q_lbs, npages, npagebytes, keylen, vallen, Scost, capfrac,
+ *     gceil, costbenefit):
  * Initialize a B+Tree with backing store accessible by sending requests via
  * the request queue ${Q_lbs}.  Aim to keep (in order of preference) at most
  * ${npages}, ${npagebytes} / pagelen, or 1024 nodes of the tree in RAM at a
  * time.  Verify that keys of length ${keylen} and values of length ${vallen}
  * can be used with the available page size; or set the variables to sensible
  * default values.  Storing a GB of data for a month costs roughly ${Scost}
- * times as much as performing 10^6 I/Os.
+ * times as much as performing 10^6 I/Os.  If ${capfrac} is non-zero, limit
+ * background cleaning to that fraction of the rate at which modifying
+ * requests are dirtying pages.
+ * If ${gceil} is non-zero, defer cleaning until the daemon is idle unless
+ * more than that fraction of the storage is garbage.  If ${costbenefit} is
+ * non-zero, track the liveness of each segment of storage, free segments
+ * which contain no live pages, and clean by cost-benefit.
  *
  * This function may call events_run internally.
  */
 struct btree * btree_init(struct wire_requestqueue *, uint64_t, uint64_t,
-    uint64_t *, uint64_t *, double);
+    uint64_t *, uint64_t *, double, double, double, int);
 
 /**
  * btree_balance(T, callback, cookie):
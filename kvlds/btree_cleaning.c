@@ -1,6 +1,9 @@
+#include <stdint.h>
 #include <stdlib.h>
 
+#include "elasticqueue.h"
 #include "events.h"
+#include "proto_lbs.h"
 #include "warnp.h"
 
 #include "btree.h"
@@ -24,6 +27,20 @@ struct cleaning_group {
 	struct cleaning_group * next;	/* Next group. */
 	struct cleaning_group * prev;	/* Previous group. */
 	size_t pending_fetches;	/* Number of nodes not fetched yet. */
+	size_t ncleans;		/* Number of node cleans launched. */
+
+	/* Used when cleaning a segment rather than the oldest leaves. */
+	uint64_t lo;		/* First page in the segment. */
+	uint64_t hi;		/* Page after the end of the segment. */
+	size_t pending_finds;	/* Nodes being searched for leaves. */
+	int cut;		/* Did the cap stop us cleaning some leaves? */
+};
+
+/* Liveness of a segment of SEGLEN pages. */
+struct segment {
+	uint64_t nlive;		/* Pages written which are still in use. */
+	int freed;		/* Have we sent a FREERANGE? */
+	int targeted;		/* Has the cleaner cleaned this segment? */
 };
 
 /* Cleaner state. */
@@ -35,12 +52,69 @@ struct cleaner {
 	int group_pending;	/* Are we trying to find a group to clean? */
 	struct cleaning_group * head;	/* Head of the list of groups. */
 	size_t pending_cleans;	/* Number of nodes fetching + waiting. */
+	int cleaning;		/* Are we dirtying pages right now? */
+
+	/* Cap on cleaning I/O relative to the rate of client writes. */
+	double capfrac;		/* Fraction of the client write rate, or 0. */
+	double caprate;		/* Pages/s dirtied by requests (smoothed). */
+	double capbudget;	/* Cleans we can launch before next tick. */
+	uint64_t lastmod;	/* stats.pages_modified at the last tick. */
+
+	/* Time-of-load-aware scheduling. */
+	double gceil;		/* Garbage ceiling, or 0 if not scheduling. */
+	double load;		/* Smoothed fraction of time spent busy. */
+	int idle;		/* Is the event loop idle? */
+	int deferring;		/* Are we deferring cleaning until idle? */
+
+	/* Per-segment liveness tracking and cost-benefit cleaning. */
+	int costbenefit;	/* Are we tracking segment liveness? */
+	struct elasticqueue * segs;	/* Segments from segbase onwards. */
+	uint64_t segbase;	/* Number of the first tracked segment. */
+
+	/* Accounting. */
+	uint64_t startblk;	/* Value of T->nextblk when we started. */
+	struct btree_cleaning_stats stats;
 };
 
+/* Number of pages in a segment. */
+#define SEGLEN	256
+
+/*
+ * Number of fetched leaves we want before we dirty them, so that the pages
+ * we rewrite are written out together rather than a few at a time.
+ */
+#define CLEANBATCH	64
+
 /* Time between ticks of the cleaning debt clock. */
 static const struct timeval onesec = {.tv_sec = 1, .tv_usec = 0};
 
+/*
+ * If the event loop spends less than this fraction of its time handling
+ * events, we consider it to be idle.
+ */
+#define IDLE_LOAD	0.1
+
+/*
+ * If modifying requests are dirtying fewer pages per second than this, we
+ * don't cap cleaning, since there are no commits for it to compete with.
+ */
+#define CAP_MINRATE	1.0
+
 static int poke(struct cleaner *);
+static int callback_freerange(void *, int);
+static void untarget(struct cleaner *, uint64_t);
+
+/*
+ * Are we capping cleaning I/O, with modifying requests writing pages, and
+ * have we already used up this second's allowance?
+ */
+static int
+overbudget(struct cleaner * C)
+{
+
+	return ((C->capfrac > 0.0) && (C->caprate >= CAP_MINRATE) &&
+	    (C->capbudget <= 0.0));
+}
 
 /* Compute oldestncleaf upwards in the shadow tree. */
 static void
@@ -132,6 +206,10 @@ callback_clean(void * cookie, struct node * N)
 	/* If this node is not CLEAN, we don't need to clean it any more. */
 	if (N->state != NODE_STATE_CLEAN) {
 		CG->C->pending_cleans--;
+
+		/* Kill the group if it is now empty. */
+		if ((CG->head == NULL) && (CG->pending_fetches == 0))
+			free_cg(CG);
 		goto done;
 	}
 
@@ -220,13 +298,23 @@ callback_find(void * cookie, struct node * N)
 
 	/* If we have a node of height 1, figure out which leaves to clean. */
 	if (N->height == 1) {
-		/* Look for nodes with low oldestncleaf values. */
+		/*
+		 * Look for nodes with low oldestncleaf values.  If we run out
+		 * of capped cleaning allowance after the first, leave the rest
+		 * for later groups.
+		 */
 		for (i = 0; i <= N->nkeys; i++) {
+			if ((CG->ncleans > 0) && overbudget(C)) {
+				C->stats.ncapped++;
+				break;
+			}
 			if (N->v.children[i]->oldestncleaf <
 			    C->T->nextblk - C->T->nnodes / 2) {
 				/* This child needs to be cleaned. */
 				CG->pending_fetches++;
 				C->pending_cleans++;
+				C->capbudget -= 1;
+				CG->ncleans++;
 				N->v.children[i]->oldestncleaf =
 				    (uint64_t)(-1);
 				if (btree_node_descend(C->T, N->v.children[i],
@@ -251,6 +339,8 @@ callback_find(void * cookie, struct node * N)
 	/* This node needs to be cleaned. */
 	CG->pending_fetches++;
 	C->pending_cleans++;
+	C->capbudget -= 1;
+	CG->ncleans++;
 	N->oldestncleaf = (uint64_t)(-1);
 	if (btree_node_descend(C->T, N, callback_clean, CG))
 		goto err1;
@@ -276,11 +366,221 @@ err0:
 	return (-1);
 }
 
+/* Find the leaves in the segment which a cleaning group is targeting. */
+static int
+callback_findseg(void * cookie, struct node * N)
+{
+	struct cleaning_group * CG = cookie;
+	struct cleaner * C = CG->C;
+	struct node * child;
+	size_t i;
+
+	/* We're not fetching this node or searching it any more. */
+	CG->pending_finds--;
+	CG->pending_fetches--;
+
+	if (N->height > 1) {
+		/*
+		 * Search each child which has leaves old enough to be in the
+		 * segment.  Since we only target old segments, this should
+		 * be a small part of the tree.
+		 */
+		for (i = 0; i <= N->nkeys; i++) {
+			if (N->v.children[i]->oldestncleaf >= CG->hi)
+				continue;
+			CG->pending_finds++;
+			CG->pending_fetches++;
+			if (btree_node_descend(C->T, N->v.children[i],
+			    callback_findseg, CG))
+				goto err1;
+		}
+	} else if (N->height == 1) {
+		/*
+		 * Clean any children which are in the segment, unless we have
+		 * used up our capped cleaning allowance; the group always
+		 * gets to clean at least one leaf.
+		 */
+		for (i = 0; i <= N->nkeys; i++) {
+			child = N->v.children[i];
+			if ((child->oldestncleaf < CG->lo) ||
+			    (child->oldestncleaf >= CG->hi))
+				continue;
+			if ((CG->ncleans > 0) && overbudget(C)) {
+				C->stats.ncapped++;
+				CG->cut = 1;
+				break;
+			}
+			CG->pending_fetches++;
+			C->pending_cleans++;
+			C->capbudget -= 1;
+			CG->ncleans++;
+			child->oldestncleaf = (uint64_t)(-1);
+			if (btree_node_descend(C->T, child,
+			    callback_clean, CG))
+				goto err1;
+		}
+
+		/* Recompute oldestncleaf upwards. */
+		recompute_oncl(N);
+	} else if ((N->oldestncleaf >= CG->lo) &&
+	    (N->oldestncleaf < CG->hi)) {
+		/* The root is a leaf, and it is in the segment. */
+		CG->pending_fetches++;
+		C->pending_cleans++;
+		C->capbudget -= 1;
+		CG->ncleans++;
+		N->oldestncleaf = (uint64_t)(-1);
+		if (btree_node_descend(C->T, N, callback_clean, CG))
+			goto err1;
+
+		/* Recompute oldestncleaf upwards. */
+		recompute_oncl(N->p_shadow);
+	}
+
+	/* Unlock the node. */
+	btree_node_unlock(C->T, N);
+
+	/* If we've finished searching, we can look for another group. */
+	if (CG->pending_finds == 0) {
+		C->group_pending = 0;
+
+		/* If we didn't clean the whole segment, it can be picked again. */
+		if (CG->cut)
+			untarget(C, CG->lo);
+
+		/* If we didn't find anything to clean, kill the group. */
+		if ((CG->head == NULL) && (CG->pending_fetches == 0))
+			free_cg(CG);
+	}
+
+	/* Launch cleaning if possible and appropriate. */
+	if (poke(C))
+		goto err0;
+
+	/* Success! */
+	return (0);
+
+err1:
+	btree_node_unlock(C->T, N);
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Tell the block store that a segment no longer holds any live pages. */
+static int
+freeseg(struct cleaner * C, size_t idx)
+{
+	struct segment * seg = elasticqueue_get(C->segs, idx);
+
+	/* Send a FREERANGE request for the segment. */
+	if (proto_lbs_request_free_range(C->T->LBS, (C->segbase + idx) * SEGLEN,
+	    SEGLEN, callback_freerange, NULL))
+		goto err0;
+
+	/* This segment has been freed. */
+	seg->freed = 1;
+	C->stats.segs_freed++;
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Callback for FREERANGE requests. */
+static int
+callback_freerange(void * cookie, int failed)
+{
+
+	(void)cookie; /* UNUSED */
+
+	/* If we failed, print a warning. */
+	if (failed)
+		warn0("FREERANGE failed");
+
+	/* FREERANGE is only advisory, so we never fail. */
+	return (0);
+}
+
+/*
+ * Pick the segment which gives us the best ratio of garbage reclaimed to
+ * cleaning I/O performed, weighted by age, as in the cost-benefit policy of
+ * LFS; return 1 and the range of page numbers via ${lo} and ${hi}, or 0 if
+ * there are no suitable segments.
+ */
+static int
+pickseg(struct cleaner * C, uint64_t * lo, uint64_t * hi)
+{
+	struct btree * T = C->T;
+	struct segment * seg;
+	struct segment * best = NULL;
+	uint64_t maxend, start;
+	double u, score, bestscore = 0.0;
+	size_t i;
+
+	/*
+	 * Only consider segments which are at least as old as the leaves the
+	 * oldest-first cleaner would clean; cleaning young segments is rarely
+	 * worthwhile since their pages are likely to be modified anyway.
+	 */
+	if (T->nextblk < T->nnodes / 2)
+		return (0);
+	maxend = T->nextblk - T->nnodes / 2;
+
+	/* Score each segment. */
+	for (i = 0; i < elasticqueue_getlen(C->segs); i++) {
+		seg = elasticqueue_get(C->segs, i);
+		start = (C->segbase + i) * SEGLEN;
+		if (start + SEGLEN > maxend)
+			break;
+		if (seg->freed || seg->targeted)
+			continue;
+
+		/* Benefit / cost = (1 - u) * age / (1 + u). */
+		u = (double)(seg->nlive) / SEGLEN;
+		score = (1.0 - u) * (double)(T->nextblk - start) / (1.0 + u);
+		if (score > bestscore) {
+			best = seg;
+			bestscore = score;
+			*lo = start;
+			*hi = start + SEGLEN;
+		}
+	}
+
+	/* Did we find anything? */
+	if (best == NULL)
+		return (0);
+
+	/* We're going to clean this segment. */
+	best->targeted = 1;
+	C->stats.segs_cleaned++;
+	return (1);
+}
+
+/* Allow the segment starting at page ${lo} to be picked again. */
+static void
+untarget(struct cleaner * C, uint64_t lo)
+{
+	struct segment * seg;
+
+	/* Segments we no longer track have been freed. */
+	if (lo / SEGLEN < C->segbase)
+		return;
+	if ((seg = elasticqueue_get(C->segs,
+	    (size_t)(lo / SEGLEN - C->segbase))) == NULL)
+		return;
+	seg->targeted = 0;
+}
+
 /* Launch cleaning if possible and appropriate. */
 static int
 poke(struct cleaner * C)
 {
 	struct cleaning_group * CG;
+	int (* callback)(void *, struct node *);
 
 	/*
 	 * If we're trying to find a group to clean, we need to wait until
@@ -297,14 +597,41 @@ poke(struct cleaner * C)
 	if (C->pending_cleans >= C->cleandebt)
 		goto done;
 
+	/* If we're waiting for the load to drop, don't clean anything yet. */
+	if (C->deferring) {
+		C->stats.ndeferred++;
+		goto done;
+	}
+
+	/*
+	 * If we're capping cleaning I/O, modifying requests are writing
+	 * pages, and we have already used up this second's allowance, wait
+	 * for the next tick.
+	 */
+	if (overbudget(C)) {
+		C->stats.ncapped++;
+		goto done;
+	}
+
 	/* We're going to launch a group of node cleans. */
 	if ((CG = malloc(sizeof(struct cleaning_group))) == NULL)
 		goto err0;
 	CG->C = C;
 	CG->head = NULL;
 	CG->pending_fetches = 1;
+	CG->ncleans = 0;
+	CG->cut = 0;
 	C->group_pending = 1;
 
+	/* Clean the best segment, or failing that, the oldest leaves. */
+	if (C->costbenefit && pickseg(C, &CG->lo, &CG->hi)) {
+		CG->pending_finds = 1;
+		callback = callback_findseg;
+	} else {
+		CG->pending_finds = 0;
+		callback = callback_find;
+	}
+
 	/* Hook this group into the list of groups. */
 	CG->next = C->head;
 	CG->prev = NULL;
@@ -313,7 +640,7 @@ poke(struct cleaner * C)
 		CG->next->prev = CG;
 
 	/* Find the right group to clean. */
-	if (btree_node_descend(C->T, C->T->root_shadow, callback_find, CG))
+	if (btree_node_descend(C->T, C->T->root_shadow, callback, CG))
 		goto err1;
 
 done:
@@ -329,16 +656,84 @@ err0:
 	return (-1);
 }
 
+/* Decide whether to defer cleaning or to pay down our debt now. */
+static void
+schedule(struct cleaner * C)
+{
+	struct btree * T = C->T;
+	double N, mu, va, max;
+	double garbage;
+	uint64_t target;
+
+	/* Nothing to do if we're not scheduling or not cleaning at all. */
+	if ((C->gceil == 0.0) || (C->cleanrate == 0.0))
+		return;
+
+	/*
+	 * Figure out what fraction of the last second the event loop spent
+	 * handling events rather than waiting in select(2), and smooth it
+	 * so that a single quiet second in the middle of a busy period
+	 * doesn't trigger a flurry of cleaning.
+	 */
+	events_network_selectstats(&N, &mu, &va, &max);
+	C->load = (C->load + N * mu) / 2;
+	C->idle = (C->load < IDLE_LOAD);
+	if (C->idle)
+		C->stats.ticks_idle++;
+
+	/* What fraction of our storage is garbage? */
+	if ((T->npages > 0) && (T->npages >= T->nnodes))
+		garbage = (double)(T->npages - T->nnodes) / T->npages;
+	else
+		garbage = 0.0;
+
+	/*
+	 * If we're idle, pay down our debt aggressively: aim to clean all
+	 * of the garbage, but (as in tick) never more than the size of the
+	 * tree.  Otherwise, let the debt build up and defer cleaning until
+	 * the load drops, unless we have hit the garbage ceiling.
+	 */
+	if (C->idle) {
+		if (T->npages >= T->nnodes) {
+			target = T->npages - T->nnodes;
+			if (target > T->nnodes)
+				target = T->nnodes;
+			if (C->cleandebt < target)
+				C->cleandebt = target;
+		}
+		C->deferring = 0;
+	} else {
+		C->deferring = (garbage < C->gceil);
+	}
+}
+
 /* Cleaning timer tick. */
 static int
 tick(void * cookie)
 {
 	struct cleaner * C = cookie;
 	struct btree * T = C->T;
+	struct segment * seg;
 
 	/* The timer is not running. */
 	C->cleantimer = NULL;
 
+	/*
+	 * Track the rate at which modifying requests are dirtying pages (not
+	 * counting the pages dirtied by the cleaner itself), smoothed so that
+	 * it follows changes in load within a few seconds, and top up our
+	 * allowance of cleans for the next second to the requested fraction
+	 * of that rate.  We don't let the allowance accumulate beyond one
+	 * second's worth, so that cleaning which was deferred during a spike
+	 * doesn't all happen at once when the spike ends.
+	 */
+	C->caprate = (C->caprate +
+	    (double)(C->stats.pages_modified - C->lastmod)) / 2;
+	C->lastmod = C->stats.pages_modified;
+	C->capbudget += C->capfrac * C->caprate;
+	if (C->capbudget > C->capfrac * C->caprate)
+		C->capbudget = C->capfrac * C->caprate;
+
 	/*
 	 * Adjust our "cleaning debt" based on current amount of garbage.
 	 * This is an underestimate of the amount of garbage if page have
@@ -370,6 +765,16 @@ tick(void * cookie)
 	if (C->cleandebt > T->nnodes)
 		C->cleandebt = T->nnodes;
 
+	/* Stop tracking segments which we have freed. */
+	while ((elasticqueue_getlen(C->segs) > 0) &&
+	    ((seg = elasticqueue_get(C->segs, 0))->freed)) {
+		elasticqueue_delete(C->segs);
+		C->segbase++;
+	}
+
+	/* Decide when cleaning should happen. */
+	schedule(C);
+
 	/* Launch cleaning if possible and appropriate. */
 	if (poke(C))
 		goto err0;
@@ -390,19 +795,26 @@ err0:
 }
 
 /**
- * btree_cleaning_start(T, Scost):
+ * btree_cleaning_start(T, Scost, capfrac, gceil, costbenefit):
  * Launch background cleaning of the B+Tree ${T}.  Attempt to minimize the
  * cost of storage plus I/O, based on a GB-month of storage costing ${Scost}
- * time as much as 10^6 I/Os.  Return a cookie which can be passed to
- * clean_stop to stop background cleaning.
+ * time as much as 10^6 I/Os.  If ${capfrac} is non-zero, do not clean more
+ * than ${capfrac} pages per second for each page per second recently
+ * dirtied by modifying requests.  If ${gceil} is non-zero, defer cleaning while
+ * the event loop is busy unless more than a fraction ${gceil} of the storage
+ * is garbage, and pay down the cleaning debt when the event loop is idle.
+ * If ${costbenefit} is non-zero, track which pages in each segment of the
+ * block store are live, issue FREERANGE requests for segments which contain
+ * no live pages, and clean the segments which give the most benefit per
+ * page cleaned rather than the oldest leaves.  Return a cookie which can be
+ * passed to clean_stop to stop background cleaning.
  */
 struct cleaner *
-btree_cleaning_start(struct btree * T, double Scost)
+btree_cleaning_start(struct btree * T, double Scost, double capfrac,
+    double gceil, int costbenefit)
 {
 	struct cleaner * C;
 
-	(void)Scost;
-
 	/* Create a cleaner state structure. */
 	if ((C = malloc(sizeof(struct cleaner))) == NULL)
 		goto err0;
@@ -410,6 +822,40 @@ btree_cleaning_start(struct btree * T, double Scost)
 	C->group_pending = 0;
 	C->head = NULL;
 	C->pending_cleans = 0;
+	C->cleaning = 0;
+
+	/* We haven't seen any pages being dirtied yet. */
+	C->capfrac = capfrac;
+	C->caprate = 0.0;
+	C->capbudget = 0.0;
+	C->lastmod = 0;
+	C->startblk = T->nextblk;
+
+	/* Assume that we're busy until we find out otherwise. */
+	C->gceil = gceil;
+	C->load = 1.0;
+	C->idle = 0;
+	C->deferring = 0;
+
+	/* Track the liveness of pages written from the next segment on. */
+	C->costbenefit = costbenefit && (Scost > 0.0);
+	C->segbase = (T->nextblk + SEGLEN - 1) / SEGLEN;
+	if ((C->segs = elasticqueue_init(sizeof(struct segment))) == NULL)
+		goto err1;
+
+	/* Nothing has been cleaned or written yet. */
+	C->stats.pages_cleaned = 0;
+	C->stats.pages_modified = 0;
+	C->stats.pages_appended = 0;
+	C->stats.bytes_appended = 0;
+	C->stats.bytes_user = 0;
+	C->stats.pages_storage = 0;
+	C->stats.pages_garbage = 0;
+	C->stats.ncapped = 0;
+	C->stats.ndeferred = 0;
+	C->stats.ticks_idle = 0;
+	C->stats.segs_freed = 0;
+	C->stats.segs_cleaned = 0;
 
 	/**
 	 * The optimal rate of cleaning is when the cost accrued to store
@@ -435,12 +881,14 @@ btree_cleaning_start(struct btree * T, double Scost)
 	if ((C->cleantimer =
 	    events_timer_register(tick, C, &onesec)) == NULL) {
 		warnp("events_timer_register");
-		goto err1;
+		goto err2;
 	}
 
 	/* Success! */
 	return (C);
 
+err2:
+	elasticqueue_free(C->segs);
 err1:
 	free(C);
 err0:
@@ -457,6 +905,12 @@ btree_cleaning_notify_dirtying(struct cleaner * C, struct node * N)
 {
 	struct btree * T = C->T;
 
+	/* Record who is responsible for this page being rewritten. */
+	if (C->cleaning)
+		C->stats.pages_cleaned++;
+	else
+		C->stats.pages_modified++;
+
 	/*
 	 * Adjust our "cleaning debt" based on this page.  We count a page
 	 * which is x% of the maximum age as being x% of a page-cleaning;
@@ -479,36 +933,49 @@ btree_cleaning_notify_dirtying(struct cleaner * C, struct node * N)
 
 /**
  * btree_cleaning_possible(C):
- * Return non-zero if the cleaner has any groups of pages fetched which it
- * is waiting for an opportunity to dirty.
+ * Return non-zero if the cleaner has a batch of fetched pages which it is
+ * waiting for an opportunity to dirty.
  */
 int
 btree_cleaning_possible(struct cleaner * C)
 {
 	struct cleaning_group * G;
+	struct cleaning * CC;
+	size_t nready = 0;
+	int fetching = C->group_pending;
 
-	/* Scan through the list of groups. */
+	/* Count the nodes which are ready for cleaning. */
 	for (G = C->head; G != NULL; G = G->next) {
 		/* Is this group ready for cleaning? */
-		if (G->pending_fetches == 0)
-			return (1);
+		if (G->pending_fetches != 0) {
+			fetching = 1;
+			continue;
+		}
+
+		/* Count the nodes in this group. */
+		for (CC = G->head; CC != NULL; CC = CC->next)
+			nready++;
 	}
 
-	/* No groups are ready for cleaning. */
-	return (0);
+	/*
+	 * We want to dirty a full batch of nodes at once, but if we're not
+	 * fetching anything else there's no point waiting.
+	 */
+	return ((nready > 0) && ((nready >= CLEANBATCH) || !fetching));
 }
 
-/**
- * btree_cleaning_clean(C):
- * Dirty whatever pages the cleaner wants to dirty.
- */
-int
-btree_cleaning_clean(struct cleaner * C)
+/* Dirty the nodes in all the groups which are ready for cleaning. */
+static int
+dirtygroups(struct cleaner * C)
 {
 	struct cleaning_group * G;
 	struct cleaning_group * Gnext;
 	struct cleaning * CC;
 	struct cleaning * CCnext;
+	struct node * N;
+
+	/* Pages dirtied from here on are being dirtied by the cleaner. */
+	C->cleaning = 1;
 
 	/* Scan through the list of groups. */
 	for (G = C->head; G != NULL; G = Gnext) {
@@ -525,11 +992,123 @@ btree_cleaning_clean(struct cleaner * C)
 			CCnext = CC->next;
 
 			/* Dirty the node. */
-			if (btree_node_dirty(C->T, CC->N) == 0)
+			if ((N = btree_node_dirty(C->T, CC->N)) == NULL)
+				goto err0;
+
+			/*
+			 * Write it out with the other cold pages -- unless
+			 * it is the root, since that must always be written
+			 * after the rest of the tree.
+			 */
+			if (N->root == 0)
+				N->cold = 1;
+		}
+	}
+
+	/* We're done dirtying pages. */
+	C->cleaning = 0;
+
+	/* Success! */
+	return (0);
+
+err0:
+	C->cleaning = 0;
+
+	/* Failure! */
+	return (-1);
+}
+
+/**
+ * btree_cleaning_clean(C):
+ * Dirty whatever pages the cleaner wants to dirty.
+ */
+int
+btree_cleaning_clean(struct cleaner * C)
+{
+
+	/* Wait until we have a batch of nodes ready. */
+	if (!btree_cleaning_possible(C))
+		return (0);
+
+	/* Dirty the nodes. */
+	return (dirtygroups(C));
+}
+
+/**
+ * btree_cleaning_idle(C):
+ * Return non-zero if the cleaner is paying down its cleaning debt because
+ * the event loop is idle.
+ */
+int
+btree_cleaning_idle(struct cleaner * C)
+{
+
+	/* We only care if we're idle and have cleaning to do. */
+	return (C->idle && (C->cleandebt > 0));
+}
+
+/**
+ * btree_cleaning_notify_userbytes(C, len):
+ * Notify the cleaner that a modifying request has written ${len} bytes of
+ * keys and values.
+ */
+void
+btree_cleaning_notify_userbytes(struct cleaner * C, size_t len)
+{
+
+	/* Just record the number of bytes. */
+	C->stats.bytes_user += len;
+}
+
+/**
+ * btree_cleaning_notify_written(C, blkno, nblks):
+ * Notify the cleaner that ${nblks} pages have been written starting at page
+ * ${blkno}.
+ */
+int
+btree_cleaning_notify_written(struct cleaner * C, uint64_t blkno,
+    uint64_t nblks)
+{
+	struct segment seg0 = {0, 0, 0};
+	struct segment * seg;
+	uint64_t segnum, n;
+
+	/* Nothing to do if we're not tracking segments. */
+	if (!C->costbenefit)
+		goto done;
+
+	/* Ignore pages from before the first segment we're tracking. */
+	if (blkno < C->segbase * SEGLEN) {
+		if (blkno + nblks <= C->segbase * SEGLEN)
+			goto done;
+		nblks -= C->segbase * SEGLEN - blkno;
+		blkno = C->segbase * SEGLEN;
+	}
+
+	/* Count the pages in each segment. */
+	while (nblks > 0) {
+		/* Which segment, and how many pages in it? */
+		segnum = blkno / SEGLEN;
+		n = SEGLEN - blkno % SEGLEN;
+		if (n > nblks)
+			n = nblks;
+
+		/* Make sure we have a record for this segment. */
+		while (C->segbase + elasticqueue_getlen(C->segs) <= segnum) {
+			if (elasticqueue_add(C->segs, &seg0))
 				goto err0;
 		}
+
+		/* These pages are live. */
+		seg = elasticqueue_get(C->segs, segnum - C->segbase);
+		seg->nlive += n;
+
+		/* Move on to the next segment. */
+		blkno += n;
+		nblks -= n;
 	}
 
+done:
 	/* Success! */
 	return (0);
 
@@ -538,6 +1117,78 @@ err0:
 	return (-1);
 }
 
+/**
+ * btree_cleaning_notify_freed(C, pagenum):
+ * Notify the cleaner that page ${pagenum} is no longer in use.
+ */
+void
+btree_cleaning_notify_freed(struct cleaner * C, uint64_t pagenum)
+{
+	struct segment * seg;
+	size_t idx;
+
+	/* Nothing to do if we're not tracking segments. */
+	if (!C->costbenefit)
+		return;
+
+	/* Ignore pages we aren't tracking. */
+	if ((pagenum < C->segbase * SEGLEN) ||
+	    (pagenum / SEGLEN - C->segbase >= elasticqueue_getlen(C->segs)))
+		return;
+	idx = pagenum / SEGLEN - C->segbase;
+	seg = elasticqueue_get(C->segs, idx);
+
+	/*
+	 * If we've somehow lost track of which pages are live, stop tracking
+	 * segments and leave everything for FREE to clean up eventually.
+	 */
+	if ((seg->nlive == 0) || seg->freed) {
+		warn0("Lost track of live pages in segment %ju",
+		    (uintmax_t)(C->segbase + idx));
+		C->costbenefit = 0;
+		return;
+	}
+
+	/* This page isn't live any more. */
+	seg->nlive--;
+
+	/*
+	 * Free the segment if it is complete and has no live pages.  Since
+	 * FREERANGE is only advisory, if we can't send the request we just
+	 * stop tracking segments.
+	 */
+	if ((seg->nlive == 0) &&
+	    ((C->segbase + idx + 1) * SEGLEN <= C->T->nextblk)) {
+		if (freeseg(C, idx)) {
+			warnp("Cannot issue FREERANGE request");
+			C->costbenefit = 0;
+		}
+	}
+}
+
+/**
+ * btree_cleaning_stats(C, st):
+ * Fill in ${st} with statistics about the cleaner ${C} and the tree it is
+ * cleaning.
+ */
+void
+btree_cleaning_stats(struct cleaner * C, struct btree_cleaning_stats * st)
+{
+	struct btree * T = C->T;
+
+	/* Fill in the values which aren't tracked incrementally. */
+	C->stats.pages_appended = T->nextblk - C->startblk;
+	C->stats.bytes_appended = C->stats.pages_appended * T->pagelen;
+	C->stats.pages_storage = T->npages;
+	if (T->npages >= T->nnodes)
+		C->stats.pages_garbage = T->npages - T->nnodes;
+	else
+		C->stats.pages_garbage = 0;
+
+	/* Return a copy of the statistics. */
+	*st = C->stats;
+}
+
 /**
  * btree_cleaning_stop(C):
  * Stop the background cleaning for which the cookie ${C} was returned by
@@ -556,7 +1207,7 @@ btree_cleaning_stop(struct cleaner * C)
 	/* Loop until we have no cleaning pending. */
 	do {
 		/* If we have nodes ready to be dirtied, dirty them. */
-		if (btree_cleaning_clean(C)) {
+		if (dirtygroups(C)) {
 			warnp("Failure dirtying nodes in cleaner");
 			exit(1);
 		}
@@ -575,6 +1226,9 @@ btree_cleaning_stop(struct cleaner * C)
 	/* We should have no cleaning groups. */
 	assert(C->head == NULL);
 
+	/* Free the segment liveness records. */
+	elasticqueue_free(C->segs);
+
 	/* Free the cleaner state structure. */
 	free(C);
 }
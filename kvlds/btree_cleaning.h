@@ -1,19 +1,47 @@
 #ifndef _BTREE_CLEANING_H_
 #define _BTREE_CLEANING_H_
 
+#include <stddef.h>
+#include <stdint.h>
+
 /* Opaque types. */
 struct btree;
 struct cleaner;
 struct node;
 
+/* Cleaner accounting. */
+struct btree_cleaning_stats {
+	uint64_t pages_cleaned;		/* Pages dirtied by the cleaner. */
+	uint64_t pages_modified;	/* Pages dirtied by requests. */
+	uint64_t pages_appended;	/* Pages written since startup. */
+	uint64_t bytes_appended;	/* Bytes written since startup. */
+	uint64_t bytes_user;		/* Key + value bytes modified. */
+	uint64_t pages_storage;		/* Pages of storage in use. */
+	uint64_t pages_garbage;		/* ... of which are garbage. */
+	uint64_t ncapped;		/* Cleaning deferred due to cap. */
+	uint64_t ndeferred;		/* Cleaning deferred until idle. */
+	uint64_t ticks_idle;		/* Seconds the event loop was idle. */
+	uint64_t segs_freed;		/* Segments released via FREERANGE. */
+	uint64_t segs_cleaned;		/* Segments targeted for cleaning. */
+};
+
 /**
- * btree_cleaning_start(T, Scost):
+ * btree_cleaning_start(T, Scost, capfrac, gceil, costbenefit):
  * Launch background cleaning of the B+Tree ${T}.  Attempt to minimize the
  * cost of storage plus I/O, based on a GB-month of storage costing ${Scost}
- * time as much as 10^6 I/Os.  Return a cookie which can be passed to
- * clean_stop to stop background cleaning.
+ * time as much as 10^6 I/Os.  If ${capfrac} is non-zero, do not clean more
+ * than ${capfrac} pages per second for each page per second recently
+ * dirtied by modifying requests.  If ${gceil} is non-zero, defer cleaning while
+ * the event loop is busy unless more than a fraction ${gceil} of the storage
+ * is garbage, and pay down the cleaning debt when the event loop is idle.
+ * If ${costbenefit} is non-zero, track which pages in each segment of the
+ * block store are live, issue FREERANGE requests for segments which contain
+ * no live pages, and clean the segments which give the most benefit per
+ * page cleaned rather than the oldest leaves.  Return a cookie which can be
+ * passed to clean_stop to stop background cleaning.
  */
-struct cleaner * btree_cleaning_start(struct btree *, double);
+struct cleaner * btree_cleaning_start(struct btree *, double, double,
+    double, int);
 
 /**
  * btree_cleaning_notify_dirtying(C, N):
@@ -23,8 +51,8 @@ void btree_cleaning_notify_dirtying(struct cleaner *, struct node *);
 
 /**
  * btree_cleaning_possible(C):
- * Return non-zero if the cleaner has any groups of pages fetched which it
- * is waiting for an opportunity to dirty.
+ * Return non-zero if the cleaner has a batch of fetched pages which it is
+ * waiting for an opportunity to dirty.
  */
 int btree_cleaning_possible(struct cleaner *);
 
@@ -34,6 +62,40 @@ int btree_cleaning_possible(struct cleaner *);
  */
 int btree_cleaning_clean(struct cleaner *);
 
+/**
+ * btree_cleaning_idle(C):
+ * Return non-zero if the cleaner is paying down its cleaning debt because
+ * the event loop is idle.
+ */
+int btree_cleaning_idle(struct cleaner *);
+
+/**
+ * btree_cleaning_notify_userbytes(C, len):
+ * Notify the cleaner that a modifying request has written ${len} bytes of
+ * keys and values.
+ */
+void btree_cleaning_notify_userbytes(struct cleaner *, size_t);
+
+/**
+ * btree_cleaning_notify_written(C, blkno, nblks):
+ * Notify the cleaner that ${nblks} pages have been written starting at page
+ * ${blkno}.
+ */
+int btree_cleaning_notify_written(struct cleaner *, uint64_t, uint64_t);
+
+/**
+ * btree_cleaning_notify_freed(C, pagenum):
+ * Notify the cleaner that page ${pagenum} is no longer in use.
+ */
+void btree_cleaning_notify_freed(struct cleaner *, uint64_t);
+
+/**
+ * btree_cleaning_stats(C, st):
+ * Fill in ${st} with statistics about the cleaner ${C} and the tree it is
+ * cleaning.
+ */
+void btree_cleaning_stats(struct cleaner *, struct btree_cleaning_stats *);
+
 /**
  * btree_cleaning_stop(C):
  * Stop the background cleaning for which the cookie ${C} was returned by
@@ -0,0 +1,487 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "asprintf.h"
+#include "elasticarray.h"
+#include "elasticqueue.h"
+#include "events.h"
+#include "pool.h"
+#include "sysendian.h"
+#include "warnp.h"
+
+#include "btree.h"
+#include "btree_node.h"
+#include "nmrlimit.h"
+#include "node.h"
+
+#include "btree_hotset.h"
+
+/* Seconds between writes of the hot set file. */
+#define HOTSET_PERIOD	60.0
+
+/*
+ * Prefetching may have at most 1/WINDOWFRAC as many pages in flight as
+ * non-modifying requests may touch, so that it doesn't lock down the page
+ * pool or hold up the reads done by requests for long.
+ */
+#define WINDOWFRAC	4
+
+/* Page numbers. */
+ELASTICARRAY_DECL(PAGELIST, pagelist, uint64_t);
+
+/* A parent node whose hot children we haven't finished fetching. */
+struct hotparent {
+	struct node * N;		/* The node, locked. */
+	size_t i;			/* Next child to look at. */
+};
+
+/* Hot set prefetcher state. */
+struct hotset {
+	struct btree * T;		/* Tree we're handling. */
+	struct nmrlimit * L;		/* Read concurrency controller. */
+	char * path;			/* Hot set file. */
+	char * path_tmp;		/* Hot set file being written. */
+	uint64_t * pages;		/* Sorted pages to fetch, or NULL. */
+	size_t npages;			/* Number of pages in ${pages}. */
+	struct elasticqueue * parents;	/* Queue of struct hotparent. */
+	size_t pending;			/* Prefetch callbacks pending. */
+	int done;			/* Non-zero if not prefetching. */
+	void * timer_cookie;		/* Cookie for write timer. */
+};
+
+static int callback_prefetch(void *, struct node *);
+
+/* Comparison function for sorting and searching page numbers. */
+static int
+compar_pagenum(const void * _x, const void * _y)
+{
+	const uint64_t * x = _x;
+	const uint64_t * y = _y;
+
+	if (*x < *y)
+		return (-1);
+	else if (*x > *y)
+		return (1);
+	else
+		return (0);
+}
+
+/* Is this page in the hot set we're prefetching? */
+static int
+ishot(struct hotset * H, uint64_t pagenum)
+{
+
+	return (bsearch(&pagenum, H->pages, H->npages, sizeof(uint64_t),
+	    compar_pagenum) != NULL);
+}
+
+/* Read the hot set file into ${H}; return 0 if it doesn't exist. */
+static int
+readpages(struct hotset * H)
+{
+	PAGELIST PL;
+	FILE * f;
+	uint8_t buf[8];
+	uint64_t pagenum;
+
+	/* Open the file; if it doesn't exist, we have no hot set. */
+	if ((f = fopen(H->path, "r")) == NULL) {
+		if (errno == ENOENT)
+			goto done;
+		warnp("Cannot open hot set file: %s", H->path);
+		goto err0;
+	}
+
+	/* Read page numbers into a list. */
+	if ((PL = pagelist_init(0)) == NULL)
+		goto err1;
+	while (fread(buf, 8, 1, f) == 1) {
+		pagenum = be64dec(buf);
+		if (pagelist_append(PL, &pagenum, 1))
+			goto err2;
+	}
+	if (ferror(f)) {
+		warnp("Error reading hot set file: %s", H->path);
+		goto err2;
+	}
+
+	/* Export the list and sort it so that we can search it. */
+	if (pagelist_export(PL, &H->pages, &H->npages))
+		goto err2;
+	qsort(H->pages, H->npages, sizeof(uint64_t), compar_pagenum);
+
+	/* Close the file. */
+	if (fclose(f)) {
+		warnp("fclose");
+		goto err0;
+	}
+
+done:
+	/* Success! */
+	return (0);
+
+err2:
+	pagelist_free(PL);
+err1:
+	fclose(f);
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Record the page numbers of clean nodes under ${N} which are in RAM. */
+static int
+getpages(PAGELIST PL, struct node * N)
+{
+	size_t i;
+
+	/* If the node isn't in RAM, neither is anything under it. */
+	if (!node_present(N))
+		goto done;
+
+	/* Dirty nodes don't have page numbers (yet). */
+	if (N->state == NODE_STATE_CLEAN) {
+		if (pagelist_append(PL, &N->pagenum, 1))
+			goto err0;
+	}
+
+	/* Recurse down into children. */
+	if (N->type == NODE_TYPE_PARENT) {
+		for (i = 0; i <= N->nkeys; i++) {
+			if (getpages(PL, N->v.children[i]))
+				goto err0;
+		}
+	}
+
+done:
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Write the hot set file. */
+static int
+writepages(struct hotset * H)
+{
+	PAGELIST PL;
+	FILE * f;
+	uint8_t buf[8];
+	size_t i;
+
+	/*
+	 * Get the page numbers of the nodes in the dirty tree which are in
+	 * RAM, parents before their children.  The pool holds the most
+	 * recently used nodes, so this is the current working set of the
+	 * tree: the parent nodes plus the hottest leaves.
+	 */
+	if ((PL = pagelist_init(0)) == NULL)
+		goto err0;
+	if (getpages(PL, H->T->root_dirty))
+		goto err1;
+
+	/* Write the page numbers to a temporary file. */
+	if ((f = fopen(H->path_tmp, "w")) == NULL) {
+		warnp("Cannot create hot set file: %s", H->path_tmp);
+		goto err1;
+	}
+	for (i = 0; i < pagelist_getsize(PL); i++) {
+		be64enc(buf, *pagelist_get(PL, i));
+		if (fwrite(buf, 8, 1, f) != 1) {
+			warnp("Error writing hot set file: %s", H->path_tmp);
+			goto err2;
+		}
+	}
+	if (fclose(f)) {
+		warnp("Error writing hot set file: %s", H->path_tmp);
+		goto err1;
+	}
+
+	/* Atomically replace the old hot set file. */
+	if (rename(H->path_tmp, H->path)) {
+		warnp("Cannot rename %s to %s", H->path_tmp, H->path);
+		goto err1;
+	}
+
+	/* Free the list. */
+	pagelist_free(PL);
+
+	/* Success! */
+	return (0);
+
+err2:
+	fclose(f);
+err1:
+	pagelist_free(PL);
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Write the hot set file and schedule the next write. */
+static int
+callback_write(void * cookie)
+{
+	struct hotset * H = cookie;
+
+	/* The timer is no longer pending. */
+	H->timer_cookie = NULL;
+
+	/*
+	 * Write the hot set file.  This is advisory, so don't take down the
+	 * daemon if we can't.
+	 */
+	(void)writepages(H);
+
+	/* Schedule the next write. */
+	if ((H->timer_cookie = events_timer_register_double(callback_write,
+	    H, HOTSET_PERIOD)) == NULL)
+		goto err0;
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* If we've fetched everything, we're done prefetching. */
+static void
+checkdone(struct hotset * H)
+{
+
+	if ((H->pending == 0) && (elasticqueue_getlen(H->parents) == 0)) {
+		free(H->pages);
+		H->pages = NULL;
+		H->npages = 0;
+		H->done = 1;
+	}
+}
+
+/* Fetch hot children of queued parents, up to the in-flight limit. */
+static int
+launch(struct hotset * H)
+{
+	struct hotparent * HP;
+	struct node * C;
+	size_t window;
+
+	/* How many pages may we have in flight? */
+	if ((window = nmrlimit_get(H->L) / WINDOWFRAC) == 0)
+		window = 1;
+
+	/* Launch fetches until we hit the limit or run out of parents. */
+	while ((H->pending < window) &&
+	    (elasticqueue_getlen(H->parents) > 0)) {
+		HP = elasticqueue_get(H->parents, 0);
+
+		/*
+		 * Once the page pool is full, fetching more leaves would only
+		 * evict pages which requests have touched since we started;
+		 * so fetch only the parent nodes.
+		 */
+		if ((HP->N->height == 1) &&
+		    (pool_room(H->T->P) <= H->pending))
+			HP->i = HP->N->nkeys + 1;
+
+		/* Find the next hot child we need to fetch. */
+		for (; HP->i <= HP->N->nkeys; HP->i++) {
+			C = HP->N->v.children[HP->i];
+			if (node_present(C) && (C->type == NODE_TYPE_LEAF))
+				continue;
+			if (ishot(H, C->pagenum))
+				break;
+		}
+
+		/* If there are none left, we're done with this parent. */
+		if (HP->i > HP->N->nkeys) {
+			btree_node_unlock(H->T, HP->N);
+			elasticqueue_delete(H->parents);
+			continue;
+		}
+
+		/*
+		 * Fetch the child.  Children which are already present are
+		 * handled via an immediate callback from btree_node_descend.
+		 */
+		HP->i++;
+		H->pending++;
+		if (btree_node_descend(H->T, C, callback_prefetch, H))
+			goto err0;
+	}
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Queue the hot children of a node for fetching. */
+static int
+callback_prefetch(void * cookie, struct node * N)
+{
+	struct hotset * H = cookie;
+	struct hotparent HP;
+
+	/* We're not fetching this node any more. */
+	H->pending--;
+
+	/*
+	 * Parent nodes stay locked in the queue until we have launched the
+	 * fetches of all of their hot children; the queue is first-in,
+	 * first-out, so we read the tree one level at a time.
+	 */
+	if (N->type == NODE_TYPE_PARENT) {
+		HP.N = N;
+		HP.i = 0;
+		if (elasticqueue_add(H->parents, &HP))
+			goto err1;
+	} else {
+		btree_node_unlock(H->T, N);
+	}
+
+	/* Launch more fetches. */
+	if (launch(H))
+		goto err0;
+
+	/* We might be done. */
+	checkdone(H);
+
+	/* Success! */
+	return (0);
+
+err1:
+	btree_node_unlock(H->T, N);
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/**
+ * btree_hotset_start(T, L, path):
+ * If the hot set file ${path} exists, read the list of page numbers it holds
+ * and launch background fetching of those pages of the B+Tree ${T}, one
+ * level of the tree at a time, keeping a small fraction of the limit set by
+ * the read concurrency controller ${L} in flight.  Stop fetching leaves once
+ * the page pool is full.  Every 60 seconds, write the page numbers of the
+ * nodes of ${T} which are in RAM to ${path}.  Return a cookie which can be
+ * passed to btree_hotset_stop.
+ */
+struct hotset *
+btree_hotset_start(struct btree * T, struct nmrlimit * L, const char * path)
+{
+	struct hotset * H;
+	struct hotparent HP;
+
+	/* Allocate a structure and initialize. */
+	if ((H = malloc(sizeof(struct hotset))) == NULL)
+		goto err0;
+	H->T = T;
+	H->L = L;
+	H->pages = NULL;
+	H->npages = 0;
+	H->pending = 0;
+	H->done = 1;
+
+	/* Record the file names. */
+	if ((H->path = strdup(path)) == NULL)
+		goto err1;
+	if (asprintf(&H->path_tmp, "%s.tmp", path) == -1)
+		goto err2;
+
+	/* Create a queue of parents whose children we're fetching. */
+	if ((H->parents = elasticqueue_init(sizeof(struct hotparent))) == NULL)
+		goto err3;
+
+	/* Read the hot set from the last time we ran. */
+	if (readpages(H))
+		goto err4;
+
+	/*
+	 * If we have any hot pages, start fetching them from the root (which
+	 * is always present).  If the root is a leaf, there is nothing to do.
+	 */
+	if ((H->npages > 0) && (T->root_shadow->type == NODE_TYPE_PARENT)) {
+		H->done = 0;
+		btree_node_lock(T, T->root_shadow);
+		HP.N = T->root_shadow;
+		HP.i = 0;
+		if (elasticqueue_add(H->parents, &HP)) {
+			btree_node_unlock(T, T->root_shadow);
+			goto err4;
+		}
+		if (launch(H))
+			goto err5;
+		checkdone(H);
+	} else {
+		free(H->pages);
+		H->pages = NULL;
+	}
+
+	/* Write the hot set periodically. */
+	if ((H->timer_cookie = events_timer_register_double(callback_write,
+	    H, HOTSET_PERIOD)) == NULL)
+		goto err5;
+
+	/* Success! */
+	return (H);
+
+err5:
+	/*
+	 * If we started prefetching, we can't free the cookie which the
+	 * callbacks refer to; but we're about to exit anyway.
+	 */
+	if (H->done == 0)
+		goto err0;
+err4:
+	free(H->pages);
+	elasticqueue_free(H->parents);
+err3:
+	free(H->path_tmp);
+err2:
+	free(H->path);
+err1:
+	free(H);
+err0:
+	/* Failure! */
+	return (NULL);
+}
+
+/**
+ * btree_hotset_stop(H):
+ * Wait for any pages being fetched by the hot set prefetcher ${H} to arrive,
+ * write the hot set file a final time, and free the prefetcher state.  This
+ * function may call events_run internally.
+ */
+void
+btree_hotset_stop(struct hotset * H)
+{
+
+	/* Stop the timer if it is running. */
+	if (H->timer_cookie != NULL)
+		events_timer_cancel(H->timer_cookie);
+
+	/* Wait until we're not fetching any more pages. */
+	if (events_spin(&H->done)) {
+		warnp("Error running event loop");
+		exit(1);
+	}
+
+	/* Record the working set for the next time we start. */
+	(void)writepages(H);
+
+	/* Free the prefetcher state. */
+	free(H->pages);
+	elasticqueue_free(H->parents);
+	free(H->path_tmp);
+	free(H->path);
+	free(H);
+}
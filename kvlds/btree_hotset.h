@@ -0,0 +1,30 @@
+#ifndef _BTREE_HOTSET_H_
+#define _BTREE_HOTSET_H_
+
+/* Opaque types. */
+struct btree;
+struct hotset;
+struct nmrlimit;
+
+/**
+ * btree_hotset_start(T, L, path):
+ * If the hot set file ${path} exists, read the list of page numbers it holds
+ * and launch background fetching of those pages of the B+Tree ${T}, one
+ * level of the tree at a time, keeping a small fraction of the limit set by
+ * the read concurrency controller ${L} in flight.  Stop fetching leaves once
+ * the page pool is full.  Every 60 seconds, write the page numbers of the
+ * nodes of ${T} which are in RAM to ${path}.  Return a cookie which can be
+ * passed to btree_hotset_stop.
+ */
+struct hotset * btree_hotset_start(struct btree *, struct nmrlimit *,
+    const char *);
+
+/**
+ * btree_hotset_stop(H):
+ * Wait for any pages being fetched by the hot set prefetcher ${H} to arrive,
+ * write the hot set file a final time, and free the prefetcher state.  This
+ * function may call events_run internally.
+ */
+void btree_hotset_stop(struct hotset *);
+
+#endif /* !_BTREE_HOTSET_H_ */
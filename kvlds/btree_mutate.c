@@ -13,11 +13,14 @@
 #include "btree_mutate.h"
 
 /**
- * btree_mutate_mutable(N):
- * Make the leaf node ${N} mutable.
+ * btree_mutate_mutable(N, A, nadds):
+ * Make the leaf node ${N} mutable, with room for ${nadds} keys to be added
+ * before temporary structures need to grow.  Temporary structures are
+ * allocated from the arena ${A}, which must not be reset until
+ * btree_mutate_immutable has been called.
  */
 int
-btree_mutate_mutable(struct node * N)
+btree_mutate_mutable(struct node * N, struct arena * A, size_t nadds)
 {
 
 	/* Sanity check. */
@@ -26,8 +29,11 @@ btree_mutate_mutable(struct node * N)
 	assert(N->pagesize == (uint32_t)(-1));
 	assert(N->v.H == NULL);
 
+	/* This leaf is being modified, so it isn't cold any more. */
+	N->cold = 0;
+
 	/* Create a hash table for short-term key-value storage. */
-	if ((N->v.H = kvhash_init()) == NULL)
+	if ((N->v.H = kvhash_init(A, nadds)) == NULL)
 		goto err0;
 
 	/* Success! */
@@ -168,3 +174,82 @@ err0:
 	/* Failure! */
 	return (-1);
 }
+
+/**
+ * btree_mutate_merge(N, kvs, nkvs):
+ * Merge the ${nkvs} key-value pairs ${kvs}, which are sorted by key and
+ * contain no keys already present, into the dirty leaf node ${N}; and remove
+ * pairs from ${N} whose values have been set to NULL.  The node must not be
+ * mutable.
+ */
+int
+btree_mutate_merge(struct node * N, const struct kvpair_const * kvs,
+    size_t nkvs)
+{
+	struct kvpair_const * new_pairs;
+	size_t new_nkeys;
+	size_t mlen;
+	size_t i, j, k;
+
+	/* Sanity check. */
+	assert(N->type == NODE_TYPE_LEAF);
+	assert(N->state == NODE_STATE_DIRTY);
+	assert(N->pagesize == (uint32_t)(-1));
+	assert(N->v.H == NULL);
+
+	/* This leaf is being modified, so it isn't cold any more. */
+	N->cold = 0;
+
+	/* Update the all-keys-present-match-up-to value. */
+	for (k = 0; k < nkvs; k++) {
+		if (N->nkeys) {
+			mlen = kvldskey_mlen(kvs[k].k, N->u.pairs[0].k);
+			if (mlen < N->mlen_n)
+				N->mlen_n = (uint8_t)mlen;
+		} else {
+			N->mlen_n = 0;
+		}
+	}
+
+	/* Count keys with non-NULL values. */
+	for (new_nkeys = nkvs, i = 0; i < N->nkeys; i++)
+		if (N->u.pairs[i].v != NULL)
+			new_nkeys += 1;
+
+	/* Allocate new array of key-value pairs. */
+	if (IMALLOC(new_pairs, new_nkeys, struct kvpair_const))
+		goto err0;
+
+	/* Merge the two sorted lists into the new array. */
+	for (j = i = k = 0; i < N->nkeys; i++) {
+		/* Skip keys for which the value was deleted. */
+		if (N->u.pairs[i].v == NULL)
+			continue;
+
+		/* Copy in new pairs with smaller keys than this one. */
+		while ((k < nkvs) && (kvldskey_cmp2(N->u.pairs[i].k,
+		    kvs[k].k, N->mlen_n) > 0))
+			new_pairs[j++] = kvs[k++];
+
+		/* Copy in the pair. */
+		new_pairs[j++] = N->u.pairs[i];
+	}
+
+	/* Copy in any new pairs with keys larger than all the old ones. */
+	while (k < nkvs)
+		new_pairs[j++] = kvs[k++];
+
+	/* Free old array of key-value pairs. */
+	free(N->u.pairs);
+
+	/* Update node. */
+	N->u.pairs = new_pairs;
+	N->nkeys = new_nkeys;
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
@@ -1,15 +1,22 @@
 #ifndef _BTREE_MUTATE_H_
 #define _BTREE_MUTATE_H_
 
+#include <stddef.h>
+
 /* Opaque types. */
+struct arena;
 struct kvldskey;
+struct kvpair_const;
 struct node;
 
 /**
- * btree_mutate_mutable(N):
- * Make the leaf node ${N} mutable.
+ * btree_mutate_mutable(N, A, nadds):
+ * Make the leaf node ${N} mutable, with room for ${nadds} keys to be added
+ * before temporary structures need to grow.  Temporary structures are
+ * allocated from the arena ${A}, which must not be reset until
+ * btree_mutate_immutable has been called.
  */
-int btree_mutate_mutable(struct node *);
+int btree_mutate_mutable(struct node *, struct arena *, size_t);
 
 /**
  * btree_mutate_find(N, k):
@@ -33,4 +40,13 @@ int btree_mutate_add(struct node *, struct kvpair_const *,
  */
 int btree_mutate_immutable(struct node *);
 
+/**
+ * btree_mutate_merge(N, kvs, nkvs):
+ * Merge the ${nkvs} key-value pairs ${kvs}, which are sorted by key and
+ * contain no keys already present, into the dirty leaf node ${N}; and remove
+ * pairs from ${N} whose values have been set to NULL.  The node must not be
+ * mutable.
+ */
+int btree_mutate_merge(struct node *, const struct kvpair_const *, size_t);
+
 #endif /* !_BTREE_MUTATE_H_ */
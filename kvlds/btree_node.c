@@ -1,3 +1,5 @@
+#include <sys/time.h>
+
 #include <assert.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -8,6 +10,7 @@
 #include "kvldskey.h"
 #include "kvpair.h"
 #include "imalloc.h"
+#include "monoclock.h"
 #include "pool.h"
 #include "proto_lbs.h"
 #include "warnp.h"
@@ -33,6 +36,7 @@ struct reading {
 	struct btree * T;	/* B+tree to which this page belongs. */
 	size_t pagelen;		/* Size of page. */
 	int canfail;		/* Non-zero if failure is an option. */
+	struct timeval t_start;	/* When the read was issued. */
 };
 
 /* Descend-into-node state. */
@@ -212,6 +216,8 @@ btree_node_fetch_canfail(struct btree * T, struct node * N,
 		N->u.reading->pagelen = T->pagelen;
 		N->u.reading->T = T;
 		N->u.reading->canfail = canfail;
+		if (monoclock_get(&N->u.reading->t_start))
+			goto err2;
 
 		/* Create a list of reader callbacks. */
 		if ((N->u.reading->list = readerlist_init(0)) == NULL)
@@ -304,6 +310,7 @@ callback_fetch(void * cookie, int failed, int status, const uint8_t * buf)
 	struct node * N = cookie;
 	struct reading * R = N->u.reading;
 	struct reader * r;
+	struct timeval t_done;
 	size_t i;
 
 	/* Throw a fit if the read request failed. */
@@ -312,6 +319,13 @@ callback_fetch(void * cookie, int failed, int status, const uint8_t * buf)
 		goto err2;
 	}
 
+	/* Record how long the read took. */
+	if (monoclock_get(&t_done))
+		goto err2;
+	R->T->nfetches += 1;
+	R->T->fetchusec += (uint64_t)((t_done.tv_sec - R->t_start.tv_sec) *
+	    1000000 + (t_done.tv_usec - R->t_start.tv_usec));
+
 	/* Throw a fit if the block does not exist and we can't fail. */
 	if ((status != 0) && (R->canfail == 0)) {
 		warn0("Failed to read a mandatory page");
@@ -9,6 +9,7 @@
 #include "proto_lbs.h"
 #include "warnp.h"
 
+#include "btree_cleaning.h"
 #include "btree_node.h"
 #include "node.h"
 #include "serialize.h"
@@ -22,8 +23,14 @@ struct write_cookie {
 
 	/* The B+Tree. */
 	struct btree * T;
+
+	/* Pages dirtied by requests, written after the cleaner's pages. */
+	const uint8_t ** bufv;	/* Vector of all the pages. */
+	size_t ncold;		/* Number of pages dirtied by the cleaner. */
+	size_t nhot;		/* Number of other pages. */
 };
 
+static int callback_append_cold(void *, int, int, uint64_t);
 static int callback_append(void *, int, int, uint64_t);
 static int callback_unshadow(void *);
 
@@ -47,10 +54,33 @@ ndirty(struct node * N)
 	return (n);
 }
 
-/* Serialize the dirty nodes in a (sub)tree. */
+/* Count the number of dirty leaves dirtied by the cleaner. */
+static size_t
+ncold(struct node * N)
+{
+	size_t n, i;
+
+	/* If this node is not dirty, there are no dirty nodes. */
+	if (N->state != NODE_STATE_DIRTY)
+		return (0);
+
+	/* If this node is a leaf, it's either cold or it isn't. */
+	if (N->type != NODE_TYPE_PARENT)
+		return (N->cold);
+
+	/* Otherwise, we have the sum of children. */
+	for (n = 0, i = 0; i <= N->nkeys; i++)
+		n += ncold(N->v.children[i]);
+	return (n);
+}
+
+/*
+ * Serialize the dirty nodes in a (sub)tree: only the leaves dirtied by the
+ * cleaner if ${cold} is non-zero, or all the others if ${cold} is zero.
+ */
 static int
 serializetree(struct btree * T, struct node * N, size_t pagelen,
-    uint64_t nextblk, const uint8_t ** bufv, uint64_t * pn)
+    uint64_t nextblk, const uint8_t ** bufv, uint64_t * pn, int cold)
 {
 	size_t i;
 
@@ -62,10 +92,14 @@ serializetree(struct btree * T, struct node * N, size_t pagelen,
 	if (N->type == NODE_TYPE_PARENT) {
 		for (i = 0; i <= N->nkeys; i++)
 			if (serializetree(T, N->v.children[i], pagelen,
-			    nextblk, bufv, pn))
+			    nextblk, bufv, pn, cold))
 				goto err0;
 	}
 
+	/* Is this node being written in this pass? */
+	if (((N->type == NODE_TYPE_LEAF) && N->cold) != cold)
+		return (0);
+
 	/* Record this node's page number. */
 	N->pagenum = nextblk + *pn;
 
@@ -185,6 +219,10 @@ unshadow(struct btree * T, struct node * N)
 	btree_sanity(T);
 #endif
 
+	/* Tell the cleaner that this page is no longer in use. */
+	if (T->cstate != NULL)
+		btree_cleaning_notify_freed(T->cstate, N->pagenum);
+
 	/* Destroy this node. */
 	btree_node_destroy(T, N);
 }
@@ -201,6 +239,7 @@ btree_sync(struct btree * T, int (* callback)(void *), void * cookie)
 	size_t npages;
 	const uint8_t ** bufv;
 	uint64_t pn = 0;
+	int rc;
 
 	/* Bake a cookie. */
 	if ((WC = malloc(sizeof(struct write_cookie))) == NULL)
@@ -211,28 +250,53 @@ btree_sync(struct btree * T, int (* callback)(void *), void * cookie)
 
 	/* Figure out how many pages we need to write. */
 	npages = ndirty(T->root_dirty);
+	WC->ncold = ncold(T->root_dirty);
+	WC->nhot = npages - WC->ncold;
 
 	/* Allocate a vector to hold pointers to pages. */
 	if (IMALLOC(bufv, npages, const uint8_t *))
 		goto err1;
 
-	/* Serialize pages and record pointers into the vector. */
+	/*
+	 * Serialize pages and record pointers into the vector.  We put the
+	 * leaves which the cleaner dirtied first, so that they are written
+	 * together rather than being interleaved with pages which requests
+	 * are modifying (and which are likely to be modified again soon).
+	 */
 	if (serializetree(T, T->root_dirty, T->pagelen, T->nextblk,
-	    bufv, &pn))
+	    bufv, &pn, 1))
+		goto err2;
+	if (serializetree(T, T->root_dirty, T->pagelen, T->nextblk,
+	    bufv, &pn, 0))
 		goto err2;
 
 	/* Sanity check the number of pages serialized. */
 	assert(pn == npages);
 
-	/* Write pages out. */
-	if (proto_lbs_request_append_blks(T->LBS, npages, T->nextblk,
-	    T->pagelen, bufv, callback_append, WC)) {
+	/*
+	 * Write pages out, tagging the cleaner's pages so that the block
+	 * store knows where they came from.  If we have any, we write the
+	 * rest of the pages once the block store has accepted them.
+	 */
+	if (WC->ncold > 0) {
+		WC->bufv = bufv;
+		rc = proto_lbs_request_append_stream(T->LBS, WC->ncold,
+		    T->nextblk, T->pagelen, bufv, PROTO_LBS_STREAM_CLEANER,
+		    callback_append_cold, WC);
+	} else {
+		WC->bufv = NULL;
+		rc = proto_lbs_request_append_stream(T->LBS, npages,
+		    T->nextblk, T->pagelen, bufv, PROTO_LBS_STREAM_USER,
+		    callback_append, WC);
+	}
+	if (rc) {
 		warnp("Error writing pages");
 		goto err2;
 	}
 
-	/* Free the page pointers vector. */
-	free(bufv);
+	/* Free the page pointers vector, unless we still need it. */
+	if (WC->bufv == NULL)
+		free(bufv);
 
 	/* Success! */
 	return (0);
@@ -246,6 +310,54 @@ err0:
 	return (-1);
 }
 
+/* Callback for btree_sync when the cleaner's pages have been written. */
+static int
+callback_append_cold(void * cookie, int failed, int status, uint64_t blkno)
+{
+	struct write_cookie * WC = cookie;
+	struct btree * T = WC->T;
+
+	/* Throw a fit if we didn't manage to write the pages. */
+	if (failed)
+		goto err1;
+	if (status) {
+		warn0("Failed to write dirty nodes to backing store");
+		goto err1;
+	}
+
+	/*
+	 * We assigned page numbers to all the pages before we started, so
+	 * the block store had better not have skipped any block numbers.
+	 * (The cleaner is disabled if the block space is sparse, so this
+	 * should never happen.)
+	 */
+	if (blkno != T->nextblk + WC->ncold) {
+		warn0("Block store skipped blocks after cleaned pages");
+		goto err1;
+	}
+
+	/* Write the rest of the pages. */
+	if (proto_lbs_request_append_stream(T->LBS, WC->nhot, blkno,
+	    T->pagelen, &WC->bufv[WC->ncold], PROTO_LBS_STREAM_USER,
+	    callback_append, WC)) {
+		warnp("Error writing pages");
+		goto err1;
+	}
+
+	/* We don't need the page pointers vector any more. */
+	free(WC->bufv);
+
+	/* Success! */
+	return (0);
+
+err1:
+	free(WC->bufv);
+	free(WC);
+
+	/* Failure! */
+	return (-1);
+}
+
 /* Callback for btree_sync when write is complete. */
 static int
 callback_append(void * cookie, int failed, int status, uint64_t blkno)
@@ -261,6 +373,11 @@ callback_append(void * cookie, int failed, int status, uint64_t blkno)
 		goto err1;
 	}
 
+	/* Tell the cleaner which pages we wrote. */
+	if ((T->cstate != NULL) && btree_cleaning_notify_written(T->cstate,
+	    T->nextblk, blkno - T->nextblk))
+		goto err1;
+
 	/* Record the next available block number. */
 	T->nextblk = blkno;
 
@@ -1,5 +1,6 @@
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/time.h>
 
 #include <assert.h>
 #include <errno.h>
@@ -8,12 +9,15 @@
 #include <stdlib.h>
 #include <unistd.h>
 
+#include "arena.h"
 #include "events.h"
 #include "imalloc.h"
 #include "kvldskey.h"
+#include "monoclock.h"
 #include "mpool.h"
 #include "netbuf.h"
 #include "network.h"
+#include "opstats.h"
 #include "proto_kvlds.h"
 #include "serialize.h"
 #include "wire.h"
@@ -21,13 +25,11 @@
 
 #include "btree.h"
 #include "btree_cleaning.h"
+#include "nmrlimit.h"
 #include "node.h"
 
 #include "dispatch.h"
 
-/* Maximum number of requests to have pending at once. */
-#define MAXREQS	4096
-
 /* Linked list of requests. */
 struct requestq {
 	/* The request. */
@@ -39,6 +41,17 @@ struct requestq {
 	/* Used for NMRs after dequeueing. */
 	struct dispatch_state * D;
 	size_t npages;
+
+	/* Request timing. */
+	uint32_t type;			/* Request type. */
+	struct timeval t_arrive;	/* When the request was read. */
+	struct timeval t_start;		/* When the request was launched. */
+};
+
+/* Timing of a modifying request in the current batch. */
+struct mr_time {
+	uint32_t type;			/* Request type. */
+	struct timeval t_arrive;	/* When the request was read. */
 };
 
 /* Request dispatcher state. */
@@ -50,6 +63,7 @@ struct dispatch_state {
 	struct netbuf_write * writeq;	/* Packet write queue. */
 	void * read_cookie;		/* Request read cookie. */
 	size_t nrequests;		/* Number of responses we owe. */
+	size_t maxreqs;			/* Max # responses to owe. */
 
 	/* Operational parameters. */
 	struct btree * T;		/* The B+Tree we're working on. */
@@ -60,12 +74,14 @@ struct dispatch_state {
 	struct requestq * nmr_head;	/* First request in the queue. */
 	struct requestq ** nmr_tail;	/* Pointer to final NULL. */
 	size_t nmr_ip;			/* Pages touched by ongoing NMRs. */
-	size_t nmr_concurrency;		/* Max # pages touched by NMRs. */
+	struct nmrlimit * nmr_limit;	/* Max # pages touched by NMRs. */
 
 	/* Modifying requests. */
 	struct requestq * mr_head;	/* First request in the queue. */
 	struct requestq ** mr_tail;	/* Pointer to final NULL. */
 	size_t mr_reqs;			/* # requests in current batch. */
+	struct mr_time * mr_times;	/* Timing of requests in batch. */
+	struct timeval mr_start;	/* When the batch was launched. */
 	size_t mr_concurrency;		/* Max # pages touched by MRs. */
 
 	/* Stop-queuing-MRs-yet-and-start-processing-them controls. */
@@ -79,8 +95,17 @@ struct dispatch_state {
 	/* Cleaning-flush timer. */
 	void * mrc_timer;		/* Cookie from events_timer. */
 	int docleans;			/* Cleaning needs a batch of MRs. */
+
+	/* Request latency statistics. */
+	struct opstats * S;
+
+	/* Allocator for modifying-request batch state. */
+	struct arena * A;
 };
 
+/* Maximum number of GETs to launch as a group. */
+#define GETGROUP	128
+
 MPOOL(requestq, struct requestq, 4096);
 
 static int callback_accept(void *, int);
@@ -97,6 +122,21 @@ static int readreqs(struct dispatch_state *);
 /* Time between ticks of the 'flush cleans if we have had no MRs' clock. */
 static const struct timeval fivesec = {.tv_sec = 5, .tv_usec = 0};
 
+/* ... and when the cleaner is paying down its debt while we're idle. */
+static const struct timeval idletime = {.tv_sec = 0, .tv_usec = 100000};
+
+/* Return the time to wait before forcing a cleaning-only batch of MRs. */
+static const struct timeval *
+mrc_timeout(struct dispatch_state * D)
+{
+
+	/* If we're idle and the cleaner wants to clean, don't wait long. */
+	if (btree_cleaning_idle(D->T->cstate))
+		return (&idletime);
+	else
+		return (&fivesec);
+}
+
 /* The connection is dying.  Help speed up the process. */
 static int
 dropconnection(void * cookie)
@@ -151,29 +191,109 @@ dropconnection(void * cookie)
 	return (0);
 }
 
+/*
+ * Launch a group of GETs from the head of the non-modifying request queue,
+ * if possible; set ${*launched} to zero if not.
+ */
+static int
+launchgets(struct dispatch_state * D, int * launched)
+{
+	struct proto_kvlds_request * reqs[GETGROUP];
+	void * cookies[GETGROUP];
+	struct requestq * RQ;
+	size_t limit = nmrlimit_get(D->nmr_limit);
+	size_t n;
+
+	/*
+	 * The first GET needs a path from the root to a leaf; each further
+	 * GET in the group adds at most one leaf, since the group finds each
+	 * leaf only once.
+	 */
+	for (n = 0; n < GETGROUP; n++) {
+		/* Is there another GET? */
+		if (((RQ = D->nmr_head) == NULL) ||
+		    (RQ->R->type != PROTO_KVLDS_GET))
+			break;
+
+		/* How many pages would this request need to touch? */
+		RQ->npages = (n == 0) ? D->T->root_shadow->height + 1 : 1;
+
+		/* Can we handle this request? */
+		if ((D->nmr_ip > 0) && (D->nmr_ip + RQ->npages > limit)) {
+			nmrlimit_blocked(D->nmr_limit);
+			break;
+		}
+
+		/* Dequeue this request. */
+		D->nmr_head = RQ->next;
+
+		/* Record when we started working on this request. */
+		if (monoclock_get(&RQ->t_start))
+			goto err0;
+
+		/* Add it to the group. */
+		RQ->D = D;
+		reqs[n] = RQ->R;
+		cookies[n] = RQ;
+		D->nmr_ip += RQ->npages;
+	}
+
+	/* Launch the group. */
+	if ((n > 0) && dispatch_nmr_launch_gets(D->T, reqs, n, D->writeq,
+	    callback_nmr_done, cookies))
+		goto err0;
+	*launched = (n > 0);
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
 /* Launch non-modifying requests, if possible. */
 static int
 poke_nmr(struct dispatch_state * D)
 {
 	struct requestq * RQ;
+	int launched;
 
 	/* If we have any queued requests, try to launch them. */
 	while ((RQ = D->nmr_head) != NULL) {
-		/* How many pages would this request need to touch? */
-		if (RQ->R->type == PROTO_KVLDS_GET)
-			RQ->npages = D->T->root_shadow->height + 1;
+		/* GETs are launched in groups. */
+		if (RQ->R->type == PROTO_KVLDS_GET) {
+			if (launchgets(D, &launched))
+				goto err0;
+			if (!launched)
+				break;
+			continue;
+		}
+
+		/*
+		 * How many pages would this request need to touch?  An MGET
+		 * is charged like a group of GETs.
+		 */
+		if (RQ->R->type == PROTO_KVLDS_MGET)
+			RQ->npages = D->T->root_shadow->height + RQ->R->nkeys;
 		else
 			RQ->npages = D->T->root_shadow->height +
 			    D->T->pagelen / SERIALIZE_PERCHILD;
 
 		/* Can we handle this request? */
 		if ((D->nmr_ip > 0) &&
-		    (D->nmr_ip + RQ->npages > D->nmr_concurrency))
+		    (D->nmr_ip + RQ->npages > nmrlimit_get(D->nmr_limit))) {
+			nmrlimit_blocked(D->nmr_limit);
 			break;
+		}
 
 		/* Dequeue this request. */
 		D->nmr_head = RQ->next;
 
+		/* Record when we started working on this request. */
+		if (monoclock_get(&RQ->t_start))
+			goto err0;
+
 		/* Launch the request. */
 		RQ->D = D;
 		if (dispatch_nmr_launch(D->T, RQ->R, D->writeq,
@@ -196,10 +316,22 @@ callback_nmr_done(void * cookie)
 {
 	struct requestq * RQ = cookie;
 	struct dispatch_state * D = RQ->D;
+	struct timeval t_done;
 
 	/* This NMR is no longer in progress. */
 	D->nmr_ip -= RQ->npages;
 
+	/* Let the concurrency controller know. */
+	if (nmrlimit_done(D->nmr_limit, RQ->npages))
+		goto err1;
+
+	/* Record the request latency. */
+	if (monoclock_get(&t_done))
+		goto err1;
+	if (opstats_record(D->S, RQ->type, &RQ->t_arrive, &RQ->t_start,
+	    &t_done))
+		goto err1;
+
 	/* Free request cookie. */
 	mpool_requestq_free(RQ);
 
@@ -217,11 +349,22 @@ callback_nmr_done(void * cookie)
 	/* Success! */
 	return (0);
 
+err1:
+	mpool_requestq_free(RQ);
+	D->nrequests -= 1;
 err0:
 	/* Failure! */
 	return (-1);
 }
 
+/* Return the number of operations the modifying request ${R} performs. */
+static size_t
+mrops(struct proto_kvlds_request * R)
+{
+
+	return ((R->type == PROTO_KVLDS_MSET) ? R->nkeys : 1);
+}
+
 /* Launch modifying requests or start a timer if necessary. */
 static int
 poke_mr(struct dispatch_state * D)
@@ -230,6 +373,7 @@ poke_mr(struct dispatch_state * D)
 	size_t pagesperop = D->T->root_dirty->height + 1;
 	struct proto_kvlds_request ** reqs;
 	struct requestq * RQ;
+	size_t maxops, nops;
 	size_t i;
 
 	/* Launch a batch of requests if possible. */
@@ -237,15 +381,27 @@ poke_mr(struct dispatch_state * D)
 	    ((D->mr_timer_expired != 0) ||
 	     (D->docleans != 0) ||
 	     (D->mr_qlen >= D->mr_min_batch))) {
-		/* Figure out how many requests will be in this batch. */
-		if (D->mr_qlen * pagesperop > concurrency)
-			D->mr_reqs = concurrency / pagesperop;
-		else
-			D->mr_reqs = D->mr_qlen;
+		/*
+		 * Figure out how many requests will be in this batch.  An
+		 * MSET counts as one operation per key-value pair, and is
+		 * never split between batches.
+		 */
+		maxops = concurrency / pagesperop;
+		D->mr_reqs = nops = 0;
+		for (RQ = D->mr_head; RQ != NULL; RQ = RQ->next) {
+			if ((D->mr_reqs > 0) && (nops + mrops(RQ->R) > maxops))
+				break;
+			nops += mrops(RQ->R);
+			D->mr_reqs += 1;
+		}
 
-		/* Allocate an array. */
+		/* Allocate arrays. */
 		if (IMALLOC(reqs, D->mr_reqs, struct proto_kvlds_request *))
 			goto err0;
+		if (IMALLOC(D->mr_times, D->mr_reqs, struct mr_time)) {
+			free(reqs);
+			goto err0;
+		}
 
 		/* Fill the array with requests. */
 		for (i = 0; i < D->mr_reqs; i++) {
@@ -257,8 +413,10 @@ poke_mr(struct dispatch_state * D)
 			D->mr_head = RQ->next;
 			D->mr_qlen -= 1;
 
-			/* Insert into the array. */
+			/* Insert into the arrays. */
 			reqs[i] = RQ->R;
+			D->mr_times[i].type = RQ->type;
+			D->mr_times[i].t_arrive = RQ->t_arrive;
 
 			/* Free linked list node. */
 			mpool_requestq_free(RQ);
@@ -266,10 +424,12 @@ poke_mr(struct dispatch_state * D)
 
 		/* Modifying requests are now in progress. */
 		D->mr_inprogress = 1;
+		if (monoclock_get(&D->mr_start))
+			goto err1;
 
 		/* Launch the batch of modifying requests. */
-		if (dispatch_mr_launch(D->T, reqs, D->mr_reqs, D->writeq,
-		    callback_mr_done, D))
+		if (dispatch_mr_launch(D->T, D->A, reqs, D->mr_reqs,
+		    D->writeq, callback_mr_done, D))
 			goto err1;
 
 		/* We beat the clock.  Disable it. */
@@ -281,13 +441,13 @@ poke_mr(struct dispatch_state * D)
 		/* The (unset) timer hasn't expired. */
 		D->mr_timer_expired = 0;
 
-		/* Reset the do-a-cleaning-only-batch timer to 5 seconds. */
+		/* Reset the do-a-cleaning-only-batch timer. */
 		if (D->mrc_timer != NULL) {
 			events_timer_cancel(D->mrc_timer);
 			D->mrc_timer = NULL;
 		}
 		if ((D->mrc_timer = events_timer_register(callback_mrc_timer,
-		    D, &fivesec)) == NULL)
+		    D, mrc_timeout(D))) == NULL)
 			goto err0;
 
 		/* We don't need to launch another batch any more. */
@@ -316,6 +476,8 @@ err1:
 	for (i = 0; i < D->mr_reqs; i++)
 		proto_kvlds_request_free(reqs[i]);
 	free(reqs);
+	free(D->mr_times);
+	D->mr_times = NULL;
 err0:
 	/* Failure! */
 	return (-1);
@@ -346,7 +508,7 @@ callback_mrc_timer(void * cookie)
 	/* If we have no pending cleaning, reset the timer. */
 	if (!btree_cleaning_possible(D->T->cstate)) {
 		if ((D->mrc_timer = events_timer_register(callback_mrc_timer,
-		    D, &fivesec)) == NULL)
+		    D, mrc_timeout(D))) == NULL)
 			return (-1);
 		else
 			return (0);
@@ -367,12 +529,25 @@ static int
 callback_mr_done(void * cookie)
 {
 	struct dispatch_state * D = cookie;
+	struct timeval t_done;
+	size_t i;
 
 #ifdef SANITY_CHECKS
 	/* Sanity check the B+Tree. */
 	btree_sanity(D->T);
 #endif
 
+	/* Record the latencies of the requests in this batch. */
+	if (monoclock_get(&t_done))
+		goto err1;
+	for (i = 0; i < D->mr_reqs; i++) {
+		if (opstats_record(D->S, D->mr_times[i].type,
+		    &D->mr_times[i].t_arrive, &D->mr_start, &t_done))
+			goto err1;
+	}
+	free(D->mr_times);
+	D->mr_times = NULL;
+
 	/* We've handled a bunch of requests. */
 	D->nrequests -= D->mr_reqs;
 
@@ -386,6 +561,9 @@ callback_mr_done(void * cookie)
 	/* Maybe we can launch some more MRs? */
 	return (poke_mr(D));
 
+err1:
+	free(D->mr_times);
+	D->mr_times = NULL;
 err0:
 	/* Failure! */
 	return (-1);
@@ -408,8 +586,8 @@ readreqs(struct dispatch_state * D)
 	if (D->read_cookie != NULL)
 		goto done;
 
-	/* If we have MAXREQS requests in progress, do nothing. */
-	if (D->nrequests == MAXREQS)
+	/* If we have maxreqs requests in progress, do nothing. */
+	if (D->nrequests >= D->maxreqs)
 		goto done;
 
 	/* Wait for a request to arrive. */
@@ -428,6 +606,80 @@ err0:
 	return (-1);
 }
 
+/* Copy the cleaner accounting into the statistics. */
+static int
+setcounters(struct dispatch_state * D)
+{
+	struct btree_cleaning_stats st;
+	struct nmrlimit_stats lst;
+	uint64_t nallocs, nmallocs;
+
+	/* Ask the cleaner for its statistics. */
+	btree_cleaning_stats(D->T->cstate, &st);
+
+	/* Ask the NMR concurrency controller what it has been doing. */
+	nmrlimit_stats(D->nmr_limit, &lst);
+
+	/* Ask the batch arena how much work it has saved malloc. */
+	arena_stats(D->A, &nallocs, &nmallocs);
+
+	/* Record them as counters. */
+	if (opstats_counter(D->S, PROTO_KVLDS_CTR_PAGES_CLEANED,
+	    st.pages_cleaned))
+		goto err0;
+	if (opstats_counter(D->S, PROTO_KVLDS_CTR_PAGES_MODIFIED,
+	    st.pages_modified))
+		goto err0;
+	if (opstats_counter(D->S, PROTO_KVLDS_CTR_PAGES_APPENDED,
+	    st.pages_appended))
+		goto err0;
+	if (opstats_counter(D->S, PROTO_KVLDS_CTR_BYTES_APPENDED,
+	    st.bytes_appended))
+		goto err0;
+	if (opstats_counter(D->S, PROTO_KVLDS_CTR_BYTES_USER,
+	    st.bytes_user))
+		goto err0;
+	if (opstats_counter(D->S, PROTO_KVLDS_CTR_PAGES_STORAGE,
+	    st.pages_storage))
+		goto err0;
+	if (opstats_counter(D->S, PROTO_KVLDS_CTR_PAGES_GARBAGE,
+	    st.pages_garbage))
+		goto err0;
+	if (opstats_counter(D->S, PROTO_KVLDS_CTR_CLEANS_CAPPED,
+	    st.ncapped))
+		goto err0;
+	if (opstats_counter(D->S, PROTO_KVLDS_CTR_CLEANS_DEFERRED,
+	    st.ndeferred))
+		goto err0;
+	if (opstats_counter(D->S, PROTO_KVLDS_CTR_TICKS_IDLE,
+	    st.ticks_idle))
+		goto err0;
+	if (opstats_counter(D->S, PROTO_KVLDS_CTR_SEGS_FREED,
+	    st.segs_freed))
+		goto err0;
+	if (opstats_counter(D->S, PROTO_KVLDS_CTR_SEGS_CLEANED,
+	    st.segs_cleaned))
+		goto err0;
+	if (opstats_counter(D->S, PROTO_KVLDS_CTR_ARENA_ALLOCS, nallocs))
+		goto err0;
+	if (opstats_counter(D->S, PROTO_KVLDS_CTR_ARENA_MALLOCS, nmallocs))
+		goto err0;
+	if (opstats_counter(D->S, PROTO_KVLDS_CTR_NMR_LIMIT, lst.limit))
+		goto err0;
+	if (opstats_counter(D->S, PROTO_KVLDS_CTR_NMR_GROWS, lst.ngrows))
+		goto err0;
+	if (opstats_counter(D->S, PROTO_KVLDS_CTR_NMR_SHRINKS,
+	    lst.nshrinks))
+		goto err0;
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
 /* Read and dispatch incoming request(s). */
 static int
 gotrequest(void * cookie, int status)
@@ -435,6 +687,10 @@ gotrequest(void * cookie, int status)
 	struct dispatch_state * D = cookie;
 	struct proto_kvlds_request * R;
 	struct requestq * RQ;
+	struct timeval t_arrive;
+	uint8_t * buf;
+	size_t buflen;
+	size_t i;
 
 	/* We're no longer waiting for a packet to arrive. */
 	D->read_cookie = NULL;
@@ -443,8 +699,12 @@ gotrequest(void * cookie, int status)
 	if (status)
 		goto drop;
 
+	/* Requests read now are considered to have arrived now. */
+	if (monoclock_get(&t_arrive))
+		goto err0;
+
 	/*
-	 * Read packets until there are no more to read, we hit MAXREQS, or
+	 * Read packets until there are no more to read, we hit maxreqs, or
 	 * an error occurs.
 	 */
 	do {
@@ -452,8 +712,8 @@ gotrequest(void * cookie, int status)
 		if ((R = proto_kvlds_request_alloc()) == NULL)
 			goto err0;
 
-		/* If we have MAXREQS requests, stop looping. */
-		if (D->nrequests == MAXREQS)
+		/* If we have maxreqs requests, stop looping. */
+		if (D->nrequests >= D->maxreqs)
 			break;
 
 		/* Attempt to read a request. */
@@ -472,6 +732,8 @@ gotrequest(void * cookie, int status)
 			goto err1;
 		RQ->R = R;
 		RQ->next = NULL;
+		RQ->type = R->type;
+		RQ->t_arrive = t_arrive;
 
 		/* Add to the modifying or non-modifying queue, and poke it. */
 		switch (R->type) {
@@ -487,6 +749,32 @@ gotrequest(void * cookie, int status)
 			/* Free the request packet. */
 			proto_kvlds_request_free(R);
 
+			/* This request has been handled. */
+			D->nrequests -= 1;
+			break;
+		case PROTO_KVLDS_STATS:
+			/* Update the cleaner counters. */
+			if (setcounters(D))
+				goto err2;
+
+			/* Serialize the statistics we have so far. */
+			if (opstats_serialize(D->S, &buf, &buflen))
+				goto err2;
+
+			/* Send the response immediately. */
+			if (proto_kvlds_response_stats(D->writeq, RQ->R->ID,
+			    buf, buflen)) {
+				free(buf);
+				goto err2;
+			}
+			free(buf);
+
+			/* Free the linked list node. */
+			mpool_requestq_free(RQ);
+
+			/* Free the request packet. */
+			proto_kvlds_request_free(R);
+
 			/* This request has been handled. */
 			D->nrequests -= 1;
 			break;
@@ -504,6 +792,16 @@ gotrequest(void * cookie, int status)
 
 			/* FALLTHROUGH */
 
+		case PROTO_KVLDS_MSET:
+			/* The same limits apply to each key-value pair. */
+			for (i = 0; i < R->nkeys; i++) {
+				if ((R->keys[i]->len > D->kmax) ||
+				    (R->values[i]->len > D->vmax))
+					goto drop2;
+			}
+
+			/* FALLTHROUGH */
+
 		case PROTO_KVLDS_DELETE:
 		case PROTO_KVLDS_CAD:
 			/* Add to modifying request queue. */
@@ -521,6 +819,7 @@ gotrequest(void * cookie, int status)
 				goto err0;
 			break;
 		case PROTO_KVLDS_GET:
+		case PROTO_KVLDS_MGET:
 		case PROTO_KVLDS_RANGE:
 			/* Add to non-modifying request queue. */
 			if (D->nmr_head == NULL)
@@ -574,16 +873,21 @@ err0:
 }
 
 /**
- * dispatch_accept(s, T, kmax, vmax, w, g):
+ * dispatch_accept(s, T, kmax, vmax, w, g, q, L, S, A):
  * Accept a connection from the listening socket ${s} and return a dispatch
  * state for the B+Tree ${T}.  Keys will be at most ${kmax} bytes; values
  * will be at most ${vmax} bytes; up to ${w} seconds should be spent waiting
  * for more requests before performing a group commit, unless ${g} requests
- * are pending.
+ * are pending.  At most ${q} requests will be read before responses to them
+ * have been sent, and the number of pages which non-modifying requests may
+ * touch at once is set by the controller ${L}.  Request latencies are
+ * recorded in ${S}.  State for batches of modifying requests is allocated
+ * from the arena ${A}.
  */
 struct dispatch_state *
 dispatch_accept(int s, struct btree * T,
-    size_t kmax, size_t vmax, double w, size_t g)
+    size_t kmax, size_t vmax, double w, size_t g, size_t q,
+    struct nmrlimit * L, struct opstats * S, struct arena * A)
 {
 	struct dispatch_state * D;
 
@@ -599,11 +903,13 @@ dispatch_accept(int s, struct btree * T,
 	D->kmax = kmax;
 	D->vmax = vmax;
 	D->nrequests = 0;
+	D->maxreqs = q;
 	D->nmr_head = NULL;
 	D->nmr_ip = 0;
-	D->nmr_concurrency = T->poolsz / 4;
+	D->nmr_limit = L;
 	D->mr_head = NULL;
 	D->mr_reqs = 0;
+	D->mr_times = NULL;
 	D->mr_concurrency = T->poolsz / 4;
 	D->mr_inprogress = 0;
 	D->mr_qlen = 0;
@@ -613,6 +919,8 @@ dispatch_accept(int s, struct btree * T,
 	D->mr_timeout.tv_usec = (suseconds_t)((w - D->mr_timeout.tv_sec)
 	    * 1000000);
 	D->mr_min_batch = g;
+	D->S = S;
+	D->A = A;
 
 	/* Start the periodic cleaning timer. */
 	D->docleans = 0;
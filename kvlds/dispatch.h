@@ -2,21 +2,29 @@
 #define _DISPATCH_H_
 
 /* Opaque types. */
+struct arena;
 struct btree;
 struct dispatch_state;
 struct netbuf_write;
+struct nmrlimit;
+struct opstats;
 struct proto_kvlds_request;
 
 /**
- * dispatch_accept(s, T, kmax, vmax, w, g):
+ * dispatch_accept(s, T, kmax, vmax, w, g, q, L, S, A):
  * Accept a connection from the listening socket ${s} and return a dispatch
  * state for the B+Tree ${T}.  Keys will be at most ${kmax} bytes; values
  * will be at most ${vmax} bytes; up to ${w} seconds should be spent waiting
  * for more requests before performing a group commit, unless ${g} requests
- * are pending.
+ * are pending.  At most ${q} requests will be read before responses to them
+ * have been sent, and the number of pages which non-modifying requests may
+ * touch at once is set by the controller ${L}.  Request latencies are
+ * recorded in ${S}.  State for batches of modifying requests is allocated
+ * from the arena ${A}.
  */
 struct dispatch_state * dispatch_accept(int, struct btree *, size_t, size_t,
-    double, size_t);
+    double, size_t, size_t, struct nmrlimit *, struct opstats *,
+    struct arena *);
 
 /**
  * dispatch_alive(D):
@@ -43,13 +51,27 @@ int dispatch_nmr_launch(struct btree *, struct proto_kvlds_request *,
     struct netbuf_write *, int (*)(void *), void *);
 
 /**
- * dispatch_mr_launch(T, reqs, nreqs, WQ, callback_done, cookie):
+ * dispatch_nmr_launch_gets(T, reqs, nreqs, WQ, callback_done, cookies):
+ * Perform the ${nreqs} GET requests ${reqs[0]} ... ${reqs[nreqs - 1]} on the
+ * B+Tree ${T}, finding each leaf only once however many of the keys it
+ * holds; write response packets to the write queue ${WQ}; and free the
+ * requests.  Invoke the callback ${callback_done}(${cookies[i]}) after
+ * request ${reqs[i]} is processed.
+ */
+int dispatch_nmr_launch_gets(struct btree *, struct proto_kvlds_request **,
+    size_t, struct netbuf_write *, int (*)(void *), void **);
+
+/**
+ * dispatch_mr_launch(T, A, reqs, nreqs, WQ, callback_done, cookie):
  * Perform the ${nreqs} modifying requests ${reqs[0]} ... ${reqs[nreqs - 1]}
  * on the B+Tree ${T}; write response packets to the write queue ${WQ}; and
  * free the requests and request array.  Invoke the callback
- * ${callback_done}(${cookie}) after the requests have been serviced.
+ * ${callback_done}(${cookie}) after the requests have been serviced.  State
+ * for the batch is allocated from the arena ${A}, which is reset once the
+ * dirty nodes have been written out.
  */
-int dispatch_mr_launch(struct btree *, struct proto_kvlds_request **, size_t,
-    struct netbuf_write *, int (*)(void *), void *);
+int dispatch_mr_launch(struct btree *, struct arena *,
+    struct proto_kvlds_request **, size_t, struct netbuf_write *,
+    int (*)(void *), void *);
 
 #endif /* !_DISPATCH_H_ */
@@ -1,11 +1,11 @@
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
 
+#include "arena.h"
 #include "events.h"
-#include "imalloc.h"
 #include "kvldskey.h"
 #include "kvpair.h"
-#include "mpool.h"
 #include "netbuf.h"
 #include "proto_kvlds.h"
 
@@ -18,24 +18,52 @@
 
 #include "dispatch.h"
 
-/* A single request. */
+/*
+ * Batches with at least SORTMIN requests, no more than 1/SORTINV of which
+ * have keys smaller than the key of the request before them, are sorted by
+ * key; leaves are then found with a single in-order walk of the tree, and
+ * the requests for each leaf are applied with a single merge rather than via
+ * a hash table.  This suits bulk updates; requests scattered across the tree
+ * gain nothing from the walk and would pay for the sort.
+ */
+#define SORTMIN	256
+#define SORTINV	8
+
+/*
+ * A single operation: a request, or one key-value pair of an MSET.  The
+ * first operation of each request sends its response and frees it.
+ */
 struct req_cookie {
 	struct proto_kvlds_request * R;
+	uint32_t type;
+	const struct kvldskey * key;
+	const struct kvldskey * value;
+	const struct kvldskey * oval;
 	struct node * leaf;
 	struct batch * batch;
+	size_t seq;
 	int opdone;
+	int respond;
 };
 
-/* State for a batch of modifying requests. */
+/*
+ * State for a batch of modifying requests.  This, and everything else which
+ * lives only as long as the batch, is allocated from the batch arena.
+ */
 struct batch {
 	int (*callback_done)(void *);
 	void * cookie;
 	size_t nreqs;
 	struct btree * T;
+	struct arena * A;
 	struct netbuf_write * WQ;
 	struct req_cookie ** reqs;
+	struct req_cookie ** sorted;	/* NULL if not sorting. */
 	size_t leavestofind;
-	struct node ** dirties;
+	size_t nextfind;		/* Next sorted request to find. */
+	int findip;			/* Finding a leaf. */
+	int finding;			/* Inside findleaves. */
+	struct nodepair * dirties;
 	size_t ndirty;
 };
 
@@ -43,11 +71,12 @@ struct batch {
 struct nodepair {
 	struct node * shadow;
 	struct node * dirty;
+	size_t nadds;		/* Max # keys the batch adds to the leaf. */
 };
 
-MPOOL(reqcookie, struct req_cookie, 4096);
-
+static int findleaves(struct batch *);
 static int callback_gotleaf(void *, struct node *);
+static int callback_gotrange(void *, struct node *, struct kvldskey *);
 static int callback_gotleaves(void *);
 static int callback_balanced(void *);
 static int callback_synced(void *);
@@ -67,39 +96,75 @@ compar_snp(const void * _x, const void * _y)
 		return (1);
 }
 
-/* Find the dirty node corresponding to a shadow node. */
-static struct node *
-finddirty(struct nodepair * V, size_t N, struct node * shadow)
+/* Compare requests by key, breaking ties by their order in the batch. */
+static int
+compar_req(const void * _x, const void * _y)
+{
+	const struct req_cookie * x = *((const struct req_cookie * const *)_x);
+	const struct req_cookie * y = *((const struct req_cookie * const *)_y);
+	int rc;
+
+	if ((rc = kvldskey_cmp(x->key, y->key)) != 0)
+		return (rc);
+	else if (x->seq < y->seq)
+		return (-1);
+	else if (x->seq == y->seq)
+		return (0);
+	else
+		return (1);
+}
+
+/*
+ * Count the requests in the batch ${B} with keys smaller than the key of the
+ * request before them, stopping if the count exceeds ${max}.
+ */
+static size_t
+countinv(struct batch * B, size_t max)
+{
+	size_t ninv;
+	size_t i;
+
+	for (ninv = 0, i = 1; (i < B->nreqs) && (ninv <= max); i++) {
+		if (kvldskey_cmp(B->reqs[i - 1]->key, B->reqs[i]->key) > 0)
+			ninv += 1;
+	}
+
+	/* Return the count. */
+	return (ninv);
+}
+
+/* Find the shadow/dirty pair for a shadow node, or NULL if none. */
+static struct nodepair *
+findpair(struct nodepair * V, size_t N, struct node * shadow)
 {
-	struct nodepair * pair;
 	struct nodepair k;
 
 	/* Binary search. */
 	k.shadow = shadow;
-	pair = bsearch(&k, V, N, sizeof(struct nodepair), compar_snp);
-
-	/* If we found the shadow node, return the matching dirty node. */
-	if (pair != NULL)
-		return (pair->dirty);
-
-	/* Otherwise, return the shadow node we were given. */
-	return (shadow);
+	return (bsearch(&k, V, N, sizeof(struct nodepair), compar_snp));
 }
 
 /**
- * dispatch_mr_launch(T, reqs, nreqs, WQ, callback_done, cookie):
+ * dispatch_mr_launch(T, A, reqs, nreqs, WQ, callback_done, cookie):
  * Perform the ${nreqs} modifying requests ${reqs[0]} ... ${reqs[nreqs - 1]}
  * on the B+Tree ${T}; write response packets to the write queue ${WQ}; and
  * free the requests and request array.  Invoke the callback
- * ${callback_done}(${cookie}) after the requests have been serviced.
+ * ${callback_done}(${cookie}) after the requests have been serviced.  State
+ * for the batch is allocated from the arena ${A}, which is reset once the
+ * dirty nodes have been written out.
  */
 int
-dispatch_mr_launch(struct btree * T, struct proto_kvlds_request ** reqs,
-    size_t nreqs, struct netbuf_write * WQ,
-    int (* callback_done)(void *), void * cookie)
+dispatch_mr_launch(struct btree * T, struct arena * A,
+    struct proto_kvlds_request ** reqs, size_t nreqs,
+    struct netbuf_write * WQ, int (* callback_done)(void *), void * cookie)
 {
 	struct batch * B;
-	size_t i;
+	struct req_cookie * ops;
+	struct req_cookie * req;
+	struct proto_kvlds_request * R;
+	size_t nops;
+	size_t ninv;
+	size_t i, j, n;
 
 #ifdef SANITY_CHECKS
 	/* Sanity check the B+Tree. */
@@ -107,39 +172,85 @@ dispatch_mr_launch(struct btree * T, struct proto_kvlds_request ** reqs,
 #endif
 
 	/* Bake a cookie. */
-	if ((B = malloc(sizeof(struct batch))) == NULL)
-		goto err0;
+	if ((B = arena_malloc(A, sizeof(struct batch))) == NULL)
+		goto err1;
 	B->callback_done = callback_done;
 	B->cookie = cookie;
-	B->nreqs = nreqs;
 	B->T = T;
+	B->A = A;
 	B->WQ = WQ;
 
-	/* Allocate an array of request cookie pointers. */
-	if (IMALLOC(B->reqs, B->nreqs, struct req_cookie *))
+	/* Each MSET key-value pair is a separate operation. */
+	for (nops = i = 0; i < nreqs; i++) {
+		if (reqs[i]->type == PROTO_KVLDS_MSET)
+			nops += reqs[i]->nkeys;
+		else
+			nops += 1;
+	}
+	B->nreqs = nops;
+
+	/* Allocate request cookies and an array of pointers to them. */
+	if (ARENA_IMALLOC(A, ops, B->nreqs, struct req_cookie))
+		goto err1;
+	if (ARENA_IMALLOC(A, B->reqs, B->nreqs, struct req_cookie *))
 		goto err1;
 
 	/* Bake request cookies. */
-	for (i = 0; i < B->nreqs; i++)
-		B->reqs[i] = NULL;
-	for (i = 0; i < B->nreqs; i++) {
-		if ((B->reqs[i] = mpool_reqcookie_malloc()) == NULL)
-			goto err2;
-		B->reqs[i]->R = reqs[i];
-		B->reqs[i]->batch = B;
-		B->reqs[i]->opdone = 0;
+	for (nops = i = 0; i < nreqs; i++) {
+		R = reqs[i];
+		n = (R->type == PROTO_KVLDS_MSET) ? R->nkeys : 1;
+		for (j = 0; j < n; j++) {
+			req = B->reqs[nops] = &ops[nops];
+			req->R = R;
+			if (R->type == PROTO_KVLDS_MSET) {
+				req->type = PROTO_KVLDS_SET;
+				req->key = R->keys[j];
+				req->value = R->values[j];
+			} else {
+				req->type = R->type;
+				req->key = R->key;
+				req->value = R->value;
+			}
+			req->oval = R->oval;
+			req->batch = B;
+			req->seq = nops++;
+			req->opdone = 0;
+			req->respond = (j == 0);
+		}
 	}
 
 	/* If we don't need to find any leaves, schedule the next step. */
+	B->sorted = NULL;
 	if ((B->leavestofind = B->nreqs) == 0) {
 		if (!events_immediate_register(callback_gotleaves, B, 1))
-			goto err2;
+			goto err1;
+	}
+
+	/* For large, mostly ordered batches, sort and walk the tree. */
+	if ((B->nreqs >= SORTMIN) && ((ninv = countinv(B,
+	    B->nreqs / SORTINV)) <= B->nreqs / SORTINV)) {
+		if (ARENA_IMALLOC(A, B->sorted, B->nreqs,
+		    struct req_cookie *))
+			goto err1;
+		memcpy(B->sorted, B->reqs,
+		    B->nreqs * sizeof(struct req_cookie *));
+		if (ninv > 0)
+			qsort(B->sorted, B->nreqs,
+			    sizeof(struct req_cookie *), compar_req);
+		B->nextfind = 0;
+		B->findip = 0;
+		B->finding = 0;
+
+		/* As below, we can't clean up if this fails. */
+		if (findleaves(B))
+			goto err0;
+		goto done;
 	}
 
 	/* Look for the leaves. */
 	for (i = 0; i < B->nreqs; i++) {
 		if (btree_find_leaf(B->T, B->T->root_dirty,
-		    B->reqs[i]->R->key, callback_gotleaf, B->reqs[i])) {
+		    B->reqs[i]->key, callback_gotleaf, B->reqs[i])) {
 			/*
 			 * We can't clean up properly since we can't cancel
 			 * any already-in-progress leaf-finding; just error
@@ -149,18 +260,96 @@ dispatch_mr_launch(struct btree * T, struct proto_kvlds_request ** reqs,
 		}
 	}
 
+done:
 	/* Free input request vector. */
 	free(reqs);
 
 	/* Success! */
 	return (0);
 
-err2:
-	for (i = 0; i < B->nreqs; i++)
-		mpool_reqcookie_free(B->reqs[i]);
-	free(B->reqs);
 err1:
-	free(B);
+	arena_reset(A);
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/*
+ * Find the leaves for sorted requests, starting from the first request for
+ * which we don't have a leaf yet, until we have found them all or need to
+ * wait for a node to be paged in.
+ */
+static int
+findleaves(struct batch * B)
+{
+
+	/* We're walking the tree. */
+	B->finding = 1;
+
+	/* Find the leaf holding the next key which isn't in a known leaf. */
+	while ((B->leavestofind > 0) && (B->findip == 0)) {
+		B->findip = 1;
+		if (btree_find_range(B->T, B->T->root_dirty,
+		    B->sorted[B->nextfind]->key, 0, callback_gotrange, B))
+			goto err0;
+	}
+
+	/* We're not walking the tree any more. */
+	B->finding = 0;
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/*
+ * We have found the leaf responsible for the next sorted request, and the
+ * end of its range; it may also be responsible for the requests after it.
+ */
+static int
+callback_gotrange(void * cookie, struct node * N, struct kvldskey * e)
+{
+	struct batch * B = cookie;
+	int locked = 1;
+
+	/* Attach requests to the leaf while their keys are in its range. */
+	do {
+		/* Each request holds a lock on its leaf. */
+		if (!locked)
+			btree_node_lock(B->T, N);
+		locked = 0;
+
+		/* Record the leaf node. */
+		B->sorted[B->nextfind]->leaf = N;
+
+		/* We've found a leaf. */
+		B->nextfind += 1;
+		B->leavestofind -= 1;
+	} while ((B->leavestofind > 0) && ((e->len == 0) ||
+	    (kvldskey_cmp(B->sorted[B->nextfind]->key, e) < 0)));
+
+	/* We're done with the range endpoint. */
+	kvldskey_free(e);
+
+	/* We're not looking for a leaf any more. */
+	B->findip = 0;
+
+	/* If we've found all of them, move on to the next step. */
+	if (B->leavestofind == 0) {
+		if (!events_immediate_register(callback_gotleaves, B, 1))
+			goto err0;
+	} else if (!B->finding) {
+		/* We were called after a node was paged in; keep walking. */
+		if (findleaves(B))
+			goto err0;
+	}
+
+	/* Success! */
+	return (0);
+
 err0:
 	/* Failure! */
 	return (-1);
@@ -198,31 +387,30 @@ static int
 batch_dirty(struct batch * B)
 {
 	struct req_cookie * req;
-	struct proto_kvlds_request * R;
 	struct nodepair * shadowdirty;
+	struct nodepair * pair;
 	size_t Nsd;
 	size_t i;
 	struct kvpair_const * kv;
 
 	/* Allocate array to hold (shadow node, dirty node) pairs. */
-	if (IMALLOC(shadowdirty, B->nreqs, struct nodepair))
+	if (ARENA_IMALLOC(B->A, shadowdirty, B->nreqs, struct nodepair))
 		goto err0;
 	Nsd = 0;
 
 	/* Dirty leaves which will need to be modified. */
 	for (i = 0; i < B->nreqs; i++) {
 		req = B->reqs[i];
-		R = req->R;
 
 		/* If the node has already been dirtied, move on. */
 		if (req->leaf->state != NODE_STATE_CLEAN)
 			continue;
 
 		/* Look for the relevant key within the node. */
-		kv = btree_find_kvpair(req->leaf, R->key);
+		kv = btree_find_kvpair(req->leaf, req->key);
 
 		/* If this request doesn't do anything, move on. */
-		switch (R->type) {
+		switch (req->type) {
 		case PROTO_KVLDS_SET:
 			/*
 			 * Operation has effect if the key doesn't exist OR
@@ -249,7 +437,7 @@ batch_dirty(struct batch * B)
 			 */
 			if (kv == NULL)
 				continue;
-			if (kvldskey_cmp(R->oval, kv->v))
+			if (kvldskey_cmp(req->oval, kv->v))
 				continue;
 			break;
 		}
@@ -258,7 +446,8 @@ batch_dirty(struct batch * B)
 		shadowdirty[Nsd].shadow = req->leaf;
 		if ((shadowdirty[Nsd].dirty =
 		    btree_node_dirty(B->T, req->leaf)) == NULL)
-			goto err1;
+			goto err0;
+		shadowdirty[Nsd].nadds = 0;
 		Nsd += 1;
 	}
 
@@ -270,24 +459,27 @@ batch_dirty(struct batch * B)
 	if (Nsd > 0)
 		qsort(shadowdirty, Nsd, sizeof(struct nodepair), compar_snp);
 
-	/* Translate shadow node pointers to dirty node pointers. */
-	for (i = 0; i < B->nreqs; i++)
-		B->reqs[i]->leaf =
-		    finddirty(shadowdirty, Nsd, B->reqs[i]->leaf);
-
-	/* Create a list of dirty leaves for future reference. */
-	if ((B->ndirty = Nsd) > 0) {
-		if (IMALLOC(B->dirties, B->ndirty, struct node *))
-			goto err1;
-		for (i = 0; i < B->ndirty; i++)
-			B->dirties[i] = shadowdirty[i].dirty;
-	} else {
-		/* No dirty leaves. */
-		B->dirties = NULL;
+	/*
+	 * Translate shadow node pointers to dirty node pointers, and count
+	 * the requests which might add a key to each dirty leaf so that its
+	 * hash table can be sized in advance.  Requests for the same leaf are
+	 * often adjacent, so avoid searching again for the same pair.
+	 */
+	for (pair = NULL, i = 0; i < B->nreqs; i++) {
+		req = B->reqs[i];
+		if ((pair == NULL) || (pair->shadow != req->leaf))
+			pair = findpair(shadowdirty, Nsd, req->leaf);
+		if (pair == NULL)
+			continue;
+		req->leaf = pair->dirty;
+		if ((req->type == PROTO_KVLDS_SET) ||
+		    (req->type == PROTO_KVLDS_ADD))
+			pair->nadds += 1;
 	}
 
-	/* Free the shadow/dirty pairs. */
-	free(shadowdirty);
+	/* Keep the list of dirty leaves for future reference. */
+	B->dirties = shadowdirty;
+	B->ndirty = Nsd;
 
 	/* Tell the cleaner to dirty nodes now if it wants. */
 	if (btree_cleaning_clean(B->T->cstate))
@@ -296,8 +488,6 @@ batch_dirty(struct batch * B)
 	/* Success! */
 	return (0);
 
-err1:
-	free(shadowdirty);
 err0:
 	/* Failure! */
 	return (-1);
@@ -309,27 +499,87 @@ err0:
 #define OP_MODIFY	1
 #define OP_DELETE	2
 
+/* Figure out what ${req} needs to do to a key with value ${val}. */
+static int
+getop(struct req_cookie * req, const struct kvldskey * val)
+{
+	int op = OP_NONE;
+
+	switch (req->type) {
+	case PROTO_KVLDS_SET:
+		/* Add or modify as required. */
+		op = OP_ADD;
+		break;
+	case PROTO_KVLDS_CAS:
+		/*
+		 * Operation only has effect if key exists and is
+		 * associated with the right value.
+		 */
+		if ((val != NULL) &&
+		    (kvldskey_cmp(req->oval, val) == 0))
+			op = OP_MODIFY;
+		break;
+	case PROTO_KVLDS_ADD:
+		/* Operation only has effect if key doesn't exist. */
+		if (val == NULL)
+			op = OP_ADD;
+		break;
+	case PROTO_KVLDS_MODIFY:
+		/* Operation only has effect if key exists. */
+		if (val != NULL)
+			op = OP_MODIFY;
+		break;
+	case PROTO_KVLDS_DELETE:
+		/* Operation only has effect if key exists. */
+		if (val != NULL)
+			op = OP_DELETE;
+		break;
+	case PROTO_KVLDS_CAD:
+		/*
+		 * Operation only has effect if key exists and is
+		 * associated with the right value.
+		 */
+		if ((val != NULL) &&
+		    (kvldskey_cmp(req->oval, val) == 0))
+			op = OP_DELETE;
+		break;
+	}
+
+	/* Return the operation. */
+	return (op);
+}
+
+/* Record if we did something, and how many bytes we wrote. */
+static void
+doneop(struct batch * B, struct req_cookie * req, int op)
+{
+	if (op != OP_NONE) {
+		req->opdone = 1;
+		btree_cleaning_notify_userbytes(B->T->cstate,
+		    req->key->len +
+		    ((op == OP_DELETE) ? 0 : req->value->len));
+	}
+}
+
 /* Perform the requested operations. */
 static int
 batch_run(struct batch * B)
 {
 	struct req_cookie * req;
-	struct proto_kvlds_request * R;
 	struct node * leaf;
 	size_t i;
 	struct kvpair_const * pos;
-	const struct kvldskey * val;
 	int op;
 
 	/* Prepare leaves for mutation. */
 	for (i = 0; i < B->ndirty; i++)
-		if (btree_mutate_mutable(B->dirties[i]))
+		if (btree_mutate_mutable(B->dirties[i].dirty, B->A,
+		    B->dirties[i].nadds))
 			goto err0;
 
 	/* Handle requests in order. */
 	for (i = 0; i < B->nreqs; i++) {
 		req = B->reqs[i];
-		R = req->R;
 		leaf = req->leaf;
 
 		/* If this node isn't dirty, we're not doing anything. */
@@ -337,50 +587,10 @@ batch_run(struct batch * B)
 			continue;
 
 		/* Look for the relevant key within the node. */
-		pos = btree_mutate_find(leaf, R->key);
-		val = pos->v;
+		pos = btree_mutate_find(leaf, req->key);
 
 		/* Figure out what we need to do (if anything). */
-		op = OP_NONE;
-		switch (R->type) {
-		case PROTO_KVLDS_SET:
-			/* Add or modify as required. */
-			op = OP_ADD;
-			break;
-		case PROTO_KVLDS_CAS:
-			/*
-			 * Operation only has effect if key exists and is
-			 * associated with the right value.
-			 */
-			if ((val != NULL) &&
-			    (kvldskey_cmp(R->oval, val) == 0))
-				op = OP_MODIFY;
-			break;
-		case PROTO_KVLDS_ADD:
-			/* Operation only has effect if key doesn't exist. */
-			if (val == NULL)
-				op = OP_ADD;
-			break;
-		case PROTO_KVLDS_MODIFY:
-			/* Operation only has effect if key exists. */
-			if (val != NULL)
-				op = OP_MODIFY;
-			break;
-		case PROTO_KVLDS_DELETE:
-			/* Operation only has effect if key exists. */
-			if (val != NULL)
-				op = OP_DELETE;
-			break;
-		case PROTO_KVLDS_CAD:
-			/*
-			 * Operation only has effect if key exists and is
-			 * associated with the right value.
-			 */
-			if ((val != NULL) &&
-			    (kvldskey_cmp(R->oval, val) == 0))
-				op = OP_DELETE;
-			break;
-		}
+		op = getop(req, pos->v);
 
 		/* Actually perform the operation (if required). */
 		switch (op) {
@@ -394,7 +604,7 @@ batch_run(struct batch * B)
 			 */
 			if (pos->k == NULL) {
 				if (btree_mutate_add(leaf, pos,
-				    R->key, R->value))
+				    req->key, req->value))
 					goto err0;
 				break;
 			}
@@ -403,7 +613,7 @@ batch_run(struct batch * B)
 			/* FALLTHROUGH. */
 		case OP_MODIFY:
 			/* Modify the key. */
-			pos->v = R->value;
+			pos->v = req->value;
 			break;
 		case OP_DELETE:
 			/* Delete the key. */
@@ -412,15 +622,121 @@ batch_run(struct batch * B)
 		}
 
 		/* Record if we did something. */
-		if (op != OP_NONE)
-			req->opdone = 1;
+		doneop(B, req, op);
 	}
 
 	/* We're not going to mutate leaves any more. */
 	for (i = 0; i < B->ndirty; i++)
-		if (btree_mutate_immutable(B->dirties[i]))
+		if (btree_mutate_immutable(B->dirties[i].dirty))
+			goto err0;
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/*
+ * Perform the ${nreqs} sorted requests ${reqs}, all of which belong in the
+ * dirty leaf ${leaf}, by merging their effects into the leaf in one pass.
+ */
+static int
+batch_merge_leaf(struct batch * B, struct node * leaf,
+    struct req_cookie ** reqs, size_t nreqs)
+{
+	struct kvpair_const * kvs;
+	struct kvpair_const * pos;
+	struct req_cookie * req;
+	const struct kvldskey * val;
+	size_t nkvs;
+	size_t i, j, k;
+	int rc;
+	int op;
+
+	/* Allocate space for the new keys, of which there are at most nreqs. */
+	if (ARENA_IMALLOC(B->A, kvs, nreqs, struct kvpair_const))
+		goto err0;
+	nkvs = 0;
+
+	/* Handle each run of requests with the same key in order. */
+	for (i = k = 0; i < nreqs; i = j) {
+		/* Step through the node's keys to find this one. */
+		for (rc = 1; k < leaf->nkeys; k++) {
+			rc = kvldskey_cmp2(reqs[i]->key,
+			    leaf->u.pairs[k].k, leaf->mlen_t);
+			if (rc <= 0)
+				break;
+		}
+		pos = (rc == 0) ? &leaf->u.pairs[k] : NULL;
+		val = (pos != NULL) ? pos->v : NULL;
+
+		/* Apply requests to the value associated with this key. */
+		for (j = i; j < nreqs; j++) {
+			req = reqs[j];
+			if ((j > i) && kvldskey_cmp(req->key, reqs[i]->key))
+				break;
+
+			/* Figure out what we need to do (if anything). */
+			switch (op = getop(req, val)) {
+			case OP_ADD:
+			case OP_MODIFY:
+				val = req->value;
+				break;
+			case OP_DELETE:
+				val = NULL;
+				break;
+			}
+
+			/* Record if we did something. */
+			doneop(B, reqs[j], op);
+		}
+
+		/* Update or delete an existing pair, or record a new one. */
+		if (pos != NULL) {
+			pos->v = val;
+		} else if (val != NULL) {
+			kvs[nkvs].k = reqs[i]->key;
+			kvs[nkvs].v = val;
+			nkvs += 1;
+		}
+	}
+
+	/* Merge the new pairs into the leaf and drop deleted pairs. */
+	if (btree_mutate_merge(leaf, kvs, nkvs))
+		goto err0;
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Perform the requested operations on a sorted batch. */
+static int
+batch_run_sorted(struct batch * B)
+{
+	struct node * leaf;
+	size_t i, j;
+
+	/* Requests for each leaf are adjacent in the sorted list. */
+	for (i = 0; i < B->nreqs; i = j) {
+		leaf = B->sorted[i]->leaf;
+		for (j = i + 1; j < B->nreqs; j++)
+			if (B->sorted[j]->leaf != leaf)
+				break;
+
+		/* If this node isn't dirty, we're not doing anything. */
+		if (leaf->state != NODE_STATE_DIRTY)
+			continue;
+
+		/* Apply the requests to this leaf. */
+		if (batch_merge_leaf(B, leaf, &B->sorted[i], j - i))
 			goto err0;
-	free(B->dirties);
+	}
 
 	/* Success! */
 	return (0);
@@ -448,7 +764,7 @@ callback_gotleaves(void * cookie)
 		goto dosync;
 
 	/* Perform the requested operations. */
-	if (batch_run(B))
+	if ((B->sorted != NULL) ? batch_run_sorted(B) : batch_run(B))
 		goto err0;
 
 	/* Next we need to rebalance the tree. */
@@ -489,6 +805,7 @@ static int
 callback_synced(void * cookie)
 {
 	struct batch * B = cookie;
+	struct arena * A = B->A;
 	struct req_cookie * req;
 	struct proto_kvlds_request * R;
 	size_t i;
@@ -498,11 +815,19 @@ callback_synced(void * cookie)
 		req = B->reqs[i];
 		R = req->R;
 
+		/* Only one response per request. */
+		if (!req->respond)
+			continue;
+
 		switch (R->type) {
 		case PROTO_KVLDS_SET:
 			if (proto_kvlds_response_set(B->WQ, R->ID))
 				goto err0;
 			break;
+		case PROTO_KVLDS_MSET:
+			if (proto_kvlds_response_mset(B->WQ, R->ID))
+				goto err0;
+			break;
 		case PROTO_KVLDS_CAS:
 			if (proto_kvlds_response_cas(B->WQ, R->ID,
 			    req->opdone))
@@ -534,15 +859,14 @@ callback_synced(void * cookie)
 	if (!events_immediate_register(B->callback_done, B->cookie, 0))
 		goto err0;
 
-	/* Clean up requests and request cookies. */
+	/* Clean up requests. */
 	for (i = 0; i < B->nreqs; i++) {
-		proto_kvlds_request_free(B->reqs[i]->R);
-		mpool_reqcookie_free(B->reqs[i]);
+		if (B->reqs[i]->respond)
+			proto_kvlds_request_free(B->reqs[i]->R);
 	}
 
-	/* Free batch cookie. */
-	free(B->reqs);
-	free(B);
+	/* Free the batch cookie and everything else allocated for it. */
+	arena_reset(A);
 
 	/* Success! */
 	return (0);
@@ -34,7 +34,48 @@ struct nmr_cookie {
 	size_t leavesleft;
 };
 
-static int callback_get_gotleaf(void *, struct node *);
+/* One key in a group: a GET request, or one of the keys of an MGET. */
+struct get_req {
+	const struct kvldskey * key;	/* The key. */
+	struct proto_kvlds_request * R;	/* The GET request, or NULL. */
+	void * cookie_done;		/* Cookie for the GET callback. */
+	size_t idx;			/* Position of the key in the MGET. */
+};
+
+/* A group of GET requests, or an MGET request, sorted by key. */
+struct get_group {
+	/* State provided by caller. */
+	int (*callback_done)(void *);
+	struct btree * T;
+	struct netbuf_write * WQ;
+	struct get_req * reqs;
+	size_t nreqs;
+
+	/* MGET state. */
+	struct proto_kvlds_request * M;	/* The MGET request, or NULL. */
+	void * cookie_done;		/* Cookie for the MGET callback. */
+	struct kvldskey ** values;	/* Values found so far. */
+
+	/* Internal state. */
+	size_t nextfind;		/* Next request without a leaf. */
+	size_t nleft;			/* Requests not yet answered. */
+	int findip;			/* Finding a parent. */
+	int finding;			/* Inside findgets. */
+};
+
+/* A leaf and the requests in a group which are waiting for it. */
+struct get_leaf {
+	struct get_group * G;
+	size_t first;			/* First waiting request. */
+	size_t n;			/* Number of waiting requests. */
+};
+
+static int launchmget(struct btree *, struct proto_kvlds_request *,
+    struct netbuf_write *, int (*)(void *), void *);
+static int launchgroup(struct get_group *);
+static int findgets(struct get_group *);
+static int callback_gets_gotparent(void *, struct node *, struct kvldskey *);
+static int callback_gets_gotleaf(void *, struct node *);
 static int callback_range_gotnode(void *, struct node *, struct kvldskey *);
 static int callback_range_gotleaf(void *, struct node *);
 static int rangedone(struct nmr_cookie *);
@@ -54,8 +95,16 @@ dispatch_nmr_launch(struct btree * T, struct proto_kvlds_request * R,
 
 	/* Sanity-check: The NMR type must be reasonable. */
 	assert((R->type == PROTO_KVLDS_GET) ||
+	    (R->type == PROTO_KVLDS_MGET) ||
 	    (R->type == PROTO_KVLDS_RANGE));
 
+	/* A GET is a group of one; an MGET is a group of its keys. */
+	if (R->type == PROTO_KVLDS_GET)
+		return (dispatch_nmr_launch_gets(T, &R, 1, WQ, callback_done,
+		    &cookie_done));
+	if (R->type == PROTO_KVLDS_MGET)
+		return (launchmget(T, R, WQ, callback_done, cookie_done));
+
 	/* Bake a cookie. */
 	if ((C = malloc(sizeof(struct nmr_cookie))) == NULL)
 		goto err0;
@@ -65,24 +114,13 @@ dispatch_nmr_launch(struct btree * T, struct proto_kvlds_request * R,
 	C->R = R;
 	C->WQ = WQ;
 
-	/* Different NMRs need different handling. */
-	switch (R->type) {
-	case PROTO_KVLDS_GET:
-		/* Find the node containing (or not) this key. */
-		if (btree_find_leaf(C->T, C->T->root_shadow, C->R->key,
-		    callback_get_gotleaf, C))
-			goto err1;
-		break;
-	case PROTO_KVLDS_RANGE:
-		/*
-		 * Find a node of height 1 or less which is responsible for a
-		 * range containing the start key.
-		 */
-		if (btree_find_range(C->T, C->T->root_shadow,
-		    C->R->range_start, 1, callback_range_gotnode, C))
-			goto err1;
-		break;
-	}
+	/*
+	 * Find a node of height 1 or less which is responsible for a range
+	 * containing the start key.
+	 */
+	if (btree_find_range(C->T, C->T->root_shadow, C->R->range_start, 1,
+	    callback_range_gotnode, C))
+		goto err1;
 
 	/* Success! */
 	return (0);
@@ -94,50 +132,383 @@ err0:
 	return (-1);
 }
 
-/* We've got the leaf node.  Now find the key and send a response. */
+/* Compare GET requests by key. */
 static int
-callback_get_gotleaf(void * cookie, struct node * N)
+compar_get(const void * _x, const void * _y)
 {
-	struct nmr_cookie * C = cookie;
+	const struct get_req * x = _x;
+	const struct get_req * y = _y;
+
+	return (kvldskey_cmp(x->key, y->key));
+}
+
+/*
+ * Create a group for ${nreqs} keys on the B+Tree ${T}, with responses going
+ * to the write queue ${WQ} and completion callbacks to ${callback_done}.
+ */
+static struct get_group *
+newgroup(struct btree * T, struct netbuf_write * WQ,
+    int (* callback_done)(void *), size_t nreqs)
+{
+	struct get_group * G;
+
+	/* Bake a cookie. */
+	if ((G = malloc(sizeof(struct get_group))) == NULL)
+		goto err0;
+	G->callback_done = callback_done;
+	G->T = T;
+	G->WQ = WQ;
+	G->nreqs = nreqs;
+	G->M = NULL;
+	G->values = NULL;
+
+	/* Allocate space for the keys. */
+	if (IMALLOC(G->reqs, nreqs, struct get_req))
+		goto err1;
+
+	/* Success! */
+	return (G);
+
+err1:
+	free(G);
+err0:
+	/* Failure! */
+	return (NULL);
+}
+
+/**
+ * dispatch_nmr_launch_gets(T, reqs, nreqs, WQ, callback_done, cookies):
+ * Perform the ${nreqs} GET requests ${reqs[0]} ... ${reqs[nreqs - 1]} on the
+ * B+Tree ${T}, finding each leaf only once however many of the keys it
+ * holds; write response packets to the write queue ${WQ}; and free the
+ * requests.  Invoke the callback ${callback_done}(${cookies[i]}) after
+ * request ${reqs[i]} is processed.
+ */
+int
+dispatch_nmr_launch_gets(struct btree * T, struct proto_kvlds_request ** reqs,
+    size_t nreqs, struct netbuf_write * WQ,
+    int (* callback_done)(void *), void ** cookies)
+{
+	struct get_group * G;
+	size_t i;
+
+	/* Sanity-check: We must have some requests. */
+	assert(nreqs > 0);
+
+	/* Create a group. */
+	if ((G = newgroup(T, WQ, callback_done, nreqs)) == NULL)
+		goto err0;
+
+	/* Record the requests. */
+	for (i = 0; i < nreqs; i++) {
+		assert(reqs[i]->type == PROTO_KVLDS_GET);
+		G->reqs[i].key = reqs[i]->key;
+		G->reqs[i].R = reqs[i];
+		G->reqs[i].cookie_done = cookies[i];
+	}
+
+	/* Launch the group. */
+	return (launchgroup(G));
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Perform the MGET request ${R}; see dispatch_nmr_launch. */
+static int
+launchmget(struct btree * T, struct proto_kvlds_request * R,
+    struct netbuf_write * WQ, int (* callback_done)(void *),
+    void * cookie_done)
+{
+	struct get_group * G;
+	size_t i;
+
+	/* Create a group. */
+	if ((G = newgroup(T, WQ, callback_done, R->nkeys)) == NULL)
+		goto err0;
+	G->M = R;
+	G->cookie_done = cookie_done;
+
+	/* Allocate space for the values we find. */
+	if (IMALLOC(G->values, R->nkeys, struct kvldskey *))
+		goto err1;
+	for (i = 0; i < R->nkeys; i++)
+		G->values[i] = NULL;
+
+	/* Record the keys. */
+	for (i = 0; i < R->nkeys; i++) {
+		G->reqs[i].key = R->keys[i];
+		G->reqs[i].R = NULL;
+		G->reqs[i].idx = i;
+	}
+
+	/* Launch the group. */
+	return (launchgroup(G));
+
+err1:
+	free(G->reqs);
+	free(G);
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Sort the keys in the group ${G} and start finding leaves. */
+static int
+launchgroup(struct get_group * G)
+{
+
+	/* Sort the keys. */
+	if (G->nreqs > 1)
+		qsort(G->reqs, G->nreqs, sizeof(struct get_req), compar_get);
+
+	/* Nothing found or answered yet. */
+	G->nextfind = 0;
+	G->nleft = G->nreqs;
+	G->findip = 0;
+	G->finding = 0;
+
+	/* Start finding leaves. */
+	return (findgets(G));
+}
+
+/*
+ * Every key in the group ${G} has been handled.  Send the MGET response if
+ * this group is for an MGET, and free the group.
+ */
+static int
+groupdone(struct get_group * G)
+{
+	size_t i;
+
+	/* Handle an MGET. */
+	if (G->M != NULL) {
+		/* Send the response. */
+		if (proto_kvlds_response_mget(G->WQ, G->M->ID, G->M->nkeys,
+		    G->values))
+			goto err0;
+
+		/* Schedule the request-done callback. */
+		if (!events_immediate_register(G->callback_done,
+		    G->cookie_done, 0))
+			goto err0;
+
+		/* Free the values and the request. */
+		for (i = 0; i < G->M->nkeys; i++)
+			kvldskey_free(G->values[i]);
+		free(G->values);
+		proto_kvlds_request_free(G->M);
+	}
+
+	/* Free the group. */
+	free(G->reqs);
+	free(G);
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/*
+ * Find the parents of the leaves holding the requested keys, starting from
+ * the first request which isn't waiting for a leaf yet, until every request
+ * is waiting for a leaf or we need to wait for a node to be paged in.  Free
+ * the group if every request has been answered.
+ */
+static int
+findgets(struct get_group * G)
+{
+
+	/* We're walking the tree. */
+	G->finding = 1;
+
+	/* Find the parent responsible for the next key. */
+	while ((G->nextfind < G->nreqs) && (G->findip == 0)) {
+		G->findip = 1;
+		if (btree_find_range(G->T, G->T->root_shadow,
+		    G->reqs[G->nextfind].key, 1, callback_gets_gotparent, G))
+			goto err0;
+	}
+
+	/* We're not walking the tree any more. */
+	G->finding = 0;
+
+	/* Are we done? */
+	if (G->nleft == 0) {
+		if (groupdone(G))
+			goto err0;
+	}
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Answer the ${n} requests starting at ${first} from the leaf ${N}. */
+static int
+answergets(struct get_group * G, struct node * N, size_t first, size_t n)
+{
+	struct proto_kvlds_request * R;
 	struct kvpair_const * kv;
+	size_t i;
 
-	/* Find the key in this node. */
-	kv = btree_find_kvpair(N, C->R->key);
+	for (i = first; i < first + n; i++) {
+		/* Find the key in this node. */
+		kv = btree_find_kvpair(N, G->reqs[i].key);
 
-	/* Send the response. */
-	if (kv != NULL) {
-		/* Send the requested value back to the client. */
-		if (proto_kvlds_response_get(C->WQ, C->R->ID, 0,
-		    kv->v))
-			goto err1;
-	} else {
-		/* Send a non-present response back to the client. */
-		if (proto_kvlds_response_get(C->WQ, C->R->ID, 1,
-		    NULL))
+		/* For an MGET, just record the value. */
+		if (G->M != NULL) {
+			if ((kv != NULL) && ((G->values[G->reqs[i].idx] =
+			    kvldskey_dup(kv->v)) == NULL))
+				goto err0;
+			G->nleft -= 1;
+			continue;
+		}
+		R = G->reqs[i].R;
+
+		/* Send the response. */
+		if (kv != NULL) {
+			/* Send the requested value back to the client. */
+			if (proto_kvlds_response_get(G->WQ, R->ID, 0, kv->v))
+				goto err0;
+		} else {
+			/* Send a non-present response back to the client. */
+			if (proto_kvlds_response_get(G->WQ, R->ID, 1, NULL))
+				goto err0;
+		}
+
+		/* Schedule the request-done callback. */
+		if (!events_immediate_register(G->callback_done,
+		    G->reqs[i].cookie_done, 0))
+			goto err0;
+
+		/* Free the request. */
+		proto_kvlds_request_free(R);
+		G->nleft -= 1;
+	}
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/*
+ * We've found a node of height 1 or less responsible for the next request,
+ * and the end of its range; it is also responsible for any requests after
+ * it with keys before the end of the range.  Send each group of requests
+ * whose keys belong to the same leaf to wait for that leaf.
+ */
+static int
+callback_gets_gotparent(void * cookie, struct node * N, struct kvldskey * e)
+{
+	struct get_group * G = cookie;
+	struct get_leaf * L;
+	const struct kvldskey * bound;
+	size_t i;
+
+	/* Handle requests while their keys are within this node's range. */
+	while ((G->nextfind < G->nreqs) && ((e->len == 0) ||
+	    (kvldskey_cmp(G->reqs[G->nextfind].key, e) < 0))) {
+		/* If the tree is a single leaf, answer from it. */
+		if (N->height == 0) {
+			if (answergets(G, N, G->nextfind,
+			    G->nreqs - G->nextfind))
+				goto err1;
+			G->nextfind = G->nreqs;
+			break;
+		}
+
+		/* Which leaf is responsible for this key? */
+		i = btree_find_child(N, G->reqs[G->nextfind].key);
+		bound = (i < N->nkeys) ? N->u.keys[i] : e;
+
+		/* Bake a cookie. */
+		if ((L = malloc(sizeof(struct get_leaf))) == NULL)
 			goto err1;
+		L->G = G;
+		L->first = G->nextfind;
+
+		/* Requests are sorted, so the leaf's keys are contiguous. */
+		do {
+			G->nextfind += 1;
+		} while ((G->nextfind < G->nreqs) && ((bound->len == 0) ||
+		    (kvldskey_cmp(G->reqs[G->nextfind].key, bound) < 0)));
+		L->n = G->nextfind - L->first;
+
+		/* Wait for the leaf. */
+		if (btree_node_descend(G->T, N->v.children[i],
+		    callback_gets_gotleaf, L))
+			goto err2;
 	}
 
-	/* Schedule the request-done callback. */
-	if (!events_immediate_register(C->callback_done, C->cookie_done, 0))
-		goto err1;
+	/* Release the lock picked up by btree_find_range. */
+	btree_node_unlock(G->T, N);
 
-	/* Unlock the node. */
-	btree_node_unlock(C->T, N);
+	/* We're done with the range endpoint. */
+	kvldskey_free(e);
 
-	/* Free the request. */
-	proto_kvlds_request_free(C->R);
+	/* We're not looking for a parent any more. */
+	G->findip = 0;
 
-	/* Free the cookie. */
-	free(C);
+	/* We were called after a node was paged in; keep walking. */
+	if (!G->finding) {
+		if (findgets(G))
+			goto err0;
+	}
 
 	/* Success! */
 	return (0);
 
+err2:
+	free(L);
 err1:
-	btree_node_unlock(C->T, N);
-	proto_kvlds_request_free(C->R);
-	free(C);
+	btree_node_unlock(G->T, N);
+	kvldskey_free(e);
+err0:
+	/* Failure! */
+	return (-1);
+}
 
+/* We've got a leaf node.  Answer the requests waiting for it. */
+static int
+callback_gets_gotleaf(void * cookie, struct node * N)
+{
+	struct get_leaf * L = cookie;
+	struct get_group * G = L->G;
+
+	/* Answer the requests. */
+	if (answergets(G, N, L->first, L->n))
+		goto err1;
+
+	/* Release the lock picked up by btree_node_descend. */
+	btree_node_unlock(G->T, N);
+
+	/* Free the cookie. */
+	free(L);
+
+	/* Finish the group if we've answered everything. */
+	if ((G->nleft == 0) && !G->finding) {
+		if (groupdone(G))
+			goto err0;
+	}
+
+	/* Success! */
+	return (0);
+
+err1:
+	btree_node_unlock(G->T, N);
+	free(L);
+err0:
 	/* Failure! */
 	return (-1);
 }
@@ -4,17 +4,27 @@
 #include <string.h>
 #include <unistd.h>
 
+#include "arena.h"
 #include "asprintf.h"
 #include "daemonize.h"
 #include "events.h"
 #include "getopt.h"
 #include "humansize.h"
+#include "opstats.h"
 #include "sock.h"
 #include "warnp.h"
 #include "wire.h"
 
 #include "btree.h"
+#include "btree_hotset.h"
 #include "dispatch.h"
+#include "nmrlimit.h"
+
+/* Size of the chunks in which batch state is allocated. */
+#define ARENA_CHUNKLEN	(256 * 1024)
+
+/* Default maximum number of requests to have pending at once. */
+#define MAXREQS	4096
 
 static void
 usage(void)
@@ -25,7 +35,10 @@ usage(void)
 	    "[-C <npages> | -c <pagemem>] [-1] "
 	    "[-k <max key length>] [-v <max value length>] [-p <pidfile>] "
 	    "[-S <cost of storage per GB-month>] "
-	    "[-w <commit delay time>] [-g <min forced commit size>]\n");
+	    "[-r <max cleaning fraction>] [-G <garbage ceiling>] [-B] "
+	    "[-w <commit delay time>] [-g <min forced commit size>] "
+	    "[-q <max pending requests>] [-n <max read pages>] "
+	    "[-H <hot set file>]\n");
 	fprintf(stderr, "       kivaloo-kvlds --version\n");
 	exit(1);
 }
@@ -46,22 +59,32 @@ main(int argc, char * argv[])
 	/* State variables. */
 	struct wire_requestqueue * Q_lbs;
 	struct btree * T;
+	struct hotset * H;
 	struct dispatch_state * dstate;
+	struct opstats * S;
+	struct arena * A;
+	struct nmrlimit * L;
 	int s;
 	int s_lbs;
 
 	/* Command-line parameters. */
 	uint64_t opt_C = (uint64_t)(-1);
 	uint64_t opt_c = (uint64_t)(-1);
+	double opt_G = 0.0;
 	uint64_t opt_g = (uint64_t)(-1);
+	char * opt_H = NULL;
 	uint64_t opt_k = (uint64_t)(-1);
 	char * opt_l = NULL;
+	uint64_t opt_n = (uint64_t)(-1);
 	char * opt_p = NULL;
+	uint64_t opt_q = (uint64_t)(-1);
+	double opt_r = 0.0;
 	double opt_S = 1.0;
 	char * opt_s = NULL;
 	uint64_t opt_v = (uint64_t)(-1);
 	double opt_w = 0.0;
 	int opt_1 = 0;
+	int opt_B = 0;
 
 	/* Working variables. */
 	struct sock_addr ** sas_s;
@@ -85,12 +108,23 @@ main(int argc, char * argv[])
 			if (humansize_parse(optarg, &opt_c))
 				OPT_EINVAL(ch, optarg);
 			break;
+		GETOPT_OPTARG("-G"):
+			if (opt_G != 0.0)
+				usage();
+			opt_G = strtod(optarg, NULL);
+			break;
 		GETOPT_OPTARG("-g"):
 			if (opt_g != (uint64_t)(-1))
 				usage();
 			if (humansize_parse(optarg, &opt_g))
 				OPT_EINVAL(ch, optarg);
 			break;
+		GETOPT_OPTARG("-H"):
+			if (opt_H != NULL)
+				usage();
+			if ((opt_H = strdup(optarg)) == NULL)
+				OPT_EPARSE(ch, optarg);
+			break;
 		GETOPT_OPTARG("-k"):
 			if (opt_k != (uint64_t)(-1))
 				usage();
@@ -103,12 +137,29 @@ main(int argc, char * argv[])
 			if ((opt_l = strdup(optarg)) == NULL)
 				OPT_EPARSE(ch, optarg);
 			break;
+		GETOPT_OPTARG("-n"):
+			if (opt_n != (uint64_t)(-1))
+				usage();
+			if (humansize_parse(optarg, &opt_n))
+				OPT_EINVAL(ch, optarg);
+			break;
 		GETOPT_OPTARG("-p"):
 			if (opt_p != NULL)
 				usage();
 			if ((opt_p = strdup(optarg)) == NULL)
 				OPT_EPARSE(ch, optarg);
 			break;
+		GETOPT_OPTARG("-q"):
+			if (opt_q != (uint64_t)(-1))
+				usage();
+			if (humansize_parse(optarg, &opt_q))
+				OPT_EINVAL(ch, optarg);
+			break;
+		GETOPT_OPTARG("-r"):
+			if (opt_r != 0.0)
+				usage();
+			opt_r = strtod(optarg, NULL);
+			break;
 		GETOPT_OPTARG("-S"):
 			if (opt_S != 1.0)
 				usage();
@@ -139,6 +190,11 @@ main(int argc, char * argv[])
 				usage();
 			opt_1 = 1;
 			break;
+		GETOPT_OPT("-B"):
+			if (opt_B != 0)
+				usage();
+			opt_B = 1;
+			break;
 		GETOPT_MISSING_ARG:
 			warn0("Missing argument to %s\n", ch);
 			usage();
@@ -174,6 +230,14 @@ main(int argc, char * argv[])
 		warn0("Values longer than 255 bytes are not supported");
 		exit(1);
 	}
+	if ((opt_G < 0.0) || (opt_G >= 1.0)) {
+		warn0("Garbage ceiling must be in [0.0, 1.0): -G %f", opt_G);
+		exit(1);
+	}
+	if ((opt_r < 0.0) || (opt_r > 1.0)) {
+		warn0("Cleaning fraction must be in [0.0, 1.0]: -r %f", opt_r);
+		exit(1);
+	}
 	if ((opt_w < 0.0) || (opt_w > 1.0)) {
 		warn0("Commit delay time in [0.0, 1.0]: -w %f", opt_w);
 		exit(1);
@@ -184,6 +248,20 @@ main(int argc, char * argv[])
 		    "-g %" PRIu64, opt_g);
 		exit(1);
 	}
+	if (opt_q == (uint64_t)(-1))
+		opt_q = MAXREQS;
+	if ((opt_q < 1) || (opt_q > 1024 * 1024)) {
+		warn0("Max pending requests must be in [1, 2^20]: "
+		    "-q %" PRIu64, opt_q);
+		exit(1);
+	}
+	if (opt_n == (uint64_t)(-1))
+		opt_n = 0;
+	else if ((opt_n < 1) || (opt_n > 1024 * 1024 * 1024)) {
+		warn0("Max read pages must be in [1, 2^30]: "
+		    "-n %" PRIu64, opt_n);
+		exit(1);
+	}
 
 	/* Resolve listening address. */
 	if ((sas_s = sock_resolve(opt_s)) == NULL) {
@@ -224,11 +302,40 @@ main(int argc, char * argv[])
 
 	/* Initialize the B+Tree. */
 	if ((T =
-	    btree_init(Q_lbs, opt_C, opt_c, &opt_k, &opt_v, opt_S)) == NULL) {
+	    btree_init(Q_lbs, opt_C, opt_c, &opt_k, &opt_v, opt_S,
+	    opt_r, opt_G, opt_B)) == NULL) {
 		warnp("Cannot initialize B+Tree");
 		exit(1);
 	}
 
+	/* Create a read concurrency controller (kept across connections). */
+	if ((L = nmrlimit_init(T, (size_t)opt_n)) == NULL) {
+		warnp("Cannot initialize read concurrency controller");
+		exit(1);
+	}
+
+	/* If requested, prefetch and record the tree's hot set. */
+	if (opt_H != NULL) {
+		if ((H = btree_hotset_start(T, L, opt_H)) == NULL) {
+			warnp("Cannot start hot set prefetching");
+			exit(1);
+		}
+	} else {
+		H = NULL;
+	}
+
+	/* Create request latency statistics (kept across connections). */
+	if ((S = opstats_init()) == NULL) {
+		warnp("Cannot initialize request statistics");
+		exit(1);
+	}
+
+	/* Create an arena for modifying-request batches. */
+	if ((A = arena_init(ARENA_CHUNKLEN)) == NULL) {
+		warnp("Cannot initialize batch arena");
+		exit(1);
+	}
+
 	/* Daemonize and write pid. */
 	if (opt_p == NULL) {
 		if (asprintf(&opt_p, "%s.pid", opt_s) == -1) {
@@ -244,8 +351,8 @@ main(int argc, char * argv[])
 	/* Handle connections, one at a time. */
 	do {
 		/* Accept a connection. */
-		if ((dstate = dispatch_accept(s, T,
-		    opt_k, opt_v, opt_w, opt_g)) == NULL)
+		if ((dstate = dispatch_accept(s, T, opt_k, opt_v, opt_w,
+		    opt_g, opt_q, L, S, A)) == NULL)
 			exit(1);
 
 		/* Loop until the connection is dead. */
@@ -261,6 +368,19 @@ main(int argc, char * argv[])
 			exit(1);
 	} while (opt_1 == 0);
 
+	/* Free the batch arena. */
+	arena_free(A);
+
+	/* Free the request statistics. */
+	opstats_free(S);
+
+	/* Stop prefetching and record the hot set. */
+	if (H != NULL)
+		btree_hotset_stop(H);
+
+	/* Free the read concurrency controller. */
+	nmrlimit_free(L);
+
 	/* Free the B+Tree. */
 	btree_free(T);
 
@@ -280,6 +400,7 @@ main(int argc, char * argv[])
 	events_shutdown();
 
 	/* Free option strings. */
+	free(opt_H);
 	free(opt_l);
 	free(opt_p);
 	free(opt_s);
@@ -0,0 +1,250 @@
+#include <sys/time.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "monoclock.h"
+
+#include "btree.h"
+
+#include "nmrlimit.h"
+
+/* Seconds between adjustments of the limit. */
+#define INTERVAL	1.0
+
+/* Don't adjust the limit on the basis of fewer pages than this. */
+#define MINPAGES	256
+
+/*
+ * The limit stays between 1/MINFRAC and 1/MAXFRAC of the page pool; pages
+ * touched by in-progress requests are locked, so the pool would have nothing
+ * left to cache with if they could fill it.
+ */
+#define MINFRAC		64
+#define MAXFRAC		2
+
+/* Controller state. */
+struct nmrlimit {
+	struct btree * T;		/* The B+Tree we're reading from. */
+	int fixed;			/* Non-zero if not adapting. */
+	size_t limit;			/* Max # pages touched by NMRs. */
+	size_t min;			/* Lower bound on limit. */
+	size_t max;			/* Upper bound on limit. */
+
+	/* This interval. */
+	struct timeval t_start;		/* When the interval started. */
+	uint64_t nfetches;		/* T->nfetches at start. */
+	uint64_t fetchusec;		/* T->fetchusec at start. */
+	uint64_t npages;		/* Pages touched by NMRs. */
+	int blocked;			/* An NMR waited for the limit. */
+
+	/* Previous intervals. */
+	int grew;			/* The last adjustment was a raise. */
+	double missrate;		/* Page reads per page, or -1. */
+	double baselat;			/* Baseline read latency, or -1. */
+
+	/* Accounting. */
+	uint64_t ngrows;		/* Times the limit was raised. */
+	uint64_t nshrinks;		/* Times the limit was lowered. */
+};
+
+/* Start a new interval at time ${t}. */
+static void
+newinterval(struct nmrlimit * L, const struct timeval * t)
+{
+
+	L->t_start = *t;
+	L->nfetches = L->T->nfetches;
+	L->fetchusec = L->T->fetchusec;
+	L->npages = 0;
+	L->blocked = 0;
+}
+
+/* Adjust the limit based on what happened in the interval just ended. */
+static void
+adjust(struct nmrlimit * L)
+{
+	uint64_t nfetches = L->T->nfetches - L->nfetches;
+	double missrate;
+	double lat = 0.0;
+
+	/* How often did we need to read a page, and how long did it take? */
+	missrate = (double)nfetches / (double)L->npages;
+	if (nfetches > 0)
+		lat = (double)(L->T->fetchusec - L->fetchusec) /
+		    (double)nfetches;
+
+	/*
+	 * If raising the limit made requests miss in the page pool more
+	 * often, the pool is thrashing; back off.  Otherwise, if requests
+	 * were held back by the limit and page reads are no slower than
+	 * usual, the backend has room for more; allow a few more pages.
+	 */
+	if (L->grew && (L->missrate >= 0.0) &&
+	    (missrate > L->missrate * 1.25 + 0.01)) {
+		L->limit = (L->limit / 2 > L->min) ? L->limit / 2 : L->min;
+		L->grew = 0;
+		L->nshrinks += 1;
+	} else if (L->blocked && (L->limit < L->max) &&
+	    ((nfetches == 0) || (L->baselat < 0.0) ||
+	    (lat <= L->baselat * 1.25))) {
+		L->limit += L->limit / 8 + 1;
+		if (L->limit > L->max)
+			L->limit = L->max;
+		L->grew = 1;
+		L->ngrows += 1;
+	} else {
+		L->grew = 0;
+	}
+
+	/* Track the miss rate and the baseline read latency. */
+	L->missrate = missrate;
+	if (nfetches > 0) {
+		if ((L->baselat < 0.0) || (lat < L->baselat))
+			L->baselat = lat;
+		else
+			L->baselat += (lat - L->baselat) / 16;
+	}
+}
+
+/**
+ * nmrlimit_init(T, npages):
+ * Create a controller for the number of pages which non-modifying requests
+ * on the B+Tree ${T} may touch at once.  If ${npages} is non-zero, the limit
+ * is fixed at ${npages}; otherwise it starts at a quarter of the page pool
+ * and is adjusted based on the latency of page reads and the page pool miss
+ * rate.
+ */
+struct nmrlimit *
+nmrlimit_init(struct btree * T, size_t npages)
+{
+	struct nmrlimit * L;
+	struct timeval t;
+
+	/* Allocate the structure. */
+	if ((L = malloc(sizeof(struct nmrlimit))) == NULL)
+		goto err0;
+	L->T = T;
+
+	/* Set the limit and its bounds. */
+	if (npages != 0) {
+		L->fixed = 1;
+		L->limit = L->min = L->max = npages;
+	} else {
+		L->fixed = 0;
+		L->limit = T->poolsz / 4;
+		if ((L->min = T->poolsz / MINFRAC) == 0)
+			L->min = 1;
+		L->max = T->poolsz / MAXFRAC;
+	}
+
+	/* We don't know anything yet. */
+	L->grew = 0;
+	L->missrate = -1.0;
+	L->baselat = -1.0;
+	L->ngrows = L->nshrinks = 0;
+
+	/* Start the first interval. */
+	if (monoclock_get(&t))
+		goto err1;
+	newinterval(L, &t);
+
+	/* Success! */
+	return (L);
+
+err1:
+	free(L);
+err0:
+	/* Failure! */
+	return (NULL);
+}
+
+/**
+ * nmrlimit_get(L):
+ * Return the current limit from the controller ${L}.
+ */
+size_t
+nmrlimit_get(struct nmrlimit * L)
+{
+
+	return (L->limit);
+}
+
+/**
+ * nmrlimit_blocked(L):
+ * Notify the controller ${L} that a request was held back by the limit.
+ */
+void
+nmrlimit_blocked(struct nmrlimit * L)
+{
+
+	L->blocked = 1;
+}
+
+/**
+ * nmrlimit_done(L, npages):
+ * Notify the controller ${L} that a request which touched up to ${npages}
+ * pages has completed, and adjust the limit if it is time to do so.
+ */
+int
+nmrlimit_done(struct nmrlimit * L, size_t npages)
+{
+	struct timeval t;
+
+	/* Nothing to do if the limit is fixed. */
+	if (L->fixed)
+		goto done;
+
+	/* Count the pages. */
+	L->npages += npages;
+	if (L->npages < MINPAGES)
+		goto done;
+
+	/* Has the interval ended? */
+	if (monoclock_get(&t))
+		goto err0;
+	if ((double)(t.tv_sec - L->t_start.tv_sec) +
+	    (double)(t.tv_usec - L->t_start.tv_usec) * 0.000001 < INTERVAL)
+		goto done;
+
+	/* Adjust the limit and start a new interval. */
+	adjust(L);
+	newinterval(L, &t);
+
+done:
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/**
+ * nmrlimit_stats(L, st):
+ * Fill ${st} with accounting from the controller ${L}.
+ */
+void
+nmrlimit_stats(struct nmrlimit * L, struct nmrlimit_stats * st)
+{
+
+	st->limit = L->limit;
+	st->ngrows = L->ngrows;
+	st->nshrinks = L->nshrinks;
+}
+
+/**
+ * nmrlimit_free(L):
+ * Free the controller ${L}.
+ */
+void
+nmrlimit_free(struct nmrlimit * L)
+{
+
+	/* Behave consistently with free(NULL). */
+	if (L == NULL)
+		return;
+
+	/* Free the structure. */
+	free(L);
+}
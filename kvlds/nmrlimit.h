@@ -0,0 +1,59 @@
+#ifndef _NMRLIMIT_H_
+#define _NMRLIMIT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Opaque types. */
+struct btree;
+struct nmrlimit;
+
+/* Controller accounting. */
+struct nmrlimit_stats {
+	uint64_t limit;			/* Current limit, in pages. */
+	uint64_t ngrows;		/* Times the limit was raised. */
+	uint64_t nshrinks;		/* Times the limit was lowered. */
+};
+
+/**
+ * nmrlimit_init(T, npages):
+ * Create a controller for the number of pages which non-modifying requests
+ * on the B+Tree ${T} may touch at once.  If ${npages} is non-zero, the limit
+ * is fixed at ${npages}; otherwise it starts at a quarter of the page pool
+ * and is adjusted based on the latency of page reads and the page pool miss
+ * rate.
+ */
+struct nmrlimit * nmrlimit_init(struct btree *, size_t);
+
+/**
+ * nmrlimit_get(L):
+ * Return the current limit from the controller ${L}.
+ */
+size_t nmrlimit_get(struct nmrlimit *);
+
+/**
+ * nmrlimit_blocked(L):
+ * Notify the controller ${L} that a request was held back by the limit.
+ */
+void nmrlimit_blocked(struct nmrlimit *);
+
+/**
+ * nmrlimit_done(L, npages):
+ * Notify the controller ${L} that a request which touched up to ${npages}
+ * pages has completed, and adjust the limit if it is time to do so.
+ */
+int nmrlimit_done(struct nmrlimit *, size_t);
+
+/**
+ * nmrlimit_stats(L, st):
+ * Fill ${st} with accounting from the controller ${L}.
+ */
+void nmrlimit_stats(struct nmrlimit *, struct nmrlimit_stats *);
+
+/**
+ * nmrlimit_free(L):
+ * Free the controller ${L}.
+ */
+void nmrlimit_free(struct nmrlimit *);
+
+#endif /* !_NMRLIMIT_H_ */
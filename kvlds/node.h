@@ -65,6 +65,9 @@ struct node {
 	/* 1 if the node needs to be considered for merging; 0 otherwise. */
 	unsigned int needmerge : 1;
 
+	/* 1 if this DIRTY leaf was dirtied by the cleaner; 0 otherwise. */
+	unsigned int cold : 1;
+
 	/* Height of this node (leaf = 0); -1 if !present. */
 	int8_t height;
 
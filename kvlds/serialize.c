@@ -5,6 +5,7 @@
 #include <string.h>
 
 #include "btree.h"
+#include "crc32c.h"
 #include "kvldskey.h"
 #include "kvpair.h"
 #include "imalloc.h"
@@ -19,7 +20,7 @@
  * B+Tree page format:
  * offset length data
  * ====== ====== ====
- *      0     6   "KVLDS\0"
+ *      0     6   "KVLDS\1"
  *      6     2   BE number of keys (N)
  *      8     1   X = Height + 0x80 * rootedness:
  *                    0x00 - Non-root leaf node.
@@ -32,6 +33,8 @@
  * if root:
  *     10     8   BE number of nodes
  *     18   ???   DATA
+ * followed by
+ *    ???     4   CRC32C of everything above (as per CRC32C_Final)
  *
  * The DATA for a leaf node is:
  *      0   ???   Serialized key #0
@@ -56,8 +59,13 @@
  * A serialized (key|value) is a one-byte length followed by 0--255 bytes of
  * key or value data.
  *
- * Thus the size of a leaf node is 10 + 2*N + sum(len(key)) + sum(len(value)),
- * and the size of a non-leaf node is 30 + 21*N + sum(len(key)).
+ * Thus the size of a leaf node is 14 + 2*N + sum(len(key)) + sum(len(value)),
+ * and the size of a non-leaf node is 34 + 21*N + sum(len(key)).
+ *
+ * Pages are zero-padded to the block size.  Pages written by older versions
+ * of kvlds have the magic "KVLDS\0" and no CRC32C; these are still accepted
+ * (without checksum verification) and are replaced as the tree is modified
+ * and cleaned.
  *
  * IMPORTANT: If the serialized format changes, values in serialize.h might
  * need to be updated.
@@ -71,6 +79,7 @@
 int
 serialize(struct btree * T, struct node * N, size_t buflen)
 {
+	CRC32C_CTX ctx;
 	size_t pagelen;
 	uint8_t * p;
 	size_t i;
@@ -94,7 +103,7 @@ serialize(struct btree * T, struct node * N, size_t buflen)
 	p = N->pagebuf;
 
 	/* Copy magic. */
-	memcpy(p, "KVLDS\0", 6);
+	memcpy(p, "KVLDS\1", 6);
 	p += 6;
 
 	/* Write out the number of keys. */
@@ -160,6 +169,12 @@ serialize(struct btree * T, struct node * N, size_t buflen)
 		}
 	}
 
+	/* Append the CRC32C of the page. */
+	CRC32C_Init(&ctx);
+	CRC32C_Update(&ctx, N->pagebuf, (size_t)(p - N->pagebuf));
+	CRC32C_Final(p, &ctx);
+	p += 4;
+
 	/* Sanity-check: Make sure we computed the size correctly. */
 	assert(p == N->pagebuf + pagelen);
 
@@ -174,6 +189,46 @@ err0:
 	return (-1);
 }
 
+/*
+ * Check that the page ${buf}, the data of which ends at ${p} and is followed
+ * by ${buflen} more bytes, has a valid CRC32C there (if ${hascrc} is
+ * non-zero) and that the rest of the page is zeros.
+ */
+static int
+checktail(const uint8_t * buf, const uint8_t * p, size_t buflen, int hascrc)
+{
+	CRC32C_CTX ctx;
+	uint8_t cbuf[4];
+
+	/* Verify the CRC32C. */
+	if (hascrc) {
+		if (buflen < 4)
+			goto bad;
+		CRC32C_Init(&ctx);
+		CRC32C_Update(&ctx, buf, (size_t)(p - buf));
+		CRC32C_Final(cbuf, &ctx);
+		if (memcmp(cbuf, p, 4)) {
+			warn0("Page checksum mismatch");
+			goto bad;
+		}
+		p += 4; buflen -= 4;
+	}
+
+	/* Make sure that the rest of the page is zeros. */
+	while (buflen) {
+		if (*p != 0)
+			goto bad;
+		p++; buflen--;
+	}
+
+	/* The page is good. */
+	return (0);
+
+bad:
+	/* The page is invalid. */
+	return (-1);
+}
+
 /**
  * deserialize(N, buf, buflen):
  * Deserialize the node ${N} out of the ${buflen}-byte page buffer ${buf}.
@@ -184,6 +239,7 @@ deserialize(struct node * N, const uint8_t * buf, size_t buflen)
 {
 	uint8_t * p;
 	size_t i;
+	int hascrc;
 
 	/*
 	 * Clear errno; we will use it to distinguish between internal errors
@@ -204,10 +260,14 @@ deserialize(struct node * N, const uint8_t * buf, size_t buflen)
 	memcpy(N->pagebuf, buf, buflen);
 	p = N->pagebuf;
 
-	/* Check magic. */
+	/* Check magic; older pages don't have a CRC32C. */
 	if (buflen < 6)
 		goto err1;
-	if (memcmp(p, "KVLDS\0", 6))
+	if (memcmp(p, "KVLDS\1", 6) == 0)
+		hascrc = 1;
+	else if (memcmp(p, "KVLDS\0", 6) == 0)
+		hascrc = 0;
+	else
 		goto err1;
 	p += 6; buflen -= 6;
 
@@ -277,12 +337,9 @@ deserialize(struct node * N, const uint8_t * buf, size_t buflen)
 			N->mlen_n = 255;
 		}
 
-		/* Make sure that the rest of the page is zeros. */
-		while (buflen) {
-			if (*p != 0)
-				goto err2;
-			p++; buflen--;
-		}
+		/* Check the CRC32C and the zero padding. */
+		if (checktail(N->pagebuf, p, buflen, hascrc))
+			goto err2;
 	} else {
 		/* Allocate array of keys. */
 		if (IMALLOC(N->u.keys, N->nkeys, const struct kvldskey *))
@@ -321,12 +378,9 @@ deserialize(struct node * N, const uint8_t * buf, size_t buflen)
 			buflen -= SERIALIZE_PERCHILD;
 		}
 
-		/* Make sure that the rest of the page is zeros. */
-		while (buflen) {
-			if (*p != 0)
-				goto err4;
-			p++; buflen--;
-		}
+		/* Check the CRC32C and the zero padding. */
+		if (checktail(N->pagebuf, p, buflen, hascrc))
+			goto err4;
 	}
 
 	/* Success! */
@@ -377,8 +431,8 @@ int
 deserialize_root(struct btree * T, const uint8_t * buf)
 {
 
-	/* The size of the tree is stored at offset SERIALIZE_OVERHEAD. */
-	T->nnodes = be64dec(&buf[SERIALIZE_OVERHEAD]);
+	/* The size of the tree is stored after the 10-byte page header. */
+	T->nnodes = be64dec(&buf[10]);
 
 	/* Success! */
 	return (0);
@@ -410,6 +464,9 @@ serialize_size(struct node * N)
 	/* Matching prefix length. */
 	size += 1;
 
+	/* CRC32C trailer. */
+	size += 4;
+
 	/* Sanity check vs. values in serialize.h. */
 	assert(size == SERIALIZE_OVERHEAD);
 
@@ -21,9 +21,10 @@ struct node;
  *         sum(KSS(key[i]), i = 0 .. nkeys)
  *
  * The size of a root node is SERIALIZE_ROOT bytes more than the size of an
- * identical non-root node.
+ * identical non-root node.  SERIALIZE_OVERHEAD includes the 4-byte CRC32C
+ * trailer.
  */
-#define SERIALIZE_OVERHEAD	10
+#define SERIALIZE_OVERHEAD	14
 #define SERIALIZE_ROOT		8
 #define SERIALIZE_PERCHILD	20
 
@@ -1,6 +1,7 @@
 #include <assert.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "events.h"
 #include "objmap.h"
@@ -106,6 +107,10 @@ static int
 poke(struct deleteto * D)
 {
 	uint8_t DeletedTo[8];
+	char keybufs[PROTO_DDBKV_MMAX][17];
+	const char * keys[PROTO_DDBKV_MMAX];
+	uint64_t end;
+	size_t i;
 
 	/* If we're already busy, don't do anything. */
 	if (D->npending)
@@ -132,21 +137,30 @@ poke(struct deleteto * D)
 	}
 
 	/* Can we issue more deletes? */
-	while (D->M < D->N) {
-		/* Issue a delete for M. */
-		if (proto_dynamodb_kv_request_delete(D->Q, objmap(D->M),
+	if (D->M < D->N) {
+		/* Delete up to N, but not past the end of this "century". */
+		end = (D->M / 256 + 1) * 256;
+		if (end > D->N)
+			end = D->N;
+
+		/* Construct the keys; objmap returns a static buffer. */
+		for (i = 0; D->M + i < end; i++) {
+			memcpy(keybufs[i], objmap(D->M + i), 17);
+			keys[i] = keybufs[i];
+		}
+
+		/* Issue a single batched delete for [M, end). */
+		if (proto_dynamodb_kv_request_mdelete(D->Q, i, keys,
 		    callback_done, D))
 			goto err0;
 		D->npending++;
 
-		/* We've issued deletes for everything under one more. */
-		D->M++;
+		/* We've issued deletes for everything under end. */
+		D->M = end;
 
 		/* If we've finished a "century", stop here for a moment. */
-		if ((D->M % 256) == 0) {
+		if ((D->M % 256) == 0)
 			D->updateDeletedTo = 1;
-			break;
-		}
 	}
 
 	/* Success! */
@@ -3,8 +3,10 @@
 #include <stdlib.h>
 #include <unistd.h>
 
+#include "blkring.h"
 #include "netbuf.h"
 #include "network.h"
+#include "opstats.h"
 #include "proto_lbs.h"
 #include "warnp.h"
 #include "wire.h"
@@ -59,6 +61,50 @@ dropconnection(void * cookie)
 	return (0);
 }
 
+/* Send a STATS response reporting how often GETs hit the append ring. */
+static int
+sendstats(struct dispatch_state * D, uint64_t ID)
+{
+	struct opstats * stats;
+	uint64_t hits, misses;
+	uint8_t * buf;
+	size_t buflen;
+
+	/* We have no latency histograms, only counters. */
+	if ((stats = opstats_init()) == NULL)
+		goto err0;
+
+	/* Record the append ring hit and miss counts. */
+	if (D->S->ring != NULL) {
+		blkring_stats(D->S->ring, &hits, &misses);
+		if (opstats_counter(stats, PROTO_LBS_CTR_RING_HITS, hits))
+			goto err1;
+		if (opstats_counter(stats, PROTO_LBS_CTR_RING_MISSES, misses))
+			goto err1;
+	}
+
+	/* Serialize the statistics and send them back. */
+	if (opstats_serialize(stats, &buf, &buflen))
+		goto err1;
+	if (proto_lbs_response_stats(D->writeq, ID, buf, buflen))
+		goto err2;
+
+	/* Free the serialized and unserialized statistics. */
+	free(buf);
+	opstats_free(stats);
+
+	/* Success! */
+	return (0);
+
+err2:
+	free(buf);
+err1:
+	opstats_free(stats);
+err0:
+	/* Failure! */
+	return (-1);
+}
+
 /* Read and dispatch incoming request(s). */
 static int
 gotrequest(void * cookie, int status)
@@ -105,6 +151,7 @@ gotrequest(void * cookie, int status)
 				goto err1;
 			break;
 		case PROTO_LBS_APPEND:
+		case PROTO_LBS_APPEND2:
 			if (R->r.append.blklen != D->S->blklen)
 				goto drop2;
 			if ((R->r.append.blkno != D->S->lastblk + 1) ||
@@ -126,6 +173,20 @@ gotrequest(void * cookie, int status)
 				goto err1;
 			free(R);
 			break;
+		case PROTO_LBS_FREE_RANGE:
+			/*
+			 * FREERANGE is advisory; we rely on FREE to delete
+			 * data, since our block space is sparse.
+			 */
+			if (proto_lbs_response_free_range(D->writeq, R->ID))
+				goto err1;
+			free(R);
+			break;
+		case PROTO_LBS_STATS:
+			if (sendstats(D, R->ID))
+				goto err1;
+			free(R);
+			break;
 		default:
 			/* proto_lbs_request_read broke. */
 			assert(0);
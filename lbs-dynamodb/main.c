@@ -1,3 +1,4 @@
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -21,7 +22,8 @@ usage(void)
 {
 
 	fprintf(stderr, "usage: kivaloo-lbs-dynamodb-kv -s <lbs socket>"
-	    " -t <dynamodb-kv socket> -b <item size> [-1] [-p <pidfile>]\n");
+	    " -t <dynamodb-kv socket> -b <item size> [-r <recent append MB>]"
+	    " [-1] [-p <pidfile>]\n");
 	fprintf(stderr, "       kivaloo-lbs-dynamodb-kv --version\n");
 	exit(1);
 }
@@ -48,6 +50,7 @@ main(int argc, char * argv[])
 	char * opt_t = NULL;
 	size_t opt_b = 0;
 	char * opt_p = NULL;
+	size_t opt_r = 0;
 	int opt_1 = 0;
 
 	/* Working variables. */
@@ -72,6 +75,13 @@ main(int argc, char * argv[])
 			if ((opt_p = strdup(optarg)) == NULL)
 				OPT_EPARSE(ch, optarg);
 			break;
+		GETOPT_OPTARG("-r"):
+			if (opt_r != 0)
+				usage();
+			if (PARSENUM(&opt_r, optarg, 1,
+			    SIZE_MAX / (1024 * 1024)))
+				OPT_EPARSE(ch, optarg);
+			break;
 		GETOPT_OPTARG("-s"):
 			if (opt_s != NULL)
 				usage();
@@ -163,7 +173,8 @@ main(int argc, char * argv[])
 	}
 
 	/* Initialize the internal state. */
-	if ((S = state_init(Q_DDBKV, opt_b, deleter)) == NULL) {
+	if ((S = state_init(Q_DDBKV, opt_b, deleter,
+	    opt_r * 1024 * 1024)) == NULL) {
 		warnp("Error initializing state from DynamoDB");
 		exit(1);
 	}
@@ -3,6 +3,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "blkring.h"
 #include "events.h"
 #include "proto_lbs.h"
 #include "proto_dynamodb_kv.h"
@@ -16,6 +17,9 @@
 #include "state.h"
 
 static int callback_get(void *, int, const uint8_t *, size_t);
+static int callback_get_ring(void *);
+static int callback_mget(void *, int, const uint8_t * const *,
+    const size_t *);
 
 struct get_cookie {
 	struct state * S;
@@ -24,6 +28,13 @@ struct get_cookie {
 	    const uint8_t *, size_t);
 	void * cookie;
 	int consistent;
+	uint8_t * buf;		/* Block read from the append ring. */
+};
+
+/* GETs which are sent to DynamoDB-KV together as a single MGET. */
+struct get_batch {
+	size_t n;
+	struct get_cookie * C[PROTO_DDBKV_MMAX];
 };
 
 int callback_append_put_lastblk(void *, int);
@@ -35,7 +46,7 @@ struct append_cookie {
 	struct proto_lbs_request * R;
 	int (* callback)(void *, struct proto_lbs_request *);
 	void * cookie;
-	uint64_t nblks_left;
+	size_t nmputs;		/* MPUTs in progress. */
 	uint64_t lastblk_new;
 };
 
@@ -85,16 +96,18 @@ err0:
 }
 
 /**
- * state_init(Q_DDBKV, itemsz, D):
+ * state_init(Q_DDBKV, itemsz, D, ringlen):
  * Initialize the internal state for handling DynamoDB items of ${itemsz}
  * bytes, using the DynamoDB-KV daemon connected to ${Q_DDBKV}.  Use the
- * DeleteTo state ${D} for handling garbage collection requests.  Return a
- * state which can be passed to other state_* functions.  This function may
- * call events_run internally.
+ * DeleteTo state ${D} for handling garbage collection requests.  If
+ * ${ringlen} is non-zero, keep up to ${ringlen} bytes of the most recently
+ * appended blocks in memory and serve GETs for them without asking DynamoDB.
+ * Return a state which can be passed to other state_* functions.  This
+ * function may call events_run internally.
  */
 struct state *
 state_init(struct wire_requestqueue * Q_DDBKV,
-    size_t itemsz, struct deleteto * D)
+    size_t itemsz, struct deleteto * D, size_t ringlen)
 {
 	struct state * S;
 	struct readlastblk R;
@@ -106,6 +119,14 @@ state_init(struct wire_requestqueue * Q_DDBKV,
 	S->D = D;
 	S->blklen = itemsz - KVOVERHEAD;
 	S->npending = 0;
+	S->getq = NULL;
+	S->getq_immediate = NULL;
+
+	/* Create a ring for recently appended blocks if we want one. */
+	S->ring = NULL;
+	if ((ringlen > 0) && ((S->ring =
+	    blkring_init(ringlen / S->blklen, S->blklen)) == NULL))
+		goto err1;
 
 	/* Read "lastblk"; we *might* have written up to here. */
 	R.done = 0;
@@ -113,13 +134,15 @@ state_init(struct wire_requestqueue * Q_DDBKV,
 	    callback_readlastblk, &R) ||
 	    events_spin(&R.done)) {
 		warnp("Error reading lastblk");
-		goto err1;
+		goto err2;
 	}
 	S->lastblk = R.lastblk;
 
 	/* Success! */
 	return (S);
 
+err2:
+	blkring_free(S->ring);
 err1:
 	free(S);
 err0:
@@ -127,6 +150,125 @@ err0:
 	return (NULL);
 }
 
+/* Send the queued GETs to DynamoDB-KV. */
+static int
+getq_send(struct state * S)
+{
+	struct get_batch * G = S->getq;
+	char keybufs[PROTO_DDBKV_MMAX][17];
+	const char * keys[PROTO_DDBKV_MMAX];
+	size_t i;
+
+	/* The queue is now empty. */
+	S->getq = NULL;
+
+	/* A single GET doesn't need to be batched. */
+	if (G->n == 1) {
+		if (proto_dynamodb_kv_request_get(S->Q,
+		    objmap(G->C[0]->R->r.get.blkno), callback_get, G->C[0]))
+			goto err1;
+		free(G);
+		goto done;
+	}
+
+	/* Construct the keys; objmap returns a static buffer. */
+	for (i = 0; i < G->n; i++) {
+		memcpy(keybufs[i], objmap(G->C[i]->R->r.get.blkno), 17);
+		keys[i] = keybufs[i];
+	}
+
+	/* Send the request. */
+	if (proto_dynamodb_kv_request_mget(S->Q, G->n, keys,
+	    callback_mget, G))
+		goto err1;
+
+done:
+	/* Success! */
+	return (0);
+
+err1:
+	free(G);
+
+	/* Failure! */
+	return (-1);
+}
+
+/* Callback for sending queued GETs once we return to the event loop. */
+static int
+callback_getq_flush(void * cookie)
+{
+	struct state * S = cookie;
+
+	/* This callback is no longer pending. */
+	S->getq_immediate = NULL;
+
+	/* Send the queued GETs. */
+	return (getq_send(S));
+}
+
+/* Cancel the pending flush of queued GETs and send them now. */
+static int
+getq_flush(struct state * S)
+{
+
+	/* We don't need a callback any more. */
+	events_immediate_cancel(S->getq_immediate);
+	S->getq_immediate = NULL;
+
+	/* Send the queued GETs. */
+	return (getq_send(S));
+}
+
+/*
+ * Add the GET ${C} to the queue of GETs to be sent.  GETs which arrive
+ * together are sent as a single MGET; the queue is flushed once we return to
+ * the event loop, when it is full, or when a block is requested twice (the
+ * keys in an MGET must be distinct).
+ */
+static int
+getq_add(struct state * S, struct get_cookie * C)
+{
+	size_t i;
+
+	/* If this block is already queued, send the queued GETs first. */
+	if (S->getq != NULL) {
+		for (i = 0; i < S->getq->n; i++) {
+			if (S->getq->C[i]->R->r.get.blkno ==
+			    C->R->r.get.blkno)
+				break;
+		}
+		if ((i < S->getq->n) && getq_flush(S))
+			goto err0;
+	}
+
+	/* Start a new batch if necessary. */
+	if (S->getq == NULL) {
+		if ((S->getq = malloc(sizeof(struct get_batch))) == NULL)
+			goto err0;
+		S->getq->n = 0;
+		if ((S->getq_immediate = events_immediate_register(
+		    callback_getq_flush, S, 1)) == NULL)
+			goto err1;
+	}
+
+	/* Add this GET to the batch. */
+	S->getq->C[S->getq->n++] = C;
+
+	/* If the batch is full, send it now. */
+	if ((S->getq->n == PROTO_DDBKV_MMAX) && getq_flush(S))
+		goto err0;
+
+	/* Success! */
+	return (0);
+
+err1:
+	free(S->getq);
+	S->getq = NULL;
+err0:
+	/* Failure! */
+	return (-1);
+}
+
 /**
  * state_get(S, R, callback, cookie):
  * Perform the GET operation specified by the LBS protocol request ${R} on the
@@ -149,18 +291,35 @@ state_get(struct state * S, struct proto_lbs_request * R,
 	C->callback = callback;
 	C->cookie = cookie;
 	C->consistent = 0;
+	C->buf = NULL;
+
+	/* If we appended the block recently, we still have it. */
+	if (S->ring != NULL) {
+		if ((C->buf = malloc(S->blklen)) == NULL)
+			goto err1;
+		if (blkring_get(S->ring, R->r.get.blkno, C->buf) == 0) {
+			if (events_immediate_register(callback_get_ring,
+			    C, 0) == NULL)
+				goto err2;
+			goto sent;
+		}
+		free(C->buf);
+		C->buf = NULL;
+	}
 
-	/* Send the request. */
-	if (proto_dynamodb_kv_request_get(S->Q, objmap(R->r.get.blkno),
-	    callback_get, C))
+	/* Add the request to the queue of GETs to send. */
+	if (getq_add(S, C))
 		goto err1;
 
+sent:
 	/* We will be performing a callback later. */
 	S->npending += 1;
 
 	/* Success! */
 	return (0);
 
+err2:
+	free(C->buf);
 err1:
 	free(C);
 err0:
@@ -168,6 +327,51 @@ err0:
 	return (-1);
 }
 
+/* Callback for GETs performed by state_get from the append ring. */
+static int
+callback_get_ring(void * cookie)
+{
+	struct get_cookie * C = cookie;
+
+	/* Pretend that DynamoDB gave us the block. */
+	return (callback_get(C, 0, C->buf, C->S->blklen));
+}
+
+/* Callback for MGET requests. */
+static int
+callback_mget(void * cookie, int status, const uint8_t * const * bufs,
+    const size_t * lens)
+{
+	struct get_batch * G = cookie;
+	size_t i;
+
+	/* Handle each of the GETs as if it had been sent individually. */
+	for (i = 0; i < G->n; i++) {
+		if (status) {
+			if (callback_get(G->C[i], 1, NULL, 0))
+				goto err1;
+		} else if (bufs[i] == NULL) {
+			if (callback_get(G->C[i], 2, NULL, 0))
+				goto err1;
+		} else {
+			if (callback_get(G->C[i], 0, bufs[i], lens[i]))
+				goto err1;
+		}
+	}
+
+	/* Free the batch. */
+	free(G);
+
+	/* Success! */
+	return (0);
+
+err1:
+	free(G);
+
+	/* Failure! */
+	return (-1);
+}
+
 /* Callback for GET requests. */
 static int
 callback_get(void * cookie, int status, const uint8_t * buf, size_t buflen)
@@ -214,6 +418,7 @@ callback_get(void * cookie, int status, const uint8_t * buf, size_t buflen)
 	S->npending -= 1;
 
 	/* Free our cookie. */
+	free(C->buf);
 	free(C);
 
 	/* Return status from callback. */
@@ -243,7 +448,7 @@ state_append(struct state * S, struct proto_lbs_request * R,
 	C->R = R;
 	C->callback = callback;
 	C->cookie = cookie;
-	C->nblks_left = R->r.append.nblks;
+	C->nmputs = 0;
 	C->lastblk_new = S->lastblk + R->r.append.nblks;
 
 	/* Store the new value of lastblk. */
@@ -272,7 +477,11 @@ callback_append_put_lastblk(void * cookie, int status)
 	struct append_cookie * C = cookie;
 	struct state * S = C->S;
 	struct proto_lbs_request * R = C->R;
-	size_t i;
+	char keybufs[PROTO_DDBKV_MMAX][17];
+	const char * keys[PROTO_DDBKV_MMAX];
+	const uint8_t * bufs[PROTO_DDBKV_MMAX];
+	size_t lens[PROTO_DDBKV_MMAX];
+	size_t i, j, n;
 
 	/* Failures are bad. */
 	if (status) {
@@ -280,16 +489,29 @@ callback_append_put_lastblk(void * cookie, int status)
 		goto err0;
 	}
 
-	/* Store all the blocks except the last one. */
-	for (i = 0; i + 1 < R->r.append.nblks; i++) {
-		if (proto_dynamodb_kv_request_put(S->Q,
-		    objmap(S->lastblk + 1 + i),
-		    &R->r.append.buf[i * S->blklen], S->blklen,
+	/* Store all the blocks except the last one, in batches. */
+	for (i = 0; i + 1 < R->r.append.nblks; i += n) {
+		/* How many blocks go into this batch? */
+		n = R->r.append.nblks - 1 - i;
+		if (n > PROTO_DDBKV_MMAX)
+			n = PROTO_DDBKV_MMAX;
+
+		/* Construct the keys; objmap returns a static buffer. */
+		for (j = 0; j < n; j++) {
+			memcpy(keybufs[j], objmap(S->lastblk + 1 + i + j), 17);
+			keys[j] = keybufs[j];
+			bufs[j] = &R->r.append.buf[(i + j) * S->blklen];
+			lens[j] = S->blklen;
+		}
+
+		/* Send the blocks. */
+		if (proto_dynamodb_kv_request_mput(S->Q, n, keys, bufs, lens,
 		    callback_append_put_blks, C))
 			goto err0;
+		C->nmputs += 1;
 	}
 
-	/* If there only was one block, it. */
+	/* If there only was one block, store it. */
 	if (R->r.append.nblks == 1) {
 		i = R->r.append.nblks - 1;
 		if (proto_dynamodb_kv_request_put(S->Q,
@@ -307,7 +529,7 @@ err0:
 	return (-1);
 }
 
-/* Callback when a block, other than the final block, has been written. */
+/* Callback when a batch of blocks (not the final block) has been written. */
 int
 callback_append_put_blks(void * cookie, int status)
 {
@@ -318,19 +540,18 @@ callback_append_put_blks(void * cookie, int status)
 
 	/* Failures are bad. */
 	if (status) {
-		warn0("DynamoDB-KV failed storing \"lastblk\"");
+		warn0("DynamoDB-KV failed storing blocks");
 		goto err0;
 	}
 
-	/* We've stored a block. */
-	C->nblks_left--;
+	/* We've stored a batch of blocks. */
+	C->nmputs -= 1;
 
 	/*
-	 * If there's only one block left to store, it's the final block in
-	 * the request; store it now.
+	 * If all of the batches have been stored, the only block left is the
+	 * final block in the request; store it now.
 	 */
-
-	if (C->nblks_left == 1) {
+	if (C->nmputs == 0) {
 		i = R->r.append.nblks - 1;
 		if (proto_dynamodb_kv_request_put(S->Q,
 		    objmap(S->lastblk + 1 + i),
@@ -356,7 +577,7 @@ callback_append_put_finalblk(void * cookie, int status)
 	int rc;
 
 	/* This had better have been the only block left to store. */
-	assert(C->nblks_left == 1);
+	assert(C->nmputs == 0);
 
 	/* Failures are bad. */
 	if (status) {
@@ -364,6 +585,11 @@ callback_append_put_finalblk(void * cookie, int status)
 		goto err1;
 	}
 
+	/* Keep a copy of the blocks in memory. */
+	if (S->ring != NULL)
+		blkring_add(S->ring, S->lastblk + 1, C->R->r.append.nblks,
+		    C->R->r.append.buf);
+
 	/* Update the last-block value. */
 	S->lastblk = C->lastblk_new;
 
@@ -395,6 +621,10 @@ int
 state_gc(struct state * S, uint64_t blkno)
 {
 
+	/* The ring can drop these blocks. */
+	if (S->ring != NULL)
+		blkring_gc(S->ring, blkno);
+
 	/* Pass this along to the deleter. */
 	return (deleteto_deleteto(S->D, blkno));
 }
@@ -410,7 +640,9 @@ state_free(struct state * S)
 
 	/* Sanity-check. */
 	assert(S->npending == 0);
+	assert(S->getq == NULL);
 
-	/* Free allocation. */
+	/* Free allocations. */
+	blkring_free(S->ring);
 	free(S);
 }
@@ -2,7 +2,9 @@
 #define _STATE_H_
 
 /* Opaque types. */
+struct blkring;
 struct deleteto;
+struct get_batch;
 struct proto_lbs_request;
 struct wire_requestqueue;
 
@@ -11,23 +13,28 @@ struct state {
 	/* Bits dispatch.c needs to look at. */
 	uint32_t blklen;	/* Block size. */
 	uint64_t lastblk;	/* Last written block #. */
+	struct blkring * ring;	/* Recently appended blocks, or NULL. */
 
 	/* Internal data. */
 	struct wire_requestqueue * Q;	/* Connected to DDBKV daemon. */
 	struct deleteto * D;	/* DeleteTo state. */
 	size_t npending;	/* Callbacks not performed yet. */
+	struct get_batch * getq;	/* GETs waiting to be sent, or NULL. */
+	void * getq_immediate;	/* Cookie for sending queued GETs. */
 };
 
 /**
- * state_init(Q_DDBKV, itemsz, D):
+ * state_init(Q_DDBKV, itemsz, D, ringlen):
  * Initialize the internal state for handling DynamoDB items of ${itemsz}
  * bytes, using the DynamoDB-KV daemon connected to ${Q_DDBKV}.  Use the
- * DeleteTo state ${D} for handling garbage collection requests.  Return a
- * state which can be passed to other state_* functions.  This function may
- * call events_run internally.
+ * DeleteTo state ${D} for handling garbage collection requests.  If
+ * ${ringlen} is non-zero, keep up to ${ringlen} bytes of the most recently
+ * appended blocks in memory and serve GETs for them without asking DynamoDB.
+ * Return a state which can be passed to other state_* functions.  This
+ * function may call events_run internally.
  */
 struct state * state_init(struct wire_requestqueue *, size_t,
-    struct deleteto *);
+    struct deleteto *, size_t);
 
 /**
  * state_get(S, R, callback, cookie):
@@ -0,0 +1,672 @@
+#include <sys/types.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "asprintf.h"
+#include "crc32c.h"
+#include "events.h"
+#include "sysendian.h"
+#include "warnp.h"
+
+#include "blkcache.h"
+
+/* Seconds between writes of the index. */
+#define INTERVAL	60.0
+
+/* Marker for an empty slot. */
+#define NOBLK		((uint64_t)(-1))
+
+/* Marker for the end of a hash chain. */
+#define NOSLOT		((size_t)(-1))
+
+/* Index file identifier. */
+#define MAGIC		"lbss3bc2"
+
+/*
+ * Blocks are stored in slots in a single file; the index records which
+ * block each slot holds along with the CRC32C of its data.  Blocks are
+ * immutable once written, so the only way the index can be wrong (e.g.,
+ * after a crash when the slot was reused after the index was last written)
+ * is if the slot holds different data, and the CRC catches that.
+ *
+ * The CRC can't catch blocks from a different store which reused the same
+ * bucket, since those blocks are intact; so we also record the highest block
+ * # we have ever cached, and discard everything if the store turns out not
+ * to reach that far.
+ */
+struct blkcache {
+	char * path_blks;		/* File holding cached blocks. */
+	char * path_index;		/* Index file. */
+	char * path_tmp;		/* Index file being written. */
+	char * bucket;			/* S3 bucket name. */
+	int fd;				/* Open on path_blks. */
+	size_t blklen;			/* Block size. */
+	size_t nslots;			/* Number of blocks cached. */
+	uint64_t minblk;		/* Blocks below this are garbage. */
+	uint64_t maxblk;		/* Highest block # cached, or NOBLK. */
+
+	/* Per-slot state. */
+	uint64_t * blkno;		/* Block # or NOBLK. */
+	uint8_t (* crc)[4];		/* CRC32C of the block data. */
+	uint8_t * ref;			/* CLOCK reference bit. */
+	size_t * next;			/* Next slot in hash chain. */
+
+	/* Hash table mapping block #s to slots. */
+	size_t * heads;			/* First slot in each chain. */
+	int hshift;			/* 64 - log2(# chains). */
+
+	size_t hand;			/* CLOCK hand. */
+	int dirty;			/* Index changed since written. */
+	void * timer_cookie;		/* Index writing timer. */
+};
+
+static int callback_timer(void *);
+
+/* Return the hash chain for block ${blkno}. */
+static size_t
+chain(struct blkcache * BC, uint64_t blkno)
+{
+
+	return ((size_t)((blkno * 0x9e3779b97f4a7c15ULL) >> BC->hshift));
+}
+
+/* Return the slot holding block ${blkno}, or NOSLOT. */
+static size_t
+find(struct blkcache * BC, uint64_t blkno)
+{
+	size_t slot;
+
+	for (slot = BC->heads[chain(BC, blkno)]; slot != NOSLOT;
+	    slot = BC->next[slot]) {
+		if (BC->blkno[slot] == blkno)
+			break;
+	}
+	return (slot);
+}
+
+/* Add ${slot} to the hash chain for the block it holds. */
+static void
+addslot(struct blkcache * BC, size_t slot)
+{
+	size_t h = chain(BC, BC->blkno[slot]);
+
+	BC->next[slot] = BC->heads[h];
+	BC->heads[h] = slot;
+}
+
+/* Empty ${slot} and remove it from its hash chain. */
+static void
+dropslot(struct blkcache * BC, size_t slot)
+{
+	size_t * p;
+
+	for (p = &BC->heads[chain(BC, BC->blkno[slot])]; *p != slot;
+	    p = &BC->next[*p])
+		continue;
+	*p = BC->next[slot];
+	BC->blkno[slot] = NOBLK;
+	BC->dirty = 1;
+}
+
+/* Pick a slot to reuse, and advance the CLOCK hand past it. */
+static size_t
+victim(struct blkcache * BC)
+{
+	size_t slot;
+
+	do {
+		slot = BC->hand;
+		if (++BC->hand == BC->nslots)
+			BC->hand = 0;
+
+		/* Empty slots and garbage blocks can be reused right away. */
+		if ((BC->blkno[slot] == NOBLK) ||
+		    (BC->blkno[slot] < BC->minblk))
+			break;
+
+		/* Give recently read blocks a second chance. */
+		if (BC->ref[slot] == 0)
+			break;
+		BC->ref[slot] = 0;
+	} while (1);
+
+	return (slot);
+}
+
+/* Compute the CRC32C of the block ${buf}. */
+static void
+blkcrc(struct blkcache * BC, const uint8_t * buf, uint8_t cbuf[4])
+{
+	CRC32C_CTX ctx;
+
+	CRC32C_Init(&ctx);
+	CRC32C_Update(&ctx, buf, BC->blklen);
+	CRC32C_Final(cbuf, &ctx);
+}
+
+/*
+ * Read the contents of ${slot} into ${buf}.  Return 1 if the file ends
+ * before the end of the slot (i.e., it was never written).
+ */
+static int
+readslot(struct blkcache * BC, size_t slot, uint8_t * buf)
+{
+	off_t offset = (off_t)slot * (off_t)BC->blklen;
+	size_t bufpos;
+	ssize_t lenread;
+
+	for (bufpos = 0; bufpos < BC->blklen; bufpos += (size_t)lenread) {
+		lenread = pread(BC->fd, &buf[bufpos], BC->blklen - bufpos,
+		    offset + (off_t)bufpos);
+		if (lenread == 0)
+			return (1);
+		if ((lenread == -1) && (errno == EINTR))
+			lenread = 0;
+		if (lenread == -1) {
+			warnp("Error reading file: %s", BC->path_blks);
+			goto err0;
+		}
+	}
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Write ${buf} into ${slot}. */
+static int
+writeslot(struct blkcache * BC, size_t slot, const uint8_t * buf)
+{
+	off_t offset = (off_t)slot * (off_t)BC->blklen;
+	size_t bufpos;
+	ssize_t lenwrit;
+
+	for (bufpos = 0; bufpos < BC->blklen; bufpos += (size_t)lenwrit) {
+		lenwrit = pwrite(BC->fd, &buf[bufpos], BC->blklen - bufpos,
+		    offset + (off_t)bufpos);
+		if ((lenwrit == -1) && (errno == EINTR))
+			lenwrit = 0;
+		if (lenwrit == -1) {
+			warnp("Error writing file: %s", BC->path_blks);
+			goto err0;
+		}
+	}
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Serialize the index header into ${buf}, and return its length. */
+static size_t
+header(struct blkcache * BC, uint8_t * buf)
+{
+	size_t len = strlen(BC->bucket);
+
+	if (buf != NULL) {
+		memcpy(buf, MAGIC, 8);
+		be64enc(&buf[8], BC->nslots);
+		be64enc(&buf[16], BC->blklen);
+		be64enc(&buf[24], BC->minblk);
+		be64enc(&buf[32], BC->maxblk);
+		be32enc(&buf[40], (uint32_t)len);
+		memcpy(&buf[44], BC->bucket, len);
+	}
+	return (44 + len);
+}
+
+/* Read the index, if it exists and matches our parameters. */
+static int
+readindex(struct blkcache * BC)
+{
+	FILE * f;
+	uint8_t * hbuf;
+	uint8_t * buf;
+	uint8_t rec[12];
+	size_t hlen = header(BC, NULL);
+	size_t slot;
+
+	/* Open the index; if it doesn't exist, the cache is empty. */
+	if ((f = fopen(BC->path_index, "rb")) == NULL) {
+		if (errno == ENOENT)
+			goto done;
+		warnp("fopen(%s)", BC->path_index);
+		goto err0;
+	}
+
+	/* Check that the header matches what we would write. */
+	if ((hbuf = malloc(hlen)) == NULL)
+		goto err1;
+	if ((buf = malloc(hlen)) == NULL)
+		goto err2;
+	header(BC, hbuf);
+	if ((fread(buf, hlen, 1, f) != 1) || memcmp(buf, hbuf, 24) ||
+	    memcmp(&buf[40], &hbuf[40], hlen - 40)) {
+		warn0("Ignoring cache index with different parameters: %s",
+		    BC->path_index);
+		goto nomatch;
+	}
+	BC->minblk = be64dec(&buf[24]);
+	BC->maxblk = be64dec(&buf[32]);
+
+	/* Read the block # and CRC for each slot. */
+	for (slot = 0; slot < BC->nslots; slot++) {
+		if (fread(rec, 12, 1, f) != 1) {
+			warn0("Cache index is truncated: %s", BC->path_index);
+			goto nomatch;
+		}
+		BC->blkno[slot] = be64dec(&rec[0]);
+		memcpy(BC->crc[slot], &rec[8], 4);
+		if (BC->blkno[slot] == NOBLK)
+			continue;
+
+		/* Drop duplicates (there shouldn't be any). */
+		if (find(BC, BC->blkno[slot]) != NOSLOT) {
+			BC->blkno[slot] = NOBLK;
+			continue;
+		}
+		addslot(BC, slot);
+	}
+
+nomatch:
+	/* Clean up. */
+	free(buf);
+	free(hbuf);
+	if (fclose(f)) {
+		warnp("fclose(%s)", BC->path_index);
+		goto err0;
+	}
+
+done:
+	/* Success! */
+	return (0);
+
+err2:
+	free(hbuf);
+err1:
+	fclose(f);
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Write the index to a new file and move it into place. */
+static int
+writeindex(struct blkcache * BC)
+{
+	FILE * f;
+	uint8_t * buf;
+	size_t hlen = header(BC, NULL);
+	size_t buflen = hlen + BC->nslots * 12;
+	size_t slot;
+
+	/* Serialize the index. */
+	if ((buf = malloc(buflen)) == NULL)
+		goto err0;
+	header(BC, buf);
+	for (slot = 0; slot < BC->nslots; slot++) {
+		be64enc(&buf[hlen + slot * 12], BC->blkno[slot]);
+		memcpy(&buf[hlen + slot * 12 + 8], BC->crc[slot], 4);
+	}
+
+	/* Write it out and make sure it's on disk. */
+	if ((f = fopen(BC->path_tmp, "wb")) == NULL) {
+		warnp("fopen(%s)", BC->path_tmp);
+		goto err1;
+	}
+	if (fwrite(buf, buflen, 1, f) != 1) {
+		warnp("fwrite(%s)", BC->path_tmp);
+		goto err2;
+	}
+	if (fflush(f)) {
+		warnp("fflush(%s)", BC->path_tmp);
+		goto err2;
+	}
+	while (fsync(fileno(f))) {
+		if (errno != EINTR) {
+			warnp("fsync(%s)", BC->path_tmp);
+			goto err2;
+		}
+	}
+	if (fclose(f)) {
+		warnp("fclose(%s)", BC->path_tmp);
+		goto err1;
+	}
+
+	/* Replace the old index. */
+	if (rename(BC->path_tmp, BC->path_index)) {
+		warnp("rename(%s, %s)", BC->path_tmp, BC->path_index);
+		goto err1;
+	}
+
+	/* The index on disk is up to date. */
+	BC->dirty = 0;
+
+	/* Free the buffer. */
+	free(buf);
+
+	/* Success! */
+	return (0);
+
+err2:
+	fclose(f);
+err1:
+	free(buf);
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Write out the index if it has changed, and schedule the next write. */
+static int
+callback_timer(void * cookie)
+{
+	struct blkcache * BC = cookie;
+
+	/* The timer is no longer pending. */
+	BC->timer_cookie = NULL;
+
+	/* Write the index if necessary. */
+	if (BC->dirty && writeindex(BC))
+		goto err0;
+
+	/* Do it again later. */
+	if ((BC->timer_cookie = events_timer_register_double(callback_timer,
+	    BC, INTERVAL)) == NULL)
+		goto err0;
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/**
+ * blkcache_init(dir, nblks, blklen, bucket):
+ * Create a cache of up to ${nblks} blocks of ${blklen} bytes from the S3
+ * bucket ${bucket}, stored in the directory ${dir}.  If the directory holds
+ * an index written by a previous cache with the same parameters, the blocks
+ * it lists are retained.  The index is rewritten periodically and when the
+ * cache is freed.
+ */
+struct blkcache *
+blkcache_init(const char * dir, size_t nblks, size_t blklen,
+    const char * bucket)
+{
+	struct blkcache * BC;
+	size_t nchains;
+	size_t i;
+
+	/* Sanity-check. */
+	if ((nblks == 0) || (nblks > SIZE_MAX / blklen) ||
+	    (nblks > SIZE_MAX / sizeof(size_t) / 2)) {
+		warn0("Invalid cache size: %zu blocks", nblks);
+		goto err0;
+	}
+
+	/* Allocate a structure and initialize. */
+	if ((BC = malloc(sizeof(struct blkcache))) == NULL)
+		goto err0;
+	BC->blklen = blklen;
+	BC->nslots = nblks;
+	BC->minblk = 0;
+	BC->maxblk = NOBLK;
+	BC->hand = 0;
+	BC->dirty = 0;
+	BC->timer_cookie = NULL;
+
+	/* Figure out where things live. */
+	if ((BC->bucket = strdup(bucket)) == NULL)
+		goto err1;
+	if (asprintf(&BC->path_blks, "%s/blks", dir) == -1)
+		goto err2;
+	if (asprintf(&BC->path_index, "%s/index", dir) == -1)
+		goto err3;
+	if (asprintf(&BC->path_tmp, "%s/index.new", dir) == -1)
+		goto err4;
+
+	/* Use at least twice as many hash chains as slots. */
+	for (BC->hshift = 63, nchains = 2; nchains < nblks * 2;
+	    nchains <<= 1)
+		BC->hshift--;
+
+	/* Allocate per-slot state and hash chains. */
+	if ((BC->blkno = malloc(nblks * sizeof(uint64_t))) == NULL)
+		goto err5;
+	if ((BC->crc = malloc(nblks * 4)) == NULL)
+		goto err6;
+	if ((BC->ref = malloc(nblks)) == NULL)
+		goto err7;
+	if ((BC->next = malloc(nblks * sizeof(size_t))) == NULL)
+		goto err8;
+	if ((BC->heads = malloc(nchains * sizeof(size_t))) == NULL)
+		goto err9;
+
+	/* Everything is empty. */
+	for (i = 0; i < nblks; i++) {
+		BC->blkno[i] = NOBLK;
+		BC->ref[i] = 0;
+	}
+	for (i = 0; i < nchains; i++)
+		BC->heads[i] = NOSLOT;
+
+	/* Open the block file. */
+	if ((BC->fd = open(BC->path_blks, O_RDWR | O_CREAT, 0600)) == -1) {
+		warnp("open(%s)", BC->path_blks);
+		goto err10;
+	}
+
+	/* Pick up blocks cached by a previous invocation. */
+	if (readindex(BC))
+		goto err11;
+
+	/* Start writing the index periodically. */
+	if ((BC->timer_cookie = events_timer_register_double(callback_timer,
+	    BC, INTERVAL)) == NULL)
+		goto err11;
+
+	/* Success! */
+	return (BC);
+
+err11:
+	close(BC->fd);
+err10:
+	free(BC->heads);
+err9:
+	free(BC->next);
+err8:
+	free(BC->ref);
+err7:
+	free(BC->crc);
+err6:
+	free(BC->blkno);
+err5:
+	free(BC->path_tmp);
+err4:
+	free(BC->path_index);
+err3:
+	free(BC->path_blks);
+err2:
+	free(BC->bucket);
+err1:
+	free(BC);
+err0:
+	/* Failure! */
+	return (NULL);
+}
+
+/**
+ * blkcache_get(BC, blkno, buf):
+ * Look for block ${blkno} in the cache ${BC}.  If it is present, read it into
+ * ${buf} and return 0; otherwise, return 1.  Return -1 on error.
+ */
+int
+blkcache_get(struct blkcache * BC, uint64_t blkno, uint8_t * buf)
+{
+	uint8_t cbuf[4];
+	size_t slot;
+	int rc;
+
+	/* Do we have this block? */
+	if ((blkno < BC->minblk) || ((slot = find(BC, blkno)) == NOSLOT))
+		return (1);
+
+	/* Read it, and make sure it's the data we stored. */
+	if ((rc = readslot(BC, slot, buf)) == -1)
+		goto err0;
+	if (rc == 0)
+		blkcrc(BC, buf, cbuf);
+	if ((rc != 0) || memcmp(cbuf, BC->crc[slot], 4)) {
+		dropslot(BC, slot);
+		return (1);
+	}
+
+	/* This block has been used. */
+	BC->ref[slot] = 1;
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/**
+ * blkcache_put(BC, blkno, buf):
+ * Store the block ${blkno} with contents ${buf} in the cache ${BC}, evicting
+ * another block if necessary.
+ */
+int
+blkcache_put(struct blkcache * BC, uint64_t blkno, const uint8_t * buf)
+{
+	size_t slot;
+
+	/* Blocks never change, so there's nothing to do if we have it. */
+	if ((blkno < BC->minblk) || (find(BC, blkno) != NOSLOT))
+		goto done;
+
+	/* Find a slot and empty it. */
+	slot = victim(BC);
+	if (BC->blkno[slot] != NOBLK)
+		dropslot(BC, slot);
+
+	/* Store the block. */
+	if (writeslot(BC, slot, buf))
+		goto err0;
+	blkcrc(BC, buf, BC->crc[slot]);
+	BC->blkno[slot] = blkno;
+	BC->ref[slot] = 0;
+	addslot(BC, slot);
+	if ((BC->maxblk == NOBLK) || (blkno > BC->maxblk))
+		BC->maxblk = blkno;
+	BC->dirty = 1;
+
+done:
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/**
+ * blkcache_setlast(BC, lastblk):
+ * The store which the cache ${BC} is caching ends at block ${lastblk}, or is
+ * empty if ${lastblk} is (uint64_t)(-1).  If the cache has ever held a block
+ * after that, it was filled from a different store which used the same
+ * bucket; discard all of its blocks.
+ */
+void
+blkcache_setlast(struct blkcache * BC, uint64_t lastblk)
+{
+	size_t slot;
+
+	/* Is everything we have cached part of this store? */
+	if ((BC->maxblk == NOBLK) ||
+	    ((lastblk != (uint64_t)(-1)) && (BC->maxblk <= lastblk)))
+		return;
+
+	/* Throw away the cached blocks. */
+	warn0("Discarding cached blocks from a different store: %s",
+	    BC->path_blks);
+	for (slot = 0; slot < BC->nslots; slot++) {
+		if (BC->blkno[slot] != NOBLK)
+			dropslot(BC, slot);
+	}
+	BC->minblk = 0;
+	BC->maxblk = NOBLK;
+	BC->dirty = 1;
+}
+
+/**
+ * blkcache_gc(BC, blkno):
+ * Blocks less than ${blkno} will not be read again; the cache ${BC} may
+ * discard them.
+ */
+void
+blkcache_gc(struct blkcache * BC, uint64_t blkno)
+{
+
+	/* Slots holding these blocks are now free for reuse. */
+	if (blkno > BC->minblk) {
+		BC->minblk = blkno;
+		BC->dirty = 1;
+	}
+}
+
+/**
+ * blkcache_free(BC):
+ * Write out the index of the cache ${BC} and free it.
+ */
+int
+blkcache_free(struct blkcache * BC)
+{
+	int rc = 0;
+
+	/* Behave consistently with free(NULL). */
+	if (BC == NULL)
+		return (0);
+
+	/* Stop the timer and write the index one last time. */
+	if (BC->timer_cookie != NULL)
+		events_timer_cancel(BC->timer_cookie);
+	if (BC->dirty && writeindex(BC))
+		rc = -1;
+
+	/* Close the block file. */
+	if (close(BC->fd)) {
+		warnp("close(%s)", BC->path_blks);
+		rc = -1;
+	}
+
+	/* Free allocations. */
+	free(BC->heads);
+	free(BC->next);
+	free(BC->ref);
+	free(BC->crc);
+	free(BC->blkno);
+	free(BC->path_tmp);
+	free(BC->path_index);
+	free(BC->path_blks);
+	free(BC->bucket);
+	free(BC);
+
+	/* Return status. */
+	return (rc);
+}
@@ -0,0 +1,56 @@
+#ifndef _BLKCACHE_H_
+#define _BLKCACHE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Opaque type. */
+struct blkcache;
+
+/**
+ * blkcache_init(dir, nblks, blklen, bucket):
+ * Create a cache of up to ${nblks} blocks of ${blklen} bytes from the S3
+ * bucket ${bucket}, stored in the directory ${dir}.  If the directory holds
+ * an index written by a previous cache with the same parameters, the blocks
+ * it lists are retained.  The index is rewritten periodically and when the
+ * cache is freed.
+ */
+struct blkcache * blkcache_init(const char *, size_t, size_t, const char *);
+
+/**
+ * blkcache_get(BC, blkno, buf):
+ * Look for block ${blkno} in the cache ${BC}.  If it is present, read it into
+ * ${buf} and return 0; otherwise, return 1.  Return -1 on error.
+ */
+int blkcache_get(struct blkcache *, uint64_t, uint8_t *);
+
+/**
+ * blkcache_put(BC, blkno, buf):
+ * Store the block ${blkno} with contents ${buf} in the cache ${BC}, evicting
+ * another block if necessary.
+ */
+int blkcache_put(struct blkcache *, uint64_t, const uint8_t *);
+
+/**
+ * blkcache_setlast(BC, lastblk):
+ * The store which the cache ${BC} is caching ends at block ${lastblk}, or is
+ * empty if ${lastblk} is (uint64_t)(-1).  If the cache has ever held a block
+ * after that, it was filled from a different store which used the same
+ * bucket; discard all of its blocks.
+ */
+void blkcache_setlast(struct blkcache *, uint64_t);
+
+/**
+ * blkcache_gc(BC, blkno):
+ * Blocks less than ${blkno} will not be read again; the cache ${BC} may
+ * discard them.
+ */
+void blkcache_gc(struct blkcache *, uint64_t);
+
+/**
+ * blkcache_free(BC):
+ * Write out the index of the cache ${BC} and free it.
+ */
+int blkcache_free(struct blkcache *);
+
+#endif /* !_BLKCACHE_H_ */
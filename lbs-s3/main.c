@@ -1,4 +1,5 @@
 #include <inttypes.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -12,6 +13,7 @@
 #include "warnp.h"
 #include "wire.h"
 
+#include "blkcache.h"
 #include "deleteto.h"
 #include "dispatch.h"
 #include "s3state.h"
@@ -21,7 +23,9 @@ usage(void)
 {
 
 	fprintf(stderr, "usage: kivaloo-lbs-s3 -s <lbs socket> -t <s3 socket> "
-	    "-b <block size> -B <S3 bucket> [-1] [-p <pidfile>]\n");
+	    "-b <block size> -B <S3 bucket> [-C <# blocks to cache> "
+	    "-d <cache directory>] [-r <recent append MB>] [-1] "
+	    "[-p <pidfile>]\n");
 	fprintf(stderr, "       kivaloo-lbs-s3 --version\n");
 	exit(1);
 }
@@ -38,6 +42,7 @@ main(int argc, char * argv[])
 	/* State variables. */
 	struct wire_requestqueue * Q_S3;
 	struct deleteto * deleter;
+	struct blkcache * BC;
 	struct s3state * S;
 	struct dispatch_state * D;
 	int s;
@@ -48,7 +53,10 @@ main(int argc, char * argv[])
 	char * opt_t = NULL;
 	intmax_t opt_b = -1;
 	char * opt_B = NULL;
+	intmax_t opt_C = -1;
+	char * opt_d = NULL;
 	char * opt_p = NULL;
+	intmax_t opt_r = -1;
 	int opt_1 = 0;
 
 	/* Working variables. */
@@ -72,12 +80,28 @@ main(int argc, char * argv[])
 				usage();
 			opt_b = strtoimax(optarg, NULL, 0);
 			break;
+		GETOPT_OPTARG("-C"):
+			if (opt_C != -1)
+				usage();
+			opt_C = strtoimax(optarg, NULL, 0);
+			break;
+		GETOPT_OPTARG("-d"):
+			if (opt_d != NULL)
+				usage();
+			if ((opt_d = strdup(optarg)) == NULL)
+				OPT_EPARSE(ch, optarg);
+			break;
 		GETOPT_OPTARG("-p"):
 			if (opt_p != NULL)
 				usage();
 			if ((opt_p = strdup(optarg)) == NULL)
 				OPT_EPARSE(ch, optarg);
 			break;
+		GETOPT_OPTARG("-r"):
+			if (opt_r != -1)
+				usage();
+			opt_r = strtoimax(optarg, NULL, 0);
+			break;
 		GETOPT_OPTARG("-s"):
 			if (opt_s != NULL)
 				usage();
@@ -126,6 +150,18 @@ main(int argc, char * argv[])
 		warn0("Block size must be in [2^9, 2^17]");
 		exit(1);
 	}
+	if ((opt_C == -1) != (opt_d == NULL))
+		usage();
+	if ((opt_C != -1) && ((opt_C < 1) || ((uintmax_t)opt_C > SIZE_MAX))) {
+		warn0("Invalid number of blocks to cache: %jd", opt_C);
+		exit(1);
+	}
+	if (opt_r == -1)
+		opt_r = 0;
+	if ((opt_r < 0) || ((uintmax_t)opt_r > SIZE_MAX / (1024 * 1024))) {
+		warn0("Invalid size of recent append ring: %jd", opt_r);
+		exit(1);
+	}
 
 	/* Resolve the listening address. */
 	if ((sas_s = sock_resolve(opt_s)) == NULL) {
@@ -171,8 +207,20 @@ main(int argc, char * argv[])
 		exit(1);
 	}
 
+	/* If requested, create a local block cache. */
+	if (opt_d != NULL) {
+		if ((BC = blkcache_init(opt_d, (size_t)opt_C, opt_b,
+		    opt_B)) == NULL) {
+			warnp("Error initializing block cache in %s", opt_d);
+			exit(1);
+		}
+	} else {
+		BC = NULL;
+	}
+
 	/* Initialize the S3 state. */
-	if ((S = s3state_init(Q_S3, opt_B, opt_b, deleter)) == NULL) {
+	if ((S = s3state_init(Q_S3, opt_B, opt_b, deleter, BC,
+	    (size_t)opt_r * 1024 * 1024)) == NULL) {
 		warnp("Error initializing from S3 bucket: %s", opt_B);
 		exit(1);
 	}
@@ -211,6 +259,10 @@ main(int argc, char * argv[])
 	/* Clean up the S3 state. */
 	s3state_free(S);
 
+	/* Write out the block cache index and free the cache. */
+	if (blkcache_free(BC))
+		exit(1);
+
 	/*
 	 * Shut down deleting (cleanly if possible, but we don't care if we
 	 * encounter an error at this point).
@@ -236,6 +288,7 @@ main(int argc, char * argv[])
 	free(opt_s);
 	free(opt_p);
 	free(opt_t);
+	free(opt_d);
 	free(opt_B);
 
 	/* Success! */
@@ -3,12 +3,14 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "blkring.h"
 #include "events.h"
 #include "proto_lbs.h"
 #include "proto_s3.h"
 #include "warnp.h"
 #include "wire.h"
 
+#include "blkcache.h"
 #include "deleteto.h"
 #include "findlast.h"
 #include "objmap.h"
@@ -19,8 +21,15 @@
 #define BLK2OBJECT(blk) ((blk) / BLKSPEROBJECT + 1)
 #define BLKOFFSET(blk, blklen) (((blk) % BLKSPEROBJECT) * (blklen))
 
+/*
+ * APPENDs larger than this are uploaded as multipart uploads with parts of
+ * this size, so that they are sent over several connections in parallel.
+ */
+#define PARTLEN (8 * 1024 * 1024)
+
 static int callback_putdone(void *, int);
 static int callback_get(void *, int, size_t, const uint8_t *);
+static int callback_get_cached(void *);
 static int callback_append(void *, int);
 
 struct get_cookie {
@@ -29,6 +38,7 @@ struct get_cookie {
 	int (* callback)(void *, struct proto_lbs_request *,
 	    const uint8_t *, size_t);
 	void * cookie;
+	uint8_t * buf;		/* Block read from memory or the cache. */
 };
 
 struct append_cookie {
@@ -39,16 +49,21 @@ struct append_cookie {
 };
 
 /**
- * s3state_init(Q_S3, bucket, blklen, D):
+ * s3state_init(Q_S3, bucket, blklen, D, BC, ringlen):
  * Initialize the S3 state for bucket ${bucket} containing blocks of length
  * ${blklen} bytes by sending S3 requests via the request queue ${Q_S3}.  Use
- * the DeleteTo state ${D} for handling garbage collection requests.  Return a
- * state which can be passed to other s3state_* functions.  This function may
- * call events_run internally.
+ * the DeleteTo state ${D} for handling garbage collection requests.  If
+ * ${BC} is not NULL, serve GETs from that block cache where possible, and
+ * add blocks to it when they are read or appended.  If ${ringlen} is
+ * non-zero, keep up to ${ringlen} bytes of the most recently appended blocks
+ * in memory and serve GETs for them without asking S3.  Return a state which
+ * can be passed to other s3state_* functions.  This function may call
+ * events_run internally.
  */
 struct s3state *
 s3state_init(struct wire_requestqueue * Q_S3, const char * bucket,
-    size_t blklen, struct deleteto * D)
+    size_t blklen, struct deleteto * D, struct blkcache * BC,
+    size_t ringlen)
 {
 	struct s3state * S;
 	uint64_t L;
@@ -60,16 +75,23 @@ s3state_init(struct wire_requestqueue * Q_S3, const char * bucket,
 		goto err0;
 	S->Q_S3 = Q_S3;
 	S->D = D;
+	S->BC = BC;
 	S->blklen = blklen;
 	S->npending = 0;
 
+	/* Create a ring for recently appended blocks if we want one. */
+	S->ring = NULL;
+	if ((ringlen > 0) &&
+	    ((S->ring = blkring_init(ringlen / blklen, blklen)) == NULL))
+		goto err1;
+
 	/* Duplicate bucket name string. */
 	if ((S->bucket = strdup(bucket)) == NULL)
-		goto err1;
+		goto err2;
 
 	/* Find the last written (non-empty) object and its size. */
 	if (findlast(Q_S3, bucket, &L, &olen))
-		goto err2;
+		goto err3;
 
 	/* If we have no objects stored, just set initial values. */
 	if (L == 0) {
@@ -81,7 +103,7 @@ s3state_init(struct wire_requestqueue * Q_S3, const char * bucket,
 	/* The object size should be a multiple of the block size. */
 	if (olen % blklen != 0) {
 		warn0("S3 object size is not a multiple of the block size!");
-		goto err2;
+		goto err3;
 	}
 
 	/* Compute the last block #. */
@@ -96,19 +118,25 @@ s3state_init(struct wire_requestqueue * Q_S3, const char * bucket,
 	putdone = 0;
 	if (proto_s3_request_put(S->Q_S3, S->bucket,
 	    objmap(L + 1), 0, NULL, callback_putdone, &putdone))
-		goto err2;
+		goto err3;
 	if (events_spin(&putdone))
-		goto err2;
+		goto err3;
 
 	/* The next block # is the start of object #(L+2). */
 	S->nextblk = (L + 1) * BLKSPEROBJECT;
 
 done:
+	/* Make sure the block cache doesn't hold another store's blocks. */
+	if (S->BC != NULL)
+		blkcache_setlast(S->BC, S->lastblk);
+
 	/* Success! */
 	return (S);
 
-err2:
+err3:
 	free(S->bucket);
+err2:
+	blkring_free(S->ring);
 err1:
 	free(S);
 err0:
@@ -150,6 +178,39 @@ s3state_get(struct s3state * S, struct proto_lbs_request * R,
 	C->R = R;
 	C->callback = callback;
 	C->cookie = cookie;
+	C->buf = NULL;
+
+	/* If we appended the block recently, we still have it. */
+	if (S->ring != NULL) {
+		if ((C->buf = malloc(S->blklen)) == NULL)
+			goto err1;
+		if (blkring_get(S->ring, R->r.get.blkno, C->buf) == 0) {
+			if (events_immediate_register(callback_get_cached,
+			    C, 0) == NULL)
+				goto err2;
+			goto sent;
+		}
+	}
+
+	/* If the block is in the local cache, we don't need to ask S3. */
+	if (S->BC != NULL) {
+		if ((C->buf == NULL) &&
+		    ((C->buf = malloc(S->blklen)) == NULL))
+			goto err1;
+		switch (blkcache_get(S->BC, R->r.get.blkno, C->buf)) {
+		case -1:
+			goto err2;
+		case 0:
+			if (events_immediate_register(callback_get_cached,
+			    C, 0) == NULL)
+				goto err2;
+			goto sent;
+		}
+	}
+
+	/* We're going to ask S3 for the block. */
+	free(C->buf);
+	C->buf = NULL;
 
 	/* Send the S3 request. */
 	if (proto_s3_request_range(S->Q_S3, S->bucket,
@@ -158,12 +219,15 @@ s3state_get(struct s3state * S, struct proto_lbs_request * R,
 	    callback_get, C))
 		goto err1;
 
+sent:
 	/* We will be performing a callback later. */
 	S->npending += 1;
 
 	/* Success! */
 	return (0);
 
+err2:
+	free(C->buf);
 err1:
 	free(C);
 err0:
@@ -171,6 +235,16 @@ err0:
 	return (-1);
 }
 
+/* Callback for GETs performed by s3state_get from memory or the cache. */
+static int
+callback_get_cached(void * cookie)
+{
+	struct get_cookie * C = cookie;
+
+	/* Pretend that S3 gave us the block. */
+	return (callback_get(C, 0, C->S->blklen, C->buf));
+}
+
 /* Callback for S3 RANGEs performed by s3state_get. */
 static int
 callback_get(void * cookie, int failed, size_t buflen, const uint8_t * buf)
@@ -183,6 +257,12 @@ callback_get(void * cookie, int failed, size_t buflen, const uint8_t * buf)
 	if ((failed != 0) || (buflen != S->blklen))
 		buf = NULL;
 
+	/* Remember a block we read from S3. */
+	if ((buf != NULL) && (C->buf == NULL) && (S->BC != NULL)) {
+		if (blkcache_put(S->BC, C->R->r.get.blkno, buf))
+			goto err0;
+	}
+
 	/* Tell the dispatcher to send its response back. */
 	rc = (C->callback)(C->cookie, C->R, buf, buflen);
 
@@ -190,10 +270,18 @@ callback_get(void * cookie, int failed, size_t buflen, const uint8_t * buf)
 	S->npending -= 1;
 
 	/* Free our cookie. */
+	free(C->buf);
 	free(C);
 
 	/* Return status from callback. */
 	return (rc);
+
+err0:
+	free(C->buf);
+	free(C);
+
+	/* Failure! */
+	return (-1);
 }
 
 /**
@@ -221,11 +309,19 @@ s3state_append(struct s3state * S, struct proto_lbs_request * R,
 	assert(R->r.append.blkno % BLKSPEROBJECT == 0);
 
 	/* Send the S3 request. */
-	if (proto_s3_request_put(S->Q_S3, S->bucket,
-	    objmap(BLK2OBJECT(R->r.append.blkno)),
-	    R->r.append.nblks * S->blklen, R->r.append.buf,
-	    callback_append, C))
-		goto err1;
+	if (R->r.append.nblks * S->blklen > PARTLEN) {
+		if (proto_s3_request_mput(S->Q_S3, S->bucket,
+		    objmap(BLK2OBJECT(R->r.append.blkno)), PARTLEN,
+		    R->r.append.nblks * S->blklen, R->r.append.buf,
+		    callback_append, C))
+			goto err1;
+	} else {
+		if (proto_s3_request_put(S->Q_S3, S->bucket,
+		    objmap(BLK2OBJECT(R->r.append.blkno)),
+		    R->r.append.nblks * S->blklen, R->r.append.buf,
+		    callback_append, C))
+			goto err1;
+	}
 
 	/* We will be performing a callback later. */
 	S->npending += 1;
@@ -240,18 +336,31 @@ err0:
 	return (-1);
 }
 
-/* Callback for S3 PUTs performed by s3state_append. */
+/* Callback for S3 PUTs and MPUTs performed by s3state_append. */
 static int
 callback_append(void * cookie, int failed)
 {
 	struct append_cookie * C = cookie;
 	struct s3state * S = C->S;
+	size_t i;
 	int rc;
 
 	/* If S3 isn't talking to us, we're screwed. */
 	if (failed)
 		goto err1;
 
+	/* The blocks are in S3 now, so they can go into the local cache. */
+	for (i = 0; (S->BC != NULL) && (i < C->R->r.append.nblks); i++) {
+		if (blkcache_put(S->BC, C->R->r.append.blkno + i,
+		    &C->R->r.append.buf[i * S->blklen]))
+			goto err1;
+	}
+
+	/* Keep a copy of the blocks in memory too. */
+	if (S->ring != NULL)
+		blkring_add(S->ring, C->R->r.append.blkno,
+		    C->R->r.append.nblks, C->R->r.append.buf);
+
 	/* Update the last-block and next-block values based on this append. */
 	S->nextblk = C->R->r.append.blkno + BLKSPEROBJECT;
 	S->lastblk = C->R->r.append.blkno + C->R->r.append.nblks - 1;
@@ -284,6 +393,12 @@ int
 s3state_gc(struct s3state * S, uint64_t blkno)
 {
 
+	/* The local cache and the ring can drop these blocks. */
+	if (S->BC != NULL)
+		blkcache_gc(S->BC, blkno);
+	if (S->ring != NULL)
+		blkring_gc(S->ring, blkno);
+
 	/* We can delete objects below the one which blkno belongs to. */
 	return (deleteto_deleteto(S->D, BLK2OBJECT(blkno)));
 }
@@ -301,6 +416,7 @@ s3state_free(struct s3state * S)
 	assert(S->npending == 0);
 
 	/* Free allocations. */
+	blkring_free(S->ring);
 	free(S->bucket);
 	free(S);
 }
@@ -2,6 +2,8 @@
 #define _S3STATE_H_
 
 /* Opaque types. */
+struct blkcache;
+struct blkring;
 struct deleteto;
 struct proto_lbs_request;
 struct wire_requestqueue;
@@ -12,24 +14,30 @@ struct s3state {
 	uint32_t blklen;	/* Block size. */
 	uint64_t nextblk;	/* Next available block #. */
 	uint64_t lastblk;	/* Last written block #. */
+	struct blkring * ring;	/* Recently appended blocks, or NULL. */
 
 	/* Internal data. */
 	struct wire_requestqueue * Q_S3;	/* Connected to S3 daemon. */
 	struct deleteto * D;	/* DeleteTo state. */
+	struct blkcache * BC;	/* Local block cache, or NULL. */
 	char * bucket;		/* Bucket name. */
 	size_t npending;	/* Callbacks not performed yet. */
 };
 
 /**
- * s3state_init(Q_S3, bucket, blklen, D):
+ * s3state_init(Q_S3, bucket, blklen, D, BC, ringlen):
  * Initialize the S3 state for bucket ${bucket} containing blocks of length
  * ${blklen} bytes by sending S3 requests via the request queue ${Q_S3}.  Use
- * the DeleteTo state ${D} for handling garbage collection requests.  Return a
- * state which can be passed to other s3state_* functions.  This function may
- * call events_run internally.
+ * the DeleteTo state ${D} for handling garbage collection requests.  If
+ * ${BC} is not NULL, serve GETs from that block cache where possible, and
+ * add blocks to it when they are read or appended.  If ${ringlen} is
+ * non-zero, keep up to ${ringlen} bytes of the most recently appended blocks
+ * in memory and serve GETs for them without asking S3.  Return a state which
+ * can be passed to other s3state_* functions.  This function may call
+ * events_run internally.
  */
 struct s3state * s3state_init(struct wire_requestqueue *, const char *,
-    size_t, struct deleteto *);
+    size_t, struct deleteto *, struct blkcache *, size_t);
 
 /**
  * s3state_get(S, R, callback, cookie):
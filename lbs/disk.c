@@ -1,3 +1,8 @@
+#ifdef __linux__
+/* We need fallocate(2) and FALLOC_FL_PUNCH_HOLE, which are not in POSIX. */
+#define _GNU_SOURCE
+#endif
+
 #include <sys/types.h>
 #include <sys/stat.h>
 
@@ -12,6 +17,11 @@
 
 #include "disk.h"
 
+/* Can we punch holes in files? */
+#if defined(__linux__) && defined(FALLOC_FL_PUNCH_HOLE)
+#define HAVE_PUNCH_HOLE
+#endif
+
 /* Use O_BINARY when opening files in order to keep windows happy. */
 #ifndef O_BINARY
 #define O_BINARY 0
@@ -198,3 +208,75 @@ err0:
 	/* Failure! */
 	return (-1);
 }
+
+/**
+ * disk_punch(path, offset, nbytes):
+ * Deallocate the storage used by ${nbytes} bytes at position ${offset} in
+ * the file ${path} without changing the size of the file.  Subsequent reads
+ * from the range will return zeroes.  If the operating system or filesystem
+ * does not support this, do nothing.  If the file ${path} does not exist,
+ * fail and return with errno set to ENOENT.
+ */
+int
+disk_punch(const char * path, off_t offset, off_t nbytes)
+{
+#ifdef HAVE_PUNCH_HOLE
+	int fd;
+
+	/* Attempt to open the file. */
+	while ((fd = open(path, O_WRONLY | O_BINARY)) == -1) {
+		/* Try again on EINTR. */
+		if (errno == EINTR)
+			continue;
+
+		/* Fail without printing a warning on ENOENT. */
+		if (errno == ENOENT)
+			goto err0;
+
+		/* Print a warning and fail for anything else. */
+		warnp("open(%s)", path);
+		goto err0;
+	}
+
+	/*
+	 * Punch a hole, ignoring kernels and filesystems which don't support
+	 * it; depending on where the support is missing, we get EOPNOTSUPP,
+	 * ENOSYS, or EINVAL.
+	 */
+	while (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+	    offset, nbytes)) {
+		if (errno == EINTR)
+			continue;
+		if ((errno == EOPNOTSUPP) || (errno == ENOSYS) ||
+		    (errno == EINVAL))
+			break;
+		warnp("fallocate(%s, %" PRIu64 ", %" PRIu64 ")", path,
+		    (uint64_t)(offset), (uint64_t)(nbytes));
+		goto err1;
+	}
+
+	/* Close the file. */
+	while (close(fd)) {
+		if (errno != EINTR) {
+			warnp("close(%s)", path);
+			goto err0;
+		}
+	}
+
+	/* Success! */
+	return (0);
+
+err1:
+	close(fd);
+err0:
+	/* Failure! */
+	return (-1);
+#else
+	(void)path; /* UNUSED */
+	(void)offset; /* UNUSED */
+	(void)nbytes; /* UNUSED */
+
+	/* Nothing to do. */
+	return (0);
+#endif
+}
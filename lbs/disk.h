@@ -30,4 +30,14 @@ int disk_read(const char *, off_t, size_t, uint8_t *);
  */
 int disk_write(const char *, int, size_t, const uint8_t *, int);
 
+/**
+ * disk_punch(path, offset, nbytes):
+ * Deallocate the storage used by ${nbytes} bytes at position ${offset} in
+ * the file ${path} without changing the size of the file.  Subsequent reads
+ * from the range will return zeroes.  If the operating system or filesystem
+ * does not support this, do nothing.  If the file ${path} does not exist,
+ * fail and return with errno set to ENOENT.
+ */
+int disk_punch(const char *, off_t, off_t);
+
 #endif /* !_DISK_H_ */
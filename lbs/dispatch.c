@@ -1,5 +1,6 @@
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/time.h>
 #include <sys/un.h>
 
 #include <assert.h>
@@ -7,9 +8,12 @@
 #include <stdlib.h>
 #include <unistd.h>
 
+#include "elasticqueue.h"
 #include "imalloc.h"
+#include "monoclock.h"
 #include "netbuf.h"
 #include "network.h"
+#include "opstats.h"
 #include "proto_lbs.h"
 #include "wire.h"
 #include "warnp.h"
@@ -21,6 +25,32 @@
 
 static int callback_accept(void *, int);
 
+/*
+ * Record that a request of type ${type} which arrived at ${t_arrive} and
+ * started being serviced at ${t_start} has been completed.
+ */
+static int
+record(struct dispatch_state * D, uint32_t type,
+    const struct timeval * t_arrive, const struct timeval * t_start)
+{
+	struct timeval t_done;
+
+	/* What time is it now? */
+	if (monoclock_get(&t_done))
+		goto err0;
+
+	/* Record the request latency. */
+	if (opstats_record(D->stats, type, t_arrive, t_start, &t_done))
+		goto err0;
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
 /* The ID of a thread with completed work has been read (or not). */
 static int
 workdone(void * cookie, ssize_t lenread)
@@ -40,9 +70,23 @@ workdone(void * cookie, ssize_t lenread)
 	if (dispatch_response_send(D, D->workers[D->wakeupID]))
 		goto err0;
 
+	/*
+	 * Record the latency of GETs and APPENDs; FREEs were recorded when
+	 * they were acknowledged.
+	 */
+	if ((D->wakeupID <= D->nreaders) && record(D,
+	    (D->wakeupID < D->nreaders) ? PROTO_LBS_GET : PROTO_LBS_APPEND,
+	    &D->worktimes[D->wakeupID].t_arrive,
+	    &D->worktimes[D->wakeupID].t_start))
+		goto err0;
+
 	/* Mark the thread as available for more work. */
 	if (D->wakeupID == D->nreaders + 1) {
 		D->deleter_busy = 0;
+
+		/* Free any block ranges which are waiting. */
+		if (dispatch_request_pokefreeq(D))
+			goto err0;
 	} else if (D->wakeupID == D->nreaders) {
 		D->writer_busy = 0;
 	} else {
@@ -103,6 +147,7 @@ gotrequest(void * cookie, int status)
 {
 	struct dispatch_state * D = cookie;
 	struct proto_lbs_request * R;
+	uint32_t type;
 
 	/* We're no longer waiting for a packet to arrive. */
 	D->read_cookie = NULL;
@@ -111,6 +156,10 @@ gotrequest(void * cookie, int status)
 	if (status)
 		goto drop;
 
+	/* Requests read now are considered to have arrived now. */
+	if (monoclock_get(&D->t_read))
+		goto err0;
+
 	/* Read packets until there are no more or an error occurs. */
 	do {
 		/* Allocate space for a request. */
@@ -129,7 +178,7 @@ gotrequest(void * cookie, int status)
 		D->npending += 1;
 
 		/* Handle and free the request. */
-		switch (R->type) {
+		switch ((type = R->type)) {
 		case PROTO_LBS_PARAMS:
 			if (dispatch_request_params(D, R))
 				goto err0;
@@ -143,6 +192,7 @@ gotrequest(void * cookie, int status)
 				goto err0;
 			break;
 		case PROTO_LBS_APPEND:
+		case PROTO_LBS_APPEND2:
 			/* Make sure the (implied) block length is correct. */
 			if (R->r.append.blklen != D->blocklen) {
 				free(R->r.append.buf);
@@ -156,10 +206,24 @@ gotrequest(void * cookie, int status)
 			if (dispatch_request_free(D, R))
 				goto err0;
 			break;
+		case PROTO_LBS_FREE_RANGE:
+			if (dispatch_request_free_range(D, R))
+				goto err0;
+			break;
+		case PROTO_LBS_STATS:
+			if (dispatch_request_stats(D, R))
+				goto err0;
+			break;
 		default:
 			/* proto_lbs_request_read broke. */
 			assert(0);
 		}
+
+		/* Requests other than GET and APPEND have been answered. */
+		if ((type != PROTO_LBS_GET) && (type != PROTO_LBS_APPEND) &&
+		    (type != PROTO_LBS_APPEND2) &&
+		    record(D, type, &D->t_read, &D->t_read))
+			goto err0;
 	} while (1);
 
 	/* Free the (unused) request structure. */
@@ -216,16 +280,26 @@ dispatch_init(struct storage_state * S, size_t blocklen, size_t nreaders)
 	for (i = 0; i < D->nreaders; i++)
 		D->readers_idle[i] = i;
 
+	/* Nothing has been appended yet. */
+	for (i = 0; i < PROTO_LBS_NSTREAMS; i++)
+		D->nblks_stream[i] = 0;
+
+	/* Create latency statistics and per-thread request timings. */
+	if ((D->stats = opstats_init()) == NULL)
+		goto err2;
+	if (IMALLOC(D->worktimes, D->nreaders + 2, struct worktime))
+		goto err3;
+
 	/* Create a socket pair for sending work completion messages. */
 	if (socketpair(AF_UNIX, SOCK_STREAM, 0, D->spair)) {
 		warnp("socketpair");
-		goto err2;
+		goto err4;
 	}
 
 	/* Mark the read end of the socket pair as non-blocking. */
 	if (fcntl(D->spair[0], F_SETFL, O_NONBLOCK) == -1) {
 		warnp("Cannot make wakeup socket non-blocking");
-		goto err3;
+		goto err5;
 	}
 
 	/* Read work completion messages from the socket. */
@@ -233,14 +307,14 @@ dispatch_init(struct storage_state * S, size_t blocklen, size_t nreaders)
 	    (uint8_t *)&D->wakeupID, sizeof(size_t), sizeof(size_t),
 	    workdone, D)) == NULL) {
 		warnp("Error reading thread ID from socket");
-		goto err3;
+		goto err5;
 	}
 
 	/* Create worker threads. */
 	nworkers = D->nreaders + 2;
 	if (IMALLOC(D->workers, nworkers, struct workctl *)) {
 		warnp("malloc");
-		goto err4;
+		goto err6;
 	}
 	for (i = 0; i < nworkers; i++)
 		D->workers[i] = NULL;
@@ -248,25 +322,33 @@ dispatch_init(struct storage_state * S, size_t blocklen, size_t nreaders)
 		if ((D->workers[i] =
 		    worker_create(i, S, D->spair[1])) == NULL) {
 			warnp("Cannot create worker thread");
-			goto err5;
+			goto err7;
 		}
 	}
 
+	/* We don't have any block ranges to free yet. */
+	if ((D->freeq = elasticqueue_init(sizeof(struct freerange))) == NULL)
+		goto err7;
+
 	/* Success! */
 	return (D);
 
-err5:
+err7:
 	for (i = 0; i < nworkers; i++) {
 		if (D->workers[i] == NULL)
 			continue;
 		worker_kill(D->workers[i]);
 	}
 	free(D->workers);
-err4:
+err6:
 	network_read_cancel(D->wakeup_cookie);
-err3:
+err5:
 	close(D->spair[1]);
 	close(D->spair[0]);
+err4:
+	free(D->worktimes);
+err3:
+	opstats_free(D->stats);
 err2:
 	free(D->readers_idle);
 err1:
@@ -445,6 +527,9 @@ dispatch_done(struct dispatch_state * D)
 	}
 
 	/* Free allocated memory. */
+	elasticqueue_free(D->freeq);
+	free(D->worktimes);
+	opstats_free(D->stats);
 	free(D->readers_idle);
 	free(D);
 
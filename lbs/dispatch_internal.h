@@ -1,11 +1,17 @@
 #ifndef _DISPATCH_INTERNAL_H_
 #define _DISPATCH_INTERNAL_H_
 
+#include <sys/time.h>
+
 #include <stdint.h>
 
+#include "proto_lbs.h"
+
 /* Opaque types. */
+struct elasticqueue;
 struct netbuf_read;
 struct netbuf_write;
+struct opstats;
 struct proto_lbs_request;
 struct storage_state;
 
@@ -14,6 +20,19 @@ struct readq {
 	struct readq * next;		/* Next pending read. */
 	uint64_t reqID;			/* Packet ID of GET request. */
 	uint64_t blkno;			/* Requested block #. */
+	struct timeval t_arrive;	/* When the request was read. */
+};
+
+/* Range of blocks waiting to be freed. */
+struct freerange {
+	uint64_t blkno;			/* First block # to free. */
+	uint64_t nblks;			/* # of blocks to free. */
+};
+
+/* Timing of the request a worker thread is handling. */
+struct worktime {
+	struct timeval t_arrive;	/* When the request was read. */
+	struct timeval t_start;		/* When the work was assigned. */
 };
 
 /* State of the work dispatcher. */
@@ -48,6 +67,15 @@ struct dispatch_state {
 	/* Pending work. */
 	struct readq * readq_head;	/* Queue of pending reads. */
 	struct readq ** readq_tail;	/* Location of terminating NULL. */
+	struct elasticqueue * freeq;	/* Queue of pending FREERANGEs. */
+
+	/* Request latency statistics. */
+	struct opstats * stats;		/* Latency histograms. */
+	struct worktime * worktimes;	/* Indexed by thread #. */
+	struct timeval t_read;		/* When requests were last read. */
+
+	/* Blocks appended via each append stream. */
+	uint64_t nblks_stream[PROTO_LBS_NSTREAMS];
 };
 
 /**
@@ -86,7 +114,7 @@ int dispatch_request_pokereadq(struct dispatch_state *);
 
 /**
  * dispatch_request_append(dstate, R):
- * Handle and free a APPEND request.
+ * Handle and free an APPEND or APPEND2 request.
  */
 int dispatch_request_append(struct dispatch_state *,
     struct proto_lbs_request *);
@@ -98,4 +126,24 @@ int dispatch_request_append(struct dispatch_state *,
 int dispatch_request_free(struct dispatch_state *,
     struct proto_lbs_request *);
 
+/**
+ * dispatch_request_free_range(dstate, R):
+ * Handle and free a FREERANGE request.
+ */
+int dispatch_request_free_range(struct dispatch_state *,
+    struct proto_lbs_request *);
+
+/**
+ * dispatch_request_pokefreeq(dstate):
+ * Launch a queued FREERANGE if possible.
+ */
+int dispatch_request_pokefreeq(struct dispatch_state *);
+
+/**
+ * dispatch_request_stats(dstate, R):
+ * Handle and free a STATS request.
+ */
+int dispatch_request_stats(struct dispatch_state *,
+    struct proto_lbs_request *);
+
 #endif /* !_DISPATCH_INTERNAL_H_ */
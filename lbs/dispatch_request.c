@@ -1,5 +1,8 @@
 #include <stdlib.h>
 
+#include "elasticqueue.h"
+#include "monoclock.h"
+#include "opstats.h"
 #include "proto_lbs.h"
 #include "warnp.h"
 
@@ -102,6 +105,7 @@ dispatch_request_get(struct dispatch_state * dstate,
 	rq->next = NULL;
 	rq->reqID = R->ID;
 	rq->blkno = R->r.get.blkno;
+	rq->t_arrive = dstate->t_read;
 	if (dstate->readq_head == NULL)
 		dstate->readq_head = rq;
 	else
@@ -134,6 +138,7 @@ dispatch_request_pokereadq(struct dispatch_state * dstate)
 {
 	struct readq * R;
 	struct workctl * reader;
+	struct worktime * T;
 	uint8_t * buf;
 
 	/* Loop as long as we can launch a read. */
@@ -148,8 +153,15 @@ dispatch_request_pokereadq(struct dispatch_state * dstate)
 		/* Grab an idle reader. */
 		reader = dstate->workers[
 		    dstate->readers_idle[dstate->nreaders_idle - 1]];
+		T = &dstate->worktimes[
+		    dstate->readers_idle[dstate->nreaders_idle - 1]];
 		dstate->nreaders_idle -= 1;
 
+		/* Record when this read arrived and when it started. */
+		T->t_arrive = R->t_arrive;
+		if (monoclock_get(&T->t_start))
+			goto err1;
+
 		/* Give the reader the work. */
 		if (worker_assign(reader, 0, R->blkno, 0, buf, R->reqID))
 			goto err1;
@@ -174,13 +186,14 @@ err0:
 
 /**
  * dispatch_request_append(dstate, R):
- * Handle and free a APPEND request.
+ * Handle and free an APPEND or APPEND2 request.
  */
 int
 dispatch_request_append(struct dispatch_state * dstate,
     struct proto_lbs_request * R)
 {
 	struct workctl * writer = dstate->workers[dstate->nreaders];
+	struct worktime * T = &dstate->worktimes[dstate->nreaders];
 	uint64_t blkno;
 
 	/* Figure out what the first available block number is. */
@@ -199,6 +212,12 @@ dispatch_request_append(struct dispatch_state * dstate,
 			goto err1;
 	}
 
+	/* Appends are never queued; they start as soon as they arrive. */
+	T->t_arrive = T->t_start = dstate->t_read;
+
+	/* Record which stream these blocks came from. */
+	dstate->nblks_stream[R->r.append.stream] += R->r.append.nblks;
+
 	/* Give the writer the work. */
 	dstate->writer_busy = 1;
 	if (worker_assign(writer, 1, R->r.append.blkno, R->r.append.nblks,
@@ -259,3 +278,124 @@ err1:
 	/* Failure! */
 	return (-1);
 }
+
+/**
+ * dispatch_request_free_range(dstate, R):
+ * Handle and free a FREERANGE request.
+ */
+int
+dispatch_request_free_range(struct dispatch_state * dstate,
+    struct proto_lbs_request * R)
+{
+	struct freerange fr;
+
+	/*
+	 * Unlike FREEs, which are repeated as the set of blocks to free grows,
+	 * FREERANGEs are only sent once; so rather than dropping them if the
+	 * deleter is busy, add them to a queue.
+	 */
+	fr.blkno = R->r.free_range.blkno;
+	fr.nblks = R->r.free_range.nblks;
+	if (elasticqueue_add(dstate->freeq, &fr))
+		goto err1;
+
+	/* Launch the work if possible. */
+	if (dispatch_request_pokefreeq(dstate))
+		goto err1;
+
+	/*
+	 * Send an ACK to the request.  FREERANGEs are advisory, so we don't
+	 * need to wait until we succeed before responding.
+	 */
+	dstate->npending--;
+	if (proto_lbs_response_free_range(dstate->writeq, R->ID))
+		goto err1;
+
+	/* Free the request. */
+	free(R);
+
+	/* Success! */
+	return (0);
+
+err1:
+	free(R);
+
+	/* Failure! */
+	return (-1);
+}
+
+/**
+ * dispatch_request_pokefreeq(dstate):
+ * Launch a queued FREERANGE if possible.
+ */
+int
+dispatch_request_pokefreeq(struct dispatch_state * dstate)
+{
+	struct workctl * deleter = dstate->workers[dstate->nreaders + 1];
+	struct freerange * fr;
+
+	/* If the deleter is busy or we have nothing to do, return. */
+	if (dstate->deleter_busy ||
+	    ((fr = elasticqueue_get(dstate->freeq, 0)) == NULL))
+		goto done;
+
+	/* Give the deleter the work. */
+	dstate->deleter_busy = 1;
+	if (worker_assign(deleter, 3, fr->blkno, fr->nblks, NULL, 0))
+		goto err0;
+
+	/* Remove the range from the queue. */
+	elasticqueue_delete(dstate->freeq);
+
+done:
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/**
+ * dispatch_request_stats(dstate, R):
+ * Handle and free a STATS request.
+ */
+int
+dispatch_request_stats(struct dispatch_state * dstate,
+    struct proto_lbs_request * R)
+{
+	uint8_t * buf;
+	size_t buflen;
+
+	/* Record how many blocks each append stream has written. */
+	if (opstats_counter(dstate->stats, PROTO_LBS_CTR_BLKS_USER,
+	    dstate->nblks_stream[PROTO_LBS_STREAM_USER]))
+		goto err1;
+	if (opstats_counter(dstate->stats, PROTO_LBS_CTR_BLKS_CLEANER,
+	    dstate->nblks_stream[PROTO_LBS_STREAM_CLEANER]))
+		goto err1;
+
+	/* Serialize the latency statistics. */
+	if (opstats_serialize(dstate->stats, &buf, &buflen))
+		goto err1;
+
+	/* Send the response packet back. */
+	dstate->npending--;
+	if (proto_lbs_response_stats(dstate->writeq, R->ID, buf, buflen))
+		goto err2;
+
+	/* Free the serialized statistics and the request structure. */
+	free(buf);
+	free(R);
+
+	/* Success! */
+	return (0);
+
+err2:
+	free(buf);
+err1:
+	free(R);
+
+	/* Failure! */
+	return (-1);
+}
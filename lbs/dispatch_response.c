@@ -72,6 +72,9 @@ dispatch_response_send(struct dispatch_state * dstate, struct workctl * thread)
 		 * before the work was assigned to a thread.
 		 */
 		break;
+	case 3:	/* free range operation. */
+		/* As with FREE, a response has already been sent. */
+		break;
 	default:
 		warn0("invalid work type: %d", op);
 		goto err0;
@@ -458,6 +458,77 @@ err0:
 	return (-1);
 }
 
+/**
+ * storage_free_range(S, blkno, nblks):
+ * Using storage state ${S}, release the disk space used by none, some, or
+ * all of the ${nblks} blocks starting at block ${blkno}.  The contents of
+ * those blocks are undefined afterwards.  There MUST NOT at any time be more
+ * than one thread calling this function or storage_delete.
+ */
+int
+storage_free_range(struct storage_state * S, uint64_t blkno, uint64_t nblks)
+{
+	struct file_state * fs;
+	uint64_t fileno, start, end;
+	size_t i;
+	char * s;
+
+	/*
+	 * Look at each file in turn.  We drop the lock while punching holes;
+	 * but since files are only ever deleted by storage_delete, which we
+	 * are not racing against, and are only ever added at the end of the
+	 * queue, the index of each file remains valid.
+	 */
+	for (i = 0; ; i++) {
+		/* Grab a read lock. */
+		if (storage_util_readlock(S))
+			goto err0;
+
+		/* If we've run out of files, we're done. */
+		if ((fs = elasticqueue_get(S->files, i)) == NULL)
+			break;
+
+		/* If this file starts after the range, we're done. */
+		if (fs->start >= blkno + nblks)
+			break;
+
+		/* Figure out which part of the range lies in this file. */
+		fileno = fs->start;
+		start = (blkno > fs->start) ? blkno : fs->start;
+		end = (blkno + nblks < fs->start + fs->len) ?
+		    blkno + nblks : fs->start + fs->len;
+
+		/* Release the lock. */
+		if (storage_util_unlock(S))
+			goto err0;
+
+		/* Skip files which precede the range. */
+		if (start >= end)
+			continue;
+
+		/* Punch a hole in the file. */
+		if ((s = storage_util_mkpath(S, fileno)) == NULL)
+			goto err0;
+		if (disk_punch(s, (off_t)((start - fileno) * S->blocklen),
+		    (off_t)((end - start) * S->blocklen)))
+			goto err1;
+		free(s);
+	}
+
+	/* Release the lock. */
+	if (storage_util_unlock(S))
+		goto err0;
+
+	/* Success! */
+	return (0);
+
+err1:
+	free(s);
+err0:
+	/* Failure! */
+	return (-1);
+}
+
 /**
  * storage_done(S):
  * Free the storage state data ${S}.
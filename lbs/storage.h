@@ -44,6 +44,15 @@ int storage_write(struct storage_state *, uint64_t, uint64_t, uint8_t *);
  */
 int storage_delete(struct storage_state *, uint64_t);
 
+/**
+ * storage_free_range(S, blkno, nblks):
+ * Using storage state ${S}, release the disk space used by none, some, or
+ * all of the ${nblks} blocks starting at block ${blkno}.  The contents of
+ * those blocks are undefined afterwards.  There MUST NOT at any time be more
+ * than one thread calling this function or storage_delete.
+ */
+int storage_free_range(struct storage_state *, uint64_t, uint64_t);
+
 /**
  * storage_done(S):
  * Free the storage state data ${S}.
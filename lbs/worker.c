@@ -28,10 +28,12 @@ struct workctl {
 	struct storage_state * sstate;	/* Storage state. */
 
 	/* Work to be done. */
-	int op;			/* 0 = read, 1 = write, 2 = free. */
+	int op;			/* 0 = read, 1 = write, 2 = free, */
+				/* 3 = free range. */
 	uint64_t blkno;		/* Block to read, first block to write, */
-				/* or first block to NOT delete. */
-	size_t nblks;		/* Number of blocks to write. */
+				/* first block to NOT delete, or first */
+				/* block to free. */
+	size_t nblks;		/* Number of blocks to write or free. */
 				/* Number of blocks successfully read. */
 	uint8_t * buf;		/* Buffer to read/write into/from. */
 	uint64_t reqID;		/* ID of request (not used by worker). */
@@ -92,6 +94,15 @@ workthread(void * cookie)
 				exit(1);
 			}
 			break;
+		case 3:	/* Free range */
+			/*
+			 * The blocks are already garbage, so failing to free
+			 * them just means we keep using the disk space.
+			 */
+			if (storage_free_range(ctl->sstate,
+			    ctl->blkno, ctl->nblks))
+				warnp("Failure freeing blocks");
+			break;
 		default:
 			warn0("Invalid op: %d", ctl->op);
 		}
@@ -0,0 +1,533 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "asprintf.h"
+#include "hexify.h"
+#include "insecure_memzero.h"
+#include "sha256.h"
+#include "warnp.h"
+
+#include "aws_sign_cache.h"
+
+/* Signing key derived for a (date, region, service) tuple. */
+struct aws_sign_cache {
+	char date[9];
+	char * region;			/* NULL if no key is cached. */
+	char * service;
+	uint8_t kSigning[32];
+};
+
+/* Derive the signing key ${kSigning} for (${date}, ${region}, ${service}). */
+static int
+derivekey(const char * key_secret, const char * date, const char * region,
+    const char * service, uint8_t kSigning[32])
+{
+	char * AWS4_key;
+	uint8_t kDate[32];
+	uint8_t kRegion[32];
+	uint8_t kService[32];
+
+	/* Construct "AWS4" + key_secret. */
+	if (asprintf(&AWS4_key, "AWS4%s", key_secret) == -1)
+		goto err0;
+
+	/* kDate = HMAC("AWS4" + kSecret, Date). */
+	HMAC_SHA256_Buf(AWS4_key, strlen(AWS4_key), date, strlen(date), kDate);
+
+	/* kRegion = HMAC(kDate, Region). */
+	HMAC_SHA256_Buf(kDate, 32, region, strlen(region), kRegion);
+
+	/* kService = HMAC(kRegion, Service). */
+	HMAC_SHA256_Buf(kRegion, 32, service, strlen(service), kService);
+
+	/* kSigning = HMAC(kService, "aws4_request"). */
+	HMAC_SHA256_Buf(kService, 32, "aws4_request", strlen("aws4_request"),
+	    kSigning);
+
+	/* Free string allocated by asprintf. */
+	insecure_memzero(AWS4_key, strlen(AWS4_key));
+	free(AWS4_key);
+
+	/* Clean up the intermediate keys. */
+	insecure_memzero(kDate, 32);
+	insecure_memzero(kRegion, 32);
+	insecure_memzero(kService, 32);
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Forget any signing key stored in the cache ${C}. */
+static void
+cache_clear(struct aws_sign_cache * C)
+{
+
+	/* Free strings. */
+	free(C->region);
+	free(C->service);
+	C->region = C->service = NULL;
+
+	/* Zero the cached key. */
+	insecure_memzero(C->kSigning, 32);
+}
+
+/* Look up or derive the signing key, using and updating the cache ${C}. */
+static int
+getkey(struct aws_sign_cache * C, const char * key_secret, const char * date,
+    const char * region, const char * service, uint8_t kSigning[32])
+{
+
+	/* If we have no cache, just derive the key. */
+	if (C == NULL)
+		return (derivekey(key_secret, date, region, service, kSigning));
+
+	/* Use the cached key if it is for the right date/region/service. */
+	if ((C->region != NULL) && (strcmp(C->date, date) == 0) &&
+	    (strcmp(C->region, region) == 0) &&
+	    (strcmp(C->service, service) == 0)) {
+		memcpy(kSigning, C->kSigning, 32);
+		return (0);
+	}
+
+	/* Derive a new key. */
+	cache_clear(C);
+	if (derivekey(key_secret, date, region, service, kSigning))
+		goto err0;
+
+	/* Store it in the cache. */
+	if ((C->region = strdup(region)) == NULL)
+		goto err0;
+	if ((C->service = strdup(service)) == NULL)
+		goto err1;
+	memcpy(C->date, date, 9);
+	memcpy(C->kSigning, kSigning, 32);
+
+	/* Success! */
+	return (0);
+
+err1:
+	free(C->region);
+	C->region = NULL;
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Sign the Canonical Request ${creq}; write the hex signature to ${sigbuf}. */
+static int
+aws_sign(struct aws_sign_cache * C, const char * key_secret,
+    const char * date, const char * datetime, const char * region,
+    const char * service, const char * creq, char sigbuf[65])
+{
+	uint8_t kSigning[32];
+	uint8_t h_creq[32];
+	char hhex_creq[65];
+	char * STS;
+	uint8_t hmac[32];
+
+	/* Get the signing key. */
+	if (getkey(C, key_secret, date, region, service, kSigning))
+		goto err1;
+
+	/* Generate the hexified hash of the Canonical Request string. */
+	SHA256_Buf(creq, strlen(creq), h_creq);
+	hexify(h_creq, hhex_creq, 32);
+
+	/* Construct the String to Sign. */
+	if (asprintf(&STS,
+	    "AWS4-HMAC-SHA256\n"
+	    "%s\n"
+	    "%s/%s/%s/aws4_request\n"
+	    "%s",
+	    datetime, date, region, service, hhex_creq) == -1)
+		goto err1;
+
+	/* Sign and hexify the String to Sign. */
+	HMAC_SHA256_Buf(kSigning, 32, STS, strlen(STS), hmac);
+	hexify(hmac, sigbuf, 32);
+
+	/* Free string allocated by asprintf. */
+	free(STS);
+
+	/* Clean up. */
+	insecure_memzero(kSigning, 32);
+
+	/* Success! */
+	return (0);
+
+err1:
+	insecure_memzero(kSigning, 32);
+
+	/* Failure! */
+	return (-1);
+}
+
+/* Construct the date strings <yyyymmdd> and <yyyymmddThhmmssZ> for now. */
+static int
+gettimes(char date[9], char datetime[17])
+{
+	time_t t_now;
+
+	/* Get the current time. */
+	if (time(&t_now) == (time_t)(-1)) {
+		warnp("time");
+		goto err0;
+	}
+
+	/* Construct date string <yyyymmdd>. */
+	if (strftime(date, 9, "%Y%m%d", gmtime(&t_now)) == 0) {
+		warnp("strftime");
+		goto err0;
+	}
+
+	/* Construct date-and-time string <yyyymmddThhmmssZ>. */
+	if (strftime(datetime, 17, "%Y%m%dT%H%M%SZ", gmtime(&t_now)) == 0) {
+		warnp("strftime");
+		goto err0;
+	}
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/*
+ * Construct the canonical form ${canon} of the headers ${xhdrs} and the
+ * list ${names} of their names (each followed by ';') for signing.
+ */
+static int
+xheaders(const struct aws_sign_header * xhdrs, size_t nxhdrs, char ** canon,
+    char ** names)
+{
+	char * s;
+	size_t i;
+
+	/* Start with empty strings. */
+	if ((*canon = strdup("")) == NULL)
+		goto err0;
+	if ((*names = strdup("")) == NULL)
+		goto err1;
+
+	/* Append each header in turn. */
+	for (i = 0; i < nxhdrs; i++) {
+		if (asprintf(&s, "%s%s:%s\n", *canon, xhdrs[i].name,
+		    xhdrs[i].value) == -1)
+			goto err2;
+		free(*canon);
+		*canon = s;
+		if (asprintf(&s, "%s%s;", *names, xhdrs[i].name) == -1)
+			goto err2;
+		free(*names);
+		*names = s;
+	}
+
+	/* Success! */
+	return (0);
+
+err2:
+	free(*names);
+err1:
+	free(*canon);
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/**
+ * aws_sign_cache_init(void):
+ * Create a cache for SigV4 signing keys.  Deriving a signing key requires
+ * four HMAC-SHA256 computations; the key only depends on the secret key, the
+ * date, the region, and the service, so it can be reused for all requests
+ * made on the same day to the same region and service.  A cache must only be
+ * used with a single secret key.
+ */
+struct aws_sign_cache *
+aws_sign_cache_init(void)
+{
+	struct aws_sign_cache * C;
+
+	/* Allocate structure. */
+	if ((C = malloc(sizeof(struct aws_sign_cache))) == NULL)
+		goto err0;
+
+	/* Nothing is cached yet. */
+	C->region = C->service = NULL;
+
+	/* Success! */
+	return (C);
+
+err0:
+	/* Failure! */
+	return (NULL);
+}
+
+/*
+ * Split ${path} into the URI ${uri} and the canonical query string ${query}
+ * used when signing it.  Query parameters must already be sorted and
+ * URI-encoded; parameters without values (e.g. "?uploads") are given an
+ * empty value.
+ */
+static int
+splitpath(const char * path, char ** uri, char ** query)
+{
+	const char * q;
+	size_t urilen;
+	size_t i, k;
+	int haseq;
+
+	/* Find the start of the query string, if any. */
+	if ((q = strchr(path, '?')) == NULL)
+		q = &path[strlen(path)];
+	urilen = (size_t)(q - path);
+	if (*q == '?')
+		q++;
+
+	/* Duplicate the URI. */
+	if ((*uri = malloc(urilen + 1)) == NULL)
+		goto err0;
+	memcpy(*uri, path, urilen);
+	(*uri)[urilen] = '\0';
+
+	/* Allow room for an '=' to be added to every parameter. */
+	if ((*query = malloc(strlen(q) * 2 + 1)) == NULL)
+		goto err1;
+
+	/* Copy parameters, adding an '=' to any which lack one. */
+	for (i = k = 0, haseq = 0; ; i++) {
+		if ((q[i] == '&') || (q[i] == '\0')) {
+			if ((i > 0) && !haseq)
+				(*query)[k++] = '=';
+			if (q[i] == '\0')
+				break;
+			haseq = 0;
+		} else if (q[i] == '=') {
+			haseq = 1;
+		}
+		(*query)[k++] = q[i];
+	}
+	(*query)[k] = '\0';
+
+	/* Success! */
+	return (0);
+
+err1:
+	free(*uri);
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/**
+ * aws_sign_cache_s3_headers(C, key_id, key_secret, region, method, bucket,
+ *     path, xhdrs, nxhdrs, body, bodylen, x_amz_content_sha256, x_amz_date,
+ *     authorization):
+ * Behave as aws_sign_s3_headers, but use and update the signing key cache
+ * ${C} (if non-NULL), and also sign the ${nxhdrs} headers ${xhdrs}, which
+ * must be sent along with the request.  The names of the headers in ${xhdrs}
+ * must be in lower case, sorted, and sort after "host" and before
+ * "x-amz-content-sha256"; this is the case for the x-amz-checksum-* headers.
+ * The ${path} may include a query string, the parameters of which must be
+ * sorted and URI-encoded.
+ */
+int
+aws_sign_cache_s3_headers(struct aws_sign_cache * C, const char * key_id,
+    const char * key_secret, const char * region, const char * method,
+    const char * bucket, const char * path,
+    const struct aws_sign_header * xhdrs, size_t nxhdrs,
+    const uint8_t * body, size_t bodylen, char ** x_amz_content_sha256,
+    char ** x_amz_date, char ** authorization)
+{
+	char date[9];
+	char datetime[17];
+	uint8_t hbuf[32];
+	char content_sha256[65];
+	char * uri;
+	char * query;
+	char * xcanon;
+	char * xnames;
+	char * canonical_request;
+	char sigbuf[65];
+
+	/* Get the date strings. */
+	if (gettimes(date, datetime))
+		goto err0;
+
+	/* Compute the hexified SHA256 of the payload. */
+	SHA256_Buf(body, body ? bodylen : 0, hbuf);
+	hexify(hbuf, content_sha256, 32);
+
+	/* Separate any query string from the path. */
+	if (splitpath(path, &uri, &query))
+		goto err0;
+
+	/* Construct the canonical extra headers and their names. */
+	if (xheaders(xhdrs, nxhdrs, &xcanon, &xnames))
+		goto err1;
+
+	/* Construct Canonical Request. */
+	if (asprintf(&canonical_request,
+	    "%s\n"
+	    "%s\n"
+	    "%s\n"
+	    "host:%s.s3.amazonaws.com\n"
+	    "%s"
+	    "x-amz-content-sha256:%s\n"
+	    "x-amz-date:%s\n"
+	    "\n"
+	    "host;%sx-amz-content-sha256;x-amz-date\n"
+	    "%s",
+	    method, uri, query, bucket, xcanon, content_sha256, datetime,
+	    xnames, content_sha256) == -1)
+		goto err2;
+
+	/* Compute request signature. */
+	if (aws_sign(C, key_secret, date, datetime, region,
+	    "s3", canonical_request, sigbuf))
+		goto err3;
+
+	/* Construct Authorization header. */
+	if (asprintf(authorization,
+	    "AWS4-HMAC-SHA256 "
+	    "Credential=%s/%s/%s/s3/aws4_request,"
+	    "SignedHeaders=host;%sx-amz-content-sha256;x-amz-date,"
+	    "Signature=%s",
+	    key_id, date, region, xnames, sigbuf) == -1)
+		goto err3;
+
+	/* Duplicate X-Amz-Content-SHA256 and X-Amz-Date headers. */
+	if ((*x_amz_content_sha256 = strdup(content_sha256)) == NULL)
+		goto err4;
+	if ((*x_amz_date = strdup(datetime)) == NULL)
+		goto err5;
+
+	/* Free strings allocated by asprintf, xheaders, and splitpath. */
+	free(canonical_request);
+	free(xnames);
+	free(xcanon);
+	free(query);
+	free(uri);
+
+	/* Success! */
+	return (0);
+
+err5:
+	free(*x_amz_content_sha256);
+err4:
+	free(*authorization);
+err3:
+	free(canonical_request);
+err2:
+	free(xnames);
+	free(xcanon);
+err1:
+	free(query);
+	free(uri);
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/**
+ * aws_sign_cache_dynamodb_headers(C, key_id, key_secret, region, op, body,
+ *     bodylen, x_amz_content_sha256, x_amz_date, authorization):
+ * Behave as aws_sign_dynamodb_headers, but use and update the signing key
+ * cache ${C} (if non-NULL).
+ */
+int
+aws_sign_cache_dynamodb_headers(struct aws_sign_cache * C,
+    const char * key_id, const char * key_secret, const char * region,
+    const char * op, const uint8_t * body, size_t bodylen,
+    char ** x_amz_content_sha256, char ** x_amz_date, char ** authorization)
+{
+	char date[9];
+	char datetime[17];
+	uint8_t hbuf[32];
+	char content_sha256[65];
+	char * canonical_request;
+	char sigbuf[65];
+
+	/* Get the date strings. */
+	if (gettimes(date, datetime))
+		goto err0;
+
+	/* Compute the hexified SHA256 of the payload. */
+	SHA256_Buf(body, body ? bodylen : 0, hbuf);
+	hexify(hbuf, content_sha256, 32);
+
+	/* Construct Canonical Request. */
+	if (asprintf(&canonical_request,
+	    "POST\n"
+	    "/\n"
+	    "\n"
+	    "host:dynamodb.%s.amazonaws.com\n"
+	    "x-amz-content-sha256:%s\n"
+	    "x-amz-date:%s\n"
+	    "x-amz-target:DynamoDB_20120810.%s\n"
+	    "\n"
+	    "host;x-amz-content-sha256;x-amz-date;x-amz-target\n"
+	    "%s",
+	    region, content_sha256, datetime, op, content_sha256) == -1)
+		goto err0;
+
+	/* Compute request signature. */
+	if (aws_sign(C, key_secret, date, datetime, region,
+	    "dynamodb", canonical_request, sigbuf))
+		goto err1;
+
+	/* Construct Authorization header. */
+	if (asprintf(authorization,
+	    "AWS4-HMAC-SHA256 "
+	    "Credential=%s/%s/%s/dynamodb/aws4_request,"
+	    "SignedHeaders=host;x-amz-content-sha256;x-amz-date;x-amz-target,"
+	    "Signature=%s",
+	    key_id, date, region, sigbuf) == -1)
+		goto err1;
+
+	/* Duplicate X-Amz-Content-SHA256 and X-Amz-Date headers. */
+	if ((*x_amz_content_sha256 = strdup(content_sha256)) == NULL)
+		goto err2;
+	if ((*x_amz_date = strdup(datetime)) == NULL)
+		goto err3;
+
+	/* Free string allocated by asprintf. */
+	free(canonical_request);
+
+	/* Success! */
+	return (0);
+
+err3:
+	free(*x_amz_content_sha256);
+err2:
+	free(*authorization);
+err1:
+	free(canonical_request);
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/**
+ * aws_sign_cache_free(C):
+ * Free the signing key cache ${C}.
+ */
+void
+aws_sign_cache_free(struct aws_sign_cache * C)
+{
+
+	/* Behave consistently with free(NULL). */
+	if (C == NULL)
+		return;
+
+	/* Forget the cached key and free the structure. */
+	cache_clear(C);
+	free(C);
+}
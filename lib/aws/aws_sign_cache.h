@@ -0,0 +1,59 @@
+#ifndef _AWS_SIGN_CACHE_H_
+#define _AWS_SIGN_CACHE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Opaque type. */
+struct aws_sign_cache;
+
+/* Additional header to be signed. */
+struct aws_sign_header {
+	const char * name;	/* Lower case. */
+	const char * value;
+};
+
+/**
+ * aws_sign_cache_init(void):
+ * Create a cache for SigV4 signing keys.  Deriving a signing key requires
+ * four HMAC-SHA256 computations; the key only depends on the secret key, the
+ * date, the region, and the service, so it can be reused for all requests
+ * made on the same day to the same region and service.  A cache must only be
+ * used with a single secret key.
+ */
+struct aws_sign_cache * aws_sign_cache_init(void);
+
+/**
+ * aws_sign_cache_s3_headers(C, key_id, key_secret, region, method, bucket,
+ *     path, xhdrs, nxhdrs, body, bodylen, x_amz_content_sha256, x_amz_date,
+ *     authorization):
+ * Behave as aws_sign_s3_headers, but use and update the signing key cache
+ * ${C} (if non-NULL), and also sign the ${nxhdrs} headers ${xhdrs}, which
+ * must be sent along with the request.  The names of the headers in ${xhdrs}
+ * must be in lower case, sorted, and sort after "host" and before
+ * "x-amz-content-sha256"; this is the case for the x-amz-checksum-* headers.
+ * The ${path} may include a query string, the parameters of which must be
+ * sorted and URI-encoded.
+ */
+int aws_sign_cache_s3_headers(struct aws_sign_cache *, const char *,
+    const char *, const char *, const char *, const char *, const char *,
+    const struct aws_sign_header *, size_t, const uint8_t *, size_t,
+    char **, char **, char **);
+
+/**
+ * aws_sign_cache_dynamodb_headers(C, key_id, key_secret, region, op, body,
+ *     bodylen, x_amz_content_sha256, x_amz_date, authorization):
+ * Behave as aws_sign_dynamodb_headers, but use and update the signing key
+ * cache ${C} (if non-NULL).
+ */
+int aws_sign_cache_dynamodb_headers(struct aws_sign_cache *, const char *,
+    const char *, const char *, const char *, const uint8_t *, size_t,
+    char **, char **, char **);
+
+/**
+ * aws_sign_cache_free(C):
+ * Free the signing key cache ${C}.
+ */
+void aws_sign_cache_free(struct aws_sign_cache *);
+
+#endif /* !_AWS_SIGN_CACHE_H_ */
@@ -0,0 +1,223 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "arena.h"
+
+/*
+ * Alignment of allocations; this must be a power of 2 and at least as
+ * strict as the alignment of any type.
+ */
+#define ALIGN	16
+
+/* A type with the strictest alignment we need to provide. */
+union arena_align {
+	long long ll;
+	long double ld;
+	void * p;
+	void (* fp)(void);
+	uint8_t pad[ALIGN];
+};
+
+/* Round a length up to a multiple of the alignment. */
+#define ALIGNLEN(len)	(((len) + ALIGN - 1) & ~(size_t)(ALIGN - 1))
+
+/* A chunk of memory, followed by its data. */
+struct arena_chunk {
+	union {
+		struct {
+			struct arena_chunk * next;
+			size_t len;
+		} h;
+		union arena_align align;
+	} u;
+};
+
+/* Allocations larger than this fraction of a chunk get their own chunk. */
+#define BIGFRAC	4
+
+struct arena {
+	size_t chunklen;		/* Length of a standard chunk. */
+	struct arena_chunk * chunks;	/* Chunks in use. */
+	struct arena_chunk * spare;	/* Standard chunks available. */
+	uint8_t * pos;			/* Free space in the current chunk. */
+	size_t avail;			/* Bytes available at pos. */
+	uint64_t nallocs;		/* Allocations made. */
+	uint64_t nmallocs;		/* Chunks allocated via malloc. */
+};
+
+/* Obtain a chunk of ${len} bytes and add it to the in-use list. */
+static struct arena_chunk *
+newchunk(struct arena * A, size_t len)
+{
+	struct arena_chunk * c;
+
+	/* Reuse a spare chunk if possible; otherwise, allocate one. */
+	if ((len == A->chunklen) && (A->spare != NULL)) {
+		c = A->spare;
+		A->spare = c->u.h.next;
+	} else {
+		if (len > SIZE_MAX - sizeof(struct arena_chunk))
+			goto err0;
+		if ((c = malloc(sizeof(struct arena_chunk) + len)) == NULL)
+			goto err0;
+		c->u.h.len = len;
+		A->nmallocs += 1;
+	}
+
+	/* Add it to the list of chunks in use. */
+	c->u.h.next = A->chunks;
+	A->chunks = c;
+
+	/* Success! */
+	return (c);
+
+err0:
+	/* Failure! */
+	return (NULL);
+}
+
+/**
+ * arena_init(chunklen):
+ * Create an arena which allocates memory in chunks of ${chunklen} bytes.
+ */
+struct arena *
+arena_init(size_t chunklen)
+{
+	struct arena * A;
+
+	/* Allocate the structure. */
+	if ((A = malloc(sizeof(struct arena))) == NULL)
+		goto err0;
+
+	/* No chunks yet. */
+	A->chunklen = ALIGNLEN(chunklen);
+	A->chunks = NULL;
+	A->spare = NULL;
+	A->pos = NULL;
+	A->avail = 0;
+	A->nallocs = 0;
+	A->nmallocs = 0;
+
+	/* Success! */
+	return (A);
+
+err0:
+	/* Failure! */
+	return (NULL);
+}
+
+/**
+ * arena_malloc(A, len):
+ * Allocate ${len} bytes from the arena ${A}.  The memory is suitably aligned
+ * for any type and remains valid until the next call to arena_reset.
+ */
+void *
+arena_malloc(struct arena * A, size_t len)
+{
+	struct arena_chunk * c;
+	void * p;
+
+	/* Avoid overflow when rounding up. */
+	if (len > SIZE_MAX / 2)
+		goto err0;
+	len = ALIGNLEN(len);
+
+	/* Large allocations get a chunk of their own. */
+	if (len > A->chunklen / BIGFRAC) {
+		if ((c = newchunk(A, len)) == NULL)
+			goto err0;
+		p = &c[1];
+		goto done;
+	}
+
+	/* Start a new chunk if this one is full. */
+	if (len > A->avail) {
+		if ((c = newchunk(A, A->chunklen)) == NULL)
+			goto err0;
+		A->pos = (uint8_t *)&c[1];
+		A->avail = A->chunklen;
+	}
+
+	/* Carve the allocation out of the current chunk. */
+	p = A->pos;
+	A->pos += len;
+	A->avail -= len;
+
+done:
+	/* We've made an allocation. */
+	A->nallocs += 1;
+
+	/* Success! */
+	return (p);
+
+err0:
+	/* Failure! */
+	return (NULL);
+}
+
+/**
+ * arena_reset(A):
+ * Release all memory allocated from the arena ${A}.  Chunks are retained for
+ * use by later allocations.
+ */
+void
+arena_reset(struct arena * A)
+{
+	struct arena_chunk * c;
+
+	/* Move standard chunks to the spare list; free the others. */
+	while ((c = A->chunks) != NULL) {
+		A->chunks = c->u.h.next;
+		if (c->u.h.len == A->chunklen) {
+			c->u.h.next = A->spare;
+			A->spare = c;
+		} else {
+			free(c);
+		}
+	}
+
+	/* There is no current chunk. */
+	A->pos = NULL;
+	A->avail = 0;
+}
+
+/**
+ * arena_stats(A, nallocs, nmallocs):
+ * Return via ${nallocs} the number of allocations which have been made from
+ * the arena ${A}, and via ${nmallocs} the number of times the arena has
+ * needed to call malloc in order to satisfy them.
+ */
+void
+arena_stats(struct arena * A, uint64_t * nallocs, uint64_t * nmallocs)
+{
+
+	*nallocs = A->nallocs;
+	*nmallocs = A->nmallocs;
+}
+
+/**
+ * arena_free(A):
+ * Free the arena ${A} and all memory allocated from it.
+ */
+void
+arena_free(struct arena * A)
+{
+	struct arena_chunk * c;
+
+	/* Be compatible with free(NULL). */
+	if (A == NULL)
+		return;
+
+	/* Put everything onto the spare list. */
+	arena_reset(A);
+
+	/* Free the spare chunks. */
+	while ((c = A->spare) != NULL) {
+		A->spare = c->u.h.next;
+		free(c);
+	}
+
+	/* Free the arena. */
+	free(A);
+}
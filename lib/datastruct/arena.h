@@ -0,0 +1,79 @@
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * An arena is a bump allocator for objects which all die at the same time.
+ * Allocations are carved out of large chunks; individual allocations are
+ * never freed, but arena_reset releases everything at once and keeps the
+ * chunks for reuse, so that in steady state an arena performs no calls to
+ * malloc or free at all.
+ */
+
+/* Opaque type. */
+struct arena;
+
+/**
+ * arena_init(chunklen):
+ * Create an arena which allocates memory in chunks of ${chunklen} bytes.
+ */
+struct arena * arena_init(size_t);
+
+/**
+ * arena_malloc(A, len):
+ * Allocate ${len} bytes from the arena ${A}.  The memory is suitably aligned
+ * for any type and remains valid until the next call to arena_reset.
+ */
+void * arena_malloc(struct arena *, size_t);
+
+/**
+ * arena_reset(A):
+ * Release all memory allocated from the arena ${A}.  Chunks are retained for
+ * use by later allocations.
+ */
+void arena_reset(struct arena *);
+
+/**
+ * arena_stats(A, nallocs, nmallocs):
+ * Return via ${nallocs} the number of allocations which have been made from
+ * the arena ${A}, and via ${nmallocs} the number of times the arena has
+ * needed to call malloc in order to satisfy them.
+ */
+void arena_stats(struct arena *, uint64_t *, uint64_t *);
+
+/**
+ * arena_free(A):
+ * Free the arena ${A} and all memory allocated from it.
+ */
+void arena_free(struct arena *);
+
+/**
+ * arena_imalloc(A, nrec, reclen):
+ * Allocate ${nrec} records of length ${reclen} from the arena ${A}.  Check
+ * for size_t overflow.
+ */
+static inline void *
+arena_imalloc(struct arena * A, size_t nrec, size_t reclen)
+{
+
+	if (nrec > SIZE_MAX / reclen) {
+		errno = ENOMEM;
+		return (NULL);
+	} else {
+		return (arena_malloc(A, nrec * reclen));
+	}
+}
+
+/**
+ * ARENA_IMALLOC(A, p, nrec, type):
+ * Allocate ${nrec} records of type ${type} from the arena ${A} and store the
+ * pointer in ${p}.  Return non-zero on failure.
+ */
+#define ARENA_IMALLOC(A, p, nrec, type)					\
+	((((p) = (type *)arena_imalloc((A), (nrec), sizeof(type))) == NULL) && \
+	    ((nrec) > 0))
+
+#endif /* !_ARENA_H_ */
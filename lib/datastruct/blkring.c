@@ -0,0 +1,197 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "blkring.h"
+
+/*
+ * Blocks are stored in slots, oldest first, starting at slot ${first} and
+ * wrapping around at the end of the ring.  Since block numbers increase as
+ * blocks are added, the block numbers of occupied slots are sorted in ring
+ * order and we can find a block by binary search.
+ */
+struct blkring {
+	size_t nslots;		/* Number of slots. */
+	size_t blklen;		/* Block length. */
+	size_t first;		/* Slot holding the oldest block. */
+	size_t count;		/* Number of slots occupied. */
+	uint64_t * blknos;	/* Block # held in each slot. */
+	uint8_t * data;		/* Block data, ${nslots} x ${blklen} bytes. */
+	uint64_t hits;		/* Calls to blkring_get which found a block. */
+	uint64_t misses;	/* Calls to blkring_get which did not. */
+};
+
+/* Slot holding the i'th oldest block in the ring. */
+#define SLOT(R, i)	(((R)->first + (i)) % (R)->nslots)
+
+/**
+ * blkring_init(nblks, blklen):
+ * Create a ring holding the ${nblks} most recently added blocks of length
+ * ${blklen} bytes.
+ */
+struct blkring *
+blkring_init(size_t nblks, size_t blklen)
+{
+	struct blkring * R;
+
+	/* Sanity-check the ring size. */
+	if ((nblks == 0) || (nblks > SIZE_MAX / blklen) ||
+	    (nblks > SIZE_MAX / sizeof(uint64_t))) {
+		errno = ENOMEM;
+		goto err0;
+	}
+
+	/* Allocate a structure and initialize. */
+	if ((R = malloc(sizeof(struct blkring))) == NULL)
+		goto err0;
+	R->nslots = nblks;
+	R->blklen = blklen;
+	R->first = 0;
+	R->count = 0;
+	R->hits = 0;
+	R->misses = 0;
+
+	/* Allocate the slots. */
+	if ((R->blknos = malloc(nblks * sizeof(uint64_t))) == NULL)
+		goto err1;
+	if ((R->data = malloc(nblks * blklen)) == NULL)
+		goto err2;
+
+	/* Success! */
+	return (R);
+
+err2:
+	free(R->blknos);
+err1:
+	free(R);
+err0:
+	/* Failure! */
+	return (NULL);
+}
+
+/**
+ * blkring_add(R, blkno, nblks, buf):
+ * Add the ${nblks} blocks ${blkno} ... ${blkno} + ${nblks} - 1 with contents
+ * ${buf} to the ring ${R}, discarding the oldest blocks if the ring is full.
+ * Block numbers must increase from one call to the next; if they do not,
+ * the blocks already in the ring are discarded first.
+ */
+void
+blkring_add(struct blkring * R, uint64_t blkno, size_t nblks,
+    const uint8_t * buf)
+{
+	size_t slot;
+	size_t i;
+
+	/* If these blocks don't follow the newest block, start over. */
+	if ((R->count > 0) && (blkno <= R->blknos[SLOT(R, R->count - 1)]))
+		R->count = 0;
+
+	/* Blocks which would be pushed out by later blocks can be skipped. */
+	if (nblks > R->nslots) {
+		i = nblks - R->nslots;
+		blkno += i;
+		buf += i * R->blklen;
+		nblks = R->nslots;
+	}
+
+	/* Copy the blocks into the ring. */
+	for (i = 0; i < nblks; i++) {
+		/* Use an empty slot if we have one, or else the oldest. */
+		if (R->count < R->nslots) {
+			slot = SLOT(R, R->count);
+			R->count += 1;
+		} else {
+			slot = R->first;
+			R->first = SLOT(R, 1);
+		}
+
+		/* Record the block. */
+		R->blknos[slot] = blkno + i;
+		memcpy(&R->data[slot * R->blklen], &buf[i * R->blklen],
+		    R->blklen);
+	}
+}
+
+/**
+ * blkring_get(R, blkno, buf):
+ * Look for block ${blkno} in the ring ${R}.  If it is present, copy it into
+ * ${buf} and return 0; otherwise, return 1.
+ */
+int
+blkring_get(struct blkring * R, uint64_t blkno, uint8_t * buf)
+{
+	size_t lo, hi, mid;
+	size_t slot;
+
+	/* Binary search for the block in [lo, hi). */
+	lo = 0;
+	hi = R->count;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		slot = SLOT(R, mid);
+		if (R->blknos[slot] == blkno) {
+			/* Found it. */
+			memcpy(buf, &R->data[slot * R->blklen], R->blklen);
+			R->hits += 1;
+			return (0);
+		}
+		if (R->blknos[slot] < blkno)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	/* The block is not in the ring. */
+	R->misses += 1;
+	return (1);
+}
+
+/**
+ * blkring_gc(R, blkno):
+ * Blocks less than ${blkno} will not be read again; discard them from the
+ * ring ${R}.
+ */
+void
+blkring_gc(struct blkring * R, uint64_t blkno)
+{
+
+	/* Discard the oldest blocks until we reach ${blkno}. */
+	while ((R->count > 0) && (R->blknos[R->first] < blkno)) {
+		R->first = SLOT(R, 1);
+		R->count -= 1;
+	}
+}
+
+/**
+ * blkring_stats(R, hits, misses):
+ * Return via ${hits} and ${misses} the number of calls to blkring_get on the
+ * ring ${R} which found and did not find their block.
+ */
+void
+blkring_stats(struct blkring * R, uint64_t * hits, uint64_t * misses)
+{
+
+	/* Report the counts. */
+	*hits = R->hits;
+	*misses = R->misses;
+}
+
+/**
+ * blkring_free(R):
+ * Free the ring ${R}.
+ */
+void
+blkring_free(struct blkring * R)
+{
+
+	/* Behave consistently with free(NULL). */
+	if (R == NULL)
+		return;
+
+	/* Free the slots and the structure. */
+	free(R->data);
+	free(R->blknos);
+	free(R);
+}
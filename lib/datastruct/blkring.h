@@ -0,0 +1,53 @@
+#ifndef _BLKRING_H_
+#define _BLKRING_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Opaque type. */
+struct blkring;
+
+/**
+ * blkring_init(nblks, blklen):
+ * Create a ring holding the ${nblks} most recently added blocks of length
+ * ${blklen} bytes.
+ */
+struct blkring * blkring_init(size_t, size_t);
+
+/**
+ * blkring_add(R, blkno, nblks, buf):
+ * Add the ${nblks} blocks ${blkno} ... ${blkno} + ${nblks} - 1 with contents
+ * ${buf} to the ring ${R}, discarding the oldest blocks if the ring is full.
+ * Block numbers must increase from one call to the next; if they do not,
+ * the blocks already in the ring are discarded first.
+ */
+void blkring_add(struct blkring *, uint64_t, size_t, const uint8_t *);
+
+/**
+ * blkring_get(R, blkno, buf):
+ * Look for block ${blkno} in the ring ${R}.  If it is present, copy it into
+ * ${buf} and return 0; otherwise, return 1.
+ */
+int blkring_get(struct blkring *, uint64_t, uint8_t *);
+
+/**
+ * blkring_gc(R, blkno):
+ * Blocks less than ${blkno} will not be read again; discard them from the
+ * ring ${R}.
+ */
+void blkring_gc(struct blkring *, uint64_t);
+
+/**
+ * blkring_stats(R, hits, misses):
+ * Return via ${hits} and ${misses} the number of calls to blkring_get on the
+ * ring ${R} which found and did not find their block.
+ */
+void blkring_stats(struct blkring *, uint64_t *, uint64_t *);
+
+/**
+ * blkring_free(R):
+ * Free the ring ${R}.
+ */
+void blkring_free(struct blkring *);
+
+#endif /* !_BLKRING_H_ */
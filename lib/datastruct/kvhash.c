@@ -1,7 +1,14 @@
 #include <assert.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "arena.h"
 #include "crc32c.h"
 #include "imalloc.h"
 #include "kvldskey.h"
@@ -10,61 +17,63 @@
 
 #include "kvhash.h"
 
-/* Rehash the table into double the space. */
-static int
-rehash(struct kvhash * H)
-{
-	size_t new_nslots;
-	struct kvpair_const * new_pairs;
-	uint32_t * new_hashes;
-	size_t i, pos;
+/* Number of slots whose control bytes are examined at once. */
+#define GROUP	16
 
-	/* Double the table size. */
-	new_nslots = H->nslots * 2;
+/* Control byte for an empty slot. */
+#define CTRL_EMPTY	0x80
 
-	/* Allocate new arrays. */
-	if (IMALLOC(new_pairs, new_nslots, struct kvpair_const))
-		goto err0;
-	if (IMALLOC(new_hashes, new_nslots, uint32_t))
-		goto err1;
+/*
+ * Control byte padding the first group of a table with fewer than GROUP
+ * slots; it never matches an empty slot or a tag.
+ */
+#define CTRL_PAD	0xff
 
-	/* Nothing in the new table yet. */
-	memset(new_pairs, 0, new_nslots * sizeof(struct kvpair_const));
+/* Smallest table size. */
+#define MINSLOTS	4
 
-	/* Scan the old table and move entries. */
-	for (i = 0; i < H->nslots; i++) {
-		/* Skip empty slots. */
-		if (H->pairs[i].k == NULL)
-			continue;
-
-		/* Look for an empty slot in the new table. */
-		pos = H->hashes[i] & (new_nslots - 1);
-		while (new_pairs[pos].k != NULL)
-			pos = (pos + 1) & (new_nslots - 1);
+/* The control byte for a key with hash ${h}: its top 7 bits. */
+#define TAG(h)	((uint8_t)((h) >> 25))
 
-		/* Copy the key, value, and hash across. */
-		new_pairs[pos].k = H->pairs[i].k;
-		new_pairs[pos].v = H->pairs[i].v;
-		new_hashes[pos] = H->hashes[i];
-	}
+/* Allocate ${nrec} records of length ${reclen} from ${A} or the heap. */
+static void *
+hmalloc(struct arena * A, size_t nrec, size_t reclen)
+{
 
-	/* Free the old arrays. */
-	free(H->pairs);
-	free(H->hashes);
+	if (A != NULL)
+		return (arena_imalloc(A, nrec, reclen));
+	else
+		return (imalloc(nrec, reclen));
+}
 
-	/* Attach new arrays to the hash table. */
-	H->pairs = new_pairs;
-	H->hashes = new_hashes;
-	H->nslots = new_nslots;
+/* Free ${p} unless it was allocated from the arena ${A}. */
+static void
+hfree(struct arena * A, void * p)
+{
 
-	/* Success! */
-	return (0);
+	if (A == NULL)
+		free(p);
+}
 
-err1:
-	free(new_pairs);
-err0:
-	/* Failure! */
-	return (-1);
+/* Return a bitmask of the slots in the group at ${ctrl} with byte ${c}. */
+static inline unsigned int
+match(const uint8_t * ctrl, uint8_t c)
+{
+#ifdef __SSE2__
+	__m128i g = _mm_loadu_si128((const __m128i *)ctrl);
+
+	return ((unsigned int)_mm_movemask_epi8(
+	    _mm_cmpeq_epi8(g, _mm_set1_epi8((char)c))));
+#else
+	unsigned int m = 0;
+	size_t i;
+
+	for (i = 0; i < GROUP; i++) {
+		if (ctrl[i] == c)
+			m |= 1U << i;
+	}
+	return (m);
+#endif
 }
 
 /* Compute the hash of a key. */
@@ -83,37 +92,123 @@ hash(const struct kvldskey * k)
 	return (h);
 }
 
+/* Allocate empty tables of ${nslots} slots for ${H}. */
+static int
+alloctables(struct kvhash * H, size_t nslots)
+{
+	size_t nctrl = (nslots < GROUP) ? GROUP : nslots;
+
+	/* Allocate the arrays. */
+	if ((H->pairs = hmalloc(H->A, nslots,
+	    sizeof(struct kvpair_const))) == NULL)
+		goto err0;
+	if ((H->ctrl = hmalloc(H->A, nctrl, 1)) == NULL)
+		goto err1;
+	H->nslots = nslots;
+
+	/* Nothing in the table yet. */
+	memset(H->pairs, 0, nslots * sizeof(struct kvpair_const));
+	memset(H->ctrl, CTRL_EMPTY, nslots);
+	memset(&H->ctrl[nslots], CTRL_PAD, nctrl - nslots);
+
+	/* Success! */
+	return (0);
+
+err1:
+	hfree(H->A, H->pairs);
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Rehash the table into double the space. */
+static int
+rehash(struct kvhash * H)
+{
+	struct kvpair_const * old_pairs = H->pairs;
+	uint8_t * old_ctrl = H->ctrl;
+	size_t old_nslots = H->nslots;
+	size_t i, pos;
+	unsigned int m;
+	uint32_t h;
+
+	/* Allocate new arrays of double the size. */
+	if (alloctables(H, old_nslots * 2))
+		goto err0;
+
+	/* Scan the old table and move entries. */
+	for (i = 0; i < old_nslots; i++) {
+		/* Skip empty slots. */
+		if (old_ctrl[i] == CTRL_EMPTY)
+			continue;
+
+		/* Look for a group with an empty slot in the new table. */
+		h = hash(old_pairs[i].k);
+		pos = h & (H->nslots - 1) & ~(size_t)(GROUP - 1);
+		while ((m = match(&H->ctrl[pos], CTRL_EMPTY)) == 0)
+			pos = (pos + GROUP) & (H->nslots - 1);
+		pos += (size_t)(ffs((int)m) - 1);
+
+		/* Copy the key, value, and control byte across. */
+		H->pairs[pos] = old_pairs[i];
+		H->ctrl[pos] = old_ctrl[i];
+	}
+
+	/* Free the old arrays. */
+	hfree(H->A, old_pairs);
+	hfree(H->A, old_ctrl);
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Put the old arrays back. */
+	H->pairs = old_pairs;
+	H->ctrl = old_ctrl;
+	H->nslots = old_nslots;
+
+	/* Failure! */
+	return (-1);
+}
+
 /**
- * kvhash_init(void):
- * Return an empty kvhash.
+ * kvhash_init(A, nkeys):
+ * Return an empty kvhash with room for ${nkeys} keys before it needs to be
+ * expanded.  If ${A} is not NULL, allocate the kvhash and its tables from
+ * the arena ${A}; in that case the kvhash must not be used after the arena
+ * is reset.
  */
 struct kvhash *
-kvhash_init(void)
+kvhash_init(struct arena * A, size_t nkeys)
 {
 	struct kvhash * H;
+	size_t nslots;
+
+	/* A kvhash cannot hold more than 2^30 keys. */
+	if (nkeys > ((size_t)1 << 30))
+		nkeys = (size_t)1 << 30;
+
+	/* Pick a power-of-2 size which can hold nkeys while 3/4 full. */
+	for (nslots = MINSLOTS; nkeys + nslots / 4 > nslots; nslots *= 2)
+		continue;
 
 	/* Allocate a kvhash. */
-	if ((H = malloc(sizeof(struct kvhash))) == NULL)
+	if ((H = hmalloc(A, 1, sizeof(struct kvhash))) == NULL)
 		goto err0;
+	H->A = A;
 
-	/* We start with 4 slots. */
-	H->nslots = 4;
-	if (IMALLOC(H->pairs, H->nslots, struct kvpair_const))
+	/* Allocate the tables. */
+	if (alloctables(H, nslots))
 		goto err1;
-	if (IMALLOC(H->hashes, H->nslots, uint32_t))
-		goto err2;
 
 	/* This table is empty. */
 	H->nkeys = 0;
-	memset(H->pairs, 0, H->nslots * sizeof(struct kvpair_const));
 
 	/* Success! */
 	return (H);
 
-err2:
-	free(H->pairs);
 err1:
-	free(H);
+	hfree(A, H);
 err0:
 	/* Failure! */
 	return (NULL);
@@ -122,54 +217,65 @@ err0:
 /**
  * kvhash_search(H, k):
  * Search for the key ${k} in the kvhash ${H}.  Return a pointer to the
- * kvpair structure where the key appears or would appear if inserted.  Write
- * the hash value into the corresponding location in the hashes array.
+ * kvpair structure where the key appears or would appear if inserted.  If
+ * the key is not present, remember the slot so that kvhash_postadd can mark
+ * it as being in use.
  */
 struct kvpair_const *
 kvhash_search(struct kvhash * H, const struct kvldskey * k)
 {
-	size_t pos;
+	size_t pos, i;
+	unsigned int m;
 	uint32_t h;
+	uint8_t tag;
 
 	/* Compute the hash. */
 	h = hash(k);
+	tag = TAG(h);
 
-	/* Scan the table until we find an empty slot or the key. */
-	pos = h & (H->nslots - 1);
+	/* Scan groups until we find the key or an empty slot. */
+	pos = h & (H->nslots - 1) & ~(size_t)(GROUP - 1);
 	do {
-		/* If this slot is empty, stop. */
-		if (H->pairs[pos].k == NULL)
+		/* Compare keys in slots with matching control bytes. */
+		for (m = match(&H->ctrl[pos], tag); m != 0; m &= m - 1) {
+			i = pos + (size_t)(ffs((int)m) - 1);
+			if (kvldskey_cmp(k, H->pairs[i].k) == 0)
+				return (&H->pairs[i]);
+		}
+
+		/* If this group has an empty slot, the key isn't here. */
+		if ((m = match(&H->ctrl[pos], CTRL_EMPTY)) != 0)
 			break;
 
-		/* If the hash and key match, stop. */
-		if ((H->hashes[pos] == h) &&
-		    (kvldskey_cmp(k, H->pairs[pos].k) == 0))
-			break;
-
-		/* Move on to the next slot. */
-		pos = (pos + 1) & (H->nslots - 1);
+		/* Move on to the next group. */
+		pos = (pos + GROUP) & (H->nslots - 1);
 	} while (1);
 
-	/*
-	 * Write the hash here.  If the key is already present, this has no
-	 * effect; if the key is not present, this ensures that they hash is
-	 * in place if/when the key is added.
-	 */
-	H->hashes[pos] = h;
+	/* Remember where the key would go, for kvhash_postadd. */
+	H->lastpos = pos + (size_t)(ffs((int)m) - 1);
+	H->lasttag = tag;
 
-	/* Return a pointer to the kvpair struct. */
-	return (&H->pairs[pos]);
+	/* Return a pointer to the empty kvpair struct. */
+	return (&H->pairs[H->lastpos]);
 }
 
 /**
  * kvhash_postadd(H):
- * Record that key-value pair has been added to the kvhash ${H}.  Rehash
- * (expand) the table if necessary.
+ * Record that a key-value pair has been added to the kvhash ${H} in the slot
+ * returned by the most recent call to kvhash_search.  Rehash (expand) the
+ * table if necessary.
  */
 int
 kvhash_postadd(struct kvhash * H)
 {
 
+	/* Sanity check: A key should have been added to an empty slot. */
+	assert(H->ctrl[H->lastpos] == CTRL_EMPTY);
+	assert(H->pairs[H->lastpos].k != NULL);
+
+	/* The slot is now in use. */
+	H->ctrl[H->lastpos] = H->lasttag;
+
 	/* We've added an entry to the hash table. */
 	H->nkeys += 1;
 
@@ -199,8 +305,8 @@ kvhash_free(struct kvhash * H)
 	if (H == NULL)
 		return;
 
-	/* Free the hash table. */
-	free(H->hashes);
-	free(H->pairs);
-	free(H);
+	/* Free the hash table (unless it lives in an arena). */
+	hfree(H->A, H->ctrl);
+	hfree(H->A, H->pairs);
+	hfree(H->A, H);
 }
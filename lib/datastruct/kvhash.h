@@ -1,9 +1,11 @@
 #ifndef _KVHASH_H_
 #define _KVHASH_H_
 
+#include <stddef.h>
 #include <stdint.h>
 
 /* Opaque types. */
+struct arena;
 struct kvldskey;
 struct kvpair_const;
 
@@ -11,37 +13,53 @@ struct kvpair_const;
  * A kvhash structure is a hash table containing keys which each has either
  * a value or NULL associated with it.  New keys can be added to a kvhash,
  * but keys cannot be deleted.  A kvhash cannot contain more than 2^30 keys.
+ *
+ * Slots are grouped into blocks of 16 (or a single smaller block, in small
+ * tables), and each slot has a control byte which is either 0x80 (empty) or
+ * 7 bits taken from the hash of the key it holds; a lookup examines the
+ * control bytes for a group at once and only compares keys whose 7 hash
+ * bits match.
  */
 /**
  * Invariants:
- * 1. (pairs[i].k != NULL) ==> (hashes[i] == hash(pairs[i].k)).
+ * 1. (pairs[i].k != NULL) ==> (ctrl[i] == tag(hash(pairs[i].k))), except
+ *    between kvhash_search returning &pairs[i] and kvhash_postadd.
  * 2. (pairs[i].k == NULL) ==> (pairs[i].v == NULL).
+ * 3. (pairs[i].k == NULL) <==> (ctrl[i] == 0x80), with the same exception.
  */
 struct kvhash {
 	struct kvpair_const * pairs;
-	uint32_t * hashes;
+	uint8_t * ctrl;
 	size_t nkeys;
 	size_t nslots;
+	struct arena * A;
+	size_t lastpos;		/* Slot returned by the last kvhash_search. */
+	uint8_t lasttag;	/* Control byte for that slot's key. */
 };
 
 /**
- * kvhash_init(void):
- * Return an empty kvhash.
+ * kvhash_init(A, nkeys):
+ * Return an empty kvhash with room for ${nkeys} keys before it needs to be
+ * expanded.  If ${A} is not NULL, allocate the kvhash and its tables from
+ * the arena ${A}; in that case the kvhash must not be used after the arena
+ * is reset.
  */
-struct kvhash * kvhash_init(void);
+struct kvhash * kvhash_init(struct arena *, size_t);
 
 /**
  * kvhash_search(H, k):
  * Search for the key ${k} in the kvhash ${H}.  Return a pointer to the
- * kvpair structure where the key appears or would appear if inserted.  Write
- * the hash value into the corresponding location in the hashes array.
+ * kvpair structure where the key appears or would appear if inserted.  If
+ * the key is not present, remember the slot so that kvhash_postadd can mark
+ * it as being in use.
  */
 struct kvpair_const * kvhash_search(struct kvhash *, const struct kvldskey *);
 
 /**
  * kvhash_postadd(H):
- * Record that key-value pair has been added to the kvhash ${H}.  Rehash
- * (expand) the table if necessary.
+ * Record that a key-value pair has been added to the kvhash ${H} in the slot
+ * returned by the most recent call to kvhash_search.  Rehash (expand) the
+ * table if necessary.
  */
 int kvhash_postadd(struct kvhash *);
 
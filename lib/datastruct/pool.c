@@ -106,6 +106,21 @@ pool_rec_lockcount(struct pool * P, void * rec)
 	return (get_pool_elem(P, rec)->wire_count);
 }
 
+/**
+ * pool_room(P):
+ * Return the number of records which can be added to the pool ${P} before
+ * it reaches its target size.
+ */
+size_t
+pool_room(struct pool * P)
+{
+
+	/* The pool can exceed its target size if records are locked. */
+	if (P->used >= P->size)
+		return (0);
+	return (P->size - P->used);
+}
+
 /**
  * pool_free(P):
  * Free the pool ${P}, which must be empty.
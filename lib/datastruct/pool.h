@@ -52,6 +52,13 @@ static void pool_rec_unlock(struct pool *, void *);
  */
 size_t pool_rec_lockcount(struct pool *, void *);
 
+/**
+ * pool_room(P):
+ * Return the number of records which can be added to the pool ${P} before
+ * it reaches its target size.
+ */
+size_t pool_room(struct pool *);
+
 /**
  * pool_free(P):
  * Free the pool ${P}, which must be empty.
@@ -0,0 +1,486 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dynamodb_kv.h"
+#include "dynamodb_request_queue.h"
+#include "events.h"
+#include "http.h"
+
+#include "dynamodb_batch.h"
+
+/* Delay before the first retry of unprocessed items, and maximum delay. */
+#define BACKOFF_MIN	0.05
+#define BACKOFF_MAX	2.0
+
+/* Extra response space for a BatchWriteItem which leaves items unprocessed. */
+#define WRITE_MAXRLEN	65536
+
+/* Maximum BatchGetItem response length: 16 MB of items plus some slack. */
+#define GET_MAXRLEN	(16 * 1024 * 1024 + 65536)
+
+/* Batch operation types. */
+#define BATCH_PUT	0
+#define BATCH_DELETE	1
+#define BATCH_GET	2
+
+/* A single BatchWriteItem or BatchGetItem request. */
+struct chunk {
+	struct dynamodb_batch * B;	/* Batch we belong to. */
+	size_t slot;			/* Our position in B->chunks. */
+	size_t n;			/* Number of items. */
+	size_t idx[DYNAMODB_KV_BATCHGET_MAX];	/* Indices of items. */
+	const char * keys[DYNAMODB_KV_BATCHGET_MAX];
+	char * body;			/* DynamoDB request body. */
+};
+
+/* Batch operation state. */
+struct dynamodb_batch {
+	/* Operation parameters. */
+	struct dynamodb_request_queue * Q;
+	int prio;
+	const char * table;
+	int type;
+	int consistent;
+	size_t n;
+	const char * const * keys;
+	const uint8_t * const * bufs;
+	const size_t * lens;
+	int (* callback_status)(void *, int);
+	int (* callback_get)(void *, int, const uint8_t * const *,
+	    const uint32_t *);
+	void * cookie;
+
+	/* Internal state. */
+	uint8_t * todo;			/* Items not yet processed. */
+	uint8_t ** vbufs;		/* Values read, for GETs. */
+	uint32_t * vlens;		/* Lengths of values read. */
+	struct chunk ** chunks;		/* Requests in progress, or NULL. */
+	size_t nchunks;			/* Number of requests in progress. */
+	int failed;			/* A request has failed. */
+	double backoff;			/* Delay before the next retry. */
+	void * timer_cookie;		/* Retry timer, or NULL. */
+};
+
+static int issue(struct dynamodb_batch *);
+
+/* Free the batch ${B}. */
+static void
+batch_free(struct dynamodb_batch * B)
+{
+	size_t i;
+
+	/* Stop the retry timer, if any. */
+	if (B->timer_cookie != NULL)
+		events_timer_cancel(B->timer_cookie);
+
+	/* Free any requests in progress. */
+	for (i = 0; i < B->nchunks; i++) {
+		if (B->chunks[i] == NULL)
+			continue;
+		free(B->chunks[i]->body);
+		free(B->chunks[i]);
+	}
+	free(B->chunks);
+
+	/* Free any values we read. */
+	if (B->vbufs != NULL) {
+		for (i = 0; i < B->n; i++)
+			free(B->vbufs[i]);
+	}
+	free(B->vlens);
+	free(B->vbufs);
+
+	/* Free the remaining state. */
+	free(B->todo);
+	free(B);
+}
+
+/* Invoke the callback for the batch ${B} and free it. */
+static int
+done(struct dynamodb_batch * B)
+{
+	int status = B->failed ? 1 : 0;
+	int rc;
+
+	/* Invoke the upstream callback. */
+	if (B->type == BATCH_GET)
+		rc = (B->callback_get)(B->cookie, status,
+		    (const uint8_t * const *)B->vbufs, B->vlens);
+	else
+		rc = (B->callback_status)(B->cookie, status);
+
+	/* Free the batch state. */
+	batch_free(B);
+
+	/* Return status from callback. */
+	return (rc);
+}
+
+/* Callback from events_timer. */
+static int
+callback_retry(void * cookie)
+{
+	struct dynamodb_batch * B = cookie;
+
+	/* There is no timer callback pending any more. */
+	B->timer_cookie = NULL;
+
+	/* Issue requests for the items which are left. */
+	return (issue(B));
+}
+
+/* A BatchWriteItem or BatchGetItem request has completed. */
+static int
+callback_chunk(void * cookie, struct http_response * res)
+{
+	struct chunk * C = cookie;
+	struct dynamodb_batch * B = C->B;
+	uint8_t unprocessed[DYNAMODB_KV_BATCHGET_MAX];
+	uint8_t * vbufs[DYNAMODB_KV_BATCHGET_MAX];
+	uint32_t vlens[DYNAMODB_KV_BATCHGET_MAX];
+	size_t i;
+
+	/* Did the request succeed? */
+	if ((res->status != 200) || (res->bodylen == (size_t)(-1))) {
+		B->failed = 1;
+		goto chunkdone;
+	}
+
+	/* Which items, if any, were not processed? */
+	dynamodb_kv_batch_unprocessed(res->body, res->bodylen, B->table,
+	    C->n, C->keys, unprocessed);
+
+	/* Extract any values we read. */
+	if (B->type == BATCH_GET) {
+		if (dynamodb_kv_batch_extractv(res->body, res->bodylen,
+		    B->table, C->n, C->keys, vbufs, vlens))
+			goto err0;
+		for (i = 0; i < C->n; i++) {
+			if (unprocessed[i]) {
+				free(vbufs[i]);
+				continue;
+			}
+			B->vbufs[C->idx[i]] = vbufs[i];
+			B->vlens[C->idx[i]] = vlens[i];
+		}
+	}
+
+	/* Everything else is done. */
+	for (i = 0; i < C->n; i++) {
+		if (unprocessed[i] == 0)
+			B->todo[C->idx[i]] = 0;
+	}
+
+chunkdone:
+	/* This request is no longer in progress. */
+	free(res->body);
+	B->chunks[C->slot] = NULL;
+	free(C->body);
+	free(C);
+
+	/* Are other requests still in progress? */
+	for (i = 0; i < B->nchunks; i++) {
+		if (B->chunks[i] != NULL)
+			return (0);
+	}
+
+	/* If a request failed, we're done. */
+	if (B->failed)
+		return (done(B));
+
+	/* Are there any items left? */
+	for (i = 0; i < B->n; i++) {
+		if (B->todo[i])
+			break;
+	}
+	if (i == B->n)
+		return (done(B));
+
+	/* Wait a while before retrying the unprocessed items. */
+	if ((B->timer_cookie = events_timer_register_double(callback_retry,
+	    B, B->backoff)) == NULL)
+		goto err0;
+	B->backoff *= 2.0;
+	if (B->backoff > BACKOFF_MAX)
+		B->backoff = BACKOFF_MAX;
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Issue requests for all of the items in ${B} which have not been done. */
+static int
+issue(struct dynamodb_batch * B)
+{
+	const uint8_t * bufs[DYNAMODB_KV_BATCHWRITE_MAX];
+	size_t lens[DYNAMODB_KV_BATCHWRITE_MAX];
+	struct chunk * C;
+	const char * op;
+	size_t maxitems;
+	size_t maxrlen;
+	size_t i, j;
+
+	/* How many items can we fit into each request? */
+	if (B->type == BATCH_GET) {
+		op = "BatchGetItem";
+		maxitems = DYNAMODB_KV_BATCHGET_MAX;
+	} else {
+		op = "BatchWriteItem";
+		maxitems = DYNAMODB_KV_BATCHWRITE_MAX;
+	}
+
+	/* Split the remaining items into requests. */
+	B->nchunks = 0;
+	for (i = 0; i < B->n; ) {
+		/* Bake a cookie. */
+		if ((C = malloc(sizeof(struct chunk))) == NULL)
+			goto err0;
+		C->B = B;
+		C->slot = B->nchunks;
+		C->n = 0;
+
+		/* Add items which have not been done yet. */
+		for (; (i < B->n) && (C->n < maxitems); i++) {
+			if (B->todo[i] == 0)
+				continue;
+			C->idx[C->n] = i;
+			C->keys[C->n] = B->keys[i];
+			C->n++;
+		}
+
+		/* Did we run out of items? */
+		if (C->n == 0) {
+			free(C);
+			break;
+		}
+
+		/* Construct the request body. */
+		switch (B->type) {
+		case BATCH_PUT:
+			for (j = 0; j < C->n; j++) {
+				bufs[j] = B->bufs[C->idx[j]];
+				lens[j] = B->lens[C->idx[j]];
+			}
+			C->body = dynamodb_kv_batchput(B->table, C->n,
+			    C->keys, bufs, lens);
+			break;
+		case BATCH_DELETE:
+			C->body = dynamodb_kv_batchdelete(B->table, C->n,
+			    C->keys);
+			break;
+		default:
+			C->body = dynamodb_kv_batchget(B->table, C->n,
+			    C->keys, B->consistent);
+			break;
+		}
+		if (C->body == NULL)
+			goto err1;
+
+		/*
+		 * A BatchWriteItem response echoes back any unprocessed
+		 * items, so it can be as long as the request.
+		 */
+		if (B->type == BATCH_GET)
+			maxrlen = GET_MAXRLEN;
+		else
+			maxrlen = strlen(C->body) + WRITE_MAXRLEN;
+
+		/* Queue the request. */
+		if (dynamodb_request_queue_batch(B->Q, B->prio, op, C->body,
+		    C->n, maxrlen, NULL, callback_chunk, C))
+			goto err2;
+		B->chunks[B->nchunks++] = C;
+	}
+
+	/* Success! */
+	return (0);
+
+err2:
+	free(C->body);
+err1:
+	free(C);
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Create and start a batch operation. */
+static struct dynamodb_batch *
+batch_init(struct dynamodb_request_queue * Q, int prio, const char * table,
+    int type, int consistent, size_t n, const char * const * keys,
+    const uint8_t * const * bufs, const size_t * lens,
+    int (* callback_status)(void *, int),
+    int (* callback_get)(void *, int, const uint8_t * const *,
+        const uint32_t *), void * cookie)
+{
+	struct dynamodb_batch * B;
+	size_t maxitems;
+	size_t i;
+
+	/* Sanity-check. */
+	assert(n > 0);
+
+	/* How many items can we fit into each request? */
+	if (type == BATCH_GET)
+		maxitems = DYNAMODB_KV_BATCHGET_MAX;
+	else
+		maxitems = DYNAMODB_KV_BATCHWRITE_MAX;
+
+	/* Allocate a structure and initialize. */
+	if ((B = malloc(sizeof(struct dynamodb_batch))) == NULL)
+		goto err0;
+	B->Q = Q;
+	B->prio = prio;
+	B->table = table;
+	B->type = type;
+	B->consistent = consistent;
+	B->n = n;
+	B->keys = keys;
+	B->bufs = bufs;
+	B->lens = lens;
+	B->callback_status = callback_status;
+	B->callback_get = callback_get;
+	B->cookie = cookie;
+	B->vbufs = NULL;
+	B->vlens = NULL;
+	B->nchunks = 0;
+	B->failed = 0;
+	B->backoff = BACKOFF_MIN;
+	B->timer_cookie = NULL;
+
+	/* Every item needs to be processed. */
+	if ((B->todo = malloc(n)) == NULL)
+		goto err1;
+	memset(B->todo, 1, n);
+
+	/* Allocate space for tracking requests. */
+	if ((B->chunks = malloc((n / maxitems + 1) *
+	    sizeof(struct chunk *))) == NULL)
+		goto err2;
+
+	/* Allocate space for values we read. */
+	if (type == BATCH_GET) {
+		if ((B->vbufs = malloc(n * sizeof(uint8_t *))) == NULL)
+			goto err3;
+		if ((B->vlens = malloc(n * sizeof(uint32_t))) == NULL)
+			goto err3;
+		for (i = 0; i < n; i++) {
+			B->vbufs[i] = NULL;
+			B->vlens[i] = 0;
+		}
+	}
+
+	/* Send the requests. */
+	if (issue(B))
+		goto err3;
+
+	/* Success! */
+	return (B);
+
+err3:
+	/*
+	 * Requests which were queued before we failed still refer to ${B};
+	 * but the caller will treat this failure as fatal, so there's no
+	 * way for them to complete.
+	 */
+	free(B->vlens);
+	free(B->vbufs);
+	free(B->chunks);
+err2:
+	free(B->todo);
+err1:
+	free(B);
+err0:
+	/* Failure! */
+	return (NULL);
+}
+
+/**
+ * dynamodb_batch_put(Q, prio, table, n, keys, bufs, lens, callback, cookie):
+ * Using the DynamoDB request queue ${Q} with priority ${prio}, associate
+ * V=${bufs[i]} (of length ${lens[i]}) with K=${keys[i]} in DynamoDB table
+ * ${table} for each i < ${n}, via as many BatchWriteItem requests as are
+ * needed; items which DynamoDB returns as unprocessed are retried with
+ * exponential backoff.  Invoke
+ *     ${callback}(${cookie}, status)
+ * when done, where ${status} is 0 on success and 1 on failure.  The ${n}
+ * keys must be distinct, and ${n} must be non-zero.  The table name and
+ * the arrays (and what they point to) must remain valid until the callback
+ * is invoked or the batch is cancelled.
+ */
+struct dynamodb_batch *
+dynamodb_batch_put(struct dynamodb_request_queue * Q, int prio,
+    const char * table, size_t n, const char * const * keys,
+    const uint8_t * const * bufs, const size_t * lens,
+    int (* callback)(void *, int), void * cookie)
+{
+
+	/* Start the operation. */
+	return (batch_init(Q, prio, table, BATCH_PUT, 0, n, keys, bufs, lens,
+	    callback, NULL, cookie));
+}
+
+/**
+ * dynamodb_batch_delete(Q, prio, table, n, keys, callback, cookie):
+ * As dynamodb_batch_put, except that the items associated with K=${keys[i]}
+ * are deleted.
+ */
+struct dynamodb_batch *
+dynamodb_batch_delete(struct dynamodb_request_queue * Q, int prio,
+    const char * table, size_t n, const char * const * keys,
+    int (* callback)(void *, int), void * cookie)
+{
+
+	/* Start the operation. */
+	return (batch_init(Q, prio, table, BATCH_DELETE, 0, n, keys,
+	    NULL, NULL, callback, NULL, cookie));
+}
+
+/**
+ * dynamodb_batch_get(Q, prio, table, consistent, n, keys, callback, cookie):
+ * Using the DynamoDB request queue ${Q} with priority ${prio}, read the
+ * values associated with K=${keys[i]} in DynamoDB table ${table} for each
+ * i < ${n}, via as many BatchGetItem requests as are needed and with strong
+ * consistency if ${consistent} is non-zero; keys which DynamoDB returns as
+ * unprocessed are retried with exponential backoff.  Invoke
+ *     ${callback}(${cookie}, status, bufs, lens)
+ * when done, where ${status} is 0 on success and 1 on failure, and (on
+ * success) ${bufs[i]} is the value associated with ${keys[i]} (of length
+ * ${lens[i]}) or NULL if there is no such item.  The values are only valid
+ * until the callback returns.  The ${n} keys must be distinct, and ${n}
+ * must be non-zero.  The table name and the array of keys (and what it
+ * points to) must remain valid until the callback is invoked or the batch
+ * is cancelled.
+ */
+struct dynamodb_batch *
+dynamodb_batch_get(struct dynamodb_request_queue * Q, int prio,
+    const char * table, int consistent, size_t n, const char * const * keys,
+    int (* callback)(void *, int, const uint8_t * const *, const uint32_t *),
+    void * cookie)
+{
+
+	/* Start the operation. */
+	return (batch_init(Q, prio, table, BATCH_GET, consistent, n, keys,
+	    NULL, NULL, NULL, callback, cookie));
+}
+
+/**
+ * dynamodb_batch_cancel(B):
+ * Free the state of the batch operation ${B} without performing its
+ * callback.  This must only be called after the DynamoDB request queue used
+ * by the operation has been flushed, since queued requests refer to the
+ * state.
+ */
+void
+dynamodb_batch_cancel(struct dynamodb_batch * B)
+{
+
+	/* Free the batch state. */
+	batch_free(B);
+}
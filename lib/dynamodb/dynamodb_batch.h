@@ -0,0 +1,66 @@
+#ifndef _DYNAMODB_BATCH_H_
+#define _DYNAMODB_BATCH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Opaque types. */
+struct dynamodb_batch;
+struct dynamodb_request_queue;
+
+/**
+ * dynamodb_batch_put(Q, prio, table, n, keys, bufs, lens, callback, cookie):
+ * Using the DynamoDB request queue ${Q} with priority ${prio}, associate
+ * V=${bufs[i]} (of length ${lens[i]}) with K=${keys[i]} in DynamoDB table
+ * ${table} for each i < ${n}, via as many BatchWriteItem requests as are
+ * needed; items which DynamoDB returns as unprocessed are retried with
+ * exponential backoff.  Invoke
+ *     ${callback}(${cookie}, status)
+ * when done, where ${status} is 0 on success and 1 on failure.  The ${n}
+ * keys must be distinct, and ${n} must be non-zero.  The table name and
+ * the arrays (and what they point to) must remain valid until the callback
+ * is invoked or the batch is cancelled.
+ */
+struct dynamodb_batch * dynamodb_batch_put(struct dynamodb_request_queue *,
+    int, const char *, size_t, const char * const *, const uint8_t * const *,
+    const size_t *, int (*)(void *, int), void *);
+
+/**
+ * dynamodb_batch_delete(Q, prio, table, n, keys, callback, cookie):
+ * As dynamodb_batch_put, except that the items associated with K=${keys[i]}
+ * are deleted.
+ */
+struct dynamodb_batch * dynamodb_batch_delete(struct dynamodb_request_queue *,
+    int, const char *, size_t, const char * const *, int (*)(void *, int),
+    void *);
+
+/**
+ * dynamodb_batch_get(Q, prio, table, consistent, n, keys, callback, cookie):
+ * Using the DynamoDB request queue ${Q} with priority ${prio}, read the
+ * values associated with K=${keys[i]} in DynamoDB table ${table} for each
+ * i < ${n}, via as many BatchGetItem requests as are needed and with strong
+ * consistency if ${consistent} is non-zero; keys which DynamoDB returns as
+ * unprocessed are retried with exponential backoff.  Invoke
+ *     ${callback}(${cookie}, status, bufs, lens)
+ * when done, where ${status} is 0 on success and 1 on failure, and (on
+ * success) ${bufs[i]} is the value associated with ${keys[i]} (of length
+ * ${lens[i]}) or NULL if there is no such item.  The values are only valid
+ * until the callback returns.  The ${n} keys must be distinct, and ${n}
+ * must be non-zero.  The table name and the array of keys (and what it
+ * points to) must remain valid until the callback is invoked or the batch
+ * is cancelled.
+ */
+struct dynamodb_batch * dynamodb_batch_get(struct dynamodb_request_queue *,
+    int, const char *, int, size_t, const char * const *,
+    int (*)(void *, int, const uint8_t * const *, const uint32_t *), void *);
+
+/**
+ * dynamodb_batch_cancel(B):
+ * Free the state of the batch operation ${B} without performing its
+ * callback.  This must only be called after the DynamoDB request queue used
+ * by the operation has been flushed, since queued requests refer to the
+ * state.
+ */
+void dynamodb_batch_cancel(struct dynamodb_batch *);
+
+#endif /* !_DYNAMODB_BATCH_H_ */
@@ -5,6 +5,7 @@
 
 #include "b64encode.h"
 #include "json.h"
+#include "json_array.h"
 
 #include "dynamodb_kv.h"
 
@@ -14,6 +15,155 @@
 	spos += strlen(s1);			\
 } while (0);
 
+/* Build a BatchWriteItem or BatchGetItem request body. */
+static char *
+batchbody(const char * table, const char * s2, const char * s3,
+    size_t n, const char * const * keys, const char * k1,
+    const uint8_t * const * bufs, const size_t * lens, const char * k2,
+    const char * k3)
+{
+	const char * s1 = "{\"RequestItems\":{\"";
+	size_t slen;
+	size_t spos = 0;
+	size_t i;
+	char * s;
+
+	/* Sanity-check. */
+	assert(n > 0);
+
+	/* Compute the request length. */
+	slen = strlen(s1) + strlen(table) + strlen(s2) + (n - 1) + strlen(s3);
+	for (i = 0; i < n; i++) {
+		slen += strlen(k1) + strlen(keys[i]) + strlen(k3);
+		if (bufs != NULL)
+			slen += strlen(k2) + ((lens[i] + 2) / 3) * 4;
+	}
+
+	/* Allocate request string. */
+	if ((s = malloc(slen + 1)) == NULL)
+		goto done;
+
+	/* Construct the request, piece by piece. */
+	COPYANDINCR(s, spos, s1);
+	COPYANDINCR(s, spos, table);
+	COPYANDINCR(s, spos, s2);
+	for (i = 0; i < n; i++) {
+		if (i > 0)
+			s[spos++] = ',';
+		COPYANDINCR(s, spos, k1);
+		COPYANDINCR(s, spos, keys[i]);
+		if (bufs != NULL) {
+			COPYANDINCR(s, spos, k2);
+			b64encode(bufs[i], &s[spos], lens[i]);
+			spos += ((lens[i] + 2) / 3) * 4;
+		}
+		COPYANDINCR(s, spos, k3);
+	}
+	COPYANDINCR(s, spos, s3);
+	s[spos] = '\0';
+
+	/* Check that we got the buffer size right. */
+	assert(slen == spos);
+
+done:
+	/* Return string (or NULL if allocation failed). */
+	return (s);
+}
+
+/*
+ * If ${p} points at a JSON string which is one of the ${n} keys ${keys},
+ * return the index of that key; otherwise, return ${n}.
+ */
+static size_t
+findkey(const uint8_t * p, const uint8_t * end, size_t n,
+    const char * const * keys)
+{
+	size_t slen;
+	size_t i;
+
+	/* We should be pointing at the opening '"' of a string. */
+	if ((p == end) || (*p++ != '"'))
+		return (n);
+
+	/* How long is it? */
+	for (slen = 0; &p[slen] != end; slen++) {
+		if (p[slen] == '"')
+			break;
+	}
+
+	/* We should have found a terminating '"'. */
+	if (&p[slen] == end)
+		return (n);
+
+	/* Look for a matching key. */
+	for (i = 0; i < n; i++) {
+		if ((strlen(keys[i]) == slen) &&
+		    (memcmp(keys[i], p, slen) == 0))
+			break;
+	}
+
+	/* Return the index of the key we found, or ${n}. */
+	return (i);
+}
+
+/*
+ * Base64 decode the JSON string at ${p} into a newly allocated buffer, and
+ * return it and its length via ${outbuf} / ${outlen}.  If there is no such
+ * string, return with ${outbuf} set to NULL.
+ */
+static int
+decodestr(const uint8_t * p, const uint8_t * end,
+    uint8_t ** outbuf, uint32_t * outlen)
+{
+	size_t slen;
+	size_t vlen;
+
+	/* We should be pointing at the opening '"' of a string. */
+	if (p == end)
+		goto novalue;
+	if (*p++ != '"')
+		goto novalue;
+
+	/* How long is it? */
+	for (slen = 0; &p[slen] != end; slen++) {
+		if (p[slen] == '"')
+			break;
+	}
+
+	/* We should have found a terminating '"'. */
+	if (&p[slen] == end)
+		goto novalue;
+
+	/* Allocate a buffer. */
+	if ((*outbuf = malloc((slen / 4) * 3)) == NULL)
+		goto err0;
+
+	/* Attempt to parse the base64-encoded data. */
+	if (b64decode((const char *)p, slen, *outbuf, &vlen))
+		goto novalue1;
+
+	/* Record the size of the returned value. */
+	if (vlen >= (uint32_t)(-1))
+		goto novalue1;
+	*outlen = vlen;
+
+	/* Success! */
+	return (0);
+
+novalue1:
+	free(*outbuf);
+novalue:
+	/* We have no value. */
+	*outbuf = NULL;
+
+	/* Success!  (Or at least, no internal error.) */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
 /**
  * dynamodb_kv_put(table, key, buf, len):
  * Construct a DynamoDB request body for a PutItem of V=${buf} (of length
@@ -215,12 +365,12 @@ dynamodb_kv_extractv(const uint8_t * inbuf, size_t inlen,
 {
 	const uint8_t * p = inbuf;
 	const uint8_t * end = &inbuf[inlen];
-	size_t slen;
-	size_t vlen;
 
 	/* If we have no response body, there is no value. */
-	if (inbuf == NULL)
-		goto novalue;
+	if (inbuf == NULL) {
+		*outbuf = NULL;
+		return (0);
+	}
 
 	/**
 	 * We need to locate B64VALUE in the string
@@ -233,48 +383,252 @@ dynamodb_kv_extractv(const uint8_t * inbuf, size_t inlen,
 	p = json_find(p, end, "V");
 	p = json_find(p, end, "B");
 
-	/* We should be pointing at the opening '"' of a string. */
-	if (p == end)
-		goto novalue;
-	if (*p++ != '"')
-		goto novalue;
+	/* Decode the value. */
+	return (decodestr(p, end, outbuf, outlen));
+}
 
-	/* How long is it? */
-	for (slen = 0; &p[slen] != end; slen++) {
-		if (p[slen] == '"')
-			break;
-	}
+/**
+ * dynamodb_kv_batchput(table, n, keys, bufs, lens):
+ * Construct a DynamoDB request body for a BatchWriteItem which associates
+ * V=${bufs[i]} (of length ${lens[i]}) with K=${keys[i]} in DynamoDB table
+ * ${table} for each i < ${n}.  The ${n} keys must be distinct, and ${n} must
+ * be between 1 and DYNAMODB_KV_BATCHWRITE_MAX.
+ */
+char *
+dynamodb_kv_batchput(const char * table, size_t n, const char * const * keys,
+    const uint8_t * const * bufs, const size_t * lens)
+{
+	/**
+	 * The body of a BatchWriteItem request (with spaces added) is:
+	 * { "RequestItems": {
+	 *     "TABLE": [
+	 *       { "PutRequest": {
+	 *           "Item": {
+	 *             "K": { "S": "KEY" },
+	 *             "V": { "B": "BASE64VALUE" }
+	 *           }
+	 *       } },
+	 *       ...
+	 *     ]
+	 *   },
+	 *   "ReturnConsumedCapacity": "TOTAL"
+	 * }
+	 */
+	const char * s2 = "\":[";
+	const char * k1 = "{\"PutRequest\":{\"Item\":{\"K\":{\"S\":\"";
+	const char * k2 = "\"},\"V\":{\"B\":\"";
+	const char * k3 = "\"}}}}";
+	const char * s3 = "]},\"ReturnConsumedCapacity\":\"TOTAL\"}";
 
-	/* We should have found a terminating '"'. */
-	if (&p[slen] == end)
-		goto novalue;
+	/* Sanity-check. */
+	assert(n <= DYNAMODB_KV_BATCHWRITE_MAX);
 
-	/* Allocate a buffer. */
-	if ((*outbuf = malloc((slen / 4) * 3)) == NULL)
-		goto err0;
+	/* Construct the request. */
+	return (batchbody(table, s2, s3, n, keys, k1, bufs, lens, k2, k3));
+}
 
-	/* Attempt to parse the base64-encoded data. */
-	if (b64decode((const char *)p, slen, *outbuf, &vlen))
-		goto novalue1;
+/**
+ * dynamodb_kv_batchdelete(table, n, keys):
+ * Construct a DynamoDB request body for a BatchWriteItem which deletes the
+ * items associated with K=${keys[i]} in DynamoDB table ${table} for each
+ * i < ${n}.  The ${n} keys must be distinct, and ${n} must be between 1 and
+ * DYNAMODB_KV_BATCHWRITE_MAX.
+ */
+char *
+dynamodb_kv_batchdelete(const char * table, size_t n,
+    const char * const * keys)
+{
+	/**
+	 * The body of a BatchWriteItem request (with spaces added) is:
+	 * { "RequestItems": {
+	 *     "TABLE": [
+	 *       { "DeleteRequest": {
+	 *           "Key": {
+	 *             "K": { "S": "KEY" }
+	 *           }
+	 *       } },
+	 *       ...
+	 *     ]
+	 *   },
+	 *   "ReturnConsumedCapacity": "TOTAL"
+	 * }
+	 */
+	const char * s2 = "\":[";
+	const char * k1 = "{\"DeleteRequest\":{\"Key\":{\"K\":{\"S\":\"";
+	const char * k3 = "\"}}}}";
+	const char * s3 = "]},\"ReturnConsumedCapacity\":\"TOTAL\"}";
 
-	/* Record the size of the returned value. */
-	if (vlen >= (uint32_t)(-1))
-		goto novalue1;
-	*outlen = vlen;
+	/* Sanity-check. */
+	assert(n <= DYNAMODB_KV_BATCHWRITE_MAX);
 
-	/* Success! */
-	return (0);
+	/* Construct the request. */
+	return (batchbody(table, s2, s3, n, keys, k1, NULL, NULL, NULL, k3));
+}
 
-novalue1:
-	free(*outbuf);
-novalue:
-	/* We have no value. */
-	*outbuf = NULL;
+/**
+ * dynamodb_kv_batchget(table, n, keys, consistent):
+ * Construct a DynamoDB request body for a BatchGetItem of the items
+ * associated with K=${keys[i]} in DynamoDB table ${table} for each i < ${n},
+ * with strong consistency if ${consistent} is non-zero.  The ${n} keys must
+ * be distinct, and ${n} must be between 1 and DYNAMODB_KV_BATCHGET_MAX.
+ */
+char *
+dynamodb_kv_batchget(const char * table, size_t n, const char * const * keys,
+    int consistent)
+{
+	/**
+	 * The body of a BatchGetItem request (with spaces added) is:
+	 * { "RequestItems": {
+	 *     "TABLE": {
+	 *       "ConsistentRead": true,
+	 *       "Keys": [
+	 *         { "K": { "S": "KEY" } },
+	 *         ...
+	 *       ]
+	 *     }
+	 *   },
+	 *   "ReturnConsumedCapacity": "TOTAL"
+	 * }
+	 * where the ConsistentRead field is omitted for eventually consistent
+	 * reads.
+	 */
+	const char * s2 = consistent ?
+	    "\":{\"ConsistentRead\":true,\"Keys\":[" : "\":{\"Keys\":[";
+	const char * k1 = "{\"K\":{\"S\":\"";
+	const char * k3 = "\"}}";
+	const char * s3 = "]}},\"ReturnConsumedCapacity\":\"TOTAL\"}";
 
-	/* Success!  (Or at least, no internal error.) */
+	/* Sanity-check. */
+	assert(n <= DYNAMODB_KV_BATCHGET_MAX);
+
+	/* Construct the request. */
+	return (batchbody(table, s2, s3, n, keys, k1, NULL, NULL, NULL, k3));
+}
+
+/**
+ * dynamodb_kv_batch_extractv(inbuf, inlen, table, n, keys, outbufs, outlens):
+ * Extract and base64 decode the "V" fields of the items from table ${table}
+ * in the BatchGetItem response provided via ${inbuf} (of length ${inlen}).
+ * For each of the ${n} keys ${keys[i]}, return a buffer and its length via
+ * ${outbufs[i]} / ${outlens[i]}; if the response has no such item, set
+ * ${outbufs[i]} to NULL.
+ */
+int
+dynamodb_kv_batch_extractv(const uint8_t * inbuf, size_t inlen,
+    const char * table, size_t n, const char * const * keys,
+    uint8_t ** outbufs, uint32_t * outlens)
+{
+	const uint8_t * end = &inbuf[inlen];
+	const uint8_t * p;
+	const uint8_t * q;
+	size_t i;
+
+	/* We haven't found any values yet. */
+	for (i = 0; i < n; i++)
+		outbufs[i] = NULL;
+
+	/* If we have no response body, there are no values. */
+	if (inbuf == NULL)
+		return (0);
+
+	/**
+	 * The items are in an array in the string
+	 * {"Responses":{"TABLE":[{"V":{"B":"dmFsdWUK"},"K":{"S":"key"}},
+	 * ...]},"UnprocessedKeys":{}}
+	 * so we look for the json object associated with "Responses"; then
+	 * look for the array associated with "TABLE" inside that, and walk
+	 * through the items in that array.
+	 */
+	p = json_find(inbuf, end, "Responses");
+	p = json_find(p, end, table);
+	for (p = json_array_first(p, end); p != end;
+	    p = json_array_next(p, end)) {
+		/* Which key is this item associated with? */
+		q = json_find(p, end, "K");
+		q = json_find(q, end, "S");
+		if ((i = findkey(q, end, n, keys)) == n)
+			continue;
+
+		/* Ignore duplicate items. */
+		if (outbufs[i] != NULL)
+			continue;
+
+		/* Decode the value. */
+		q = json_find(p, end, "V");
+		q = json_find(q, end, "B");
+		if (decodestr(q, end, &outbufs[i], &outlens[i]))
+			goto err1;
+	}
+
+	/* Success! */
 	return (0);
 
-err0:
+err1:
+	for (i = 0; i < n; i++) {
+		free(outbufs[i]);
+		outbufs[i] = NULL;
+	}
+
 	/* Failure! */
 	return (-1);
 }
+
+/**
+ * dynamodb_kv_batch_unprocessed(inbuf, inlen, table, n, keys, unprocessed):
+ * For each of the ${n} keys ${keys[i]}, set ${unprocessed[i]} to 1 if the
+ * BatchWriteItem or BatchGetItem response provided via ${inbuf} (of length
+ * ${inlen}) lists the item with that key in table ${table} as unprocessed,
+ * and to 0 otherwise.
+ */
+void
+dynamodb_kv_batch_unprocessed(const uint8_t * inbuf, size_t inlen,
+    const char * table, size_t n, const char * const * keys,
+    uint8_t * unprocessed)
+{
+	const uint8_t * end = &inbuf[inlen];
+	const uint8_t * p;
+	const uint8_t * q;
+	size_t i;
+
+	/* Nothing is unprocessed unless we find it listed. */
+	for (i = 0; i < n; i++)
+		unprocessed[i] = 0;
+
+	/* If we have no response body, there is nothing listed. */
+	if (inbuf == NULL)
+		return;
+
+	/**
+	 * A BatchWriteItem response lists unprocessed items as
+	 * {"UnprocessedItems":{"TABLE":[{"PutRequest":{"Item":{"K":{"S":
+	 * "key"},"V":{"B":"dmFsdWUK"}}}},{"DeleteRequest":{"Key":{"K":
+	 * {"S":"key"}}}},...]}}
+	 * while a BatchGetItem response lists unprocessed keys as
+	 * {"UnprocessedKeys":{"TABLE":{"Keys":[{"K":{"S":"key"}},...]}}}.
+	 */
+	p = json_find(inbuf, end, "UnprocessedItems");
+	p = json_find(p, end, table);
+	for (p = json_array_first(p, end); p != end;
+	    p = json_array_next(p, end)) {
+		if ((q = json_find(p, end, "PutRequest")) != end) {
+			q = json_find(q, end, "Item");
+		} else {
+			q = json_find(p, end, "DeleteRequest");
+			q = json_find(q, end, "Key");
+		}
+		q = json_find(q, end, "K");
+		q = json_find(q, end, "S");
+		if ((i = findkey(q, end, n, keys)) < n)
+			unprocessed[i] = 1;
+	}
+	p = json_find(inbuf, end, "UnprocessedKeys");
+	p = json_find(p, end, table);
+	p = json_find(p, end, "Keys");
+	for (p = json_array_first(p, end); p != end;
+	    p = json_array_next(p, end)) {
+		q = json_find(p, end, "K");
+		q = json_find(q, end, "S");
+		if ((i = findkey(q, end, n, keys)) < n)
+			unprocessed[i] = 1;
+	}
+}
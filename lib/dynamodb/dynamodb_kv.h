@@ -41,4 +41,57 @@ char * dynamodb_kv_delete(const char *, const char *);
  */
 int dynamodb_kv_extractv(const uint8_t *, size_t, uint8_t **, uint32_t *);
 
+/* Maximum number of items in a BatchWriteItem or BatchGetItem request. */
+#define DYNAMODB_KV_BATCHWRITE_MAX	25
+#define DYNAMODB_KV_BATCHGET_MAX	100
+
+/**
+ * dynamodb_kv_batchput(table, n, keys, bufs, lens):
+ * Construct a DynamoDB request body for a BatchWriteItem which associates
+ * V=${bufs[i]} (of length ${lens[i]}) with K=${keys[i]} in DynamoDB table
+ * ${table} for each i < ${n}.  The ${n} keys must be distinct, and ${n} must
+ * be between 1 and DYNAMODB_KV_BATCHWRITE_MAX.
+ */
+char * dynamodb_kv_batchput(const char *, size_t, const char * const *,
+    const uint8_t * const *, const size_t *);
+
+/**
+ * dynamodb_kv_batchdelete(table, n, keys):
+ * Construct a DynamoDB request body for a BatchWriteItem which deletes the
+ * items associated with K=${keys[i]} in DynamoDB table ${table} for each
+ * i < ${n}.  The ${n} keys must be distinct, and ${n} must be between 1 and
+ * DYNAMODB_KV_BATCHWRITE_MAX.
+ */
+char * dynamodb_kv_batchdelete(const char *, size_t, const char * const *);
+
+/**
+ * dynamodb_kv_batchget(table, n, keys, consistent):
+ * Construct a DynamoDB request body for a BatchGetItem of the items
+ * associated with K=${keys[i]} in DynamoDB table ${table} for each i < ${n},
+ * with strong consistency if ${consistent} is non-zero.  The ${n} keys must
+ * be distinct, and ${n} must be between 1 and DYNAMODB_KV_BATCHGET_MAX.
+ */
+char * dynamodb_kv_batchget(const char *, size_t, const char * const *, int);
+
+/**
+ * dynamodb_kv_batch_extractv(inbuf, inlen, table, n, keys, outbufs, outlens):
+ * Extract and base64 decode the "V" fields of the items from table ${table}
+ * in the BatchGetItem response provided via ${inbuf} (of length ${inlen}).
+ * For each of the ${n} keys ${keys[i]}, return a buffer and its length via
+ * ${outbufs[i]} / ${outlens[i]}; if the response has no such item, set
+ * ${outbufs[i]} to NULL.
+ */
+int dynamodb_kv_batch_extractv(const uint8_t *, size_t, const char *,
+    size_t, const char * const *, uint8_t **, uint32_t *);
+
+/**
+ * dynamodb_kv_batch_unprocessed(inbuf, inlen, table, n, keys, unprocessed):
+ * For each of the ${n} keys ${keys[i]}, set ${unprocessed[i]} to 1 if the
+ * BatchWriteItem or BatchGetItem response provided via ${inbuf} (of length
+ * ${inlen}) lists the item with that key in table ${table} as unprocessed,
+ * and to 0 otherwise.
+ */
+void dynamodb_kv_batch_unprocessed(const uint8_t *, size_t, const char *,
+    size_t, const char * const *, uint8_t *);
+
 #endif /* !_DYNAMODB_KV_ */
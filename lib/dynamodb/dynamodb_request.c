@@ -1,17 +1,19 @@
 #include <stdlib.h>
 
 #include "asprintf.h"
-#include "aws_sign.h"
+#include "aws_sign_cache.h"
 #include "http.h"
 
 #include "dynamodb_request.h"
 
 /**
- * dynamodb_request(addrs, key_id, key_secret, region, op, body, bodylen,
- *     maxrlen, callback, cookie):
+ * dynamodb_request(P, SC, addrs, key_id, key_secret, region, op, body,
+ *     bodylen, maxrlen, callback, cookie):
  * Using the AWS Key ID ${key_id} and Secret Access Key ${key_secret}, send
  * the DynamoDB request contained in ${body} (of length ${bodylen}) for the
- * operation ${op} to region ${region} located at ${addrs}.
+ * operation ${op} to region ${region} located at ${addrs}, using a connection
+ * from the HTTP connection pool ${P} if ${P} is not NULL, and using ${SC}
+ * as a cache of signing keys if ${SC} is not NULL.
  * 
  * Read a response with a body of up to ${maxrlen} bytes and invoke the
  * provided callback as ${callback}(${cookie}, ${response}), with a response
@@ -30,9 +32,10 @@
  * callback is invoked.
  */
 void *
-dynamodb_request(struct sock_addr * const * addrs, const char * key_id,
-    const char * key_secret, const char * region, const char * op,
-    const uint8_t * body, size_t bodylen, size_t maxrlen,
+dynamodb_request(struct http_pool * P, struct aws_sign_cache * SC,
+    struct sock_addr * const * addrs, const char * key_id,
+    const char * key_secret, const char * region,
+    const char * op, const uint8_t * body, size_t bodylen, size_t maxrlen,
     int (* callback)(void *, struct http_response *), void * cookie)
 {
 	struct http_request RH;
@@ -46,8 +49,9 @@ dynamodb_request(struct sock_addr * const * addrs, const char * key_id,
 	void * http_cookie;
 
 	/* Construct headers needed for authorization. */
-	if (aws_sign_dynamodb_headers(key_id, key_secret, region, op, body,
-	    bodylen, &x_amz_content_sha256, &x_amz_date, &authorization))
+	if (aws_sign_cache_dynamodb_headers(SC, key_id, key_secret, region,
+	    op, body, bodylen, &x_amz_content_sha256, &x_amz_date,
+	    &authorization))
 		goto err0;
 
 	/* Construct Host header. */
@@ -67,6 +71,7 @@ dynamodb_request(struct sock_addr * const * addrs, const char * key_id,
 	RH.path = "/";
 	RH.bodylen = bodylen;
 	RH.body = body;
+	RH.resbuf = NULL;
 	RH.nheaders = 7;
 	RH.headers = RHH;
 
@@ -87,7 +92,7 @@ dynamodb_request(struct sock_addr * const * addrs, const char * key_id,
 	RHH[6].value = "application/x-amz-json-1.0";
 
 	/* Send the request. */
-	if ((http_cookie = http_request(addrs, &RH, maxrlen,
+	if ((http_cookie = http_pool_request(P, addrs, &RH, maxrlen,
 	    callback, cookie)) == NULL)
 		goto err4;
 
@@ -4,15 +4,19 @@
 #include <stdint.h>
 
 /* Opaque types. */
+struct aws_sign_cache;
+struct http_pool;
 struct http_response;
 struct sock_addr;
 
 /**
- * dynamodb_request(addrs, key_id, key_secret, region, op, body, bodylen,
- *     maxrlen, callback, cookie):
+ * dynamodb_request(P, SC, addrs, key_id, key_secret, region, op, body,
+ *     bodylen, maxrlen, callback, cookie):
  * Using the AWS Key ID ${key_id} and Secret Access Key ${key_secret}, send
  * the DynamoDB request contained in ${body} (of length ${bodylen}) for the
- * operation ${op} to region ${region} located at ${addrs}.
+ * operation ${op} to region ${region} located at ${addrs}, using a connection
+ * from the HTTP connection pool ${P} if ${P} is not NULL, and using ${SC}
+ * as a cache of signing keys if ${SC} is not NULL.
  * 
  * Read a response with a body of up to ${maxrlen} bytes and invoke the
  * provided callback as ${callback}(${cookie}, ${response}), with a response
@@ -30,8 +34,9 @@ struct sock_addr;
  * returns.  The provided request body buffer must remain valid until the
  * callback is invoked.
  */
-void * dynamodb_request(struct sock_addr * const *, const char *,
-    const char *, const char *, const char *, const uint8_t *, size_t,
-    size_t, int (*)(void *, struct http_response *), void *);
+void * dynamodb_request(struct http_pool *, struct aws_sign_cache *,
+    struct sock_addr * const *, const char *, const char *, const char *,
+    const char *, const uint8_t *, size_t, size_t,
+    int (*)(void *, struct http_response *), void *);
 
 #endif /* !_DYNAMODB_REQUEST_H_ */
@@ -1,12 +1,15 @@
+#include <assert.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "aws_sign_cache.h"
 #include "dynamodb_request.h"
 #include "events.h"
 #include "http.h"
 #include "insecure_memzero.h"
 #include "json.h"
+#include "json_array.h"
 #include "logging.h"
 #include "monoclock.h"
 #include "ptrheap.h"
@@ -17,6 +20,26 @@
 
 #include "dynamodb_request_queue.h"
 
+/* Maximum number of connections to keep open to each DynamoDB endpoint. */
+#define MAXCONNS 64
+
+/*
+ * Adaptive (AIMD) rate control: when throttled, cut the rate limit and the
+ * capacity allowed in flight by AIMD_DECREASE; then raise the rate limit by
+ * AIMD_INCREASE times the rate at which we were throttled every second.
+ */
+#define AIMD_DECREASE	0.5
+#define AIMD_INCREASE	0.05
+
+/* We never limit ourselves to less than one capacity unit per second. */
+#define RATE_MIN	1.0
+
+/* Stop limiting requests to an on-demand table after a minute of calm. */
+#define ONDEMAND_CALM	60.0
+
+/* Token bucket size used when we're not limiting the request rate. */
+#define BUCKET_UNLIMITED	(300.0 * 50000.0)
+
 /* Request. */
 struct request {
 	struct dynamodb_request_queue * Q;
@@ -24,6 +47,7 @@ struct request {
 	const uint8_t * body;
 	size_t bodylen;
 	size_t maxrlen;
+	size_t nitems;
 	char * logstr;
 	int (* callback)(void *, struct http_response *);
 	void * cookie;
@@ -41,10 +65,20 @@ struct dynamodb_request_queue {
 	char * key_secret;
 	char * region;
 	struct serverpool * SP;
-	double mu_capperreq;
+	struct http_pool * HP;
+	struct aws_sign_cache * SC;
+	double mu_capperitem;
+	double capacity;
+	double rate;
+	double rate_incr;
 	double spercap;
 	double bucket_cap;
 	double maxburst_cap;
+	double window_cap;
+	double consumed_cap;
+	double crate;
+	struct timeval t_adjust;
+	struct timeval t_throttle;
 	void * timer_cookie;
 	void * immediate_cookie;
 	size_t inflight;
@@ -176,20 +210,15 @@ err0:
 	return (-1);
 }
 
-/* Extract ConsumedCapacity->CapacityUnits from returned JSON. */
+/* Extract CapacityUnits from the ConsumedCapacity object at ${buf}. */
 static int
-extractcapacity(struct http_response * res, double * pcap)
+extractunits(const uint8_t * buf, const uint8_t * end, double * pcap)
 {
-	const uint8_t * buf = res->body;
-	const uint8_t * end = res->body + res->bodylen;
 	char * capacity;
 	size_t len;
 	double c;
 
-	/* Look for ConsumedCapacity. */
-	buf = json_find(buf, end, "ConsumedCapacity");
-
-	/* Look for CapacityUnits inside that. */
+	/* Look for CapacityUnits. */
 	buf = json_find(buf, end, "CapacityUnits");
 
 	/* Figure out how long the numeric value is. */
@@ -232,6 +261,191 @@ err0:
 	return (-1);
 }
 
+/* Extract ConsumedCapacity->CapacityUnits from returned JSON. */
+static int
+extractcapacity(struct http_response * res, double * pcap)
+{
+	const uint8_t * buf = res->body;
+	const uint8_t * end = res->body + res->bodylen;
+	double c;
+
+	/* Look for ConsumedCapacity. */
+	buf = json_find(buf, end, "ConsumedCapacity");
+
+	/*
+	 * Batch operations return an array with an entry for each table
+	 * they touched; add up the capacity units from all of them.
+	 */
+	if ((buf != end) && (buf[0] == '[')) {
+		*pcap = 0.0;
+		for (buf = json_array_first(buf, end); buf != end;
+		    buf = json_array_next(buf, end)) {
+			if (extractunits(buf, end, &c))
+				goto err0;
+			*pcap += c;
+		}
+	} else {
+		if (extractunits(buf, end, pcap))
+			goto err0;
+	}
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Return the number of seconds from ${t0} to ${t1}. */
+static double
+tvdiff(const struct timeval * t0, const struct timeval * t1)
+{
+
+	return ((double)(t1->tv_sec - t0->tv_sec) +
+	    (double)(t1->tv_usec - t0->tv_usec) * 0.000001);
+}
+
+/* Make the token bucket match the rate limit. */
+static void
+setrate(struct dynamodb_request_queue * Q)
+{
+
+	/*
+	 * How long does it take for one capacity unit to arrive?  If we're
+	 * not limiting the request rate, no tokens arrive; instead, we fill
+	 * the bucket and leave it full.
+	 */
+	if (Q->rate > 0.0) {
+		Q->spercap = 1.0 / Q->rate;
+	} else {
+		Q->spercap = 0.0;
+		Q->bucket_cap = BUCKET_UNLIMITED;
+	}
+}
+
+/*
+ * Update our measurement of the rate at which we're consuming capacity, and
+ * (additively) increase our rate limit if a second or more has passed since
+ * we last did so.
+ */
+static int
+adjust(struct dynamodb_request_queue * Q)
+{
+	struct timeval tnow;
+	double t;
+
+	/* Has a second passed? */
+	if (monoclock_get(&tnow))
+		goto err0;
+	if ((t = tvdiff(&Q->t_adjust, &tnow)) < 1.0)
+		goto done;
+
+	/* Update our rolling average of capacity units per second. */
+	Q->crate += (Q->consumed_cap / t - Q->crate) * 0.5;
+	Q->consumed_cap = 0.0;
+	Q->t_adjust = tnow;
+
+	/* If we're not limiting the request rate, there's nothing to do. */
+	if (Q->rate == 0.0)
+		goto done;
+
+	/*
+	 * Tables with provisioned capacity get the rate limit raised back up
+	 * to that capacity.  On-demand tables have no such ceiling; but they
+	 * adapt to our traffic by themselves, so once we've gone for a while
+	 * without being throttled we stop limiting the request rate.
+	 */
+	Q->rate += Q->rate_incr * t;
+	if ((Q->capacity > 0.0) && (Q->rate > Q->capacity))
+		Q->rate = Q->capacity;
+	if ((Q->capacity == 0.0) &&
+	    (tvdiff(&Q->t_throttle, &tnow) > ONDEMAND_CALM))
+		Q->rate = 0.0;
+	setrate(Q);
+
+done:
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/*
+ * We were throttled in response to the request ${R}; (multiplicatively)
+ * reduce the rate limit and the capacity we allow to be in flight.
+ */
+static int
+throttled(struct dynamodb_request_queue * Q, struct request * R)
+{
+	struct timeval tnow;
+	double t;
+	double base;
+
+	/*
+	 * Requests which were sent before we last cut back were sent at the
+	 * old rate; a burst of throttling should only make us cut back once.
+	 */
+	if (tvdiff(&Q->t_throttle, &R->t_start) < 0.0)
+		goto done;
+	if (monoclock_get(&tnow))
+		goto err0;
+	Q->t_throttle = tnow;
+
+	/* Halve the capacity we allow to be in flight, down to one item. */
+	Q->window_cap *= AIMD_DECREASE;
+	if (Q->window_cap < Q->mu_capperitem)
+		Q->window_cap = Q->mu_capperitem;
+
+	/*
+	 * Figure out how fast we were consuming capacity: our rolling
+	 * average, unless the current (partial) second has been faster.  We
+	 * don't extrapolate from a fraction of a second, since we'd rather
+	 * err on the side of overestimating (we'll cut back again if needed)
+	 * than of taking a long time to climb back up.
+	 */
+	if ((t = tvdiff(&Q->t_adjust, &tnow)) < 1.0)
+		t = 1.0;
+	base = Q->crate;
+	if (Q->consumed_cap / t > base)
+		base = Q->consumed_cap / t;
+
+	/*
+	 * If we were already limiting the request rate to less than that,
+	 * cut back from the limit instead.
+	 */
+	if ((Q->rate > 0.0) && ((Q->rate < base) || (base == 0.0)))
+		base = Q->rate;
+
+	/*
+	 * If we were consuming the table's full provisioned capacity, being
+	 * throttled is no surprise; emptying the modelled bucket is enough to
+	 * bring us back to that rate.  Otherwise, something else is eating
+	 * into the table's capacity (another client, or a hot partition).
+	 */
+	if ((Q->capacity > 0.0) && (base >= Q->capacity))
+		goto done;
+
+	/* Cut back, and arrange to climb back at a proportionate pace. */
+	Q->rate = base * AIMD_DECREASE;
+	if (Q->rate < RATE_MIN)
+		Q->rate = RATE_MIN;
+	Q->rate_incr = base * AIMD_INCREASE;
+	if (Q->rate_incr < RATE_MIN)
+		Q->rate_incr = RATE_MIN;
+	setrate(Q);
+
+done:
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
 /* Callback from dynamodb_request (aka. from http_request). */
 static int
 callback_reqdone(void * cookie, struct http_response * res)
@@ -243,14 +457,14 @@ callback_reqdone(void * cookie, struct http_response * res)
 
 	/*
 	 * If we have a response body, extract the number of capacity units
-	 * used and update our rolling average.
+	 * used and update our rolling average of capacity units per item.
 	 */
 	if ((res != NULL) && (res->bodylen > 0)) {
 		if (extractcapacity(res, &capacity))
 			rc = -1;
 		if (capacity != 0.0)
-			Q->mu_capperreq +=
-			    (capacity - Q->mu_capperreq) * 0.01;
+			Q->mu_capperitem += (capacity / R->nitems -
+			    Q->mu_capperitem) * 0.01;
 	}
 
 	/* Optionally log this request. */
@@ -261,12 +475,19 @@ callback_reqdone(void * cookie, struct http_response * res)
 
 	/* This request is no longer in progress. */
 	R->http_cookie = NULL;
-	Q->inflight--;
+	Q->inflight -= R->nitems;
 
 	/* We may have used up some capacity. */
-	Q->bucket_cap -= capacity;
-	if (Q->bucket_cap < 0.0)
-		Q->bucket_cap = 0.0;
+	Q->consumed_cap += capacity;
+	if (Q->spercap > 0.0) {
+		Q->bucket_cap -= capacity;
+		if (Q->bucket_cap < 0.0)
+			Q->bucket_cap = 0.0;
+	}
+
+	/* Update our rate measurement and limit. */
+	if (adjust(Q))
+		rc = -1;
 
 	/* Don't need the target address any more. */
 	sock_addr_free(R->addrs[0]);
@@ -281,9 +502,11 @@ callback_reqdone(void * cookie, struct http_response * res)
 		 * We hit the throughput limits.  Zero out our estimate of
 		 * the number of tokens in the bucket; we won't send any
 		 * more requests until timer ticks add more tokens to the
-		 * modelled bucket.
+		 * modelled bucket.  Then cut back our rate limit.
 		 */
 		Q->bucket_cap = 0.0;
+		if (throttled(Q, R))
+			rc = -1;
 	} else if ((res != NULL) && (res->status < 500)) {
 		/*
 		 * Anything which isn't an internal DynamoDB error or a
@@ -291,6 +514,16 @@ callback_reqdone(void * cookie, struct http_response * res)
 		 * to the upstream code.
 		 */
 
+		/*
+		 * DynamoDB handled this request without throttling it, so
+		 * allow a bit more capacity to be in flight: one item's worth
+		 * more for each window's worth of completed items.
+		 */
+		Q->window_cap += R->nitems * Q->mu_capperitem *
+		    Q->mu_capperitem / Q->window_cap;
+		if (Q->window_cap > Q->maxburst_cap)
+			Q->window_cap = Q->maxburst_cap;
+
 		/* Dequeue the request. */
 		ptrheap_delete(Q->reqs, R->rc);
 
@@ -333,10 +566,10 @@ sendreq(struct dynamodb_request_queue * Q, struct request * R)
 		goto err1;
 
 	/* Send the request. */
-	Q->inflight++;
-	if ((R->http_cookie = dynamodb_request(R->addrs, Q->key_id,
-	    Q->key_secret, Q->region, R->op, R->body, R->bodylen, R->maxrlen,
-	    callback_reqdone, R)) == NULL)
+	Q->inflight += R->nitems;
+	if ((R->http_cookie = dynamodb_request(Q->HP, Q->SC,
+	    R->addrs, Q->key_id, Q->key_secret, Q->region, R->op, R->body,
+	    R->bodylen, R->maxrlen, callback_reqdone, R)) == NULL)
 		goto err1;
 
 	/* The priority of this request has changed. */
@@ -359,9 +592,14 @@ runqueue(struct dynamodb_request_queue * Q)
 {
 	struct request * R;
 
-	/* Send requests as long as we have enough capacity. */
-	while ((Q->inflight * Q->mu_capperreq < Q->maxburst_cap) &&
-	    (Q->inflight * Q->mu_capperreq < Q->bucket_cap)) {
+	/*
+	 * Send requests as long as we have enough capacity, both in our
+	 * window of capacity allowed in flight and in the modelled bucket.
+	 * Batch requests count as one request per item, since that's what
+	 * they cost.
+	 */
+	while ((Q->inflight * Q->mu_capperitem < Q->window_cap) &&
+	    (Q->inflight * Q->mu_capperitem < Q->bucket_cap)) {
 		/* Find the highest-priority request in the queue. */
 		R = ptrheap_getmin(Q->reqs);
 
@@ -374,8 +612,11 @@ runqueue(struct dynamodb_request_queue * Q)
 			goto err0;
 	}
 
-	/* Do we need to (re)start the capacity-accumulation timer? */
-	if ((Q->timer_cookie == NULL) &&
+	/*
+	 * Do we need to (re)start the capacity-accumulation timer?  We don't
+	 * have one if we're not limiting the request rate.
+	 */
+	if ((Q->timer_cookie == NULL) && (Q->spercap > 0.0) &&
 	    (Q->bucket_cap * Q->spercap < 300.0)) {
 		if ((Q->timer_cookie = events_timer_register_double(
 		        poke_timer, Q, Q->spercap)) == NULL)
@@ -456,24 +697,45 @@ dynamodb_request_queue_init(const char * key_id, const char * key_secret,
 	/* Record the server pool to draw IP addresses from. */
 	Q->SP = SP;
 
+	/* Reuse connections to the addresses we get from it. */
+	if ((Q->HP = http_pool_init(MAXCONNS)) == NULL)
+		goto err4;
+
+	/* Cache signing keys rather than deriving one for each request. */
+	if ((Q->SC = aws_sign_cache_init()) == NULL)
+		goto err5;
+
 	/*
 	 * Initialize rate-limiting parameters.  The initial bucket capacity
 	 * is set to 300 seconds of 50k capacity units per second; this
 	 * allows an effectively unlimited burst until the first "capacity
 	 * exceeded" warning is seen, after which bucket_cap is limited to
-	 * 300 seconds of provisioned capacity.
+	 * 300 seconds of our rate limit.  We start out treating the table
+	 * as on-demand, i.e., with no rate limit.
 	 */
-	Q->mu_capperreq = 1.0;
-	Q->bucket_cap = 300.0 * 50000.0;
+	Q->mu_capperitem = 1.0;
+	Q->capacity = 0.0;
+	Q->rate = 0.0;
+	Q->rate_incr = RATE_MIN;
+	Q->bucket_cap = BUCKET_UNLIMITED;
+	Q->window_cap = 500.0;
+	setrate(Q);
 	dynamodb_request_queue_setcapacity(Q, 0);
 
+	/* We haven't consumed any capacity or been throttled yet. */
+	Q->consumed_cap = 0.0;
+	Q->crate = 0.0;
+	if (monoclock_get(&Q->t_adjust))
+		goto err6;
+	Q->t_throttle = Q->t_adjust;
+
 	/* We have no pending events. */
 	Q->timer_cookie = NULL;
 	Q->immediate_cookie = NULL;
 
 	/* No requests yet. */
 	if ((Q->reqs = ptrheap_init(compar, setreccookie, Q)) == NULL)
-		goto err4;
+		goto err6;
 	Q->reqnum = 0;
 	Q->inflight = 0;
 
@@ -483,6 +745,10 @@ dynamodb_request_queue_init(const char * key_id, const char * key_secret,
 	/* Success! */
 	return (Q);
 
+err6:
+	aws_sign_cache_free(Q->SC);
+err5:
+	http_pool_free(Q->HP);
 err4:
 	free(Q->region);
 err3:
@@ -514,19 +780,31 @@ dynamodb_request_queue_log(struct dynamodb_request_queue * Q,
  * Set the capacity of the DyanamoDB request queue to ${capacity} capacity
  * units per second; use this value (along with ConsumedCapacity fields from
  * DynamoDB responses) to rate-limit requests after seeing a "Throughput
- * Exceeded" exception.  If passed a capacity of 0, the request rate will
- * not be limited.
+ * Exceeded" exception.  If passed a capacity of 0, the table is treated as
+ * having on-demand capacity: the request rate will not be limited unless
+ * DynamoDB throttles requests, and then only for as long as that continues.
+ * In either case, the rate limit and the number of requests in flight are
+ * cut back when requests are throttled and then gradually raised again.
  */
 void
 dynamodb_request_queue_setcapacity(struct dynamodb_request_queue * Q,
     int capacity)
 {
 
-	/* How long does it take for one capacity unit to arrive? */
-	if (capacity > 0)
-		Q->spercap = 1.0 / capacity;
-	else
-		Q->spercap = 0.0;
+	/*
+	 * If the table's capacity has changed, start again from the new
+	 * capacity (or from not limiting the request rate at all, if the
+	 * table is now on-demand); otherwise, leave our rate limit where our
+	 * adaptive control has put it.
+	 */
+	if ((double)capacity != Q->capacity) {
+		Q->capacity = (capacity > 0) ? capacity : 0.0;
+		Q->rate = Q->capacity;
+		Q->rate_incr = Q->capacity * AIMD_INCREASE;
+		if (Q->rate_incr < RATE_MIN)
+			Q->rate_incr = RATE_MIN;
+		setrate(Q);
+	}
 
 	/*
 	 * Allow up to 5 seconds worth of requests to be in flight at once
@@ -539,6 +817,8 @@ dynamodb_request_queue_setcapacity(struct dynamodb_request_queue * Q,
 		Q->maxburst_cap = capacity * 5.0;
 	else
 		Q->maxburst_cap = 500.0;
+	if (Q->window_cap > Q->maxburst_cap)
+		Q->window_cap = Q->maxburst_cap;
 }
 
 /**
@@ -566,8 +846,30 @@ dynamodb_request_queue(struct dynamodb_request_queue * Q, int prio,
     const char * op, const char * body, size_t maxrlen, const char * logstr,
     int (* callback)(void *, struct http_response *), void * cookie)
 {
+
+	/* This is a batch of one item. */
+	return (dynamodb_request_queue_batch(Q, prio, op, body, 1, maxrlen,
+	    logstr, callback, cookie));
+}
+
+/**
+ * dynamodb_request_queue_batch(Q, prio, op, body, nitems, maxrlen, logstr,
+ *     callback, cookie):
+ * As dynamodb_request_queue, except that the request is a batch operation
+ * on ${nitems} items; for the purpose of rate limiting, it is treated as
+ * ${nitems} requests.
+ */
+int
+dynamodb_request_queue_batch(struct dynamodb_request_queue * Q, int prio,
+    const char * op, const char * body, size_t nitems, size_t maxrlen,
+    const char * logstr, int (* callback)(void *, struct http_response *),
+    void * cookie)
+{
 	struct request * R;
 
+	/* Sanity-check. */
+	assert(nitems > 0);
+
 	/* Allocate and fill request structure. */
 	if ((R = malloc(sizeof(struct request))) == NULL)
 		goto err0;
@@ -576,6 +878,7 @@ dynamodb_request_queue(struct dynamodb_request_queue * Q, int prio,
 	R->body = (const uint8_t *)body;
 	R->bodylen = strlen(body);
 	R->maxrlen = maxrlen;
+	R->nitems = nitems;
 	R->callback = callback;
 	R->cookie = cookie;
 	R->http_cookie = NULL;
@@ -634,7 +937,7 @@ dynamodb_request_queue_flush(struct dynamodb_request_queue * Q)
 		if (R->http_cookie != NULL) {
 			http_request_cancel(R->http_cookie);
 			sock_addr_free(R->addrs[0]);
-			Q->inflight--;
+			Q->inflight -= R->nitems;
 		}
 
 		/* Free the request. */
@@ -666,6 +969,12 @@ dynamodb_request_queue_free(struct dynamodb_request_queue * Q)
 	/* Free the (now empty) request queue. */
 	ptrheap_free(Q->reqs);
 
+	/* Close any idle HTTP connections. */
+	http_pool_free(Q->HP);
+
+	/* Free the signing key cache. */
+	aws_sign_cache_free(Q->SC);
+
 	/* Free string allocated by strdup. */
 	free(Q->region);
 
@@ -30,8 +30,11 @@ void dynamodb_request_queue_log(struct dynamodb_request_queue *,
  * Set the capacity of the DyanamoDB request queue to ${capacity} capacity
  * units per second; use this value (along with ConsumedCapacity fields from
  * DynamoDB responses) to rate-limit requests after seeing a "Throughput
- * Exceeded" exception.  If passed a capacity of 0, the request rate will
- * not be limited.
+ * Exceeded" exception.  If passed a capacity of 0, the table is treated as
+ * having on-demand capacity: the request rate will not be limited unless
+ * DynamoDB throttles requests, and then only for as long as that continues.
+ * In either case, the rate limit and the number of requests in flight are
+ * cut back when requests are throttled and then gradually raised again.
  */
 void dynamodb_request_queue_setcapacity(struct dynamodb_request_queue *, int);
 
@@ -59,6 +62,17 @@ int dynamodb_request_queue(struct dynamodb_request_queue *, int, const char *,
     const char *, size_t, const char *,
     int (*)(void *, struct http_response *), void *); 
 
+/**
+ * dynamodb_request_queue_batch(Q, prio, op, body, nitems, maxrlen, logstr,
+ *     callback, cookie):
+ * As dynamodb_request_queue, except that the request is a batch operation
+ * on ${nitems} items; for the purpose of rate limiting, it is treated as
+ * ${nitems} requests.
+ */
+int dynamodb_request_queue_batch(struct dynamodb_request_queue *, int,
+    const char *, const char *, size_t, size_t, const char *,
+    int (*)(void *, struct http_response *), void *);
+
 /**
  * dynamodb_request_queue_flush(Q):
  * Flush the DynamoDB request queue ${Q}.  Any queued requests will be
@@ -0,0 +1,231 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "histogram.h"
+
+/*
+ * Values are recorded with SUBBITS bits of precision: Values less than
+ * 2^SUBBITS each have their own bucket, and each subsequent power of two is
+ * split into 2^(SUBBITS - 1) equally sized buckets.
+ */
+#define SUBBITS		5
+#define SUBCOUNT	(1 << SUBBITS)
+#define HALFCOUNT	(1 << (SUBBITS - 1))
+
+/* Number of buckets needed to cover all 64-bit values. */
+#define NBUCKETS	(SUBCOUNT + (64 - SUBBITS) * HALFCOUNT)
+
+struct histogram {
+	uint64_t count;			/* Number of values recorded. */
+	uint64_t max;			/* Largest value recorded. */
+	uint64_t buckets[NBUCKETS];	/* Values recorded in each bucket. */
+};
+
+/* Return the position of the most significant bit set in ${x} > 0. */
+static int
+msb(uint64_t x)
+{
+	int n = 0;
+
+	/* Binary search for the top bit. */
+	if (x >> 32) {
+		x >>= 32;
+		n += 32;
+	}
+	if (x >> 16) {
+		x >>= 16;
+		n += 16;
+	}
+	if (x >> 8) {
+		x >>= 8;
+		n += 8;
+	}
+	if (x >> 4) {
+		x >>= 4;
+		n += 4;
+	}
+	if (x >> 2) {
+		x >>= 2;
+		n += 2;
+	}
+	if (x >> 1)
+		n += 1;
+
+	return (n);
+}
+
+/* Return the index of the bucket into which ${x} falls. */
+static size_t
+bucket(uint64_t x)
+{
+	int shift;
+
+	/* Small values get their own buckets. */
+	if (x < SUBCOUNT)
+		return ((size_t)x);
+
+	/* Shift away all but the top SUBBITS - 1 bits below the top bit. */
+	shift = msb(x) - (SUBBITS - 1);
+
+	/* Find the sub-bucket within the right power of two. */
+	return ((size_t)(SUBCOUNT + (shift - 1) * HALFCOUNT +
+	    (int)((x >> shift) - HALFCOUNT)));
+}
+
+/* Return the largest value which falls into bucket ${i}. */
+static uint64_t
+bucket_top(size_t i)
+{
+	int shift;
+	uint64_t sub;
+
+	/* Small values get their own buckets. */
+	if (i < SUBCOUNT)
+		return ((uint64_t)i);
+
+	/* Figure out the power of two and the sub-bucket within it. */
+	shift = (int)((i - SUBCOUNT) / HALFCOUNT) + 1;
+	sub = (uint64_t)((i - SUBCOUNT) % HALFCOUNT) + HALFCOUNT;
+
+	/* This bucket covers [sub << shift, (sub + 1) << shift). */
+	return ((sub << shift) + ((((uint64_t)1) << shift) - 1));
+}
+
+/**
+ * histogram_init(void):
+ * Return an empty histogram.
+ */
+struct histogram *
+histogram_init(void)
+{
+	struct histogram * H;
+
+	/* Allocate structure. */
+	if ((H = malloc(sizeof(struct histogram))) == NULL)
+		goto err0;
+
+	/* No values yet. */
+	histogram_reset(H);
+
+	/* Success! */
+	return (H);
+
+err0:
+	/* Failure! */
+	return (NULL);
+}
+
+/**
+ * histogram_record(H, x):
+ * Record the value ${x} in the histogram ${H}.
+ */
+void
+histogram_record(struct histogram * H, uint64_t x)
+{
+
+	/* Add the value to the right bucket. */
+	H->buckets[bucket(x)] += 1;
+
+	/* Update the count and maximum. */
+	H->count += 1;
+	if (x > H->max)
+		H->max = x;
+}
+
+/**
+ * histogram_count(H):
+ * Return the number of values recorded in the histogram ${H}.
+ */
+uint64_t
+histogram_count(const struct histogram * H)
+{
+
+	return (H->count);
+}
+
+/**
+ * histogram_max(H):
+ * Return the largest value recorded in the histogram ${H}, or 0 if no values
+ * have been recorded.
+ */
+uint64_t
+histogram_max(const struct histogram * H)
+{
+
+	return (H->max);
+}
+
+/**
+ * histogram_percentile(H, p):
+ * Return an upper bound on the ${p}th percentile of the values recorded in
+ * the histogram ${H}, i.e., a value such that at least ${p}% of the recorded
+ * values are less than or equal to it; or 0 if no values have been recorded.
+ * The value returned is never larger than histogram_max(${H}).
+ */
+uint64_t
+histogram_percentile(const struct histogram * H, double p)
+{
+	double t;
+	uint64_t target;
+	uint64_t seen;
+	uint64_t top;
+	size_t i;
+
+	/* If we have no values, there is no percentile. */
+	if (H->count == 0)
+		return (0);
+
+	/* How many values must be less than or equal to the result? */
+	if (p >= 100.0)
+		p = 100.0;
+	t = (double)H->count * p / 100.0;
+	target = (uint64_t)t;
+	if ((double)target < t)
+		target += 1;
+	if (target == 0)
+		target = 1;
+
+	/* Find the bucket where we reach that many values. */
+	for (seen = 0, i = 0; i < NBUCKETS; i++) {
+		seen += H->buckets[i];
+		if (seen >= target)
+			break;
+	}
+
+	/* Don't report a value larger than any we saw. */
+	top = bucket_top(i);
+	if (top > H->max)
+		top = H->max;
+
+	return (top);
+}
+
+/**
+ * histogram_reset(H):
+ * Remove all values from the histogram ${H}.
+ */
+void
+histogram_reset(struct histogram * H)
+{
+
+	H->count = 0;
+	H->max = 0;
+	memset(H->buckets, 0, sizeof(H->buckets));
+}
+
+/**
+ * histogram_free(H):
+ * Free the histogram ${H}.
+ */
+void
+histogram_free(struct histogram * H)
+{
+
+	/* Be compatible with free(NULL). */
+	if (H == NULL)
+		return;
+
+	/* Free the structure. */
+	free(H);
+}
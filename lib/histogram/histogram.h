@@ -0,0 +1,64 @@
+#ifndef _HISTOGRAM_H_
+#define _HISTOGRAM_H_
+
+#include <stdint.h>
+
+/* Opaque type. */
+struct histogram;
+
+/**
+ * A histogram records a distribution of non-negative integer values (e.g.,
+ * latencies in microseconds) using logarithmically spaced buckets which are
+ * each subdivided linearly, in the style of HdrHistogram: values below 32 are
+ * recorded exactly, and larger values are recorded with a relative error of
+ * less than 1/16.  Recording a value takes constant time and does not
+ * allocate memory.
+ */
+
+/**
+ * histogram_init(void):
+ * Return an empty histogram.
+ */
+struct histogram * histogram_init(void);
+
+/**
+ * histogram_record(H, x):
+ * Record the value ${x} in the histogram ${H}.
+ */
+void histogram_record(struct histogram *, uint64_t);
+
+/**
+ * histogram_count(H):
+ * Return the number of values recorded in the histogram ${H}.
+ */
+uint64_t histogram_count(const struct histogram *);
+
+/**
+ * histogram_max(H):
+ * Return the largest value recorded in the histogram ${H}, or 0 if no values
+ * have been recorded.
+ */
+uint64_t histogram_max(const struct histogram *);
+
+/**
+ * histogram_percentile(H, p):
+ * Return an upper bound on the ${p}th percentile of the values recorded in
+ * the histogram ${H}, i.e., a value such that at least ${p}% of the recorded
+ * values are less than or equal to it; or 0 if no values have been recorded.
+ * The value returned is never larger than histogram_max(${H}).
+ */
+uint64_t histogram_percentile(const struct histogram *, double);
+
+/**
+ * histogram_reset(H):
+ * Remove all values from the histogram ${H}.
+ */
+void histogram_reset(struct histogram *);
+
+/**
+ * histogram_free(H):
+ * Free the histogram ${H}.
+ */
+void histogram_free(struct histogram *);
+
+#endif /* !_HISTOGRAM_H_ */
@@ -0,0 +1,390 @@
+#include <sys/time.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "elasticarray.h"
+#include "histogram.h"
+#include "imalloc.h"
+#include "sysendian.h"
+
+#include "opstats.h"
+
+/* Histograms for one opcode. */
+struct opstats_op {
+	uint32_t op;
+	struct histogram * queue;
+	struct histogram * service;
+};
+
+ELASTICARRAY_DECL(OPLIST, oplist, struct opstats_op);
+ELASTICARRAY_DECL(CTRLIST, ctrlist, struct opstats_counter);
+
+struct opstats {
+	OPLIST ops;
+	CTRLIST ctrs;
+};
+
+/* Percentiles corresponding to OPSTATS_P50, _P99, and _P999. */
+static const double pcts[OPSTATS_NPCT - 1] = {50.0, 99.0, 99.9};
+
+/* Length of a serialized summary. */
+#define SUMMARYLEN	(4 + 8 + 2 * OPSTATS_NPCT * 8)
+
+/* Length of a serialized counter. */
+#define COUNTERLEN	(4 + 8)
+
+/* Return the number of microseconds from ${t0} to ${t1}, or 0 if negative. */
+static uint64_t
+micros(const struct timeval * t0, const struct timeval * t1)
+{
+	int64_t us;
+
+	/* Compute the difference. */
+	us = (int64_t)(t1->tv_sec - t0->tv_sec) * 1000000 +
+	    (int64_t)(t1->tv_usec - t0->tv_usec);
+
+	/* Time doesn't go backwards. */
+	return ((us > 0) ? (uint64_t)us : 0);
+}
+
+/* Find the histograms for opcode ${op}, creating them if necessary. */
+static struct opstats_op *
+getop(struct opstats * S, uint32_t op)
+{
+	struct opstats_op O;
+	size_t i;
+
+	/* Look for an existing entry; there are only a handful of opcodes. */
+	for (i = 0; i < oplist_getsize(S->ops); i++) {
+		if (oplist_get(S->ops, i)->op == op)
+			return (oplist_get(S->ops, i));
+	}
+
+	/* Create new histograms. */
+	O.op = op;
+	if ((O.queue = histogram_init()) == NULL)
+		goto err0;
+	if ((O.service = histogram_init()) == NULL)
+		goto err1;
+
+	/* Add them to the list. */
+	if (oplist_append(S->ops, &O, 1))
+		goto err2;
+
+	/* Return the new entry. */
+	return (oplist_get(S->ops, oplist_getsize(S->ops) - 1));
+
+err2:
+	histogram_free(O.service);
+err1:
+	histogram_free(O.queue);
+err0:
+	/* Failure! */
+	return (NULL);
+}
+
+/* Write the percentiles of ${H} into ${buf}. */
+static void
+encodepcts(const struct histogram * H, uint8_t * buf)
+{
+	size_t i;
+
+	for (i = 0; i < OPSTATS_NPCT - 1; i++)
+		be64enc(&buf[i * 8], histogram_percentile(H, pcts[i]));
+	be64enc(&buf[OPSTATS_MAX * 8], histogram_max(H));
+}
+
+/*
+ * Return non-zero if the ${buflen}-byte buffer ${buf} holds ${nsums}
+ * summaries followed by either nothing or a well-formed list of counters.
+ */
+static int
+countersok(const uint8_t * buf, size_t buflen, size_t nsums)
+{
+	size_t off = 4 + nsums * SUMMARYLEN;
+	size_t nctrs;
+
+	/* No counters at all? */
+	if (buflen == off)
+		return (1);
+
+	/* Check the number of counters against the remaining length. */
+	if (buflen - off < 4)
+		return (0);
+	nctrs = be32dec(&buf[off]);
+	if ((buflen - off - 4) / COUNTERLEN != nctrs)
+		return (0);
+	if ((buflen - off - 4) % COUNTERLEN != 0)
+		return (0);
+
+	/* Looks good. */
+	return (1);
+}
+
+/**
+ * opstats_init(void):
+ * Create and return an empty opstats structure.
+ */
+struct opstats *
+opstats_init(void)
+{
+	struct opstats * S;
+
+	/* Allocate structure. */
+	if ((S = malloc(sizeof(struct opstats))) == NULL)
+		goto err0;
+
+	/* No opcodes seen yet. */
+	if ((S->ops = oplist_init(0)) == NULL)
+		goto err1;
+
+	/* No counters yet. */
+	if ((S->ctrs = ctrlist_init(0)) == NULL)
+		goto err2;
+
+	/* Success! */
+	return (S);
+
+err2:
+	oplist_free(S->ops);
+err1:
+	free(S);
+err0:
+	/* Failure! */
+	return (NULL);
+}
+
+/**
+ * opstats_record(S, op, t_arrive, t_start, t_done):
+ * Record in ${S} that a request with opcode ${op} arrived at ${t_arrive},
+ * started being serviced at ${t_start}, and was completed at ${t_done}.
+ */
+int
+opstats_record(struct opstats * S, uint32_t op,
+    const struct timeval * t_arrive, const struct timeval * t_start,
+    const struct timeval * t_done)
+{
+	struct opstats_op * O;
+
+	/* Find the histograms for this opcode. */
+	if ((O = getop(S, op)) == NULL)
+		goto err0;
+
+	/* Record the queueing and service times. */
+	histogram_record(O->queue, micros(t_arrive, t_start));
+	histogram_record(O->service, micros(t_start, t_done));
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/**
+ * opstats_counter(S, id, value):
+ * Set the counter ${id} in ${S} to ${value}, creating it if necessary.
+ */
+int
+opstats_counter(struct opstats * S, uint32_t id, uint64_t value)
+{
+	struct opstats_counter ctr;
+	size_t i;
+
+	/* Look for an existing counter. */
+	for (i = 0; i < ctrlist_getsize(S->ctrs); i++) {
+		if (ctrlist_get(S->ctrs, i)->id == id) {
+			ctrlist_get(S->ctrs, i)->value = value;
+			return (0);
+		}
+	}
+
+	/* Add a new counter. */
+	ctr.id = id;
+	ctr.value = value;
+	if (ctrlist_append(S->ctrs, &ctr, 1))
+		goto err0;
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/**
+ * opstats_serialize(S, buf, buflen):
+ * Serialize a summary of the latencies and counters recorded in ${S},
+ * returning a malloc-allocated buffer via ${buf} and its length via ${buflen}.
+ */
+int
+opstats_serialize(struct opstats * S, uint8_t ** buf, size_t * buflen)
+{
+	struct opstats_op * O;
+	struct opstats_counter * ctr;
+	size_t nops = oplist_getsize(S->ops);
+	size_t nctrs = ctrlist_getsize(S->ctrs);
+	uint8_t * p;
+	size_t i;
+
+	/* Allocate a buffer. */
+	*buflen = 4 + nops * SUMMARYLEN;
+	if (nctrs > 0)
+		*buflen += 4 + nctrs * COUNTERLEN;
+	if ((*buf = malloc(*buflen)) == NULL)
+		goto err0;
+
+	/* Write the number of opcodes, followed by a summary of each. */
+	be32enc(&(*buf)[0], (uint32_t)nops);
+	for (i = 0, p = &(*buf)[4]; i < nops; i++, p += SUMMARYLEN) {
+		O = oplist_get(S->ops, i);
+		be32enc(&p[0], O->op);
+		be64enc(&p[4], histogram_count(O->service));
+		encodepcts(O->queue, &p[12]);
+		encodepcts(O->service, &p[12 + OPSTATS_NPCT * 8]);
+	}
+
+	/* If we have any counters, write them after the summaries. */
+	if (nctrs > 0) {
+		be32enc(&p[0], (uint32_t)nctrs);
+		for (i = 0, p += 4; i < nctrs; i++, p += COUNTERLEN) {
+			ctr = ctrlist_get(S->ctrs, i);
+			be32enc(&p[0], ctr->id);
+			be64enc(&p[4], ctr->value);
+		}
+	}
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/**
+ * opstats_unserialize(buf, buflen, sums, nsums):
+ * Parse the ${buflen}-byte buffer ${buf} produced by opstats_serialize,
+ * returning a malloc-allocated array of summaries via ${sums} and its length
+ * via ${nsums}.
+ */
+int
+opstats_unserialize(const uint8_t * buf, size_t buflen,
+    struct opstats_summary ** sums, size_t * nsums)
+{
+	struct opstats_summary * sum;
+	const uint8_t * p;
+	size_t i, j;
+
+	/* Parse and sanity-check the number of summaries. */
+	if (buflen < 4)
+		goto err0;
+	*nsums = be32dec(&buf[0]);
+	if ((buflen - 4) / SUMMARYLEN < *nsums)
+		goto err0;
+	if (countersok(buf, buflen, *nsums) == 0)
+		goto err0;
+
+	/* Allocate an array. */
+	if (IMALLOC(*sums, *nsums, struct opstats_summary))
+		goto err0;
+
+	/* Parse the summaries. */
+	for (i = 0, p = &buf[4]; i < *nsums; i++, p += SUMMARYLEN) {
+		sum = &(*sums)[i];
+		sum->op = be32dec(&p[0]);
+		sum->count = be64dec(&p[4]);
+		for (j = 0; j < OPSTATS_NPCT; j++) {
+			sum->queue[j] = be64dec(&p[12 + j * 8]);
+			sum->service[j] =
+			    be64dec(&p[12 + (OPSTATS_NPCT + j) * 8]);
+		}
+	}
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/**
+ * opstats_unserialize_counters(buf, buflen, ctrs, nctrs):
+ * Parse the counters from the ${buflen}-byte buffer ${buf} produced by
+ * opstats_serialize, returning a malloc-allocated array of counters via
+ * ${ctrs} and its length via ${nctrs}.
+ */
+int
+opstats_unserialize_counters(const uint8_t * buf, size_t buflen,
+    struct opstats_counter ** ctrs, size_t * nctrs)
+{
+	const uint8_t * p;
+	size_t nsums;
+	size_t i;
+
+	/* Parse and sanity-check the number of summaries. */
+	if (buflen < 4)
+		goto err0;
+	nsums = be32dec(&buf[0]);
+	if ((buflen - 4) / SUMMARYLEN < nsums)
+		goto err0;
+	if (countersok(buf, buflen, nsums) == 0)
+		goto err0;
+
+	/* Skip past the summaries and figure out how many counters we have. */
+	p = &buf[4 + nsums * SUMMARYLEN];
+	if (p == &buf[buflen]) {
+		*nctrs = 0;
+	} else {
+		*nctrs = be32dec(&p[0]);
+		p += 4;
+	}
+
+	/* Allocate an array. */
+	if (IMALLOC(*ctrs, *nctrs, struct opstats_counter))
+		goto err0;
+
+	/* Parse the counters. */
+	for (i = 0; i < *nctrs; i++, p += COUNTERLEN) {
+		(*ctrs)[i].id = be32dec(&p[0]);
+		(*ctrs)[i].value = be64dec(&p[4]);
+	}
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/**
+ * opstats_free(S):
+ * Free the opstats structure ${S}.
+ */
+void
+opstats_free(struct opstats * S)
+{
+	struct opstats_op * O;
+	size_t i;
+
+	/* Be compatible with free(NULL). */
+	if (S == NULL)
+		return;
+
+	/* Free the histograms. */
+	for (i = 0; i < oplist_getsize(S->ops); i++) {
+		O = oplist_get(S->ops, i);
+		histogram_free(O->queue);
+		histogram_free(O->service);
+	}
+
+	/* Free the lists and the structure. */
+	ctrlist_free(S->ctrs);
+	oplist_free(S->ops);
+	free(S);
+}
@@ -0,0 +1,92 @@
+#ifndef _OPSTATS_H_
+#define _OPSTATS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Opaque types. */
+struct opstats;
+struct timeval;
+
+/**
+ * An opstats structure records, for each request type ("opcode") handled by
+ * a daemon, histograms of the time each request spent queued (from when it
+ * arrived until the daemon started working on it) and the time spent
+ * servicing it (from then until the response was sent), along with a set of
+ * daemon-specific counters identified by 32-bit IDs.  A summary of these can
+ * be serialized and sent over the wire in response to a STATS request.
+ */
+
+/* Percentiles reported in a summary. */
+#define OPSTATS_P50	0
+#define OPSTATS_P99	1
+#define OPSTATS_P999	2
+#define OPSTATS_MAX	3
+#define OPSTATS_NPCT	4
+
+/* Summary of the latencies of requests with one opcode, in microseconds. */
+struct opstats_summary {
+	uint32_t op;			/* Opcode. */
+	uint64_t count;			/* Number of requests. */
+	uint64_t queue[OPSTATS_NPCT];	/* Queueing time percentiles. */
+	uint64_t service[OPSTATS_NPCT];	/* Service time percentiles. */
+};
+
+/* Value of a daemon-specific counter. */
+struct opstats_counter {
+	uint32_t id;			/* Counter ID. */
+	uint64_t value;			/* Counter value. */
+};
+
+/**
+ * opstats_init(void):
+ * Create and return an empty opstats structure.
+ */
+struct opstats * opstats_init(void);
+
+/**
+ * opstats_record(S, op, t_arrive, t_start, t_done):
+ * Record in ${S} that a request with opcode ${op} arrived at ${t_arrive},
+ * started being serviced at ${t_start}, and was completed at ${t_done}.
+ */
+int opstats_record(struct opstats *, uint32_t, const struct timeval *,
+    const struct timeval *, const struct timeval *);
+
+/**
+ * opstats_counter(S, id, value):
+ * Set the counter ${id} in ${S} to ${value}, creating it if necessary.
+ */
+int opstats_counter(struct opstats *, uint32_t, uint64_t);
+
+/**
+ * opstats_serialize(S, buf, buflen):
+ * Serialize a summary of the latencies and counters recorded in ${S},
+ * returning a malloc-allocated buffer via ${buf} and its length via ${buflen}.
+ */
+int opstats_serialize(struct opstats *, uint8_t **, size_t *);
+
+/**
+ * opstats_unserialize(buf, buflen, sums, nsums):
+ * Parse the ${buflen}-byte buffer ${buf} produced by opstats_serialize,
+ * returning a malloc-allocated array of summaries via ${sums} and its length
+ * via ${nsums}.
+ */
+int opstats_unserialize(const uint8_t *, size_t, struct opstats_summary **,
+    size_t *);
+
+/**
+ * opstats_unserialize_counters(buf, buflen, ctrs, nctrs):
+ * Parse the counters from the ${buflen}-byte buffer ${buf} produced by
+ * opstats_serialize, returning a malloc-allocated array of counters via
+ * ${ctrs} and its length via ${nctrs}.
+ */
+int opstats_unserialize_counters(const uint8_t *, size_t,
+    struct opstats_counter **, size_t *);
+
+/**
+ * opstats_free(S):
+ * Free the opstats structure ${S}.
+ */
+void opstats_free(struct opstats *);
+
+#endif /* !_OPSTATS_H_ */
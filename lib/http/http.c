@@ -3,6 +3,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 
 #include "imalloc.h"
 #include "netbuf.h"
@@ -11,6 +12,7 @@
 #include "warnp.h"
 
 #include "http.h"
+#include "http_internal.h"
 
 /* We reject any response with more than 64 kB of headers. */
 #define MAXHDR 65536
@@ -26,6 +28,9 @@ struct http_cookie {
 	void * connect_cookie;		/* Cookie from network_connect. */
 	struct netbuf_write * W;	/* Buffered writer. */
 	struct netbuf_read * R;		/* Buffered reader. */
+	struct http_pool * P;		/* Connection pool, or NULL. */
+	void * get_cookie;		/* Cookie from http_pool_get. */
+	struct http_conn * C;		/* Connection from the pool. */
 
 	/* Request parameters. */
 	int req_ishead;			/* Is the method HEAD? */
@@ -39,21 +44,31 @@ struct http_cookie {
 	void * cookie;
 
 	/* Response-parsing state. */
+	int res_started;		/* Any response data received? */
 	size_t hepos;			/* No \r\n\r\n before this point. */
 	size_t res_headlen;		/* Length of res_head. */
 	uint8_t * res_head;		/* Response header. */
-	int chunked;			/* Using chunked Transfer-Encoding. */
+	int keepalive;			/* Connection can be reused. */
 	size_t readlen;			/* Length of current body read. */
 	size_t res_bodylen_max;		/* Maximum response body length. */
 	size_t res_bodylen_alloc;	/* Allocated length of res_body. */
+	uint8_t * res_buf;		/* Caller-supplied body buffer. */
 	struct http_response res;	/* Response. */
 };
 
+static struct http_cookie * request_init(struct sock_addr * const *,
+    struct http_request *, size_t, int (*)(void *, struct http_response *),
+    void *);
 static int callback_connected(void *, int);
+static int callback_gotconn(void *, struct http_conn *);
+static int sendrequest(struct http_cookie *);
 static int callback_read_header(void *, int);
 static int gotheaders(struct http_cookie *, uint8_t *, size_t);
 static int callback_chunkedheader(void *, int);
+static int callback_chunkeol(void *, int);
+static int callback_chunkedtrailer(void *, int);
 static int get_body_gotclen(struct http_cookie *, size_t);
+static int callback_gotbody(void *, int);
 static int callback_read_toeof(void *, int);
 
 /* Clean up a cookie and return -1. */
@@ -68,6 +83,25 @@ die(struct http_cookie * H)
 	return (-1);
 }
 
+/* Give the pooled connection (if any) back to the pool. */
+static void
+release(struct http_cookie * H, int reusable)
+{
+
+	/* Nothing to do if we don't have a connection from a pool. */
+	if (H->C == NULL)
+		return;
+
+	/* The reader and writer belong to the connection, not to us. */
+	H->R = NULL;
+	H->W = NULL;
+
+	/* Return the connection. */
+	H->C->fail_callback = NULL;
+	http_pool_put(H->C, reusable);
+	H->C = NULL;
+}
+
 /* Perform a failure callback. */
 static int
 fail(void * cookie)
@@ -75,6 +109,19 @@ fail(void * cookie)
 	struct http_cookie * H = cookie;
 	int rc;
 
+	/*
+	 * If we sent the request over a connection which had been sitting
+	 * idle in the pool and got nothing back, the server probably closed
+	 * the connection before it saw our request; try again.  Each such
+	 * retry discards a connection, so this cannot continue indefinitely.
+	 */
+	if ((H->C != NULL) && (H->C->nreqs > 0) && (H->res_started == 0)) {
+		release(H, 0);
+		if ((H->get_cookie = http_pool_get(H->P, H->sas[0],
+		    callback_gotconn, H)) != NULL)
+			return (0);
+	}
+
 	/* Perform the callback. */
 	rc = (H->callback)(H->cookie, NULL);
 
@@ -91,6 +138,19 @@ docallback(struct http_cookie * H)
 {
 	int rc;
 
+	/*
+	 * Return the connection to the pool first, so that it is available
+	 * for any request which the callback makes.
+	 */
+	release(H, H->keepalive);
+
+	/*
+	 * If there is no body, say so, even if we were given a buffer to read
+	 * the body into.
+	 */
+	if ((H->res.bodylen == 0) && (H->res.body == H->res_buf))
+		H->res.body = NULL;
+
 	/* Perform callback. */
 	rc = (H->callback)(H->cookie, &H->res);
 
@@ -110,12 +170,16 @@ toobig(struct http_cookie * H)
 {
 
 	/* No body any more. */
-	free(H->res.body);
+	if (H->res.body != H->res_buf)
+		free(H->res.body);
 	H->res.body = NULL;
 
 	/* The response is too big. */
 	H->res.bodylen = (size_t)(-1);
 
+	/* We haven't read the body, so we can't reuse the connection. */
+	H->keepalive = 0;
+
 	/* Perform the callback. */
 	return (docallback(H));
 }
@@ -158,6 +222,35 @@ sgetline(uint8_t * buf, size_t buflen, size_t * bufpos, size_t * linelen)
 	return (char *)(s);
 }
 
+/* Does the comma-separated list ${s} include ${token} (ignoring case)? */
+static int
+hastoken(const char * s, const char * token)
+{
+	size_t len = strlen(token);
+	size_t toklen;
+
+	do {
+		/* Skip separators and whitespace before the next element. */
+		s += strspn(s, ", \t");
+
+		/* Find the end of the element, ignoring trailing whitespace. */
+		toklen = strcspn(s, ",");
+		while ((toklen > 0) &&
+		    ((s[toklen - 1] == ' ') || (s[toklen - 1] == '\t')))
+			toklen--;
+
+		/* Is this the token we're looking for? */
+		if ((toklen == len) && (strncasecmp(s, token, len) == 0))
+			return (1);
+
+		/* Move on to the next element. */
+		s += strcspn(s, ",");
+	} while (*s != '\0');
+
+	/* Not found. */
+	return (0);
+}
+
 /* Add data to the body buffer. */
 static int
 addbody(struct http_cookie * H, uint8_t * buf, size_t buflen)
@@ -226,6 +319,78 @@ http_request(struct sock_addr * const * addrs, struct http_request * request,
     void * cookie)
 {
 	struct http_cookie * H;
+
+	/* Construct the request. */
+	if ((H = request_init(addrs, request, maxrlen,
+	    callback, cookie)) == NULL)
+		goto err0;
+
+	/* Connect to the target host. */
+	if ((H->connect_cookie = network_connect(H->sas,
+	    callback_connected, H)) == NULL)
+		goto err1;
+
+	/* Success! */
+	return (H);
+
+err1:
+	http_request_cancel(H);
+err0:
+	/* Failure! */
+	return (NULL);
+}
+
+/**
+ * http_pool_request(P, addrs, request, maxrlen, callback, cookie):
+ * Behave as http_request, except that the request is sent over a connection
+ * to ${addrs}[0] taken from the pool ${P}.  An idle persistent connection is
+ * reused if one is available; otherwise a new connection is opened, or the
+ * request waits for a connection if the pool already holds the maximum
+ * number of connections to the endpoint.  After a complete response has been
+ * read, the connection is returned to the pool unless the server asked for
+ * it to be closed; connections are closed after any error.  If ${P} is NULL,
+ * behave identically to http_request.
+ */
+void *
+http_pool_request(struct http_pool * P, struct sock_addr * const * addrs,
+    struct http_request * request, size_t maxrlen,
+    int (* callback)(void *, struct http_response *), void * cookie)
+{
+	struct http_cookie * H;
+
+	/* If we have no pool, make a one-off request. */
+	if (P == NULL)
+		return (http_request(addrs, request, maxrlen,
+		    callback, cookie));
+
+	/* Construct the request. */
+	if ((H = request_init(addrs, request, maxrlen,
+	    callback, cookie)) == NULL)
+		goto err0;
+
+	/* Get a connection from the pool. */
+	H->P = P;
+	if ((H->get_cookie = http_pool_get(P, H->sas[0],
+	    callback_gotconn, H)) == NULL)
+		goto err1;
+
+	/* Success! */
+	return (H);
+
+err1:
+	http_request_cancel(H);
+err0:
+	/* Failure! */
+	return (NULL);
+}
+
+/* Construct a request cookie. */
+static struct http_cookie *
+request_init(struct sock_addr * const * addrs, struct http_request * request,
+    size_t maxrlen, int (* callback)(void *, struct http_response *),
+    void * cookie)
+{
+	struct http_cookie * H;
 	char * s;
 	size_t i;
 
@@ -237,18 +402,30 @@ http_request(struct sock_addr * const * addrs, struct http_request * request,
 	H->connect_cookie = NULL;
 	H->W = NULL;
 	H->R = NULL;
+	H->P = NULL;
+	H->get_cookie = NULL;
+	H->C = NULL;
 	H->callback = callback;
 	H->cookie = cookie;
+	H->res_started = 0;
 	H->hepos = 0;
 	H->res_head = NULL;
+	H->keepalive = 0;
 	H->res_bodylen_max = maxrlen;
 	H->res_bodylen_alloc = 0;
+	H->res_buf = request->resbuf;
 	H->res.status = 0;
 	H->res.nheaders = 0;
 	H->res.headers = NULL;
 	H->res.bodylen = 0;
 	H->res.body = NULL;
 
+	/* If we have a buffer for the response body, read into it. */
+	if (H->res_buf != NULL) {
+		H->res.body = H->res_buf;
+		H->res_bodylen_alloc = maxrlen;
+	}
+
 	/*
 	 * Record whether this is a HEAD request; this matters when it comes
 	 * to figuring out whether the response should have a body attached.
@@ -296,16 +473,9 @@ http_request(struct sock_addr * const * addrs, struct http_request * request,
 	H->req_bodylen = request->bodylen;
 	H->req_body = request->body;
 
-	/* Connect to the target host. */
-	if ((H->connect_cookie = network_connect(H->sas,
-	    callback_connected, H)) == NULL)
-		goto err2;
-
 	/* Success! */
 	return (H);
 
-err2:
-	free(H->req_head);
 err1:
 	free(H);
 err0:
@@ -335,11 +505,48 @@ callback_connected(void * cookie, int s)
 	if ((H->W = netbuf_write_init(H->s, fail, H)) == NULL)
 		return (die(H));
 
+	/* Send the request. */
+	return (sendrequest(H));
+}
+
+/* We've got a connection from the pool (or failed). */
+static int
+callback_gotconn(void * cookie, struct http_conn * C)
+{
+	struct http_cookie * H = cookie;
+
+	/* We're not waiting for a connection any more. */
+	H->get_cookie = NULL;
+
+	/* Did we fail? */
+	if (C == NULL)
+		return (fail(H));
+
+	/* Use this connection, and handle any write failures on it. */
+	H->C = C;
+	H->R = C->R;
+	H->W = C->W;
+	C->fail_callback = fail;
+	C->fail_cookie = H;
+
+	/* Send the request. */
+	return (sendrequest(H));
+}
+
+/* Send the request and start reading the response. */
+static int
+sendrequest(struct http_cookie * H)
+{
+
+	/* Nothing has been received yet. */
+	H->res_started = 0;
+	H->hepos = 0;
+
 	/* Send the request. */
 	if (netbuf_write_write(H->W, H->req_head, H->req_headlen))
 		return (die(H));
 	if ((H->req_bodylen > 0) &&
-	    netbuf_write_write(H->W, H->req_body, H->req_bodylen))
+	    netbuf_write_write_nocopy(H->W, H->req_body, H->req_bodylen))
 		return (die(H));
 
 	/* Enter response-reading loop. */
@@ -360,6 +567,8 @@ callback_read_header(void * cookie, int status)
 
 	/* Where's the data? */
 	netbuf_read_peek(H->R, &buf, &buflen);
+	if (buflen > 0)
+		H->res_started = 1;
 
 	/* Scan forwards looking for \r\n\r\n. */
 	for (; H->hepos + 4 <= buflen; H->hepos++) {
@@ -397,6 +606,7 @@ gotheaders(struct http_cookie * H, uint8_t * buf, size_t buflen)
 	size_t len;
 	const char * te;
 	const char * clen;
+	const char * conn;
 	size_t cpos;
 
 	/* Suck the headers into a separate buffer. */
@@ -463,6 +673,16 @@ gotheaders(struct http_cookie * H, uint8_t * buf, size_t buflen)
 	/* We should be 2 bytes (\r\n) away from the end of the buffer. */
 	assert(bufpos + 2 == H->res_headlen);
 
+	/*
+	 * HTTP/1.1 connections are persistent unless the server says that it
+	 * is going to close the connection; we don't bother trying to keep
+	 * HTTP/1.0 connections alive.
+	 */
+	H->keepalive = (minor >= 1);
+	if (((conn = http_findheader(H->res.headers, H->res.nheaders,
+	    "Connection")) != NULL) && hastoken(conn, "close"))
+		H->keepalive = 0;
+
 	/*
 	 * If we received a 1xx response, we need to throw all the headers
 	 * away and read a completely new response.  RFC 2616 says that a
@@ -497,9 +717,6 @@ gotheaders(struct http_cookie * H, uint8_t * buf, size_t buflen)
 	if ((te = http_findheader(H->res.headers, H->res.nheaders,
 	    "Transfer-Encoding")) != NULL) {
 		if (strstr(te, "chunked") != NULL) {
-			/* We're using chunked transfer-encoding. */
-			H->chunked = 1;
-
 			/* Read the first chunked header line. */
 			return (callback_chunkedheader(H, 0));
 		}
@@ -522,7 +739,7 @@ gotheaders(struct http_cookie * H, uint8_t * buf, size_t buflen)
 	return (callback_read_toeof(H, 0));
 }
 
-/* Process arrived data, then read more data or chunk header, or callback. */
+/* Process arrived chunk data, then read more data or the end of the chunk. */
 static int
 callback_readdata(void * cookie, int status)
 {
@@ -555,20 +772,9 @@ callback_readdata(void * cookie, int status)
 	/* Adjust our remaining-read-length value. */
 	H->readlen -= buflen;
 
-	/* Are we done reading this block? */
-	if (H->readlen == 0) {
-		/* Was this just one chunk from a chunked encoding? */
-		if (H->chunked) {
-			/* Strip the trailing EOL. */
-			H->res.bodylen -= 2;
-
-			/* Get the next chunk. */
-			return (callback_chunkedheader(H, 0));
-		}
-
-		/* If not, just do the callback. */
-		return (docallback(H));
-	}
+	/* Are we done reading this chunk? */
+	if (H->readlen == 0)
+		return (callback_chunkeol(H, 0));
 
 	/*
 	 * Wait for the MIN(remaining read length, 1 MB) to arrive.  This is
@@ -617,18 +823,16 @@ callback_chunkedheader(void * cookie, int status)
 		/* Consume the line and EOL. */
 		netbuf_read_consume(H->R, eolpos + 2);
 
-		/* If this is zero, we're done! */
+		/* If this is zero, we just need to read the trailer. */
 		if (clen == 0)
-			return (docallback(H));
+			return (callback_chunkedtrailer(H, 0));
 
 		/* Otherwise, check that it's not too big. */
 		if (clen > H->res_bodylen_max - H->res.bodylen)
 			return (toobig(H));
-		if (clen > SIZE_MAX - 2)
-			return (toobig(H));
 
-		/* Read the chunk data plus extra EOL (we strip it later). */
-		H->readlen = clen + 2;
+		/* Read the chunk data. */
+		H->readlen = clen;
 		return (callback_readdata(H, 0));
 	}
 
@@ -644,6 +848,74 @@ callback_chunkedheader(void * cookie, int status)
 	return (0);
 }
 
+/* Read the EOL which follows the data in a chunk. */
+static int
+callback_chunkeol(void * cookie, int status)
+{
+	struct http_cookie * H = cookie;
+	uint8_t * buf;
+	size_t buflen;
+
+	/* Did we fail? */
+	if (status)
+		return (fail(H));
+
+	/* Wait until we have the EOL. */
+	netbuf_read_peek(H->R, &buf, &buflen);
+	if (buflen < 2) {
+		if (netbuf_read_wait(H->R, 2, callback_chunkeol, H))
+			return (die(H));
+		return (0);
+	}
+
+	/* It had better be an EOL. */
+	if (memcmp(buf, "\r\n", 2)) {
+		warn0("Chunk data not followed by EOL");
+		return (fail(H));
+	}
+
+	/* Consume the EOL and get the next chunk. */
+	netbuf_read_consume(H->R, 2);
+	return (callback_chunkedheader(H, 0));
+}
+
+/* Read and discard trailer lines up to the terminating blank line. */
+static int
+callback_chunkedtrailer(void * cookie, int status)
+{
+	struct http_cookie * H = cookie;
+	uint8_t * buf;
+	size_t buflen;
+	size_t eolpos;
+
+	/* Did we fail?  (EOF while reading the trailer is a failure.) */
+	if (status)
+		return (fail(H));
+
+	/* Consume complete lines until we find an empty one. */
+	do {
+		netbuf_read_peek(H->R, &buf, &buflen);
+		if ((eolpos = findeol(buf, buflen)) == buflen)
+			break;
+		netbuf_read_consume(H->R, eolpos + 2);
+
+		/* An empty line marks the end of the response. */
+		if (eolpos == 0)
+			return (docallback(H));
+	} while (1);
+
+	/* Reject any response with more than 64 kB of trailer. */
+	if (buflen > MAXHDR)
+		return (fail(H));
+
+	/* Wait until some more data arrives. */
+	if (netbuf_read_wait(H->R, buflen + 1, callback_chunkedtrailer, H))
+		return (die(H));
+
+	/* Success! */
+	return (0);
+}
+
 /* Read the response body based on the provided Content-Length. */
 static int
 get_body_gotclen(struct http_cookie * H, size_t len)
@@ -653,14 +925,47 @@ get_body_gotclen(struct http_cookie * H, size_t len)
 	if (len > H->res_bodylen_max)
 		return (toobig(H));
 
+	/* If there's no body, we're done already. */
+	if (len == 0)
+		return (docallback(H));
+
+	/*
+	 * Allocate a buffer of exactly the right size (unless the caller gave
+	 * us one) and read the body straight into it, rather than growing a
+	 * buffer as data arrives.
+	 */
+	if (H->res.body == NULL) {
+		if ((H->res.body = malloc(len)) == NULL)
+			return (die(H));
+		H->res_bodylen_alloc = len;
+	}
+
 	/* Record the length of content we need to read. */
 	H->readlen = len;
 
-	/* Once we've read this, we're done. */
-	H->chunked = 0;
+	/* Read the body. */
+	if (netbuf_read_read(H->R, H->res.body, len, callback_gotbody, H))
+		return (die(H));
+
+	/* Success! */
+	return (0);
+}
+
+/* We have read the body (or failed). */
+static int
+callback_gotbody(void * cookie, int status)
+{
+	struct http_cookie * H = cookie;
+
+	/* Did we fail?  (EOF counts as a failure here.) */
+	if (status)
+		return (fail(H));
+
+	/* We have the entire body. */
+	H->res.bodylen = H->readlen;
 
-	/* Enter the reading loop. */
-	return (callback_readdata(H, 0));
+	/* Perform the callback. */
+	return (docallback(H));
 }
 
 /* Read data until we hit EOF. */
@@ -675,9 +980,11 @@ callback_read_toeof(void * cookie, int status)
 	if (status == -1)
 		return (fail(H));
 
-	/* Did we hit EOF? */
-	if (status == 1)
+	/* Did we hit EOF?  (The connection is obviously not reusable.) */
+	if (status == 1) {
+		H->keepalive = 0;
 		return (docallback(H));
+	}
 
 	/* How much data is there? */
 	netbuf_read_peek(H->R, &buf, &buflen);
@@ -703,8 +1010,8 @@ callback_read_toeof(void * cookie, int status)
 
 /**
  * http_request_cancel(cookie):
- * Cancel the HTTP request for which ${cookie} was returned by http_request.
- * Do not invoke the associated callback function.
+ * Cancel the HTTP request for which ${cookie} was returned by http_request
+ * or http_pool_request.  Do not invoke the associated callback function.
  */
 void
 http_request_cancel(void * cookie)
@@ -715,6 +1022,13 @@ http_request_cancel(void * cookie)
 	if (H->connect_cookie != NULL)
 		network_connect_cancel(H->connect_cookie);
 
+	/* Stop waiting for a connection from the pool. */
+	if (H->get_cookie != NULL)
+		http_pool_get_cancel(H->get_cookie);
+
+	/* Close any connection from the pool; we don't know its state. */
+	release(H, 0);
+
 	/* If we have a network reader, cancel any in-progress read. */
 	if (H->R != NULL)
 		netbuf_read_wait_cancel(H->R);
@@ -732,12 +1046,14 @@ http_request_cancel(void * cookie)
 	/*
 	 * Free internal buffers.  (req_body does not need to be freed since
 	 * it is owned by the caller; res_body does need to be freed, since
-	 * it is set to NULL if/when it is passed off to the caller).
+	 * it is set to NULL if/when it is passed off to the caller, unless
+	 * it is the caller's buffer).
 	 */
 	free(H->req_head);
 	free(H->res_head);
 	free(H->res.headers);
-	free(H->res.body);
+	if (H->res.body != H->res_buf)
+		free(H->res.body);
 
 	/* Free the cookie. */
 	free(H);
@@ -4,7 +4,8 @@
 #include <stddef.h>
 #include <stdint.h>
 
-/* Opaque type. */
+/* Opaque types. */
+struct http_pool;
 struct sock_addr;
 
 struct http_header {
@@ -19,6 +20,7 @@ struct http_request {
 	struct http_header * headers;
 	size_t bodylen;
 	const uint8_t * body;
+	uint8_t * resbuf;
 };
 
 struct http_response {
@@ -43,15 +45,50 @@ struct http_response {
  * The callback is responsible for freeing the response body buffer (if any),
  * but not the rest of the response; it must copy any header strings before it
  * returns.  The provided request body buffer (if any) must remain valid until
- * the callback is invoked.
+ * the callback is invoked; it is written to the network without being copied.
+ *
+ * If ${request}->resbuf is not NULL, it must point to a buffer of ${maxrlen}
+ * bytes; the response body is read directly into that buffer instead of into
+ * a buffer allocated by http_request, and the response structure will have
+ * body == ${request}->resbuf (or NULL if there is no body).  The buffer is
+ * owned by the caller and must not be freed by the callback.
  */
 void * http_request(struct sock_addr * const *, struct http_request *, size_t,
     int (*)(void *, struct http_response *), void *);
 
+/**
+ * http_pool_init(maxconns):
+ * Create and return a pool of persistent HTTP connections which will hold at
+ * most ${maxconns} connections open to each endpoint.
+ */
+struct http_pool * http_pool_init(size_t);
+
+/**
+ * http_pool_request(P, addrs, request, maxrlen, callback, cookie):
+ * Behave as http_request, except that the request is sent over a connection
+ * to ${addrs}[0] taken from the pool ${P}.  An idle persistent connection is
+ * reused if one is available; otherwise a new connection is opened, or the
+ * request waits for a connection if the pool already holds the maximum
+ * number of connections to the endpoint.  After a complete response has been
+ * read, the connection is returned to the pool unless the server asked for
+ * it to be closed; connections are closed after any error.  If ${P} is NULL,
+ * behave identically to http_request.
+ */
+void * http_pool_request(struct http_pool *, struct sock_addr * const *,
+    struct http_request *, size_t, int (*)(void *, struct http_response *),
+    void *);
+
+/**
+ * http_pool_free(P):
+ * Close all of the idle connections in the pool ${P} and free it.  There
+ * must be no requests using the pool.
+ */
+void http_pool_free(struct http_pool *);
+
 /**
  * http_request_cancel(cookie):
- * Cancel the HTTP request for which ${cookie} was returned by http_request.
- * Do not invoke the associated callback function.
+ * Cancel the HTTP request for which ${cookie} was returned by http_request
+ * or http_pool_request.  Do not invoke the associated callback function.
  */
 void http_request_cancel(void *);
 
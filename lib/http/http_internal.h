@@ -0,0 +1,62 @@
+#ifndef _HTTP_INTERNAL_H_
+#define _HTTP_INTERNAL_H_
+
+#include <stddef.h>
+
+/* Opaque types. */
+struct http_pool;
+struct netbuf_read;
+struct netbuf_write;
+struct sock_addr;
+
+/* Persistent connection owned by an HTTP connection pool. */
+struct http_conn {
+	/* The pool to which we belong. */
+	struct http_pool * P;
+
+	/* Connection state. */
+	struct sock_addr * addr;	/* Endpoint address. */
+	int s;				/* Network socket, or -1. */
+	struct netbuf_read * R;		/* Buffered reader. */
+	struct netbuf_write * W;	/* Buffered writer. */
+	size_t nreqs;			/* # requests completed. */
+	int idle;			/* Waiting in the pool? */
+
+	/* Callback to invoke if a write fails. */
+	int (* fail_callback)(void *);
+	void * fail_cookie;
+
+	/* Doubly-linked list of connections in the pool. */
+	struct http_conn * prev;
+	struct http_conn * next;
+};
+
+/**
+ * http_pool_get(P, addr, callback, cookie):
+ * Obtain a connection to ${addr} from the pool ${P}, reusing an idle
+ * connection if possible and otherwise opening a new one once there are
+ * fewer than the maximum number of connections to ${addr}.  Invoke
+ * ${callback}(${cookie}, C) with the connection, or with C == NULL if a
+ * connection could not be established.  Return a cookie which can be passed
+ * to http_pool_get_cancel.  The callback will not be invoked before this
+ * function returns.
+ */
+void * http_pool_get(struct http_pool *, const struct sock_addr *,
+    int (*)(void *, struct http_conn *), void *);
+
+/**
+ * http_pool_get_cancel(cookie):
+ * Cancel the connection request for which ${cookie} was returned by
+ * http_pool_get.  Do not invoke the associated callback function.
+ */
+void http_pool_get_cancel(void *);
+
+/**
+ * http_pool_put(C, reusable):
+ * Return the connection ${C} to its pool.  If ${reusable} is non-zero, the
+ * connection is left idle in the pool for use by a later request; otherwise
+ * it is closed.  No callbacks are invoked before this function returns.
+ */
+void http_pool_put(struct http_conn *, int);
+
+#endif /* !_HTTP_INTERNAL_H_ */
@@ -0,0 +1,537 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "events.h"
+#include "netbuf.h"
+#include "network.h"
+#include "sock.h"
+#include "sock_util.h"
+#include "warnp.h"
+
+#include "http.h"
+#include "http_internal.h"
+
+/* Request for a connection. */
+struct getreq {
+	/* The pool from which we want a connection. */
+	struct http_pool * P;
+
+	/* Endpoint address, NULL. */
+	struct sock_addr * addrs[2];
+
+	/* Callback; NULL if cancelled while connecting. */
+	int (* callback)(void *, struct http_conn *);
+	void * cookie;
+
+	/* Connection being opened (if any). */
+	struct http_conn * C;
+	void * connect_cookie;
+
+	/* Doubly-linked list -- either _waiting_ or _connecting_. */
+	struct getreq * prev;
+	struct getreq * next;
+};
+
+/* Pool of persistent connections. */
+struct http_pool {
+	size_t maxconns;		/* Max. connections per endpoint. */
+	struct http_conn * conns;	/* All connections. */
+	struct getreq * waiting_head;	/* Requests waiting for a conn. */
+	struct getreq * waiting_tail;
+	struct getreq * connecting;	/* Requests opening a conn. */
+	void * immediate_cookie;	/* Pending callback_kick. */
+};
+
+static int callback_kick(void *);
+
+/* Remove ${G} from the list with head ${head} and tail ${tail} (if any). */
+static void
+getreq_unlink(struct getreq ** head, struct getreq ** tail,
+    struct getreq * G)
+{
+
+	if (G->next != NULL)
+		G->next->prev = G->prev;
+	else if (tail != NULL)
+		*tail = G->prev;
+	if (G->prev != NULL)
+		G->prev->next = G->next;
+	else
+		*head = G->next;
+}
+
+/* Free a connection request. */
+static void
+getreq_free(struct getreq * G)
+{
+
+	sock_addr_free(G->addrs[0]);
+	free(G);
+}
+
+/* Arrange for waiting connection requests to be examined. */
+static int
+kick(struct http_pool * P)
+{
+
+	/* Nothing to do if nobody is waiting or a kick is already pending. */
+	if ((P->waiting_head == NULL) || (P->immediate_cookie != NULL))
+		return (0);
+
+	/* Schedule a callback. */
+	if ((P->immediate_cookie =
+	    events_immediate_register(callback_kick, P, 0)) == NULL)
+		goto err0;
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Close the connection ${C} and remove it from its pool. */
+static void
+conn_close(struct http_conn * C)
+{
+	struct http_pool * P = C->P;
+
+	/* Remove from the list of connections. */
+	if (C->next != NULL)
+		C->next->prev = C->prev;
+	if (C->prev != NULL)
+		C->prev->next = C->next;
+	else
+		P->conns = C->next;
+
+	/* Free the reader and writer and close the socket. */
+	if (C->R != NULL)
+		netbuf_read_wait_cancel(C->R);
+	if (C->W != NULL)
+		netbuf_write_free(C->W);
+	if (C->R != NULL)
+		netbuf_read_free(C->R);
+	if (C->s != -1)
+		close(C->s);
+
+	/* Free the connection. */
+	sock_addr_free(C->addr);
+	free(C);
+
+	/* Someone may be waiting for a connection to this endpoint. */
+	if (kick(P))
+		warnp("Cannot schedule HTTP connection pool callback");
+}
+
+/* An idle connection was closed by the server (or sent us garbage). */
+static int
+callback_idle(void * cookie, int status)
+{
+	struct http_conn * C = cookie;
+
+	(void)status; /* UNUSED */
+
+	/* This connection is no longer usable. */
+	conn_close(C);
+
+	/* Success! */
+	return (0);
+}
+
+/* Park the connection ${C} in the pool until someone wants it. */
+static void
+conn_makeidle(struct http_conn * C)
+{
+
+	/* Nobody is using this connection. */
+	C->fail_callback = NULL;
+	C->fail_cookie = NULL;
+
+	/* Watch for the server closing the connection. */
+	if (netbuf_read_wait(C->R, 1, callback_idle, C)) {
+		conn_close(C);
+		return;
+	}
+
+	/* This connection is available. */
+	C->idle = 1;
+
+	/* Someone may be waiting for it. */
+	if (kick(C->P))
+		warnp("Cannot schedule HTTP connection pool callback");
+}
+
+/* A write on the connection failed. */
+static int
+callback_writefail(void * cookie)
+{
+	struct http_conn * C = cookie;
+
+	/* If a request is using this connection, let it handle the failure. */
+	if (C->fail_callback != NULL)
+		return ((C->fail_callback)(C->fail_cookie));
+
+	/* Otherwise just throw the connection away. */
+	conn_close(C);
+
+	/* Success! */
+	return (0);
+}
+
+/* Count the connections to ${addr} and look for an idle one. */
+static size_t
+conn_find(struct http_pool * P, const struct sock_addr * addr,
+    struct http_conn ** idle)
+{
+	struct http_conn * C;
+	size_t nconns = 0;
+
+	/* Scan the list of connections. */
+	*idle = NULL;
+	for (C = P->conns; C != NULL; C = C->next) {
+		if (sock_addr_cmp(C->addr, addr))
+			continue;
+		nconns++;
+		if (C->idle && (*idle == NULL))
+			*idle = C;
+	}
+
+	/* Return the number of connections. */
+	return (nconns);
+}
+
+/* We've connected to the endpoint (or failed). */
+static int
+callback_connected(void * cookie, int s)
+{
+	struct getreq * G = cookie;
+	struct http_pool * P = G->P;
+	struct http_conn * C = G->C;
+	int rc = 0;
+
+	/* We're not connecting any more. */
+	G->connect_cookie = NULL;
+	getreq_unlink(&P->connecting, NULL, G);
+
+	/* If we connected, set up a reader and a writer. */
+	if ((C->s = s) != -1) {
+		if ((C->R = netbuf_read_init(C->s)) == NULL)
+			goto fail;
+		if ((C->W = netbuf_write_init(C->s,
+		    callback_writefail, C)) == NULL)
+			goto fail;
+	} else {
+		goto fail;
+	}
+
+	/* Hand the connection over, or park it if nobody wants it now. */
+	if (G->callback != NULL)
+		rc = (G->callback)(G->cookie, C);
+	else
+		conn_makeidle(C);
+
+	/* Free the connection request. */
+	getreq_free(G);
+
+	/* Return status from callback. */
+	return (rc);
+
+fail:
+	/* This connection is useless. */
+	conn_close(C);
+
+	/* Tell the requestor (if any) that we failed. */
+	if (G->callback != NULL)
+		rc = (G->callback)(G->cookie, NULL);
+
+	/* Free the connection request. */
+	getreq_free(G);
+
+	/* Return status from callback. */
+	return (rc);
+}
+
+/* Try to satisfy the first waiting request which we can satisfy. */
+static int
+serveone(struct http_pool * P, int * rc)
+{
+	struct getreq * G;
+	struct http_conn * C;
+	size_t nconns;
+
+	/* Look for a request which can proceed. */
+	for (G = P->waiting_head; G != NULL; G = G->next) {
+		nconns = conn_find(P, G->addrs[0], &C);
+		if ((C != NULL) || (nconns < P->maxconns))
+			break;
+	}
+
+	/* Nothing to do? */
+	if (G == NULL)
+		return (0);
+
+	/* This request is no longer waiting. */
+	getreq_unlink(&P->waiting_head, &P->waiting_tail, G);
+
+	/* If we have an idle connection, hand it over. */
+	if (C != NULL) {
+		netbuf_read_wait_cancel(C->R);
+		C->idle = 0;
+		if ((G->callback)(G->cookie, C))
+			*rc = -1;
+		getreq_free(G);
+		return (1);
+	}
+
+	/* Create a new connection. */
+	if ((C = malloc(sizeof(struct http_conn))) == NULL)
+		goto err0;
+	C->P = P;
+	if ((C->addr = sock_addr_dup(G->addrs[0])) == NULL)
+		goto err1;
+	C->s = -1;
+	C->R = NULL;
+	C->W = NULL;
+	C->nreqs = 0;
+	C->idle = 0;
+	C->fail_callback = NULL;
+	C->fail_cookie = NULL;
+
+	/* Add it to the pool so that it counts against the limit. */
+	C->prev = NULL;
+	if ((C->next = P->conns) != NULL)
+		C->next->prev = C;
+	P->conns = C;
+
+	/* Start connecting. */
+	G->C = C;
+	if ((G->connect_cookie = network_connect(G->addrs,
+	    callback_connected, G)) == NULL)
+		goto err2;
+
+	/* This request is now connecting. */
+	G->prev = NULL;
+	if ((G->next = P->connecting) != NULL)
+		G->next->prev = G;
+	P->connecting = G;
+
+	/* We made progress. */
+	return (1);
+
+err2:
+	conn_close(C);
+	goto err0;
+err1:
+	free(C);
+err0:
+	/* Tell the requestor that we failed. */
+	warnp("Cannot open HTTP connection");
+	if ((G->callback)(G->cookie, NULL))
+		*rc = -1;
+	getreq_free(G);
+	return (1);
+}
+
+/* Hand out connections to requests which are waiting for them. */
+static int
+callback_kick(void * cookie)
+{
+	struct http_pool * P = cookie;
+	int rc = 0;
+
+	/* This callback is no longer pending. */
+	P->immediate_cookie = NULL;
+
+	/* Serve requests until we can't make any more progress. */
+	while (serveone(P, &rc))
+		continue;
+
+	/* Return status from callbacks. */
+	return (rc);
+}
+
+/**
+ * http_pool_init(maxconns):
+ * Create and return a pool of persistent HTTP connections which will hold at
+ * most ${maxconns} connections open to each endpoint.
+ */
+struct http_pool *
+http_pool_init(size_t maxconns)
+{
+	struct http_pool * P;
+
+	/* Sanity-check. */
+	assert(maxconns > 0);
+
+	/* Allocate and initialize. */
+	if ((P = malloc(sizeof(struct http_pool))) == NULL)
+		goto err0;
+	P->maxconns = maxconns;
+	P->conns = NULL;
+	P->waiting_head = P->waiting_tail = NULL;
+	P->connecting = NULL;
+	P->immediate_cookie = NULL;
+
+	/* Success! */
+	return (P);
+
+err0:
+	/* Failure! */
+	return (NULL);
+}
+
+/**
+ * http_pool_get(P, addr, callback, cookie):
+ * Obtain a connection to ${addr} from the pool ${P}, reusing an idle
+ * connection if possible and otherwise opening a new one once there are
+ * fewer than the maximum number of connections to ${addr}.  Invoke
+ * ${callback}(${cookie}, C) with the connection, or with C == NULL if a
+ * connection could not be established.  Return a cookie which can be passed
+ * to http_pool_get_cancel.  The callback will not be invoked before this
+ * function returns.
+ */
+void *
+http_pool_get(struct http_pool * P, const struct sock_addr * addr,
+    int (* callback)(void *, struct http_conn *), void * cookie)
+{
+	struct getreq * G;
+
+	/* Bake a cookie. */
+	if ((G = malloc(sizeof(struct getreq))) == NULL)
+		goto err0;
+	G->P = P;
+	if ((G->addrs[0] = sock_addr_dup(addr)) == NULL)
+		goto err1;
+	G->addrs[1] = NULL;
+	G->callback = callback;
+	G->cookie = cookie;
+	G->C = NULL;
+	G->connect_cookie = NULL;
+
+	/* Add to the tail of the waiting list. */
+	G->next = NULL;
+	if ((G->prev = P->waiting_tail) != NULL)
+		G->prev->next = G;
+	else
+		P->waiting_head = G;
+	P->waiting_tail = G;
+
+	/* Make sure we'll look at this request. */
+	if (kick(P))
+		goto err2;
+
+	/* Success! */
+	return (G);
+
+err2:
+	getreq_unlink(&P->waiting_head, &P->waiting_tail, G);
+	sock_addr_free(G->addrs[0]);
+err1:
+	free(G);
+err0:
+	/* Failure! */
+	return (NULL);
+}
+
+/**
+ * http_pool_get_cancel(cookie):
+ * Cancel the connection request for which ${cookie} was returned by
+ * http_pool_get.  Do not invoke the associated callback function.
+ */
+void
+http_pool_get_cancel(void * cookie)
+{
+	struct getreq * G = cookie;
+
+	/*
+	 * If we're in the middle of opening a connection, let it finish; it
+	 * will be parked in the pool for the next request to this endpoint.
+	 */
+	if (G->connect_cookie != NULL) {
+		G->callback = NULL;
+		G->cookie = NULL;
+		return;
+	}
+
+	/* Otherwise, stop waiting and free the request. */
+	getreq_unlink(&G->P->waiting_head, &G->P->waiting_tail, G);
+	getreq_free(G);
+}
+
+/**
+ * http_pool_put(C, reusable):
+ * Return the connection ${C} to its pool.  If ${reusable} is non-zero, the
+ * connection is left idle in the pool for use by a later request; otherwise
+ * it is closed.  No callbacks are invoked before this function returns.
+ */
+void
+http_pool_put(struct http_conn * C, int reusable)
+{
+	uint8_t * buf;
+	size_t buflen;
+
+	/* Stop reading on behalf of the request. */
+	netbuf_read_wait_cancel(C->R);
+
+	/* Unsolicited data after a response means the stream is broken. */
+	if (reusable) {
+		netbuf_read_peek(C->R, &buf, &buflen);
+		if (buflen != 0)
+			reusable = 0;
+	}
+
+	/*
+	 * If the server responded before reading the entire request, we have
+	 * an unknown amount of request body left to send (and it is written
+	 * from a buffer which the caller is about to free).
+	 */
+	if (reusable && netbuf_write_busy(C->W))
+		reusable = 0;
+
+	/* Close the connection or park it in the pool. */
+	if (reusable) {
+		C->nreqs += 1;
+		conn_makeidle(C);
+	} else {
+		conn_close(C);
+	}
+}
+
+/**
+ * http_pool_free(P):
+ * Close all of the idle connections in the pool ${P} and free it.  There
+ * must be no requests using the pool.
+ */
+void
+http_pool_free(struct http_pool * P)
+{
+	struct getreq * G;
+
+	/* Behave consistently with free(NULL). */
+	if (P == NULL)
+		return;
+
+	/* Nobody should be waiting for a connection. */
+	assert(P->waiting_head == NULL);
+
+	/* Stop opening connections which nobody wants any more. */
+	while ((G = P->connecting) != NULL) {
+		network_connect_cancel(G->connect_cookie);
+		getreq_unlink(&P->connecting, NULL, G);
+		getreq_free(G);
+	}
+
+	/* Close all the connections. */
+	while (P->conns != NULL)
+		conn_close(P->conns);
+
+	/* Cancel any pending callback. */
+	if (P->immediate_cookie != NULL)
+		events_immediate_cancel(P->immediate_cookie);
+
+	/* Free the pool structure. */
+	free(P);
+}
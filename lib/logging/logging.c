@@ -15,11 +15,20 @@
 
 #include "logging.h"
 
+/* Buffered lines are written out this many seconds after being logged. */
+#define FLUSH_DELAY	0.1
+
 /* Log file structure. */
 struct logging_file {
 	int fd;			/* File descriptor open to file. */
 	char * path;		/* Copy of path string. */
 	void * timer_cookie;	/* Cookie for has-file-moved timer. */
+	time_t ts_time;		/* Time for which ts is valid. */
+	char ts[20];		/* "YYYY-MM-DD hh:mm:ss" for ts_time. */
+	char * buf;		/* Buffered lines, or NULL if unbuffered. */
+	size_t buflen;		/* Size of buf. */
+	size_t bufpos;		/* Number of bytes of buffered lines. */
+	void * flush_cookie;	/* Cookie for buffer-flushing timer. */
 };
 
 /* Open the log file and EOL-terminate if necessary. */
@@ -81,6 +90,80 @@ err0:
 	return (-1);
 }
 
+/* Make sure we have the date and time of the current second. */
+static int
+gettimestamp(struct logging_file * F)
+{
+	time_t now;
+
+	/* What time is it? */
+	if (time(&now) == (time_t)(-1)) {
+		warnp("time");
+		goto err0;
+	}
+
+	/* Format the date and time, unless we already have. */
+	if (now != F->ts_time) {
+		if (strftime(F->ts, 20, "%Y-%m-%d %H:%M:%S",
+		    gmtime(&now)) != 19) {
+			warnp("strftime");
+			goto err0;
+		}
+		F->ts_time = now;
+	}
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Write out any buffered lines. */
+static int
+flush(struct logging_file * F)
+{
+	size_t len = F->bufpos;
+
+	/* Anything to do? */
+	if (len == 0)
+		goto done;
+
+	/*
+	 * The buffer is empty after this, whether or not we succeed; if we
+	 * can't write to the log file, we lose what was in the buffer.
+	 */
+	F->bufpos = 0;
+
+	/* Write the buffered lines to the file. */
+	if (noeintr_write(F->fd, F->buf, len) != (ssize_t)len) {
+		warnp("Cannot write to log file: %s", F->path);
+		goto err0;
+	}
+
+done:
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Write out buffered lines. */
+static int
+callback_flush(void * cookie)
+{
+	struct logging_file * F = cookie;
+
+	/* Timer callback is no longer pending. */
+	F->flush_cookie = NULL;
+
+	/* Write out the buffer. */
+	return (flush(F));
+}
+
 /* Check if we need to close and re-open the log file. */
 static int
 callback_timer(void * cookie)
@@ -114,6 +197,10 @@ callback_timer(void * cookie)
 		goto done;
 
 reopen:
+	/* Buffered lines belong in the file we have open. */
+	if (flush(F))
+		goto err0;
+
 	/* We need to close and re-open the log file. */
 	close(F->fd);
 	if ((F->fd = doopen(F->path)) == -1)
@@ -161,6 +248,14 @@ logging_open(const char * path)
 	if ((F->fd = doopen(F->path)) == -1)
 		goto err2;
 
+	/* We haven't formatted a date and time yet. */
+	F->ts_time = (time_t)(-1);
+
+	/* Write lines out immediately until asked to buffer them. */
+	F->buf = NULL;
+	F->buflen = F->bufpos = 0;
+	F->flush_cookie = NULL;
+
 	/* Start the has-file-moved timer. */
 	if ((F->timer_cookie =
 	    events_timer_register_double(callback_timer, F, 1.0)) == NULL)
@@ -180,6 +275,81 @@ err0:
 	return (NULL);
 }
 
+/**
+ * logging_buffer(F, buflen):
+ * Buffer lines written to the log file ${F} in a ${buflen}-byte buffer rather
+ * than writing each of them immediately.  Buffered lines are written out
+ * together, with a single write, 0.1 seconds after the first of them was
+ * logged; and when a line does not fit into the buffer (so that the buffer
+ * never holds more than ${buflen} bytes) or the log file is re-opened or
+ * closed.  Lines which do not fit into an empty buffer are written directly.
+ */
+int
+logging_buffer(struct logging_file * F, size_t buflen)
+{
+
+	/* Sanity-check. */
+	assert(F->buf == NULL);
+
+	/* Allocate the buffer. */
+	if ((F->buf = malloc(buflen)) == NULL)
+		goto err0;
+	F->buflen = buflen;
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Add a log line to the buffer if it fits; return 1 if it doesn't. */
+static int
+bufline(struct logging_file * F, const char * format, va_list ap)
+{
+	size_t avail = F->buflen - F->bufpos;
+	int len;
+
+	/* We need room for at least a date and time, EOL, and NUL. */
+	if (avail < 21)
+		goto toolong;
+
+	/* Format the log message after where the date and time will go. */
+	len = vsnprintf(&F->buf[F->bufpos + 19], avail - 19, format, ap);
+
+	/* Did we fail? */
+	if (len < 0)
+		goto err0;
+
+	/* Did it fit, with room for the EOL (which replaces the NUL)? */
+	if ((size_t)(len) + 20 > avail)
+		goto toolong;
+
+	/* Add the date and time and the EOL. */
+	memcpy(&F->buf[F->bufpos], F->ts, 19);
+	F->buf[F->bufpos + 19 + (size_t)(len)] = '\n';
+	F->bufpos += (size_t)(len) + 20;
+
+	/* Make sure this gets written out soon. */
+	if (F->flush_cookie == NULL) {
+		if ((F->flush_cookie = events_timer_register_double(
+		    callback_flush, F, FLUSH_DELAY)) == NULL)
+			goto err0;
+	}
+
+	/* Success! */
+	return (0);
+
+toolong:
+	/* The line doesn't fit. */
+	return (1);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
 /**
  * logging_printf(F, format, ...):
  * Write <datetime><printf-formatted-string><\n> to the log file for which ${F}
@@ -197,7 +367,35 @@ logging_printf(struct logging_file * F, const char * format, ...)
 	int len;
 	size_t buflen;
 	char * str;
-	time_t now;
+	int rc;
+
+	/* Get the date and time. */
+	if (gettimestamp(F))
+		goto err0;
+
+	/*
+	 * If we're buffering, try to add the line to the buffer; if it
+	 * doesn't fit, write out the buffer and try again.
+	 */
+	if (F->buf != NULL) {
+		for (;;) {
+			va_start(ap, format);
+			rc = bufline(F, format, ap);
+			va_end(ap);
+			if (rc == -1)
+				goto err0;
+			if (rc == 0)
+				goto done;
+
+			/* If the buffer was empty, write the line directly. */
+			if (F->bufpos == 0)
+				break;
+
+			/* Make room by writing out the buffer. */
+			if (flush(F))
+				goto err0;
+		}
+	}
 
 	/* Figure out how long the line we're writing is. */
 	va_start(ap, format);
@@ -214,14 +412,7 @@ logging_printf(struct logging_file * F, const char * format, ...)
 		goto err0;
 
 	/* Write date and time to start of buffer. */
-	if (time(&now) == (time_t)(-1)) {
-		warnp("time");
-		goto err1;
-	}
-	if (strftime(str, 20, "%Y-%m-%d %H:%M:%S", gmtime(&now)) != 19) {
-		warnp("strftime");
-		goto err1;
-	}
+	memcpy(str, F->ts, 19);
 
 	/* Append the log message. */
 	va_start(ap, format);
@@ -248,6 +439,7 @@ logging_printf(struct logging_file * F, const char * format, ...)
 	/* Free our string buffer. */
 	free(str);
 
+done:
 	/* Success! */
 	return (0);
 
@@ -270,9 +462,18 @@ logging_close(struct logging_file * F)
 	if (F->timer_cookie != NULL)
 		events_timer_cancel(F->timer_cookie);
 
-	/* Close the log file if we have it open. */
-	if (F->fd != -1)
+	/* Stop the buffer-flushing timer if it's running. */
+	if (F->flush_cookie != NULL)
+		events_timer_cancel(F->flush_cookie);
+
+	/* Close the log file if we have it open, writing out the buffer. */
+	if (F->fd != -1) {
+		(void)flush(F);
 		close(F->fd);
+	}
+
+	/* Free the buffer (if any). */
+	free(F->buf);
 
 	/* Free the duplicated path string. */
 	free(F->path);
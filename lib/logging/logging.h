@@ -27,6 +27,17 @@ struct logging_file;
  */
 struct logging_file * logging_open(const char *);
 
+/**
+ * logging_buffer(F, buflen):
+ * Buffer lines written to the log file ${F} in a ${buflen}-byte buffer rather
+ * than writing each of them immediately.  Buffered lines are written out
+ * together, with a single write, 0.1 seconds after the first of them was
+ * logged; and when a line does not fit into the buffer (so that the buffer
+ * never holds more than ${buflen} bytes) or the log file is re-opened or
+ * closed.  Lines which do not fit into an empty buffer are written directly.
+ */
+int logging_buffer(struct logging_file *, size_t);
+
 /**
  * logging_printf(F, format, ...):
  * Write <datetime><printf-formatted-string><\n> to the log file for which ${F}
@@ -40,6 +40,18 @@ void netbuf_read_wait_cancel(struct netbuf_read *);
  */
 void netbuf_read_consume(struct netbuf_read *, size_t);
 
+/**
+ * netbuf_read_read(R, buf, buflen, callback, cookie):
+ * Read ${buflen} bytes from the reader ${R} into ${buf}: copy out any data
+ * which is already buffered, then read the remainder directly from the
+ * socket without passing it through the internal buffer.  Once all the data
+ * has arrived or an error occurs, invoke ${callback}(${cookie}, status) with
+ * status set as for netbuf_read_wait.  The read can be cancelled with
+ * netbuf_read_wait_cancel, after which the contents of ${buf} are undefined.
+ */
+int netbuf_read_read(struct netbuf_read *, uint8_t *, size_t,
+    int (*)(void *, int), void *);
+
 /**
  * netbuf_read_free(R):
  * Free the reader ${R}.  Note that an indeterminate amount of data may have
@@ -80,6 +92,22 @@ int netbuf_write_consume(struct netbuf_write *, size_t);
  */
 int netbuf_write_write(struct netbuf_write *, const uint8_t *, size_t);
 
+/**
+ * netbuf_write_write_nocopy(W, buf, buflen):
+ * Write ${buflen} bytes from the buffer ${buf} via the buffered writer ${W}
+ * without copying them; the buffer must remain valid until it has been
+ * written (i.e., until netbuf_write_busy returns zero) or until the writer
+ * is freed.
+ */
+int netbuf_write_write_nocopy(struct netbuf_write *, const uint8_t *, size_t);
+
+/**
+ * netbuf_write_busy(W):
+ * Return non-zero if the buffered writer ${W} has data which has not yet
+ * been written.
+ */
+int netbuf_write_busy(struct netbuf_write *);
+
 /**
  * netbuf_write_free(W):
  * Free the writer ${W}.
@@ -25,6 +25,7 @@ struct netbuf_read {
 
 static int callback_success(void *);
 static int callback_read(void *, ssize_t);
+static int callback_readdirect(void *, ssize_t);
 
 /**
  * netbuf_read_init(s):
@@ -200,6 +201,80 @@ failed:
 	return ((R->callback)(R->cookie, -1));
 }
 
+/**
+ * netbuf_read_read(R, buf, buflen, callback, cookie):
+ * Read ${buflen} bytes from the reader ${R} into ${buf}: copy out any data
+ * which is already buffered, then read the remainder directly from the
+ * socket without passing it through the internal buffer.  Once all the data
+ * has arrived or an error occurs, invoke ${callback}(${cookie}, status) with
+ * status set as for netbuf_read_wait.  The read can be cancelled with
+ * netbuf_read_wait_cancel, after which the contents of ${buf} are undefined.
+ */
+int
+netbuf_read_read(struct netbuf_read * R, uint8_t * buf, size_t buflen,
+    int (* callback)(void *, int), void * cookie)
+{
+	size_t copylen;
+
+	/* Sanity-check: We shouldn't be reading already. */
+	assert(R->read_cookie == NULL);
+	assert(R->immediate_cookie == NULL);
+
+	/* Record parameters for future reference. */
+	R->callback = callback;
+	R->cookie = cookie;
+
+	/* Copy out as much buffered data as we can. */
+	copylen = R->datalen - R->bufpos;
+	if (copylen > buflen)
+		copylen = buflen;
+	memcpy(buf, &R->buf[R->bufpos], copylen);
+	R->bufpos += copylen;
+
+	/* If that was everything, schedule a callback. */
+	if (copylen == buflen) {
+		if ((R->immediate_cookie =
+		    events_immediate_register(callback_success, R, 0)) == NULL)
+			goto err0;
+		else
+			goto done;
+	}
+
+	/* Read the rest directly into the caller's buffer. */
+	if ((R->read_cookie = network_read(R->s, &buf[copylen],
+	    buflen - copylen, buflen - copylen, callback_readdirect, R)) == NULL)
+		goto err0;
+
+done:
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Callback for a completed direct network read. */
+static int
+callback_readdirect(void * cookie, ssize_t lenread)
+{
+	struct netbuf_read * R = cookie;
+
+	/* Sanity-check: We should be reading. */
+	assert(R->read_cookie != NULL);
+
+	/* This callback is no longer pending. */
+	R->read_cookie = NULL;
+
+	/* Perform the callback: success, EOF, or failure. */
+	if (lenread > 0)
+		return ((R->callback)(R->cookie, 0));
+	else if (lenread == 0)
+		return ((R->callback)(R->cookie, 1));
+	else
+		return ((R->callback)(R->cookie, -1));
+}
+
 /**
  * netbuf_read_wait_cancel(R):
  * Cancel any in-progress wait on the reader ${R}.  Do not invoke the callback
@@ -18,6 +18,7 @@
 /* Linked list of write buffers. */
 struct writebuf {
 	uint8_t * buf;			/* The buffer to be written. */
+	const uint8_t * data;		/* Data to write (buf or external). */
 	size_t buflen;			/* Size of buffer. */
 	size_t datalen;			/* Amount of data in buffer. */
 	struct writebuf * next;		/* Next buffer in queue. */
@@ -105,7 +106,7 @@ poke(struct netbuf_write * W)
 
 	/* Start writing a buffer. */
 	WB = W->head;
-	if ((W->write_cookie = network_write(W->s, WB->buf,
+	if ((W->write_cookie = network_write(W->s, WB->data,
 	    WB->datalen, WB->datalen, writbuf, W)) == NULL)
 		goto err0;
 
@@ -217,6 +218,7 @@ netbuf_write_reserve(struct netbuf_write * W, size_t len)
 		goto err1;
 
 	/* No data in this buffer yet. */
+	WB->data = WB->buf;
 	WB->datalen = 0;
 
 	/* Add this buffer to the queue. */
@@ -303,6 +305,67 @@ err0:
 	return (-1);
 }
 
+/**
+ * netbuf_write_write_nocopy(W, buf, buflen):
+ * Write ${buflen} bytes from the buffer ${buf} via the buffered writer ${W}
+ * without copying them; the buffer must remain valid until it has been
+ * written (i.e., until netbuf_write_busy returns zero) or until the writer
+ * is freed.
+ */
+int
+netbuf_write_write_nocopy(struct netbuf_write * W, const uint8_t * buf,
+    size_t buflen)
+{
+	struct writebuf * WB;
+
+	/* Sanity-check: No calls while buffer space reserved. */
+	assert(W->reserved == 0);
+
+	/* If we've failed, just silently discard writes. */
+	if (W->failed)
+		return (0);
+
+	/* Nothing to do if there's nothing to write. */
+	if (buflen == 0)
+		return (0);
+
+	/* Allocate a buffer structure which points at the data. */
+	if ((WB = malloc(sizeof(struct writebuf))) == NULL)
+		goto err0;
+	WB->buf = NULL;
+	WB->data = buf;
+
+	/* This buffer is full; later writes need to go into a new buffer. */
+	WB->buflen = WB->datalen = buflen;
+
+	/* Add this buffer to the queue. */
+	if (W->tail == NULL)
+		W->head = WB;
+	else
+		W->tail->next = WB;
+	W->tail = WB;
+	WB->next = NULL;
+
+	/* Poke the queue to see if we can launch more writing now. */
+	return (poke(W));
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/**
+ * netbuf_write_busy(W):
+ * Return non-zero if the buffered writer ${W} has data which has not yet
+ * been written.
+ */
+int
+netbuf_write_busy(struct netbuf_write * W)
+{
+
+	return ((W->head != NULL) || (W->curr != NULL));
+}
+
 /**
  * netbuf_write_free(W):
  * Free the writer ${W}.
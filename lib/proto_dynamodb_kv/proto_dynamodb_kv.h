@@ -51,13 +51,82 @@ int proto_dynamodb_kv_request_getc(struct wire_requestqueue *, const char *,
 int proto_dynamodb_kv_request_delete(struct wire_requestqueue *, const char *,
     int (*)(void *, int), void *);
 
+/**
+ * proto_dynamodb_kv_request_mput(Q, n, keys, bufs, lens, callback, cookie):
+ * Send a request to associate the value ${bufs[i]} (of length ${lens[i]})
+ * with the key ${keys[i]} for each i < ${n} via the request queue ${Q},
+ * where ${n} is at least 1 and at most PROTO_DDBKV_MMAX and the keys are
+ * distinct.  Invoke
+ *     ${callback}(${cookie}, status)
+ * upon request completion, where ${status} is 0 on success and 1 on failure.
+ * The values must be of length at most 256 kiB.
+ */
+int proto_dynamodb_kv_request_mput(struct wire_requestqueue *, size_t,
+    const char * const *, const uint8_t * const *, const size_t *,
+    int (*)(void *, int), void *);
+
+/**
+ * proto_dynamodb_kv_request_mget(Q, n, keys, callback, cookie):
+ * Send a request to read the values associated with the keys ${keys[i]} for
+ * each i < ${n} via the request queue ${Q}, where ${n} is at least 1 and at
+ * most PROTO_DDBKV_MMAX and the keys are distinct.  Invoke
+ *     ${callback}(${cookie}, status, bufs, lens)
+ * upon request completion, where ${status} is 0 on success and 1 on failure,
+ * and (on success) ${bufs[i]} is the value (of length ${lens[i]}) associated
+ * with ${keys[i]} or NULL if there is no such key/value pair.  The values are
+ * only valid until the callback returns.
+ */
+int proto_dynamodb_kv_request_mget(struct wire_requestqueue *, size_t,
+    const char * const *,
+    int (*)(void *, int, const uint8_t * const *, const size_t *), void *);
+
+/**
+ * proto_dynamodb_kv_request_mgetc(Q, n, keys, callback, cookie):
+ * As proto_dynamodb_kv_request_mget, except that the underlying DynamoDB
+ * requests are made with strong consistency.
+ */
+int proto_dynamodb_kv_request_mgetc(struct wire_requestqueue *, size_t,
+    const char * const *,
+    int (*)(void *, int, const uint8_t * const *, const size_t *), void *);
+
+/**
+ * proto_dynamodb_kv_request_mdelete(Q, n, keys, callback, cookie):
+ * Send a request to delete the keys ${keys[i]} and their associated values
+ * for each i < ${n} via the request queue ${Q}, where ${n} is at least 1 and
+ * at most PROTO_DDBKV_MMAX and the keys are distinct.  Invoke
+ *     ${callback}(${cookie}, status)
+ * upon request completion, where ${status} is 0 on success and 1 on failure.
+ */
+int proto_dynamodb_kv_request_mdelete(struct wire_requestqueue *, size_t,
+    const char * const *, int (*)(void *, int), void *);
+
+/**
+ * proto_dynamodb_kv_request_stats(Q, callback, cookie):
+ * Send a request for request latency statistics via the request queue ${Q}.
+ * Invoke
+ *     ${callback}(${cookie}, status, buf, len)
+ * upon request completion, where ${status} is 0 on success and 1 on failure,
+ * and (on success) ${buf} contains ${len} bytes in the format produced by
+ * opstats_serialize.  The buffer is only valid until the callback returns.
+ */
+int proto_dynamodb_kv_request_stats(struct wire_requestqueue *,
+    int (*)(void *, int, const uint8_t *, size_t), void *);
+
 /* Packet types. */
 #define PROTO_DDBKV_PUT		0x00010100
+#define PROTO_DDBKV_MPUT	0x00010101
 #define PROTO_DDBKV_GET		0x00010110
 #define PROTO_DDBKV_GETC	0x00010111
+#define PROTO_DDBKV_MGET	0x00010112
+#define PROTO_DDBKV_MGETC	0x00010113
 #define PROTO_DDBKV_DELETE	0x00010200
+#define PROTO_DDBKV_MDELETE	0x00010201
+#define PROTO_DDBKV_STATS	0x00010300
 #define PROTO_DDBKV_NONE	((uint32_t)(-1))
 
+/* Maximum number of keys in an MPUT, MGET, MGETC, or MDELETE. */
+#define PROTO_DDBKV_MMAX	256
+
 /* DynamoDB-KV request structure. */
 struct proto_ddbkv_request {
 	/* Present for all requests. */
@@ -68,6 +137,13 @@ struct proto_ddbkv_request {
 	/* Present for PUT requests only. */
 	uint32_t len;
 	uint8_t * buf;
+
+	/* Present for MPUT, MGET, MGETC, and MDELETE requests only. */
+	size_t nkeys;
+	const char ** keys;
+	const uint8_t ** bufs;		/* MPUT only. */
+	size_t * lens;			/* MPUT only. */
+	uint8_t * mblob;
 };
 
 /**
@@ -96,8 +172,12 @@ int proto_dynamodb_kv_response_status(struct netbuf_write *, uint64_t, int);
 
 #define proto_dynamodb_kv_response_put(Q, ID, status)		\
 	proto_dynamodb_kv_response_status(Q, ID, status)
+#define proto_dynamodb_kv_response_mput(Q, ID, status)		\
+	proto_dynamodb_kv_response_status(Q, ID, status)
 #define proto_dynamodb_kv_response_delete(Q, ID, status)	\
 	proto_dynamodb_kv_response_status(Q, ID, status)
+#define proto_dynamodb_kv_response_mdelete(Q, ID, status)	\
+	proto_dynamodb_kv_response_status(Q, ID, status)
 
 /**
  * proto_dynamodb_kv_response_data(Q, ID, status, len, buf):
@@ -112,5 +192,20 @@ int proto_dynamodb_kv_response_data(struct netbuf_write *, uint64_t, int,
 	proto_dynamodb_kv_response_data(Q, ID, status, len, buf)
 #define proto_dynamodb_kv_response_getc(Q, ID, status, len, buf)	\
 	proto_dynamodb_kv_response_data(Q, ID, status, len, buf)
+#define proto_dynamodb_kv_response_stats(Q, ID, len, buf)		\
+	proto_dynamodb_kv_response_data(Q, ID, 0, len, buf)
+
+/**
+ * proto_dynamodb_kv_response_mget(Q, ID, status, n, bufs, lens):
+ * Send a response with ID ${ID} to the write queue ${Q} indicating that
+ * the DynamoDB requests completed successfully (${status} = 0) with the
+ * ${n} values ${bufs[i]} (of length ${lens[i]}), each of which is NULL if
+ * there is no such key/value pair, or failed (${status} = 1).
+ */
+int proto_dynamodb_kv_response_mget(struct netbuf_write *, uint64_t, int,
+    size_t, const uint8_t * const *, const uint32_t *);
+
+#define proto_dynamodb_kv_response_mgetc(Q, ID, status, n, bufs, lens)	\
+	proto_dynamodb_kv_response_mget(Q, ID, status, n, bufs, lens)
 
 #endif /* !_PROTO_DYNAMODB_KV_H_ */
@@ -19,6 +19,12 @@ struct data_cookie {
 	void * cookie;
 };
 
+struct mget_cookie {
+	int (* callback)(void *, int, const uint8_t * const *, const size_t *);
+	void * cookie;
+	size_t n;
+};
+
 /* Macro for simplifying response-parsing errors. */
 #define BAD(rtype, ftype)	do {				\
 	warn0("Received %s response with %s", rtype, ftype);	\
@@ -123,6 +129,202 @@ failed:
 	return (rc);
 }
 
+static int
+callback_mget(void * cookie, uint8_t * buf, size_t buflen)
+{
+	struct mget_cookie * C = cookie;
+	const uint8_t ** bufs = NULL;
+	size_t * lens = NULL;
+	int failed = 1;
+	uint32_t status;
+	size_t pos;
+	size_t i;
+	int rc;
+
+	/* If we have a packet, parse it. */
+	if (buf != NULL) {
+		/* Parse the status. */
+		if (buflen < 4)
+			BAD("MGET", "bogus length");
+		status = be32dec(&buf[0]);
+
+		/* Non-zero status is a failure. */
+		switch (status) {
+		case 0:
+			break;
+		case 1:
+			if (buflen != 4)
+				BAD("MGET", "bogus length");
+			goto failed;
+		default:
+			BAD("MGET", "invalid status");
+		}
+
+		/* We should have the right number of values. */
+		if (buflen < 8)
+			BAD("MGET", "bogus length");
+		if (be32dec(&buf[4]) != C->n)
+			BAD("MGET", "wrong number of values");
+		pos = 8;
+
+		/* Allocate arrays of values. */
+		if ((bufs = malloc(C->n * sizeof(const uint8_t *))) == NULL)
+			goto failed;
+		if ((lens = malloc(C->n * sizeof(size_t))) == NULL)
+			goto failed;
+
+		/* Parse the values. */
+		for (i = 0; i < C->n; i++) {
+			if (buflen < pos + 1)
+				BAD("MGET", "bogus length");
+			switch (buf[pos++]) {
+			case 0:
+				break;
+			case 1:
+				bufs[i] = NULL;
+				lens[i] = 0;
+				continue;
+			default:
+				BAD("MGET", "invalid value status");
+			}
+			if (buflen < pos + 4)
+				BAD("MGET", "bogus length");
+			lens[i] = be32dec(&buf[pos]);
+			pos += 4;
+			if (buflen - pos < lens[i])
+				BAD("MGET", "bogus length");
+			bufs[i] = &buf[pos];
+			pos += lens[i];
+		}
+
+		/* Did we reach the end of the packet? */
+		if (pos != buflen)
+			BAD("MGET", "bogus length");
+
+		/* Success! */
+		failed = 0;
+	}
+
+failed:
+	/* Invoke the upstream callback. */
+	if (failed)
+		rc = (C->callback)(C->cookie, 1, NULL, NULL);
+	else
+		rc = (C->callback)(C->cookie, 0, bufs, lens);
+
+	/* Free the arrays and the cookie. */
+	free(lens);
+	free(bufs);
+	free(C);
+
+	/* Return status from callback. */
+	return (rc);
+}
+
+/*
+ * Start writing a request of type ${type} for the ${n} keys ${keys} and (if
+ * ${bufs} is not NULL) the values ${bufs[i]} of lengths ${lens[i]}.
+ */
+static int
+request_multi(struct wire_requestqueue * Q, uint32_t type, size_t n,
+    const char * const * keys, const uint8_t * const * bufs,
+    const size_t * lens, int (* callback)(void *, uint8_t *, size_t),
+    void * cookie)
+{
+	uint8_t *rbuf, *p;
+	size_t rlen;
+	size_t i;
+
+	/* Validate the number of keys. */
+	if ((n == 0) || (n > PROTO_DDBKV_MMAX)) {
+		warn0("Invalid number of keys: %zu", n);
+		goto err0;
+	}
+
+	/* Validate key and value lengths, and compute request packet size. */
+	rlen = 4 + 4;
+	for (i = 0; i < n; i++) {
+		if (strlen(keys[i]) > 255) {
+			warn0("Key is too long");
+			goto err0;
+		}
+		rlen += 1 + strlen(keys[i]);
+		if (bufs == NULL)
+			continue;
+		if (lens[i] > 256 * 1024) {
+			warn0("Value is too long");
+			goto err0;
+		}
+		rlen += 4 + lens[i];
+	}
+
+	/* Start writing a request. */
+	if ((p = rbuf = wire_requestqueue_add_getbuf(Q,
+	    rlen, callback, cookie)) == NULL)
+		goto err0;
+
+	/* Construct request. */
+	be32enc(p, type);
+	p += 4;
+	be32enc(p, n);
+	p += 4;
+	for (i = 0; i < n; i++) {
+		*p++ = (uint8_t)strlen(keys[i]);
+		memcpy(p, keys[i], strlen(keys[i]));
+		p += strlen(keys[i]);
+		if (bufs == NULL)
+			continue;
+		be32enc(p, lens[i]);
+		p += 4;
+		memcpy(p, bufs[i], lens[i]);
+		p += lens[i];
+	}
+
+	/* Sanity check. */
+	assert(p == &rbuf[rlen]);
+
+	/* Finish writing request. */
+	if (wire_requestqueue_add_done(Q, rbuf, rlen))
+		goto err0;
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Send an MGET or MGETC request. */
+static int
+request_mget(struct wire_requestqueue * Q, uint32_t type, size_t n,
+    const char * const * keys,
+    int (* callback)(void *, int, const uint8_t * const *, const size_t *),
+    void * cookie)
+{
+	struct mget_cookie * C;
+
+	/* Bake a cookie. */
+	if ((C = malloc(sizeof(struct mget_cookie))) == NULL)
+		goto err0;
+	C->callback = callback;
+	C->cookie = cookie;
+	C->n = n;
+
+	/* Send the request. */
+	if (request_multi(Q, type, n, keys, NULL, NULL, callback_mget, C))
+		goto err1;
+
+	/* Success! */
+	return (0);
+
+err1:
+	free(C);
+err0:
+	/* Failure! */
+	return (-1);
+}
+
 /**
  * proto_dynamodb_kv_request_put(Q, key, buf, buflen, callback, cookie):
  * Send a request to associate the value ${buf} (of length ${buflen}) with
@@ -371,3 +573,154 @@ err0:
 	/* Failure! */
 	return (-1);
 }
+
+/**
+ * proto_dynamodb_kv_request_stats(Q, callback, cookie):
+ * Send a request for request latency statistics via the request queue ${Q}.
+ * Invoke
+ *     ${callback}(${cookie}, status, buf, len)
+ * upon request completion, where ${status} is 0 on success and 1 on failure,
+ * and (on success) ${buf} contains ${len} bytes in the format produced by
+ * opstats_serialize.  The buffer is only valid until the callback returns.
+ */
+int
+proto_dynamodb_kv_request_stats(struct wire_requestqueue * Q,
+    int (* callback)(void *, int, const uint8_t *, size_t), void * cookie)
+{
+	struct data_cookie * C;
+	uint8_t buf[5];
+
+	/* Bake a cookie. */
+	if ((C = malloc(sizeof(struct data_cookie))) == NULL)
+		goto err0;
+	C->callback = callback;
+	C->cookie = cookie;
+
+	/* Construct request; the key is empty. */
+	be32enc(&buf[0], PROTO_DDBKV_STATS);
+	buf[4] = 0;
+
+	/* Send request. */
+	if (wire_requestqueue_add(Q, buf, 5, callback_data, C))
+		goto err1;
+
+	/* Success! */
+	return (0);
+
+err1:
+	free(C);
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/**
+ * proto_dynamodb_kv_request_mput(Q, n, keys, bufs, lens, callback, cookie):
+ * Send a request to associate the value ${bufs[i]} (of length ${lens[i]})
+ * with the key ${keys[i]} for each i < ${n} via the request queue ${Q},
+ * where ${n} is at least 1 and at most PROTO_DDBKV_MMAX and the keys are
+ * distinct.  Invoke
+ *     ${callback}(${cookie}, status)
+ * upon request completion, where ${status} is 0 on success and 1 on failure.
+ * The values must be of length at most 256 kiB.
+ */
+int
+proto_dynamodb_kv_request_mput(struct wire_requestqueue * Q, size_t n,
+    const char * const * keys, const uint8_t * const * bufs,
+    const size_t * lens, int (* callback)(void *, int), void * cookie)
+{
+	struct status_cookie * C;
+
+	/* Bake a cookie. */
+	if ((C = malloc(sizeof(struct status_cookie))) == NULL)
+		goto err0;
+	C->callback = callback;
+	C->cookie = cookie;
+
+	/* Send the request. */
+	if (request_multi(Q, PROTO_DDBKV_MPUT, n, keys, bufs, lens,
+	    callback_status, C))
+		goto err1;
+
+	/* Success! */
+	return (0);
+
+err1:
+	free(C);
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/**
+ * proto_dynamodb_kv_request_mget(Q, n, keys, callback, cookie):
+ * Send a request to read the values associated with the keys ${keys[i]} for
+ * each i < ${n} via the request queue ${Q}, where ${n} is at least 1 and at
+ * most PROTO_DDBKV_MMAX and the keys are distinct.  Invoke
+ *     ${callback}(${cookie}, status, bufs, lens)
+ * upon request completion, where ${status} is 0 on success and 1 on failure,
+ * and (on success) ${bufs[i]} is the value (of length ${lens[i]}) associated
+ * with ${keys[i]} or NULL if there is no such key/value pair.  The values are
+ * only valid until the callback returns.
+ */
+int
+proto_dynamodb_kv_request_mget(struct wire_requestqueue * Q, size_t n,
+    const char * const * keys,
+    int (* callback)(void *, int, const uint8_t * const *, const size_t *),
+    void * cookie)
+{
+
+	/* Send an MGET request. */
+	return (request_mget(Q, PROTO_DDBKV_MGET, n, keys, callback, cookie));
+}
+
+/**
+ * proto_dynamodb_kv_request_mgetc(Q, n, keys, callback, cookie):
+ * As proto_dynamodb_kv_request_mget, except that the underlying DynamoDB
+ * requests are made with strong consistency.
+ */
+int
+proto_dynamodb_kv_request_mgetc(struct wire_requestqueue * Q, size_t n,
+    const char * const * keys,
+    int (* callback)(void *, int, const uint8_t * const *, const size_t *),
+    void * cookie)
+{
+
+	/* Send an MGETC request. */
+	return (request_mget(Q, PROTO_DDBKV_MGETC, n, keys, callback, cookie));
+}
+
+/**
+ * proto_dynamodb_kv_request_mdelete(Q, n, keys, callback, cookie):
+ * Send a request to delete the keys ${keys[i]} and their associated values
+ * for each i < ${n} via the request queue ${Q}, where ${n} is at least 1 and
+ * at most PROTO_DDBKV_MMAX and the keys are distinct.  Invoke
+ *     ${callback}(${cookie}, status)
+ * upon request completion, where ${status} is 0 on success and 1 on failure.
+ */
+int
+proto_dynamodb_kv_request_mdelete(struct wire_requestqueue * Q, size_t n,
+    const char * const * keys, int (* callback)(void *, int), void * cookie)
+{
+	struct status_cookie * C;
+
+	/* Bake a cookie. */
+	if ((C = malloc(sizeof(struct status_cookie))) == NULL)
+		goto err0;
+	C->callback = callback;
+	C->cookie = cookie;
+
+	/* Send the request. */
+	if (request_multi(Q, PROTO_DDBKV_MDELETE, n, keys, NULL, NULL,
+	    callback_status, C))
+		goto err1;
+
+	/* Success! */
+	return (0);
+
+err1:
+	free(C);
+err0:
+	/* Failure! */
+	return (-1);
+}
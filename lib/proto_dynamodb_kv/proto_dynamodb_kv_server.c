@@ -1,11 +1,103 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "imalloc.h"
 #include "wire.h"
 #include "sysendian.h"
 
 #include "proto_dynamodb_kv.h"
 
+/**
+ * proto_dynamodb_kv_request_parse_multi(P, R):
+ * Parse the MPUT, MGET, MGETC, or MDELETE packet ${P} into the DynamoDB-KV
+ * request structure ${R}.
+ */
+static int
+proto_dynamodb_kv_request_parse_multi(const struct wire_packet * P,
+    struct proto_ddbkv_request * R)
+{
+	size_t pos = 4;
+	size_t keylen;
+	size_t i, j;
+
+	/* Parse and sanity-check the number of keys. */
+	if (P->len < pos + 4)
+		goto err0;
+	R->nkeys = be32dec(&P->buf[pos]);
+	pos += 4;
+	if ((R->nkeys == 0) || (R->nkeys > PROTO_DDBKV_MMAX))
+		goto err0;
+
+	/* Copy the packet data; keys and values will point into this. */
+	if ((R->mblob = malloc(P->len)) == NULL)
+		goto err0;
+	memcpy(R->mblob, P->buf, P->len);
+
+	/* Allocate arrays of keys and (for MPUT) values. */
+	if (IMALLOC(R->keys, R->nkeys, const char *))
+		goto err1;
+	if (R->type == PROTO_DDBKV_MPUT) {
+		if (IMALLOC(R->bufs, R->nkeys, const uint8_t *))
+			goto err1;
+		if (IMALLOC(R->lens, R->nkeys, size_t))
+			goto err1;
+	}
+
+	/* Parse keys and values. */
+	for (i = 0; i < R->nkeys; i++) {
+		/* Extract and sanity-check the key. */
+		if (P->len < pos + 1)
+			goto err1;
+		keylen = R->mblob[pos];
+		if (P->len < pos + 1 + keylen)
+			goto err1;
+		for (j = 0; j < keylen; j++)
+			if (R->mblob[pos + 1 + j] == '\0')
+				goto err1;
+
+		/*
+		 * Move the key back over its length byte and NUL-terminate
+		 * it, so that it can be used as a string in place.
+		 */
+		memmove(&R->mblob[pos], &R->mblob[pos + 1], keylen);
+		R->mblob[pos + keylen] = '\0';
+		R->keys[i] = (const char *)&R->mblob[pos];
+		pos += 1 + keylen;
+
+		/* MPUT requests have values too. */
+		if (R->type != PROTO_DDBKV_MPUT)
+			continue;
+		if (P->len < pos + 4)
+			goto err1;
+		R->lens[i] = be32dec(&R->mblob[pos]);
+		pos += 4;
+		if (P->len - pos < R->lens[i])
+			goto err1;
+		R->bufs[i] = &R->mblob[pos];
+		pos += R->lens[i];
+	}
+
+	/* Check that we processed the entire request record. */
+	if (P->len != pos)
+		goto err1;
+
+	/* Success! */
+	return (0);
+
+err1:
+	free(R->lens);
+	free(R->bufs);
+	free(R->keys);
+	free(R->mblob);
+	R->lens = NULL;
+	R->bufs = NULL;
+	R->keys = NULL;
+	R->mblob = NULL;
+err0:
+	/* Failure! */
+	return (-1);
+}
+
 /**
  * proto_dynamodb_kv_request_parse(P, R):
  * Parse the packet ${P} into the DynamoDB-KV request structure ${R}.
@@ -24,6 +116,11 @@ proto_dynamodb_kv_request_parse(const struct wire_packet * P,
 	/* Initialize pointers to NULL to make cleanup easier. */
 	R->key = NULL;
 	R->buf = NULL;
+	R->nkeys = 0;
+	R->keys = NULL;
+	R->bufs = NULL;
+	R->lens = NULL;
+	R->mblob = NULL;
 
 	/* Extract the request type. */
 	if (P->len < pos + 4)
@@ -31,7 +128,19 @@ proto_dynamodb_kv_request_parse(const struct wire_packet * P,
 	R->type = be32dec(&P->buf[pos]);
 	pos += 4;
 
-	/* Extract key length (appears in every request type). */
+	/* Requests with multiple keys are parsed separately. */
+	switch (R->type) {
+	case PROTO_DDBKV_MPUT:
+	case PROTO_DDBKV_MGET:
+	case PROTO_DDBKV_MGETC:
+	case PROTO_DDBKV_MDELETE:
+		return (proto_dynamodb_kv_request_parse_multi(P, R));
+	}
+
+	/*
+	 * Extract key length (appears in every request type; STATS requests
+	 * carry an empty key).
+	 */
 	if (P->len < pos + 1)
 		goto err0;
 	buflen = P->buf[pos++];
@@ -67,6 +176,7 @@ proto_dynamodb_kv_request_parse(const struct wire_packet * P,
 	case PROTO_DDBKV_GET:
 	case PROTO_DDBKV_GETC:
 	case PROTO_DDBKV_DELETE:
+	case PROTO_DDBKV_STATS:
 		break;
 	default:
 		goto err1;
@@ -142,6 +252,12 @@ proto_dynamodb_kv_request_free(struct proto_ddbkv_request * req)
 	if (req->type == PROTO_DDBKV_PUT)
 		free(req->buf);
 
+	/* Free the arrays and data of requests with multiple keys. */
+	free(req->lens);
+	free(req->bufs);
+	free(req->keys);
+	free(req->mblob);
+
 	/* Free the key. */
 	free(req->key);
 }
@@ -216,3 +332,62 @@ err0:
 	/* Failure! */
 	return (-1);
 }
+
+/**
+ * proto_dynamodb_kv_response_mget(Q, ID, status, n, bufs, lens):
+ * Send a response with ID ${ID} to the write queue ${Q} indicating that
+ * the DynamoDB requests completed successfully (${status} = 0) with the
+ * ${n} values ${bufs[i]} (of length ${lens[i]}), each of which is NULL if
+ * there is no such key/value pair, or failed (${status} = 1).
+ */
+int
+proto_dynamodb_kv_response_mget(struct netbuf_write * Q, uint64_t ID,
+    int status, size_t n, const uint8_t * const * bufs, const uint32_t * lens)
+{
+	uint8_t * wbuf;
+	size_t rlen;
+	size_t pos;
+	size_t i;
+
+	/* Compute the response length. */
+	rlen = 4;
+	if (status == 0) {
+		rlen += 4;
+		for (i = 0; i < n; i++)
+			rlen += 1 + ((bufs[i] != NULL) ? 4 + lens[i] : 0);
+	}
+
+	/* Get a packet data buffer. */
+	if ((wbuf = wire_writepacket_getbuf(Q, ID, rlen)) == NULL)
+		goto err0;
+
+	/* Write the packet data. */
+	be32enc(&wbuf[0], status);
+	pos = 4;
+	if (status == 0) {
+		be32enc(&wbuf[pos], n);
+		pos += 4;
+		for (i = 0; i < n; i++) {
+			if (bufs[i] == NULL) {
+				wbuf[pos++] = 1;
+				continue;
+			}
+			wbuf[pos++] = 0;
+			be32enc(&wbuf[pos], lens[i]);
+			pos += 4;
+			memcpy(&wbuf[pos], bufs[i], lens[i]);
+			pos += lens[i];
+		}
+	}
+
+	/* Finish the packet. */
+	if (wire_writepacket_done(Q, wbuf, rlen))
+		goto err0;
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
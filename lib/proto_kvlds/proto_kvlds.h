@@ -100,6 +100,34 @@ int proto_kvlds_request_get(struct wire_requestqueue *,
     const struct kvldskey *,
     int (*)(void *, int, struct kvldskey *), void *);
 
+/**
+ * proto_kvlds_request_mget(Q, nkeys, keys, callback, cookie):
+ * Send an MGET request to read the values associated with the ${nkeys} keys
+ * ${keys[0]} ... ${keys[nkeys - 1]} via the request queue ${Q}, where
+ * ${nkeys} is at least 1 and at most PROTO_KVLDS_MMAX.  Invoke
+ *     ${callback}(${cookie}, failed, values)
+ * upon request completion, where failed is 0 on success and 1 on failure,
+ * and values[i] is the value associated with the key ${keys[i]} or NULL if
+ * no value is associated.  The callback is responsible for freeing the
+ * array and its members.
+ */
+int proto_kvlds_request_mget(struct wire_requestqueue *, size_t,
+    const struct kvldskey * const *,
+    int (*)(void *, int, struct kvldskey **), void *);
+
+/**
+ * proto_kvlds_request_mset(Q, nkeys, keys, values, callback, cookie):
+ * Send an MSET request to associate the value ${values[i]} with the key
+ * ${keys[i]} for each i < ${nkeys} via the request queue ${Q}, where
+ * ${nkeys} is at least 1 and at most PROTO_KVLDS_MMAX.  The pairs are
+ * stored atomically, and in order if a key appears more than once.  Invoke
+ *     ${callback}(${cookie}, failed)
+ * upon request completion, where failed is 0 on success and 1 on failure.
+ */
+int proto_kvlds_request_mset(struct wire_requestqueue *, size_t,
+    const struct kvldskey * const *, const struct kvldskey * const *,
+    int (*)(void *, int), void *);
+
 /**
  * proto_kvlds_request_range(Q, start, end, max, callback, cookie):
  * Send a RANGE request to list key-value pairs which are >= ${start} and
@@ -130,18 +158,58 @@ int proto_kvlds_request_range2(struct wire_requestqueue *,
     int (*)(void *, const struct kvldskey *, const struct kvldskey *),
     int (*)(void *, int), void *);
 
+/**
+ * proto_kvlds_request_stats(Q, callback, cookie):
+ * Send a STATS request to get request latency statistics via the request
+ * queue ${Q}.  Invoke
+ *     ${callback}(${cookie}, failed, buf, buflen)
+ * upon request completion, where failed is 0 on success and 1 on failure,
+ * and buf is a ${buflen}-byte buffer in the format produced by
+ * opstats_serialize.  The buffer is only valid until the callback returns.
+ */
+int proto_kvlds_request_stats(struct wire_requestqueue *,
+    int (*)(void *, int, const uint8_t *, size_t), void *);
+
 /* Packet types. */
 #define PROTO_KVLDS_PARAMS	0x00000100
+#define PROTO_KVLDS_STATS	0x00000101
 #define PROTO_KVLDS_SET		0x00000110
 #define PROTO_KVLDS_CAS		0x00000111
 #define PROTO_KVLDS_ADD		0x00000112
 #define PROTO_KVLDS_MODIFY	0x00000113
+#define PROTO_KVLDS_MSET	0x00000114
 #define PROTO_KVLDS_DELETE	0x00000120
 #define PROTO_KVLDS_CAD		0x00000121
 #define PROTO_KVLDS_GET		0x00000130
 #define PROTO_KVLDS_RANGE	0x00000131
+#define PROTO_KVLDS_MGET	0x00000132
 #define PROTO_KVLDS_NONE	(uint32_t)(-1)
 
+/* Maximum number of keys in an MGET or key-value pairs in an MSET. */
+#define PROTO_KVLDS_MMAX	1024
+
+/* Counter IDs included in STATS responses. */
+#define PROTO_KVLDS_CTR_PAGES_CLEANED	0x00000001
+#define PROTO_KVLDS_CTR_PAGES_MODIFIED	0x00000002
+#define PROTO_KVLDS_CTR_PAGES_APPENDED	0x00000003
+#define PROTO_KVLDS_CTR_BYTES_APPENDED	0x00000004
+#define PROTO_KVLDS_CTR_BYTES_USER	0x00000005
+#define PROTO_KVLDS_CTR_PAGES_STORAGE	0x00000006
+#define PROTO_KVLDS_CTR_PAGES_GARBAGE	0x00000007
+#define PROTO_KVLDS_CTR_CLEANS_CAPPED	0x00000008
+#define PROTO_KVLDS_CTR_CLEANS_DEFERRED	0x00000009
+#define PROTO_KVLDS_CTR_TICKS_IDLE	0x0000000a
+#define PROTO_KVLDS_CTR_SEGS_FREED	0x0000000b
+#define PROTO_KVLDS_CTR_SEGS_CLEANED	0x0000000c
+#define PROTO_KVLDS_CTR_ARENA_ALLOCS	0x0000000d
+#define PROTO_KVLDS_CTR_ARENA_MALLOCS	0x0000000e
+#define PROTO_KVLDS_CTR_NMR_LIMIT	0x0000000f
+#define PROTO_KVLDS_CTR_NMR_GROWS	0x00000010
+#define PROTO_KVLDS_CTR_NMR_SHRINKS	0x00000011
+#define PROTO_KVLDS_CTR_MUX_CACHE_HITS	0x00000012
+#define PROTO_KVLDS_CTR_MUX_CACHE_MISSES	0x00000013
+#define PROTO_KVLDS_CTR_MUX_CACHE_ENTRIES	0x00000014
+
 /* KVLDS request structure. */
 struct proto_kvlds_request {
 	uint64_t ID;
@@ -153,6 +221,12 @@ struct proto_kvlds_request {
 #define range_end value
 	const struct kvldskey * oval;
 	uint8_t blob[4 + 3 * 256];
+
+	/* MGET and MSET requests. */
+	size_t nkeys;
+	const struct kvldskey ** keys;
+	const struct kvldskey ** values;
+	uint8_t * mblob;
 };
 
 /**
@@ -187,9 +261,9 @@ int proto_kvlds_response_params(struct netbuf_write *, uint64_t, uint32_t,
 
 /**
  * proto_kvlds_response_status(Q, ID, status):
- * Send a SET/CAS/ADD/MODIFY/DELETE/CAD response with ID ${ID} and status
- * ${status} to the write queue ${Q} indicating that the request has been
- * completed with the specified status.
+ * Send a SET/CAS/ADD/MODIFY/DELETE/CAD/MSET response with ID ${ID} and
+ * status ${status} to the write queue ${Q} indicating that the request has
+ * been completed with the specified status.
  */
 int proto_kvlds_response_status(struct netbuf_write *, uint64_t, uint32_t);
 
@@ -206,6 +280,14 @@ int proto_kvlds_response_status(struct netbuf_write *, uint64_t, uint32_t);
 #define proto_kvlds_response_cad(Q, ID, status)	\
 	proto_kvlds_response_status(Q, ID, status)
 
+/**
+ * proto_kvlds_response_stats(Q, ID, buf, buflen):
+ * Send a STATS response with ID ${ID} containing the ${buflen}-byte
+ * serialized request latency statistics ${buf} to the write queue ${Q}.
+ */
+int proto_kvlds_response_stats(struct netbuf_write *, uint64_t,
+    const uint8_t *, size_t);
+
 /**
  * proto_kvlds_response_get(Q, ID, status, value):
  * Send a GET response with ID ${ID}, status ${status}, and value ${value}
@@ -215,6 +297,18 @@ int proto_kvlds_response_status(struct netbuf_write *, uint64_t, uint32_t);
 int proto_kvlds_response_get(struct netbuf_write *, uint64_t, uint32_t,
     const struct kvldskey *);
 
+/**
+ * proto_kvlds_response_mget(Q, ID, nkeys, values):
+ * Send an MGET response with ID ${ID} and the ${nkeys} values ${values[0]}
+ * ... ${values[nkeys - 1]}, each of which is NULL if the corresponding key
+ * is not associated with any data, to the write queue ${Q}.
+ */
+int proto_kvlds_response_mget(struct netbuf_write *, uint64_t, size_t,
+    struct kvldskey **);
+
+#define proto_kvlds_response_mset(Q, ID)		\
+	proto_kvlds_response_status(Q, ID, 0)
+
 /**
  * proto_kvlds_response_range(Q, ID, nkeys, next, keys, values):
  * Send a RANGE response with ID ${ID}, next key ${next} and ${nkeys}
@@ -14,9 +14,11 @@
 #include "proto_kvlds.h"
 
 static int callback_params(void *, uint8_t *, size_t);
+static int callback_stats(void *, uint8_t *, size_t);
 static int callback_done(void *, uint8_t *, size_t);
 static int callback_donep(void *, uint8_t *, size_t);
 static int callback_get(void *, uint8_t *, size_t);
+static int callback_mget(void *, uint8_t *, size_t);
 static int callback_range(void *, uint8_t *, size_t);
 static int callback_range2(void *, int, size_t, struct kvldskey *,
     struct kvldskey **, struct kvldskey **);
@@ -27,6 +29,11 @@ struct params_cookie {
 	void * cookie;
 };
 
+struct stats_cookie {
+	int (* callback)(void *, int, const uint8_t *, size_t);
+	void * cookie;
+};
+
 struct done_cookie {
 	int (* callback)(void *, int);
 	void * cookie;
@@ -44,6 +51,12 @@ struct get_cookie {
 	void * cookie;
 };
 
+struct mget_cookie {
+	int (* callback)(void *, int, struct kvldskey **);
+	void * cookie;
+	size_t nkeys;
+};
+
 struct range_cookie {
 	int (* callback)(void *, int, size_t, struct kvldskey *,
 	    struct kvldskey **, struct kvldskey **);
@@ -108,6 +121,38 @@ failed:
 	return (rc);
 }
 
+/* Process a STATS response. */
+static int
+callback_stats(void * cookie, uint8_t * buf, size_t buflen)
+{
+	struct stats_cookie * C = cookie;
+	int failed = 1;
+	int rc;
+
+	/* If we have a packet, parse it. */
+	if (buf != NULL) {
+		/* Is the status code sane? */
+		if (buflen < 4)
+			BAD("STATS", "bogus length");
+		if (be32dec(&buf[0]) != 0)
+			BAD("STATS", "bogus status code");
+
+		/* We successfully parsed this response. */
+		failed = 0;
+	}
+
+failed:
+	/* Invoke the upstream callback. */
+	rc = (C->callback)(C->cookie, failed,
+	    failed ? NULL : &buf[4], failed ? 0 : buflen - 4);
+
+	/* Free the cookie. */
+	free(C);
+
+	/* Return status from callback. */
+	return (rc);
+}
+
 /* Process a success response. */
 static int
 callback_done(void * cookie, uint8_t * buf, size_t buflen)
@@ -223,6 +268,86 @@ failed:
 	return (rc);
 }
 
+/* Process an MGET response. */
+static int
+callback_mget(void * cookie, uint8_t * buf, size_t buflen)
+{
+	struct mget_cookie * C = cookie;
+	int failed = 1;
+	size_t bufpos = 0;
+	struct kvldskey ** values = NULL;
+	size_t vlen;
+	size_t i;
+	int rc;
+
+	/* If we have a packet, parse it. */
+	if (buf != NULL) {
+		/* Is the status code sane? */
+		if (buflen - bufpos < 4)
+			BAD("MGET", "bogus length");
+		if (be32dec(&buf[bufpos]) != 0)
+			BAD("MGET", "bogus status code");
+		bufpos += 4;
+
+		/* We should get back as many values as we asked for. */
+		if (buflen - bufpos < 4)
+			BAD("MGET", "bogus length");
+		if (be32dec(&buf[bufpos]) != C->nkeys)
+			BAD("MGET", "wrong number of values");
+		bufpos += 4;
+
+		/* Allocate buffer for values. */
+		if (IMALLOC(values, C->nkeys, struct kvldskey *))
+			goto failed;
+		for (i = 0; i < C->nkeys; i++)
+			values[i] = NULL;
+
+		/* Parse values. */
+		for (i = 0; i < C->nkeys; i++) {
+			/* Is there a value? */
+			if (buflen - bufpos < 1)
+				BAD("MGET", "bogus length");
+			if (buf[bufpos] > 1)
+				BAD("MGET", "bogus value status");
+			if (buf[bufpos++] == 1)
+				continue;
+
+			/* Parse the value. */
+			if ((vlen = kvldskey_unserialize(&values[i],
+			    &buf[bufpos], buflen - bufpos)) == 0) {
+				warnp("Error parsing MGET response value");
+				goto failed;
+			}
+			bufpos += vlen;
+		}
+
+		/* Make sure we reached the end of the packet. */
+		if (buflen != bufpos)
+			BAD("MGET", "wrong length");
+
+		/* We successfully parsed this response. */
+		failed = 0;
+	}
+
+failed:
+	/* If we failed, clean up. */
+	if (failed && (values != NULL)) {
+		for (i = 0; i < C->nkeys; i++)
+			kvldskey_free(values[i]);
+		free(values);
+		values = NULL;
+	}
+
+	/* Invoke the upstream callback. */
+	rc = (C->callback)(C->cookie, failed, values);
+
+	/* Free the cookie. */
+	free(C);
+
+	/* Return status from callback. */
+	return (rc);
+}
+
 /* Process a RANGE response. */
 static int
 callback_range(void * cookie, uint8_t * buf, size_t buflen)
@@ -422,6 +547,50 @@ err0:
 	return (-1);
 }
 
+/**
+ * proto_kvlds_request_stats(Q, callback, cookie):
+ * Send a STATS request to get request latency statistics via the request
+ * queue ${Q}.  Invoke
+ *     ${callback}(${cookie}, failed, buf, buflen)
+ * upon request completion, where failed is 0 on success and 1 on failure,
+ * and buf is a ${buflen}-byte buffer in the format produced by
+ * opstats_serialize.  The buffer is only valid until the callback returns.
+ */
+int
+proto_kvlds_request_stats(struct wire_requestqueue * Q,
+    int (* callback)(void *, int, const uint8_t *, size_t), void * cookie)
+{
+	struct stats_cookie * C;
+	uint8_t * buf;
+
+	/* Bake a cookie. */
+	if ((C = malloc(sizeof(struct stats_cookie))) == NULL)
+		goto err0;
+	C->callback = callback;
+	C->cookie = cookie;
+
+	/* Start writing a request. */
+	if ((buf = wire_requestqueue_add_getbuf(Q, 4,
+	    callback_stats, C)) == NULL)
+		goto err1;
+
+	/* Construct request. */
+	be32enc(&buf[0], PROTO_KVLDS_STATS);
+
+	/* Finish writing request. */
+	if (wire_requestqueue_add_done(Q, buf, 4))
+		goto err1;
+
+	/* Success! */
+	return (0);
+
+err1:
+	free(C);
+err0:
+	/* Failure! */
+	return (-1);
+}
+
 /**
  * proto_kvlds_request_set(Q, key, value, callback, cookie):
  * Send a SET request to associate the value ${value} with the key ${key} via
@@ -827,6 +996,145 @@ err0:
 	return (-1);
 }
 
+/**
+ * proto_kvlds_request_mget(Q, nkeys, keys, callback, cookie):
+ * Send an MGET request to read the values associated with the ${nkeys} keys
+ * ${keys[0]} ... ${keys[nkeys - 1]} via the request queue ${Q}, where
+ * ${nkeys} is at least 1 and at most PROTO_KVLDS_MMAX.  Invoke
+ *     ${callback}(${cookie}, failed, values)
+ * upon request completion, where failed is 0 on success and 1 on failure,
+ * and values[i] is the value associated with the key ${keys[i]} or NULL if
+ * no value is associated.  The callback is responsible for freeing the
+ * array and its members.
+ */
+int
+proto_kvlds_request_mget(struct wire_requestqueue * Q, size_t nkeys,
+    const struct kvldskey * const * keys,
+    int (* callback)(void *, int, struct kvldskey **), void * cookie)
+{
+	struct mget_cookie * C;
+	uint8_t * buf;
+	size_t buflen;
+	size_t bufpos;
+	size_t i;
+
+	/* Sanity-check: The server won't accept too many keys. */
+	assert((nkeys > 0) && (nkeys <= PROTO_KVLDS_MMAX));
+
+	/* Bake a cookie. */
+	if ((C = malloc(sizeof(struct mget_cookie))) == NULL)
+		goto err0;
+	C->callback = callback;
+	C->cookie = cookie;
+	C->nkeys = nkeys;
+
+	/* Compute request size. */
+	buflen = 8;
+	for (i = 0; i < nkeys; i++)
+		buflen += kvldskey_serial_size(keys[i]);
+
+	/* Start writing a request. */
+	if ((buf = wire_requestqueue_add_getbuf(Q, buflen,
+	    callback_mget, C)) == NULL)
+		goto err1;
+
+	/* Construct request. */
+	be32enc(&buf[0], PROTO_KVLDS_MGET);
+	be32enc(&buf[4], nkeys);
+	bufpos = 8;
+	for (i = 0; i < nkeys; i++) {
+		kvldskey_serialize(keys[i], &buf[bufpos]);
+		bufpos += kvldskey_serial_size(keys[i]);
+	}
+
+	/* Sanity-check. */
+	assert(bufpos == buflen);
+
+	/* Finish writing request. */
+	if (wire_requestqueue_add_done(Q, buf, buflen))
+		goto err1;
+
+	/* Success! */
+	return (0);
+
+err1:
+	free(C);
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/**
+ * proto_kvlds_request_mset(Q, nkeys, keys, values, callback, cookie):
+ * Send an MSET request to associate the value ${values[i]} with the key
+ * ${keys[i]} for each i < ${nkeys} via the request queue ${Q}, where
+ * ${nkeys} is at least 1 and at most PROTO_KVLDS_MMAX.  The pairs are
+ * stored atomically, and in order if a key appears more than once.  Invoke
+ *     ${callback}(${cookie}, failed)
+ * upon request completion, where failed is 0 on success and 1 on failure.
+ */
+int
+proto_kvlds_request_mset(struct wire_requestqueue * Q, size_t nkeys,
+    const struct kvldskey * const * keys,
+    const struct kvldskey * const * values,
+    int (* callback)(void *, int), void * cookie)
+{
+	struct done_cookie * C;
+	uint8_t * buf;
+	size_t buflen;
+	size_t bufpos;
+	size_t i;
+
+	/* Sanity-check: The server won't accept too many pairs. */
+	assert((nkeys > 0) && (nkeys <= PROTO_KVLDS_MMAX));
+
+	/* Bake a cookie. */
+	if ((C = mpool_done_malloc()) == NULL)
+		goto err0;
+	C->callback = callback;
+	C->cookie = cookie;
+	C->type = "MSET";
+
+	/* Compute request size. */
+	buflen = 8;
+	for (i = 0; i < nkeys; i++) {
+		buflen += kvldskey_serial_size(keys[i]);
+		buflen += kvldskey_serial_size(values[i]);
+	}
+
+	/* Start writing a request. */
+	if ((buf = wire_requestqueue_add_getbuf(Q, buflen,
+	    callback_done, C)) == NULL)
+		goto err1;
+
+	/* Construct request. */
+	be32enc(&buf[0], PROTO_KVLDS_MSET);
+	be32enc(&buf[4], nkeys);
+	bufpos = 8;
+	for (i = 0; i < nkeys; i++) {
+		kvldskey_serialize(keys[i], &buf[bufpos]);
+		bufpos += kvldskey_serial_size(keys[i]);
+		kvldskey_serialize(values[i], &buf[bufpos]);
+		bufpos += kvldskey_serial_size(values[i]);
+	}
+
+	/* Sanity-check. */
+	assert(bufpos == buflen);
+
+	/* Finish writing request. */
+	if (wire_requestqueue_add_done(Q, buf, buflen))
+		goto err1;
+
+	/* Success! */
+	return (0);
+
+err1:
+	mpool_done_free(C);
+err0:
+	/* Failure! */
+	return (-1);
+}
+
 /**
  * proto_kvlds_request_range(Q, start, end, max, callback, cookie):
  * Send a RANGE request to list key-value pairs which are >= ${start} and
@@ -4,6 +4,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "imalloc.h"
 #include "kvldskey.h"
 #include "mpool.h"
 #include "sysendian.h"
@@ -14,6 +15,9 @@
 
 MPOOL(request, struct proto_kvlds_request, 4096);
 
+static int proto_kvlds_request_parse_multi(const struct wire_packet *,
+    struct proto_kvlds_request *);
+
 /**
  * proto_kvlds_request_parse(P, R):
  * Parse the packet ${P} into the KVLDS request structure ${R}.
@@ -29,10 +33,22 @@ proto_kvlds_request_parse(const struct wire_packet * P,
 
 	/* Initialize keys to NULL. */
 	R->key = R->oval = R->value = NULL;
+	R->nkeys = 0;
+	R->keys = R->values = NULL;
+	R->mblob = NULL;
 
 	/* Sanity-check packet length. */
 	if (P->len < 4)
 		goto err0;
+
+	/* MGET and MSET requests don't fit into the request structure. */
+	switch (be32dec(&P->buf[0])) {
+	case PROTO_KVLDS_MGET:
+	case PROTO_KVLDS_MSET:
+		return (proto_kvlds_request_parse_multi(P, R));
+	}
+
+	/* Sanity-check packet length. */
 	if (P->len > sizeof(R->blob))
 		goto err0;
 
@@ -56,6 +72,7 @@ proto_kvlds_request_parse(const struct wire_packet * P,
 	/* Parse packet. */
 	switch (R->type) {
 	case PROTO_KVLDS_PARAMS:
+	case PROTO_KVLDS_STATS:
 		/* Nothing to parse. */
 		break;
 	case PROTO_KVLDS_DELETE:
@@ -124,6 +141,76 @@ err0:
 	return (-1);
 }
 
+/**
+ * proto_kvlds_request_parse_multi(P, R):
+ * Parse the MGET or MSET packet ${P} into the KVLDS request structure ${R}.
+ */
+static int
+proto_kvlds_request_parse_multi(const struct wire_packet * P,
+    struct proto_kvlds_request * R)
+{
+	size_t bufpos;
+	size_t i;
+
+	/* Copy the packet data. */
+	if ((R->mblob = malloc(P->len)) == NULL)
+		goto err0;
+	memcpy(R->mblob, P->buf, P->len);
+
+	/* Figure out request type. */
+	R->type = be32dec(&R->mblob[0]);
+	bufpos = 4;
+
+	/* Parse and sanity-check the number of keys. */
+	if (P->len - bufpos < 4) {
+		errno = 0;
+		goto err1;
+	}
+	R->nkeys = be32dec(&R->mblob[bufpos]);
+	bufpos += 4;
+	if ((R->nkeys == 0) || (R->nkeys > PROTO_KVLDS_MMAX)) {
+		errno = 0;
+		goto err1;
+	}
+
+	/* Allocate arrays of keys and (for MSET) values. */
+	if (IMALLOC(R->keys, R->nkeys, const struct kvldskey *))
+		goto err1;
+	if ((R->type == PROTO_KVLDS_MSET) &&
+	    IMALLOC(R->values, R->nkeys, const struct kvldskey *))
+		goto err2;
+
+	/* Parse keys and values. */
+	for (i = 0; i < R->nkeys; i++) {
+		GRABKEY(R->keys[i], R->mblob, P->len, bufpos, err3);
+		if (R->type == PROTO_KVLDS_MSET)
+			GRABKEY(R->values[i], R->mblob, P->len, bufpos, err3);
+	}
+
+	/* Did we reach the end of the packet? */
+	if (bufpos != P->len) {
+		errno = 0;
+		goto err3;
+	}
+
+	/* Success! */
+	return (0);
+
+err3:
+	free(R->values);
+	R->values = NULL;
+err2:
+	free(R->keys);
+	R->keys = NULL;
+err1:
+	warnp("Error parsing request packet of type 0x%08" PRIx32, R->type);
+	free(R->mblob);
+	R->mblob = NULL;
+err0:
+	/* Failure! */
+	return (-1);
+}
+
 /**
  * proto_kvlds_request_alloc():
  * Allocate a struct proto_kvlds_request.
@@ -131,8 +218,20 @@ err0:
 struct proto_kvlds_request *
 proto_kvlds_request_alloc(void)
 {
+	struct proto_kvlds_request * R;
+
+	/* Allocate a request with no MGET or MSET data. */
+	if ((R = mpool_request_malloc()) == NULL)
+		goto err0;
+	R->keys = R->values = NULL;
+	R->mblob = NULL;
 
-	return (mpool_request_malloc());
+	/* Success! */
+	return (R);
+
+err0:
+	/* Failure! */
+	return (NULL);
 }
 
 /**
@@ -185,6 +284,12 @@ void
 proto_kvlds_request_free(struct proto_kvlds_request * req)
 {
 
+	/* Free MGET or MSET data, if any. */
+	free(req->values);
+	free(req->keys);
+	free(req->mblob);
+
+	/* Free the request structure. */
 	mpool_request_free(req);
 }
 
@@ -222,9 +327,9 @@ err0:
 
 /**
  * proto_kvlds_response_status(Q, ID, status):
- * Send a SET/CAS/ADD/MODIFY/DELETE/CAD response with ID ${ID} and status
- * ${status} to the write queue ${Q} indicating that the request has been
- * completed with the specified status.
+ * Send a SET/CAS/ADD/MODIFY/DELETE/CAD/MSET response with ID ${ID} and
+ * status ${status} to the write queue ${Q} indicating that the request has
+ * been completed with the specified status.
  */
 int
 proto_kvlds_response_status(struct netbuf_write * Q, uint64_t ID,
@@ -251,6 +356,37 @@ err0:
 	return (-1);
 }
 
+/**
+ * proto_kvlds_response_stats(Q, ID, buf, buflen):
+ * Send a STATS response with ID ${ID} containing the ${buflen}-byte
+ * serialized request latency statistics ${buf} to the write queue ${Q}.
+ */
+int
+proto_kvlds_response_stats(struct netbuf_write * Q, uint64_t ID,
+    const uint8_t * buf, size_t buflen)
+{
+	uint8_t * wbuf;
+
+	/* Get a packet data buffer. */
+	if ((wbuf = wire_writepacket_getbuf(Q, ID, 4 + buflen)) == NULL)
+		goto err0;
+
+	/* Write the packet data. */
+	be32enc(&wbuf[0], 0);
+	memcpy(&wbuf[4], buf, buflen);
+
+	/* Finish the packet. */
+	if (wire_writepacket_done(Q, wbuf, 4 + buflen))
+		goto err0;
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
 /**
  * proto_kvlds_response_get(Q, ID, status, value):
  * Send a GET response with ID ${ID}, status ${status}, and value ${value}
@@ -290,6 +426,61 @@ err0:
 	return (-1);
 }
 
+/**
+ * proto_kvlds_response_mget(Q, ID, nkeys, values):
+ * Send an MGET response with ID ${ID} and the ${nkeys} values ${values[0]}
+ * ... ${values[nkeys - 1]}, each of which is NULL if the corresponding key
+ * is not associated with any data, to the write queue ${Q}.
+ */
+int
+proto_kvlds_response_mget(struct netbuf_write * Q, uint64_t ID,
+    size_t nkeys, struct kvldskey ** values)
+{
+	uint8_t * wbuf;
+	size_t len;
+	size_t i;
+	size_t bufpos;
+
+	/* Sanity check: We can't return more than 2^32-1 values. */
+	assert(nkeys <= UINT32_MAX);
+
+	/* Figure out how long the packet will be. */
+	len = 8 + nkeys;
+	for (i = 0; i < nkeys; i++) {
+		if (values[i] != NULL)
+			len += kvldskey_serial_size(values[i]);
+	}
+
+	/* Get a packet data buffer. */
+	if ((wbuf = wire_writepacket_getbuf(Q, ID, len)) == NULL)
+		goto err0;
+
+	/* Write the packet data. */
+	be32enc(&wbuf[0], 0);
+	be32enc(&wbuf[4], nkeys);
+	bufpos = 8;
+	for (i = 0; i < nkeys; i++) {
+		if (values[i] != NULL) {
+			wbuf[bufpos++] = 0;
+			kvldskey_serialize(values[i], &wbuf[bufpos]);
+			bufpos += kvldskey_serial_size(values[i]);
+		} else {
+			wbuf[bufpos++] = 1;
+		}
+	}
+
+	/* Finish the packet. */
+	if (wire_writepacket_done(Q, wbuf, len))
+		goto err0;
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
 /**
  * proto_kvlds_response_range(Q, ID, nkeys, next, keys, values):
  * Send a RANGE response with ID ${ID}, next key ${next} and ${nkeys}
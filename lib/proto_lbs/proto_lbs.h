@@ -56,6 +56,17 @@ int proto_lbs_request_append_blks(struct wire_requestqueue *,
     uint32_t, uint64_t, size_t, const uint8_t * const *,
     int (* callback)(void *, int, int, uint64_t), void *);
 
+/**
+ * proto_lbs_request_append_stream(Q, nblks, blkno, blklen, bufv, stream,
+ *     callback, cookie):
+ * As proto_lbs_request_append_blks, but send an APPEND2 request which tags
+ * the blocks as belonging to the append stream ${stream}, which should be
+ * one of the PROTO_LBS_STREAM_* values.
+ */
+int proto_lbs_request_append_stream(struct wire_requestqueue *,
+    uint32_t, uint64_t, size_t, const uint8_t * const *, uint32_t,
+    int (* callback)(void *, int, int, uint64_t), void *);
+
 /**
  * proto_lbs_request_append(Q, nblks, blkno, blklen, buf, callback, cookie):
  * Send an APPEND request to write ${nblks} ${blklen}-byte blocks, starting
@@ -80,14 +91,50 @@ int proto_lbs_request_append(struct wire_requestqueue *,
 int proto_lbs_request_free(struct wire_requestqueue *, uint64_t,
     int (*)(void *, int), void *);
 
+/**
+ * proto_lbs_request_free_range(Q, blkno, nblks, callback, cookie):
+ * Send a FREERANGE request to free the ${nblks} blocks starting at block
+ * ${blkno} to the request queue ${Q}.  Invoke
+ *     ${callback}(${cookie}, failed)
+ * upon request completion, where failed is 0 on success and 1 on failure.
+ */
+int proto_lbs_request_free_range(struct wire_requestqueue *, uint64_t,
+    uint64_t, int (*)(void *, int), void *);
+
+/**
+ * proto_lbs_request_stats(Q, callback, cookie):
+ * Send a STATS request via the request queue ${Q}.  Invoke
+ *     ${callback}(${cookie}, failed, buf, buflen)
+ * upon request completion, where failed is 0 on success and 1 on failure,
+ * and buf is a ${buflen}-byte buffer of request latency statistics in the
+ * format produced by opstats_serialize.  The buffer is only valid until the
+ * callback returns.
+ */
+int proto_lbs_request_stats(struct wire_requestqueue *,
+    int (*)(void *, int, const uint8_t *, size_t), void *);
+
 /* Packet types. */
 #define PROTO_LBS_PARAMS	0
 #define PROTO_LBS_PARAMS2	4
 #define PROTO_LBS_GET		1
 #define PROTO_LBS_APPEND	2
 #define PROTO_LBS_FREE		3
+#define PROTO_LBS_STATS		5
+#define PROTO_LBS_FREE_RANGE	6
+#define PROTO_LBS_APPEND2	7
 #define PROTO_LBS_NONE		((uint32_t)(-1))
 
+/* Append streams. */
+#define PROTO_LBS_STREAM_USER		0	/* Data being modified. */
+#define PROTO_LBS_STREAM_CLEANER	1	/* Data being cleaned. */
+#define PROTO_LBS_NSTREAMS		2
+
+/* Counter IDs included in STATS responses. */
+#define PROTO_LBS_CTR_BLKS_USER		0x00000001
+#define PROTO_LBS_CTR_BLKS_CLEANER	0x00000002
+#define PROTO_LBS_CTR_RING_HITS		0x00000003
+#define PROTO_LBS_CTR_RING_MISSES	0x00000004
+
 /* LBS request structure. */
 struct proto_lbs_request {
 	uint64_t ID;
@@ -109,11 +156,16 @@ struct proto_lbs_request {
 			uint32_t nblks;		/* # of blocks to write. */
 			uint32_t blklen;	/* Block length. */
 			uint64_t blkno;		/* First block # to write. */
+			uint32_t stream;	/* Append stream. */
 			uint8_t * buf;		/* Data to write. */
 		} append;
 		struct proto_lbs_request_free {
 			uint64_t blkno;		/* First block # to keep. */
 		} free;
+		struct proto_lbs_request_free_range {
+			uint64_t blkno;		/* First block # to free. */
+			uint64_t nblks;		/* # of blocks to free. */
+		} free_range;
 	} r;
 };
 
@@ -165,4 +217,19 @@ int proto_lbs_response_append(struct netbuf_write *, uint64_t,
  */
 int proto_lbs_response_free(struct netbuf_write *, uint64_t);
 
+/**
+ * proto_lbs_response_free_range(Q, ID):
+ * Send a FREERANGE response with ID ${ID} to the write queue ${Q}.
+ */
+#define proto_lbs_response_free_range(Q, ID)	\
+	proto_lbs_response_free(Q, ID)
+
+/**
+ * proto_lbs_response_stats(Q, ID, buf, buflen):
+ * Send a STATS response with ID ${ID} to the write queue ${Q} containing the
+ * ${buflen}-byte serialized request latency statistics ${buf}.
+ */
+int proto_lbs_response_stats(struct netbuf_write *, uint64_t,
+    const uint8_t *, size_t);
+
 #endif /* !_PROTO_LBS_H_ */
@@ -14,6 +14,7 @@ static int callback_params2(void *, uint8_t *, size_t);
 static int callback_get(void *, uint8_t *, size_t);
 static int callback_append(void *, uint8_t *, size_t);
 static int callback_free(void *, uint8_t *, size_t);
+static int callback_stats(void *, uint8_t *, size_t);
 
 struct params_cookie {
 	int (* callback)(void *, int, size_t, uint64_t);
@@ -41,6 +42,11 @@ struct free_cookie {
 	void * cookie;
 };
 
+struct stats_cookie {
+	int (* callback)(void *, int, const uint8_t *, size_t);
+	void * cookie;
+};
+
 /* Macro for simplifying response-parsing errors. */
 #define BAD(rtype, ftype)	do {				\
 	warn0("Received %s response with %s", rtype, ftype);	\
@@ -285,25 +291,16 @@ failed:
 	return (rc);
 }
 
-/**
- * proto_lbs_request_append_blks(Q, nblks, blkno, blklen, bufv,
- *     callback, cookie):
- * Send an APPEND request to write ${nblks} ${blklen}-byte blocks, starting
- * at position ${blkno}, with data from ${bufv[0]} ... ${bufv[nblks - 1]} to
- * the request queue ${Q}.  Invoke
- *    ${callback}(${cookie}, failed, status, blkno)
- * upon request completion, where failed is 0 on success and 1 on failure,
- * status is 0 if the append completed and 1 otherwise, and blkno is the
- * next available block number.
- */
-int
-proto_lbs_request_append_blks(struct wire_requestqueue * Q,
+/* Send an APPEND or APPEND2 request. */
+static int
+request_append(struct wire_requestqueue * Q, uint32_t type,
     uint32_t nblks, uint64_t blkno, size_t blklen,
-    const uint8_t * const * bufv,
+    const uint8_t * const * bufv, uint32_t stream,
     int (* callback)(void *, int, int, uint64_t), void * cookie)
 {
 	struct append_cookie * C;
-	size_t len = 16 + nblks * blklen;
+	size_t hlen = (type == PROTO_LBS_APPEND2) ? 20 : 16;
+	size_t len = hlen + nblks * blklen;
 	uint8_t * buf;
 	size_t i;
 
@@ -319,11 +316,13 @@ proto_lbs_request_append_blks(struct wire_requestqueue * Q,
 		goto err1;
 
 	/* Construct request. */
-	be32enc(&buf[0], PROTO_LBS_APPEND);
+	be32enc(&buf[0], type);
 	be32enc(&buf[4], nblks);
 	be64enc(&buf[8], blkno);
+	if (type == PROTO_LBS_APPEND2)
+		be32enc(&buf[16], stream);
 	for (i = 0; i < nblks; i++)
-		memcpy(&buf[16 + i * blklen], bufv[i], blklen);
+		memcpy(&buf[hlen + i * blklen], bufv[i], blklen);
 
 	/* Finish writing request. */
 	if (wire_requestqueue_add_done(Q, buf, len))
@@ -339,6 +338,48 @@ err0:
 	return (-1);
 }
 
+/**
+ * proto_lbs_request_append_blks(Q, nblks, blkno, blklen, bufv,
+ *     callback, cookie):
+ * Send an APPEND request to write ${nblks} ${blklen}-byte blocks, starting
+ * at position ${blkno}, with data from ${bufv[0]} ... ${bufv[nblks - 1]} to
+ * the request queue ${Q}.  Invoke
+ *    ${callback}(${cookie}, failed, status, blkno)
+ * upon request completion, where failed is 0 on success and 1 on failure,
+ * status is 0 if the append completed and 1 otherwise, and blkno is the
+ * next available block number.
+ */
+int
+proto_lbs_request_append_blks(struct wire_requestqueue * Q,
+    uint32_t nblks, uint64_t blkno, size_t blklen,
+    const uint8_t * const * bufv,
+    int (* callback)(void *, int, int, uint64_t), void * cookie)
+{
+
+	/* Send an untagged APPEND request. */
+	return (request_append(Q, PROTO_LBS_APPEND, nblks, blkno, blklen,
+	    bufv, PROTO_LBS_STREAM_USER, callback, cookie));
+}
+
+/**
+ * proto_lbs_request_append_stream(Q, nblks, blkno, blklen, bufv, stream,
+ *     callback, cookie):
+ * As proto_lbs_request_append_blks, but send an APPEND2 request which tags
+ * the blocks as belonging to the append stream ${stream}, which should be
+ * one of the PROTO_LBS_STREAM_* values.
+ */
+int
+proto_lbs_request_append_stream(struct wire_requestqueue * Q,
+    uint32_t nblks, uint64_t blkno, size_t blklen,
+    const uint8_t * const * bufv, uint32_t stream,
+    int (* callback)(void *, int, int, uint64_t), void * cookie)
+{
+
+	/* Send an APPEND2 request. */
+	return (request_append(Q, PROTO_LBS_APPEND2, nblks, blkno, blklen,
+	    bufv, stream, callback, cookie));
+}
+
 /**
  * proto_lbs_request_append(Q, nblks, blkno, blklen, buf, callback, cookie):
  * Send an APPEND request to write ${nblks} ${blklen}-byte blocks, starting
@@ -470,7 +511,51 @@ err0:
 	return (-1);
 }
 
-/* FREE response-handling callback. */
+/**
+ * proto_lbs_request_free_range(Q, blkno, nblks, callback, cookie):
+ * Send a FREERANGE request to free the ${nblks} blocks starting at block
+ * ${blkno} to the request queue ${Q}.  Invoke
+ *     ${callback}(${cookie}, failed)
+ * upon request completion, where failed is 0 on success and 1 on failure.
+ */
+int
+proto_lbs_request_free_range(struct wire_requestqueue * Q, uint64_t blkno,
+    uint64_t nblks, int (* callback)(void *, int), void * cookie)
+{
+	struct free_cookie * C;
+	uint8_t * buf;
+
+	/* Bake a cookie. */
+	if ((C = malloc(sizeof(struct free_cookie))) == NULL)
+		goto err0;
+	C->callback = callback;
+	C->cookie = cookie;
+
+	/* Start writing a request. */
+	if ((buf = wire_requestqueue_add_getbuf(Q, 20,
+	    callback_free, C)) == NULL)
+		goto err1;
+
+	/* Construct request. */
+	be32enc(&buf[0], PROTO_LBS_FREE_RANGE);
+	be64enc(&buf[4], blkno);
+	be64enc(&buf[12], nblks);
+
+	/* Finish writing request. */
+	if (wire_requestqueue_add_done(Q, buf, 20))
+		goto err1;
+
+	/* Success! */
+	return (0);
+
+err1:
+	free(C);
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* FREE and FREERANGE response-handling callback. */
 static int
 callback_free(void * cookie, uint8_t * buf, size_t buflen)
 {
@@ -500,3 +585,74 @@ failed:
 	/* Return status from callback. */
 	return (rc);
 }
+
+/**
+ * proto_lbs_request_stats(Q, callback, cookie):
+ * Send a STATS request via the request queue ${Q}.  Invoke
+ *     ${callback}(${cookie}, failed, buf, buflen)
+ * upon request completion, where failed is 0 on success and 1 on failure,
+ * and buf is a ${buflen}-byte buffer of request latency statistics in the
+ * format produced by opstats_serialize.  The buffer is only valid until the
+ * callback returns.
+ */
+int
+proto_lbs_request_stats(struct wire_requestqueue * Q,
+    int (* callback)(void *, int, const uint8_t *, size_t), void * cookie)
+{
+	struct stats_cookie * C;
+	uint8_t buf[4];
+
+	/* Bake a cookie. */
+	if ((C = malloc(sizeof(struct stats_cookie))) == NULL)
+		goto err0;
+	C->callback = callback;
+	C->cookie = cookie;
+
+	/* Construct request. */
+	be32enc(&buf[0], PROTO_LBS_STATS);
+
+	/* Send request. */
+	if (wire_requestqueue_add(Q, buf, 4, callback_stats, C))
+		goto err1;
+
+	/* Success! */
+	return (0);
+
+err1:
+	free(C);
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* STATS response-handling callback. */
+static int
+callback_stats(void * cookie, uint8_t * buf, size_t buflen)
+{
+	struct stats_cookie * C = cookie;
+	int failed = 1;
+	int rc;
+
+	/* If we have a packet, parse it. */
+	if (buf != NULL) {
+		/* Do we have a sane status code? */
+		if (buflen < 4)
+			BAD("STATS", "bogus length");
+		if (be32dec(&buf[0]) != 0)
+			BAD("STATS", "bogus status code");
+
+		/* We successfully parsed this response. */
+		failed = 0;
+	}
+
+failed:
+	/* Invoke the upstream callback. */
+	rc = (C->callback)(C->cookie, failed,
+	    failed ? NULL : &buf[4], failed ? 0 : buflen - 4);
+
+	/* Free the cookie. */
+	free(C);
+
+	/* Return status from callback. */
+	return (rc);
+}
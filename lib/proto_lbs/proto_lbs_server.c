@@ -14,6 +14,7 @@ static int
 proto_lbs_request_parse(const struct wire_packet * P,
     struct proto_lbs_request * R)
 {
+	size_t hlen;
 
 	/* Store request ID. */
 	R->ID = P->ID;
@@ -29,6 +30,7 @@ proto_lbs_request_parse(const struct wire_packet * P,
 	switch (R->type) {
 	case PROTO_LBS_PARAMS:
 	case PROTO_LBS_PARAMS2:
+	case PROTO_LBS_STATS:
 		if (P->len != 4)
 			goto err0;
 		/* Nothing to parse. */
@@ -39,24 +41,39 @@ proto_lbs_request_parse(const struct wire_packet * P,
 		R->r.get.blkno = be64dec(&P->buf[4]);
 		break;
 	case PROTO_LBS_APPEND:
-		if (P->len < 16)
+	case PROTO_LBS_APPEND2:
+		/* APPEND2 has a stream number after the block number. */
+		hlen = (R->type == PROTO_LBS_APPEND2) ? 20 : 16;
+		if (P->len < hlen)
 			goto err0;
 		R->r.append.nblks = be32dec(&P->buf[4]);
 		R->r.append.blkno = be64dec(&P->buf[8]);
+		if (R->type == PROTO_LBS_APPEND2)
+			R->r.append.stream = be32dec(&P->buf[16]);
+		else
+			R->r.append.stream = PROTO_LBS_STREAM_USER;
 		if (R->r.append.nblks == 0)
 			goto err0;
-		if ((P->len - 16) % R->r.append.nblks)
+		if (R->r.append.stream >= PROTO_LBS_NSTREAMS)
 			goto err0;
-		R->r.append.blklen = (P->len - 16) / R->r.append.nblks;
-		if ((R->r.append.buf = malloc(P->len - 16)) == NULL)
+		if ((P->len - hlen) % R->r.append.nblks)
 			goto err0;
-		memcpy(R->r.append.buf, &P->buf[16], P->len - 16);
+		R->r.append.blklen = (P->len - hlen) / R->r.append.nblks;
+		if ((R->r.append.buf = malloc(P->len - hlen)) == NULL)
+			goto err0;
+		memcpy(R->r.append.buf, &P->buf[hlen], P->len - hlen);
 		break;
 	case PROTO_LBS_FREE:
 		if (P->len != 12)
 			goto err0;
 		R->r.free.blkno = be64dec(&P->buf[4]);
 		break;
+	case PROTO_LBS_FREE_RANGE:
+		if (P->len != 20)
+			goto err0;
+		R->r.free_range.blkno = be64dec(&P->buf[4]);
+		R->r.free_range.nblks = be64dec(&P->buf[12]);
+		break;
 	default:
 		goto err0;
 	}
@@ -274,3 +291,34 @@ err0:
 	/* Failure! */
 	return (-1);
 }
+
+/**
+ * proto_lbs_response_stats(Q, ID, buf, buflen):
+ * Send a STATS response with ID ${ID} to the write queue ${Q} containing the
+ * ${buflen}-byte serialized request latency statistics ${buf}.
+ */
+int
+proto_lbs_response_stats(struct netbuf_write * Q, uint64_t ID,
+    const uint8_t * buf, size_t buflen)
+{
+	uint8_t * wbuf;
+
+	/* Get a packet data buffer. */
+	if ((wbuf = wire_writepacket_getbuf(Q, ID, 4 + buflen)) == NULL)
+		goto err0;
+
+	/* Write the packet data. */
+	be32enc(&wbuf[0], 0);
+	memcpy(&wbuf[4], buf, buflen);
+
+	/* Finish the packet. */
+	if (wire_writepacket_done(Q, wbuf, 4 + buflen))
+		goto err0;
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
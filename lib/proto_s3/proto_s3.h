@@ -11,6 +11,9 @@ struct wire_requestqueue;
 /* Maximum size of S3 objects accessed via this interface. */
 #define PROTO_S3_MAXLEN 0x80000000
 
+/* Minimum part size for MPUT requests (an S3 limit). */
+#define PROTO_S3_MINPART 0x00500000
+
 /**
  * proto_s3_request_put(Q, bucket, object, buflen, buf, callback, cookie):
  * Send a PUT request to store ${buflen} bytes from ${buf} to the object
@@ -21,6 +24,17 @@ struct wire_requestqueue;
 int proto_s3_request_put(struct wire_requestqueue *, const char *,
     const char *, size_t, const uint8_t *, int (*)(void *, int), void *);
 
+/**
+ * proto_s3_request_mput(Q, bucket, object, partlen, buflen, buf, callback,
+ *     cookie):
+ * Behave as proto_s3_request_put, but ask for the object to be uploaded to
+ * S3 in parts of ${partlen} bytes which are sent in parallel.  If the object
+ * fits into a single part, it is stored with an ordinary PUT.
+ */
+int proto_s3_request_mput(struct wire_requestqueue *, const char *,
+    const char *, size_t, size_t, const uint8_t *, int (*)(void *, int),
+    void *);
+
 /**
  * proto_s3_request_get(Q, bucket, object, maxlen, callback, cookie):
  * Send a GET request to read up to ${maxlen} bytes from the object ${object}
@@ -71,12 +85,26 @@ int proto_s3_request_head(struct wire_requestqueue *, const char *,
 int proto_s3_request_delete(struct wire_requestqueue *, const char *,
     const char *, int (*)(void *, int), void *);
 
+/**
+ * proto_s3_request_stats(Q, callback, cookie):
+ * Send a STATS request via the request queue ${Q}.  Invoke
+ *     ${callback}(${cookie}, failed, buf, buflen)
+ * upon request completion, where ${failed} is 0 on success or 1 on failure,
+ * and ${buf} is a ${buflen}-byte buffer of request latency statistics in the
+ * format produced by opstats_serialize.  The buffer is only valid until the
+ * callback returns.
+ */
+int proto_s3_request_stats(struct wire_requestqueue *,
+    int (*)(void *, int, const uint8_t *, size_t), void *);
+
 /* Packet types. */
 #define PROTO_S3_PUT		0x00010000
+#define PROTO_S3_MPUT		0x00010001
 #define PROTO_S3_GET		0x00010010
 #define PROTO_S3_RANGE		0x00010011
 #define PROTO_S3_HEAD		0x00010020
 #define PROTO_S3_DELETE		0x00010030
+#define PROTO_S3_STATS		0x00010040
 #define PROTO_S3_NONE		((uint32_t)(-1))
 
 /* S3 request structure. */
@@ -87,6 +115,7 @@ struct proto_s3_request {
 	char * object;
 	union proto_s3_request_data {
 		struct proto_s3_request_put {
+			uint32_t partlen;	/* Part length (MPUT only). */
 			uint32_t len;		/* Object length. */
 			uint8_t * buf;		/* Object data. */
 		} put;
@@ -105,6 +134,10 @@ struct proto_s3_request {
 			/* No parameters; dummy to avoid compiler warnings. */
 			int dummy;		/* Dummy variable. */
 		} delete;
+		struct proto_s3_request_stats {
+			/* No parameters; dummy to avoid compiler warnings. */
+			int dummy;		/* Dummy variable. */
+		} stats;
 	} r;
 };
 
@@ -150,5 +183,7 @@ int proto_s3_response_data(struct netbuf_write *, uint64_t, int,
 	proto_s3_response_data(Q, ID, status, len, buf)
 #define proto_s3_response_head(Q, ID, status, len)		\
 	proto_s3_response_data(Q, ID, status, len, NULL)
+#define proto_s3_response_stats(Q, ID, len, buf)		\
+	proto_s3_response_data(Q, ID, 200, len, buf)
 
 #endif /* !_PROTO_S3_H_ */
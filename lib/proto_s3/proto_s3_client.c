@@ -13,6 +13,7 @@ static int callback_get(void *, uint8_t *, size_t);
 static int callback_range(void *, uint8_t *, size_t);
 static int callback_head(void *, uint8_t *, size_t);
 static int callback_delete(void *, uint8_t *, size_t);
+static int callback_stats(void *, uint8_t *, size_t);
 
 struct put_cookie {
 	int (* callback)(void *, int);
@@ -34,22 +35,21 @@ struct delete_cookie {
 	void * cookie;
 };
 
+struct stats_cookie {
+	int (* callback)(void *, int, const uint8_t *, size_t);
+	void * cookie;
+};
+
 /* Macro for simplifying response-parsing errors. */
 #define BAD(rtype, ftype)	do {				\
 	warn0("Received %s response with %s", rtype, ftype);	\
 	goto failed;						\
 } while (0)
 
-/**
- * proto_s3_request_put(Q, bucket, object, buflen, buf, callback, cookie):
- * Send a PUT request to store ${buflen} bytes from ${buf} to the object
- * ${object} in the S3 bucket ${bucket} via the request queue ${Q}.  Invoke
- *     ${callback}(${cookie}, failed)
- * upon request completion, where ${failed} is 0 on success and 1 on failure.
- */
-int
-proto_s3_request_put(struct wire_requestqueue * Q, const char * bucket,
-    const char * object, size_t buflen, const uint8_t * buf,
+/* Send a PUT or MPUT request. */
+static int
+request_put(struct wire_requestqueue * Q, uint32_t type, const char * bucket,
+    const char * object, size_t partlen, size_t buflen, const uint8_t * buf,
     int (* callback)(void *, int), void * cookie)
 {
 	struct put_cookie * C;
@@ -76,6 +76,8 @@ proto_s3_request_put(struct wire_requestqueue * Q, const char * bucket,
 
 	/* Compute request packet size. */
 	rlen = 6 + strlen(bucket) + strlen(object) + 4 + buflen;
+	if (type == PROTO_S3_MPUT)
+		rlen += 4;
 
 	/* Start writing a request. */
 	if ((p = rbuf =
@@ -83,7 +85,7 @@ proto_s3_request_put(struct wire_requestqueue * Q, const char * bucket,
 		goto err1;
 
 	/* Construct request. */
-	be32enc(p, PROTO_S3_PUT);
+	be32enc(p, type);
 	p += 4;
 	*p++ = (uint8_t)strlen(bucket);
 	memcpy(p, bucket, strlen(bucket));
@@ -91,6 +93,10 @@ proto_s3_request_put(struct wire_requestqueue * Q, const char * bucket,
 	*p++ = (uint8_t)strlen(object);
 	memcpy(p, object, strlen(object));
 	p += strlen(object);
+	if (type == PROTO_S3_MPUT) {
+		be32enc(p, partlen);
+		p += 4;
+	}
 	be32enc(p, buflen);
 	p += 4;
 	memcpy(p, buf, buflen);
@@ -109,6 +115,46 @@ err0:
 	return (-1);
 }
 
+/**
+ * proto_s3_request_put(Q, bucket, object, buflen, buf, callback, cookie):
+ * Send a PUT request to store ${buflen} bytes from ${buf} to the object
+ * ${object} in the S3 bucket ${bucket} via the request queue ${Q}.  Invoke
+ *     ${callback}(${cookie}, failed)
+ * upon request completion, where ${failed} is 0 on success and 1 on failure.
+ */
+int
+proto_s3_request_put(struct wire_requestqueue * Q, const char * bucket,
+    const char * object, size_t buflen, const uint8_t * buf,
+    int (* callback)(void *, int), void * cookie)
+{
+
+	return (request_put(Q, PROTO_S3_PUT, bucket, object, 0, buflen, buf,
+	    callback, cookie));
+}
+
+/**
+ * proto_s3_request_mput(Q, bucket, object, partlen, buflen, buf, callback,
+ *     cookie):
+ * Behave as proto_s3_request_put, but ask for the object to be uploaded to
+ * S3 in parts of ${partlen} bytes which are sent in parallel.  If the object
+ * fits into a single part, it is stored with an ordinary PUT.
+ */
+int
+proto_s3_request_mput(struct wire_requestqueue * Q, const char * bucket,
+    const char * object, size_t partlen, size_t buflen, const uint8_t * buf,
+    int (* callback)(void *, int), void * cookie)
+{
+
+	/* Validate partlen. */
+	if ((partlen < PROTO_S3_MINPART) || (partlen >= PROTO_S3_MAXLEN)) {
+		warn0("MPUT part length is invalid");
+		return (-1);
+	}
+
+	return (request_put(Q, PROTO_S3_MPUT, bucket, object, partlen,
+	    buflen, buf, callback, cookie));
+}
+
 /* PUT response-handling callback. */
 static int
 callback_put(void * cookie, uint8_t * buf, size_t buflen)
@@ -584,3 +630,82 @@ failed:
 	/* Return status from callback. */
 	return (rc);
 }
+
+/**
+ * proto_s3_request_stats(Q, callback, cookie):
+ * Send a STATS request via the request queue ${Q}.  Invoke
+ *     ${callback}(${cookie}, failed, buf, buflen)
+ * upon request completion, where ${failed} is 0 on success or 1 on failure,
+ * and ${buf} is a ${buflen}-byte buffer of request latency statistics in the
+ * format produced by opstats_serialize.  The buffer is only valid until the
+ * callback returns.
+ */
+int
+proto_s3_request_stats(struct wire_requestqueue * Q,
+    int (* callback)(void *, int, const uint8_t *, size_t), void * cookie)
+{
+	struct stats_cookie * C;
+	uint8_t buf[6];
+
+	/* Bake a cookie. */
+	if ((C = malloc(sizeof(struct stats_cookie))) == NULL)
+		goto err0;
+	C->callback = callback;
+	C->cookie = cookie;
+
+	/* Construct request; the bucket and object names are empty. */
+	be32enc(&buf[0], PROTO_S3_STATS);
+	buf[4] = 0;
+	buf[5] = 0;
+
+	/* Send request. */
+	if (wire_requestqueue_add(Q, buf, 6, callback_stats, C))
+		goto err1;
+
+	/* Success! */
+	return (0);
+
+err1:
+	free(C);
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* STATS response-handling callback. */
+static int
+callback_stats(void * cookie, uint8_t * buf, size_t buflen)
+{
+	struct stats_cookie * C = cookie;
+	int failed = 1;
+	uint32_t len = 0;
+	int rc;
+
+	/* If we have a packet, parse it. */
+	if (buf != NULL) {
+		/* Do we have the right packet length? */
+		if (buflen < 8)
+			BAD("STATS", "bogus length");
+
+		/* Parse the packet. */
+		if (be32dec(&buf[0]) != 200)
+			BAD("STATS", "bogus status code");
+		len = be32dec(&buf[4]);
+		if (buflen != 8 + (size_t)len)
+			BAD("STATS", "bogus length");
+
+		/* We successfully parsed this response. */
+		failed = 0;
+	}
+
+failed:
+	/* Invoke the upstream callback. */
+	rc = (C->callback)(C->cookie, failed,
+	    failed ? NULL : &buf[8], failed ? 0 : len);
+
+	/* Free the cookie. */
+	free(C);
+
+	/* Return status from callback. */
+	return (rc);
+}
@@ -63,7 +63,10 @@ proto_s3_request_parse(const struct wire_packet * P,
 	R->type = be32dec(&P->buf[pos]);
 	pos += 4;
 
-	/* Extract bucket name (appears in every request type). */
+	/*
+	 * Extract bucket name (appears in every request type; STATS requests
+	 * carry empty bucket and object names).
+	 */
 	if ((R->bucket = mkstr(P->buf, P->len, &pos)) == NULL)
 		goto err0;
 
@@ -74,6 +77,14 @@ proto_s3_request_parse(const struct wire_packet * P,
 	/* Parse request-type-specific fields. */
 	switch (R->type) {
 	case PROTO_S3_PUT:
+	case PROTO_S3_MPUT:
+		R->r.put.partlen = 0;
+		if (R->type == PROTO_S3_MPUT) {
+			if (P->len < pos + 4)
+				goto err2;
+			R->r.put.partlen = be32dec(&P->buf[pos]);
+			pos += 4;
+		}
 		if (P->len < pos + 4)
 			goto err2;
 		R->r.put.len = be32dec(&P->buf[pos]);
@@ -97,6 +108,7 @@ proto_s3_request_parse(const struct wire_packet * P,
 		break;
 	case PROTO_S3_HEAD:
 	case PROTO_S3_DELETE:
+	case PROTO_S3_STATS:
 		if (P->len != pos)
 			goto err2;
 		break;
@@ -165,8 +177,8 @@ void
 proto_s3_request_free(struct proto_s3_request * req)
 {
 
-	/* If this is a PUT, free the malloced data buffer. */
-	if (req->type == PROTO_S3_PUT)
+	/* If this is a PUT or MPUT, free the malloced data buffer. */
+	if ((req->type == PROTO_S3_PUT) || (req->type == PROTO_S3_MPUT))
 		free(req->r.put.buf);
 
 	/* Free the object and bucket names. */
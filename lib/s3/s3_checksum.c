@@ -0,0 +1,100 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "b64encode.h"
+#include "crc32c.h"
+#include "http.h"
+#include "sysendian.h"
+
+#include "s3_verifyetag.h"
+
+#include "s3_checksum.h"
+
+/*
+ * Our CRC32C code starts from the CRC of a single implicit 1 bit and does
+ * not invert its output; S3 uses the standard CRC-32C, which starts from a
+ * state of all 1 bits and inverts the final state.  Feeding these 4 bytes
+ * in first takes our CRC32C code to the all-1s starting state.
+ */
+static const uint8_t crc32c_prefix[4] = {0x2c, 0x5f, 0xe9, 0xe6};
+
+/* Compute the standard CRC-32C of ${buf} as a big-endian value. */
+static void
+crc32c(const uint8_t * buf, size_t len, uint8_t cbuf[4])
+{
+	CRC32C_CTX ctx;
+	uint8_t state[4];
+
+	/* Compute the CRC, starting from a state of all 1 bits. */
+	CRC32C_Init(&ctx);
+	CRC32C_Update(&ctx, crc32c_prefix, 4);
+	CRC32C_Update(&ctx, buf, len);
+	CRC32C_Final(state, &ctx);
+
+	/* Invert the state; S3 sends the CRC in big-endian order. */
+	be32enc(cbuf, ~le32dec(state));
+}
+
+/**
+ * s3_checksum_crc32c(buf, len, b64):
+ * Compute the CRC32C of the ${len} bytes in ${buf}, and write it to ${b64}
+ * as a NUL-terminated string in the base-64 form used by S3 for the value of
+ * the x-amz-checksum-crc32c header.
+ */
+void
+s3_checksum_crc32c(const uint8_t * buf, size_t len, char b64[9])
+{
+	uint8_t cbuf[4];
+
+	/* Compute the CRC and encode it. */
+	crc32c(buf, len, cbuf);
+	b64encode(cbuf, b64, 4);
+}
+
+/**
+ * s3_checksum_verify(res):
+ * Check if the HTTP response ${res} contains a checksum which matches its
+ * data.  If it has an x-amz-checksum-crc32c header holding the CRC32C of
+ * the whole object, check that; otherwise, fall back to checking the MD5
+ * hash in the ETag header via s3_verifyetag.  Return 1 if the checksum
+ * matches, or 0 if not (including if there is no usable checksum).
+ */
+int
+s3_checksum_verify(struct http_response * res)
+{
+	const char * hdr;
+	uint8_t hdrcrc[6];
+	uint8_t datacrc[4];
+	size_t len;
+
+	/* Look for an x-amz-checksum-crc32c header. */
+	hdr = http_findheader(res->headers, res->nheaders,
+	    "x-amz-checksum-crc32c");
+
+	/* If there is no header, fall back to the ETag. */
+	if (hdr == NULL)
+		return (s3_verifyetag(res));
+
+	/* Skip any leading whitespace. */
+	while ((hdr[0] == ' ') || (hdr[0] == '\t'))
+		hdr++;
+
+	/*
+	 * It should be the 8 base-64 characters of a 4-byte CRC.  Objects
+	 * uploaded in multiple parts may instead have a "composite" checksum
+	 * (a CRC of the parts' CRCs, followed by "-<number of parts>") which
+	 * we can't check against the data; fall back to the ETag for those.
+	 */
+	if ((strlen(hdr) != 8) || b64decode(hdr, 8, hdrcrc, &len) ||
+	    (len != 4))
+		return (s3_verifyetag(res));
+
+	/* Compute the CRC of the HTTP response body. */
+	crc32c(res->body, res->bodylen, datacrc);
+
+	/* Check if the CRC matches the header. */
+	if (memcmp(hdrcrc, datacrc, 4))
+		return (0);
+	else
+		return (1);
+}
@@ -0,0 +1,28 @@
+#ifndef _S3_CHECKSUM_H_
+#define _S3_CHECKSUM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Opaque types. */
+struct http_response;
+
+/**
+ * s3_checksum_crc32c(buf, len, b64):
+ * Compute the CRC32C of the ${len} bytes in ${buf}, and write it to ${b64}
+ * as a NUL-terminated string in the base-64 form used by S3 for the value of
+ * the x-amz-checksum-crc32c header.
+ */
+void s3_checksum_crc32c(const uint8_t *, size_t, char[9]);
+
+/**
+ * s3_checksum_verify(res):
+ * Check if the HTTP response ${res} contains a checksum which matches its
+ * data.  If it has an x-amz-checksum-crc32c header holding the CRC32C of
+ * the whole object, check that; otherwise, fall back to checking the MD5
+ * hash in the ETag header via s3_verifyetag.  Return 1 if the checksum
+ * matches, or 0 if not (including if there is no usable checksum).
+ */
+int s3_checksum_verify(struct http_response *);
+
+#endif /* !_S3_CHECKSUM_H_ */
@@ -0,0 +1,506 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "asprintf.h"
+#include "http.h"
+#include "s3_checksum.h"
+#include "s3_request.h"
+#include "s3_request_queue.h"
+
+#include "s3_multipart.h"
+
+/* Maximum length of the responses to initiate and complete requests. */
+#define MAXRLEN	65536
+
+/* A single part of the upload. */
+struct part {
+	struct s3_multipart * M;	/* Upload we belong to. */
+	struct s3_request req;		/* UploadPart request. */
+	char * path;			/* "/foo?partNumber=N&uploadId=X". */
+	char * etag;			/* ETag returned by S3, or NULL. */
+	struct http_header hdr;		/* x-amz-checksum-crc32c header. */
+	char crc32c[9];			/* CRC32C of the part. */
+};
+
+/* Multipart upload state. */
+struct s3_multipart {
+	/* Upload parameters. */
+	struct s3_request_queue * Q;
+	const char * bucket;
+	const char * path;
+	size_t buflen;
+	const uint8_t * buf;
+	size_t partlen;
+	int (* callback)(void *, int);
+	void * cookie;
+
+	/* Initiate, complete, or abort request in progress. */
+	struct s3_request req;
+	char * reqpath;
+	char * xml;			/* CompleteMultipartUpload body. */
+	struct http_header hdrs[2];	/* Checksum headers. */
+	char crc32c[9];			/* CRC32C of the whole object. */
+
+	/* Internal state. */
+	char * uploadid;		/* URI-encoded upload ID. */
+	struct part * parts;
+	size_t nparts;
+	size_t nleft;			/* Parts which have not completed. */
+	int status;			/* 200 until a request fails. */
+};
+
+static int callback_initiate(void *, struct http_response *);
+static int callback_part(void *, struct http_response *);
+static int complete(struct s3_multipart *);
+static int callback_complete(void *, struct http_response *);
+static int callback_abort(void *, struct http_response *);
+
+/* An empty request body, for POSTs which have no content. */
+static const uint8_t nobody[1];
+
+/*
+ * S3 computes the CRC32C of the whole object from the CRC32Cs of the parts,
+ * and returns it when the object is read back.
+ */
+static const char * const crc32c_type = "FULL_OBJECT";
+
+/* Find the string ${s} in the ${buflen}-byte buffer ${buf}. */
+static const uint8_t *
+findstr(const uint8_t * buf, size_t buflen, const char * s)
+{
+	size_t slen = strlen(s);
+	size_t i;
+
+	/* Check each possible position. */
+	for (i = 0; i + slen <= buflen; i++) {
+		if (memcmp(&buf[i], s, slen) == 0)
+			return (&buf[i]);
+	}
+
+	/* Not found. */
+	return (NULL);
+}
+
+/*
+ * Extract the upload ID from the InitiateMultipartUploadResult body of the
+ * HTTP response ${res}, URI-encoded for use in a query string.
+ */
+static char *
+getuploadid(struct http_response * res)
+{
+	const uint8_t * s;
+	const uint8_t * e;
+	char * id;
+	size_t i, k;
+
+	/* Look for the <UploadId> element. */
+	if ((res->body == NULL) || (res->bodylen == (size_t)(-1)))
+		goto err0;
+	if ((s = findstr(res->body, res->bodylen, "<UploadId>")) == NULL)
+		goto err0;
+	s += strlen("<UploadId>");
+	if ((e = findstr(s, res->bodylen - (size_t)(s - res->body),
+	    "</UploadId>")) == NULL)
+		goto err0;
+	if (e == s)
+		goto err0;
+
+	/* Allocate space for the worst case of every byte being escaped. */
+	if ((id = malloc((size_t)(e - s) * 3 + 1)) == NULL)
+		goto err0;
+
+	/* Copy unreserved characters and percent-encode anything else. */
+	for (i = k = 0; &s[i] < e; i++) {
+		if ((s[i] >= 'A' && s[i] <= 'Z') ||
+		    (s[i] >= 'a' && s[i] <= 'z') ||
+		    (s[i] >= '0' && s[i] <= '9') ||
+		    (s[i] == '-') || (s[i] == '.') ||
+		    (s[i] == '_') || (s[i] == '~')) {
+			id[k++] = (char)s[i];
+		} else {
+			sprintf(&id[k], "%%%02X", s[i]);
+			k += 3;
+		}
+	}
+	id[k] = '\0';
+
+	/* Success! */
+	return (id);
+
+err0:
+	/* Failure! */
+	return (NULL);
+}
+
+/* Free the upload state ${M}. */
+static void
+multipart_free(struct s3_multipart * M)
+{
+	size_t i;
+
+	/* Free the parts. */
+	for (i = 0; (M->parts != NULL) && (i < M->nparts); i++) {
+		free(M->parts[i].path);
+		free(M->parts[i].etag);
+	}
+	free(M->parts);
+
+	/* Free other allocations. */
+	free(M->uploadid);
+	free(M->xml);
+	free(M->reqpath);
+	free(M);
+}
+
+/* The upload is finished; tell our caller and clean up. */
+static int
+done(struct s3_multipart * M)
+{
+	int rc;
+
+	/* Invoke the upstream callback. */
+	rc = (M->callback)(M->cookie, M->status);
+
+	/* Free our state. */
+	multipart_free(M);
+
+	/* Return status from callback. */
+	return (rc);
+}
+
+/*
+ * Queue the request in ${M->req}, with ${M->reqpath} as its path and the
+ * first ${nheaders} headers in ${M->hdrs}.
+ */
+static int
+sendreq(struct s3_multipart * M, const char * method, size_t nheaders,
+    const uint8_t * body, size_t bodylen,
+    int (* callback)(void *, struct http_response *))
+{
+
+	/* Fill in the request. */
+	M->req.method = method;
+	M->req.bucket = M->bucket;
+	M->req.path = M->reqpath;
+	M->req.nheaders = nheaders;
+	M->req.headers = (nheaders > 0) ? M->hdrs : NULL;
+	M->req.bodylen = bodylen;
+	M->req.body = body;
+	M->req.resbuf = NULL;
+
+	/* Send it. */
+	return (s3_request_queue(M->Q, &M->req, MAXRLEN, callback, M));
+}
+
+/* Abort the upload after a failure. */
+static int
+abortupload(struct s3_multipart * M)
+{
+
+	/* Sanity-check. */
+	assert(M->status != 200);
+
+	/* Construct the path for an AbortMultipartUpload request. */
+	free(M->reqpath);
+	if (asprintf(&M->reqpath, "%s?uploadId=%s",
+	    M->path, M->uploadid) == -1) {
+		M->reqpath = NULL;
+		goto err0;
+	}
+
+	/* Send the request. */
+	if (sendreq(M, "DELETE", 0, NULL, 0, callback_abort))
+		goto err0;
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/**
+ * s3_multipart_put(Q, bucket, path, buflen, buf, partlen, callback, cookie):
+ * Using the S3 request queue ${Q}, store the ${buflen} bytes in ${buf} as the
+ * object ${path} (of the form "/foo") in the S3 bucket ${bucket} via a
+ * multipart upload with parts of ${partlen} bytes (the last part may be
+ * shorter), which must be at least S3_MULTIPART_MINPART.  All of the parts
+ * are queued at once, so they are uploaded concurrently over as many
+ * connections as the queue may use.  The parts are sent with their CRC32Cs,
+ * and the object is stored with the CRC32C of its whole contents.  Invoke
+ *     ${callback}(${cookie}, status)
+ * when done, where ${status} is 200 on success or the HTTP status of the
+ * request which failed (or 0) otherwise; an upload which fails after it has
+ * started is aborted.  The strings ${bucket} and ${path} and the buffer
+ * ${buf} must remain valid until the callback is performed or the upload is
+ * cancelled.
+ */
+struct s3_multipart *
+s3_multipart_put(struct s3_request_queue * Q, const char * bucket,
+    const char * path, size_t buflen, const uint8_t * buf, size_t partlen,
+    int (* callback)(void *, int), void * cookie)
+{
+	struct s3_multipart * M;
+
+	/* Sanity-check. */
+	assert(partlen >= S3_MULTIPART_MINPART);
+	assert(buflen > 0);
+
+	/* Allocate a structure and initialize. */
+	if ((M = malloc(sizeof(struct s3_multipart))) == NULL)
+		goto err0;
+	M->Q = Q;
+	M->bucket = bucket;
+	M->path = path;
+	M->buflen = buflen;
+	M->buf = buf;
+	M->partlen = partlen;
+	M->callback = callback;
+	M->cookie = cookie;
+	M->xml = NULL;
+	M->uploadid = NULL;
+	M->parts = NULL;
+	M->nparts = (buflen - 1) / partlen + 1;
+	M->nleft = 0;
+	M->status = 200;
+
+	/*
+	 * Start by sending a CreateMultipartUpload request, asking S3 to
+	 * check each part against its CRC32C and to store the CRC32C of the
+	 * whole object, so that the object can be checked when it is read.
+	 */
+	if (asprintf(&M->reqpath, "%s?uploads", path) == -1)
+		goto err1;
+	M->hdrs[0].header = "x-amz-checksum-algorithm";
+	M->hdrs[0].value = "CRC32C";
+	M->hdrs[1].header = "x-amz-checksum-type";
+	M->hdrs[1].value = crc32c_type;
+	if (sendreq(M, "POST", 2, nobody, 0, callback_initiate))
+		goto err2;
+
+	/* Success! */
+	return (M);
+
+err2:
+	free(M->reqpath);
+err1:
+	free(M);
+err0:
+	/* Failure! */
+	return (NULL);
+}
+
+/* We have a response to our CreateMultipartUpload request. */
+static int
+callback_initiate(void * cookie, struct http_response * res)
+{
+	struct s3_multipart * M = cookie;
+	struct part * P;
+	size_t i;
+
+	/* If we failed or didn't get an upload ID, we're done. */
+	if ((res->status != 200) ||
+	    ((M->uploadid = getuploadid(res)) == NULL)) {
+		M->status = (res->status != 200) ? res->status : 0;
+		free(res->body);
+		return (done(M));
+	}
+	free(res->body);
+
+	/* Allocate and launch parts. */
+	if ((M->parts = calloc(M->nparts, sizeof(struct part))) == NULL)
+		goto err0;
+	for (i = 0; i < M->nparts; i++) {
+		P = &M->parts[i];
+		P->M = M;
+		if (asprintf(&P->path, "%s?partNumber=%zu&uploadId=%s",
+		    M->path, i + 1, M->uploadid) == -1) {
+			P->path = NULL;
+			goto err0;
+		}
+		P->req.method = "PUT";
+		P->req.bucket = M->bucket;
+		P->req.path = P->path;
+		P->req.body = &M->buf[i * M->partlen];
+		if (i + 1 < M->nparts)
+			P->req.bodylen = M->partlen;
+		else
+			P->req.bodylen = M->buflen - i * M->partlen;
+		P->req.resbuf = NULL;
+
+		/* Send the CRC32C of the part for S3 to check. */
+		s3_checksum_crc32c(P->req.body, P->req.bodylen, P->crc32c);
+		P->hdr.header = "x-amz-checksum-crc32c";
+		P->hdr.value = P->crc32c;
+		P->req.nheaders = 1;
+		P->req.headers = &P->hdr;
+		if (s3_request_queue(M->Q, &P->req, 0, callback_part, P))
+			goto err0;
+		M->nleft += 1;
+	}
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* A part has been uploaded (or failed). */
+static int
+callback_part(void * cookie, struct http_response * res)
+{
+	struct part * P = cookie;
+	struct s3_multipart * M = P->M;
+	const char * etag;
+
+	/* Record the ETag, or that the upload has failed. */
+	if (res->status != 200) {
+		if (M->status == 200)
+			M->status = res->status;
+	} else if ((etag = http_findheader(res->headers, res->nheaders,
+	    "ETag")) == NULL) {
+		if (M->status == 200)
+			M->status = 0;
+	} else {
+		/* Skip any leading whitespace. */
+		while ((etag[0] == ' ') || (etag[0] == '\t'))
+			etag++;
+		if ((P->etag = strdup(etag)) == NULL)
+			goto err0;
+	}
+	free(res->body);
+
+	/* Wait until every part has completed. */
+	if (--M->nleft > 0)
+		return (0);
+
+	/* Abort the upload if any part failed. */
+	if (M->status != 200)
+		return (abortupload(M));
+
+	/* Otherwise, send a CompleteMultipartUpload request. */
+	return (complete(M));
+
+err0:
+	free(res->body);
+
+	/* Failure! */
+	return (-1);
+}
+
+/* All the parts are uploaded; send a CompleteMultipartUpload request. */
+static int
+complete(struct s3_multipart * M)
+{
+	size_t xmllen;
+	size_t i;
+	char * p;
+
+	/* Figure out how long the request body will be. */
+	xmllen = strlen("<CompleteMultipartUpload>") +
+	    strlen("</CompleteMultipartUpload>") + 1;
+	for (i = 0; i < M->nparts; i++) {
+		xmllen += strlen("<Part><PartNumber></PartNumber><ETag></ETag>"
+		    "<ChecksumCRC32C></ChecksumCRC32C></Part>") +
+		    sizeof(size_t) * 3 + strlen(M->parts[i].etag) +
+		    strlen(M->parts[i].crc32c);
+	}
+
+	/* Construct the request body. */
+	if ((p = M->xml = malloc(xmllen)) == NULL)
+		goto err0;
+	p += sprintf(p, "<CompleteMultipartUpload>");
+	for (i = 0; i < M->nparts; i++) {
+		p += sprintf(p, "<Part><PartNumber>%zu</PartNumber>"
+		    "<ETag>%s</ETag><ChecksumCRC32C>%s</ChecksumCRC32C></Part>",
+		    i + 1, M->parts[i].etag, M->parts[i].crc32c);
+	}
+	p += sprintf(p, "</CompleteMultipartUpload>");
+
+	/* Construct the path. */
+	free(M->reqpath);
+	if (asprintf(&M->reqpath, "%s?uploadId=%s",
+	    M->path, M->uploadid) == -1) {
+		M->reqpath = NULL;
+		goto err0;
+	}
+
+	/*
+	 * Send the CRC32C of the whole object, so that S3 can check that the
+	 * parts it has assembled match the data we were asked to store.
+	 */
+	s3_checksum_crc32c(M->buf, M->buflen, M->crc32c);
+	M->hdrs[0].header = "x-amz-checksum-crc32c";
+	M->hdrs[0].value = M->crc32c;
+	M->hdrs[1].header = "x-amz-checksum-type";
+	M->hdrs[1].value = crc32c_type;
+
+	/* Send the request. */
+	if (sendreq(M, "POST", 2, (const uint8_t *)M->xml,
+	    (size_t)(p - M->xml), callback_complete))
+		goto err0;
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* We have a response to our CompleteMultipartUpload request. */
+static int
+callback_complete(void * cookie, struct http_response * res)
+{
+	struct s3_multipart * M = cookie;
+
+	/*
+	 * S3 can report a failure with a 200 status and an error in the
+	 * response body, so check that we have a result.
+	 */
+	if (res->status != 200)
+		M->status = res->status;
+	else if ((res->body == NULL) || (res->bodylen == (size_t)(-1)) ||
+	    (findstr(res->body, res->bodylen,
+	    "<CompleteMultipartUploadResult") == NULL))
+		M->status = 0;
+	free(res->body);
+
+	/* If the upload failed, abort it; otherwise we're done. */
+	if (M->status != 200)
+		return (abortupload(M));
+	return (done(M));
+}
+
+/* We have a response to our AbortMultipartUpload request. */
+static int
+callback_abort(void * cookie, struct http_response * res)
+{
+	struct s3_multipart * M = cookie;
+
+	/* We don't care whether the abort succeeded. */
+	free(res->body);
+
+	/* Report the original failure. */
+	return (done(M));
+}
+
+/**
+ * s3_multipart_cancel(M):
+ * Free the state of the multipart upload ${M} without performing its
+ * callback.  This must only be called after the S3 request queue used by
+ * the upload has been flushed, since queued requests refer to the state.
+ */
+void
+s3_multipart_cancel(struct s3_multipart * M)
+{
+
+	/* Just free our state. */
+	multipart_free(M);
+}
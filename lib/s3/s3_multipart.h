@@ -0,0 +1,42 @@
+#ifndef _S3_MULTIPART_H_
+#define _S3_MULTIPART_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Opaque types. */
+struct s3_multipart;
+struct s3_request_queue;
+
+/* Minimum size of any part except the last, imposed by S3. */
+#define S3_MULTIPART_MINPART	(5 * 1024 * 1024)
+
+/**
+ * s3_multipart_put(Q, bucket, path, buflen, buf, partlen, callback, cookie):
+ * Using the S3 request queue ${Q}, store the ${buflen} bytes in ${buf} as the
+ * object ${path} (of the form "/foo") in the S3 bucket ${bucket} via a
+ * multipart upload with parts of ${partlen} bytes (the last part may be
+ * shorter), which must be at least S3_MULTIPART_MINPART.  All of the parts
+ * are queued at once, so they are uploaded concurrently over as many
+ * connections as the queue may use.  The parts are sent with their CRC32Cs,
+ * and the object is stored with the CRC32C of its whole contents.  Invoke
+ *     ${callback}(${cookie}, status)
+ * when done, where ${status} is 200 on success or the HTTP status of the
+ * request which failed (or 0) otherwise; an upload which fails after it has
+ * started is aborted.  The strings ${bucket} and ${path} and the buffer
+ * ${buf} must remain valid until the callback is performed or the upload is
+ * cancelled.
+ */
+struct s3_multipart * s3_multipart_put(struct s3_request_queue *,
+    const char *, const char *, size_t, const uint8_t *, size_t,
+    int (*)(void *, int), void *);
+
+/**
+ * s3_multipart_cancel(M):
+ * Free the state of the multipart upload ${M} without performing its
+ * callback.  This must only be called after the S3 request queue used by
+ * the upload has been flushed, since queued requests refer to the state.
+ */
+void s3_multipart_cancel(struct s3_multipart *);
+
+#endif /* !_S3_MULTIPART_H_ */
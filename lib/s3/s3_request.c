@@ -3,21 +3,26 @@
 #include <string.h>
 
 #include "asprintf.h"
-#include "aws_sign.h"
+#include "aws_sign_cache.h"
 #include "http.h"
 #include "warnp.h"
 
 #include "s3_request.h"
 
 /**
- * s3_request(addrs, key_id, key_secret, region, request, maxrlen,
+ * s3_request(P, SC, addrs, key_id, key_secret, region, request, maxrlen,
  *     callback, cookie):
  * Using the AWS Key ID ${key_id} and Secret Access Key ${key_secret}, send
  * the S3 request ${request} to the specified S3 region.  Behave identically
- * to http_request otherwise.
+ * to http_pool_request otherwise (with ${request}->resbuf passed through as
+ * the HTTP response body buffer); ${P} may be NULL.  If ${SC} is not NULL,
+ * it is used as a cache of signing keys.  Any headers in ${request}->headers
+ * whose names start with "x-amz-checksum-" are signed along with the
+ * request; their names must be in lower case and sorted.
  */
 void *
-s3_request(struct sock_addr * const * addrs, const char * key_id,
+s3_request(struct http_pool * P, struct aws_sign_cache * SC,
+    struct sock_addr * const * addrs, const char * key_id,
     const char * key_secret, const char * region,
     struct s3_request * request, size_t maxrlen,
     int (* callback)(void *, struct http_response *), void * cookie)
@@ -28,14 +33,33 @@ s3_request(struct sock_addr * const * addrs, const char * key_id,
 	char * x_amz_date;
 	char * authorization;
 	char content_length[sizeof(size_t) * 3 + 1];
+	struct aws_sign_header * xhdrs = NULL;
+	size_t nxhdrs;
 	void * http_cookie;
+	size_t i;
+
+	/* Find x-amz-checksum-* headers; S3 requires them to be signed. */
+	if ((request->nheaders > 0) && ((xhdrs =
+	    malloc(request->nheaders * sizeof(struct aws_sign_header))) == NULL))
+		goto err0;
+	for (i = nxhdrs = 0; i < request->nheaders; i++) {
+		if (strncmp(request->headers[i].header, "x-amz-checksum-",
+		    strlen("x-amz-checksum-")) == 0) {
+			xhdrs[nxhdrs].name = request->headers[i].header;
+			xhdrs[nxhdrs].value = request->headers[i].value;
+			nxhdrs++;
+		}
+	}
 
 	/* Construct headers needed for authorization. */
-	if (aws_sign_s3_headers(key_id, key_secret, region,
-	    request->method, request->bucket, request->path, request->body,
-	    request->bodylen, &x_amz_content_sha256, &x_amz_date,
-	    &authorization))
+	if (aws_sign_cache_s3_headers(SC, key_id, key_secret, region,
+	    request->method, request->bucket, request->path, xhdrs, nxhdrs,
+	    request->body, request->bodylen, &x_amz_content_sha256,
+	    &x_amz_date, &authorization)) {
+		free(xhdrs);
 		goto err0;
+	}
+	free(xhdrs);
 
 	/* Construct Host header. */
 	if (asprintf(&host, "%s.s3.amazonaws.com", request->bucket) == -1)
@@ -50,6 +74,7 @@ s3_request(struct sock_addr * const * addrs, const char * key_id,
 	RH.path = request->path;
 	RH.bodylen = request->bodylen;
 	RH.body = request->body;
+	RH.resbuf = request->resbuf;
 
 	/* We have 4 or 5 extra headers. */
 	if (request->body)
@@ -78,7 +103,7 @@ s3_request(struct sock_addr * const * addrs, const char * key_id,
 	}
 
 	/* Send the request. */
-	if ((http_cookie = http_request(addrs, &RH, maxrlen,
+	if ((http_cookie = http_pool_request(P, addrs, &RH, maxrlen,
 	    callback, cookie)) == NULL)
 		goto err3;
 
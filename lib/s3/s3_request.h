@@ -2,7 +2,9 @@
 #define _S3_REQUEST_H_
 
 /* Opaque types. */
+struct aws_sign_cache;
 struct http_header;
+struct http_pool;
 struct http_response;
 struct sock_addr;
 
@@ -14,17 +16,23 @@ struct s3_request {
 	struct http_header * headers;
 	size_t bodylen;
 	const uint8_t * body;
+	uint8_t * resbuf;	/* Buffer for response body, or NULL. */
 };
 
 /**
- * s3_request(addrs, key_id, key_secret, region, request, maxrlen,
+ * s3_request(P, SC, addrs, key_id, key_secret, region, request, maxrlen,
  *     callback, cookie):
  * Using the AWS Key ID ${key_id} and Secret Access Key ${key_secret}, send
  * the S3 request ${request} to the specified S3 region.  Behave identically
- * to http_request otherwise.
+ * to http_pool_request otherwise (with ${request}->resbuf passed through as
+ * the HTTP response body buffer); ${P} may be NULL.  If ${SC} is not NULL,
+ * it is used as a cache of signing keys.  Any headers in ${request}->headers
+ * whose names start with "x-amz-checksum-" are signed along with the
+ * request; their names must be in lower case and sorted.
  */
-void * s3_request(struct sock_addr * const *, const char *, const char *,
-    const char *, struct s3_request *, size_t,
+void * s3_request(struct http_pool *, struct aws_sign_cache *,
+    struct sock_addr * const *, const char *, const char *, const char *,
+    struct s3_request *, size_t,
     int (*)(void *, struct http_response *), void *);
 
 #endif /* !_S3_REQUEST_H_ */
@@ -1,7 +1,11 @@
 #include <assert.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "aws_sign_cache.h"
+#include "events.h"
+#include "histogram.h"
 #include "http.h"
 #include "logging.h"
 #include "monoclock.h"
@@ -12,6 +16,26 @@
 
 #include "s3_request_queue.h"
 
+/*
+ * A GET which has not completed within the HEDGE_PERCENTILE percentile of
+ * recent GET latencies is hedged.  Latencies are tracked in windows of
+ * HEDGE_WINDOW GETs, and we don't hedge until we've seen HEDGE_MINSAMPLES.
+ */
+#define HEDGE_PERCENTILE	95.0
+#define HEDGE_WINDOW		1000
+#define HEDGE_MINSAMPLES	20
+
+/* Maximum number of hedged requests the budget can accumulate. */
+#define HEDGE_BURST		10.0
+
+/* An attempt at performing a request. */
+struct attempt {
+	struct request * R;		/* The request being attempted. */
+	struct sock_addr * addrs[2];	/* Endpoint address, NULL. */
+	void * http_cookie;		/* Returned by s3_request, or NULL. */
+	struct timeval t_start;		/* Start time. */
+};
+
 /* Request. */
 struct request {
 	/* The queue to which we belong. */
@@ -23,12 +47,10 @@ struct request {
 	int (* callback)(void *, struct http_response *);
 	void * cookie;
 
-	/* Start time. */
-	struct timeval t_start;
-
 	/* Internal state. */
-	struct sock_addr * addrs[2];	/* Endpoint address, NULL. */
-	void * http_cookie;		/* Returned by s3_request. */
+	struct attempt A[2];		/* Original attempt, hedged attempt. */
+	struct s3_request hreq;		/* Request for the hedged attempt. */
+	void * hedge_timer;		/* Timer for sending a hedge. */
 
 	/* Doubly-linked list -- either _queued_ or _ip_. */
 	struct request * prev;
@@ -41,6 +63,8 @@ struct s3_request_queue {
 	char * key_secret;
 	char * region;
 	struct s3_serverpool * SP;
+	struct http_pool * HP;
+	struct aws_sign_cache * SC;
 	struct logging_file * logfile;
 	size_t reqsip_max;
 	size_t reqsip;
@@ -48,19 +72,192 @@ struct s3_request_queue {
 	struct request * reqs_queued_tail;
 	struct request * reqs_ip_head;
 	struct request * reqs_ip_tail;
+
+	/* Hedged GETs. */
+	double hedge_budget;		/* Hedges per GET. */
+	double hedge_tokens;		/* Hedges we can send now. */
+	struct histogram * lat_cur;	/* GET latencies (us), this window. */
+	struct histogram * lat_prev;	/* GET latencies (us), last window. */
 };
 
+static int callback_reqdone(void *, struct http_response *);
 static int poke(struct s3_request_queue *);
 
+/* Is ${request} a GET (or RANGE, which is also a GET)? */
+static int
+isget(const struct s3_request * request)
+{
+
+	return (strcmp(request->method, "GET") == 0);
+}
+
+/* Record that the original attempt at a GET took ${t_micros} us. */
+static void
+recordlatency(struct s3_request_queue * Q, long t_micros)
+{
+	struct histogram * H;
+
+	/* Record the latency. */
+	histogram_record(Q->lat_cur, (t_micros > 0) ? (uint64_t)t_micros : 0);
+
+	/* Start a new window if this one is full. */
+	if (histogram_count(Q->lat_cur) >= HEDGE_WINDOW) {
+		H = Q->lat_prev;
+		Q->lat_prev = Q->lat_cur;
+		Q->lat_cur = H;
+		histogram_reset(Q->lat_cur);
+	}
+}
+
+/*
+ * Return the number of seconds after which a GET should be hedged, or a
+ * negative value if it shouldn't be.
+ */
+static double
+hedgedelay(struct s3_request_queue * Q)
+{
+	struct histogram * H;
+
+	/* Are we hedging at all? */
+	if (Q->hedge_budget == 0.0)
+		return (-1.0);
+
+	/* Use the last full window of latencies if we have one. */
+	if (histogram_count(Q->lat_prev) > 0)
+		H = Q->lat_prev;
+	else
+		H = Q->lat_cur;
+
+	/* Don't hedge until we know what normal latency looks like. */
+	if (histogram_count(H) < HEDGE_MINSAMPLES)
+		return (-1.0);
+
+	/* Convert the percentile from microseconds. */
+	return ((double)histogram_percentile(H, HEDGE_PERCENTILE) * 0.000001);
+}
+
+/* Return the number of microseconds since the attempt ${A} started. */
+static long
+elapsed(struct attempt * A, struct timeval * t_end)
+{
+
+	return ((t_end->tv_sec - A->t_start.tv_sec) * 1000000 +
+	    (t_end->tv_usec - A->t_start.tv_usec));
+}
+
+/* Cancel the in-progress attempt ${A}. */
+static void
+attempt_cancel(struct s3_request_queue * Q, struct attempt * A)
+{
+
+	http_request_cancel(A->http_cookie);
+	A->http_cookie = NULL;
+	sock_addr_free(A->addrs[0]);
+	A->addrs[0] = NULL;
+	Q->reqsip -= 1;
+}
+
+/* Remove ${R} from the in-progress queue. */
+static void
+ip_remove(struct s3_request_queue * Q, struct request * R)
+{
+
+	if (R->next) {
+		R->next->prev = R->prev;
+	} else {
+		Q->reqs_ip_tail = R->prev;
+	}
+	if (R->prev) {
+		R->prev->next = R->next;
+	} else {
+		Q->reqs_ip_head = R->next;
+	}
+}
+
+/**
+ * callback_hedge(cookie):
+ * The original attempt at the GET ${cookie} has been in progress for longer
+ * than most GETs take; send a duplicate of it to another endpoint, if our
+ * budget and the in-progress limit allow.
+ */
+static int
+callback_hedge(void * cookie)
+{
+	struct request * R = cookie;
+	struct s3_request_queue * Q = R->Q;
+	struct attempt * A = &R->A[1];
+	int i;
+
+	/* There is no timer pending any more. */
+	R->hedge_timer = NULL;
+
+	/* Can we afford to hedge? */
+	if ((Q->hedge_tokens < 1.0) || (Q->reqsip >= Q->reqsip_max))
+		goto done;
+
+	/*
+	 * Grab an S3 endpoint address, trying a few times to get one other
+	 * than the endpoint the original attempt went to; but if we can't,
+	 * a new connection to the same endpoint is still worth trying.
+	 */
+	for (i = 0; i < 4; i++) {
+		if ((A->addrs[0] = s3_serverpool_pick(Q->SP)) == NULL)
+			goto err0;
+		if (sock_addr_cmp(A->addrs[0], R->A[0].addrs[0]) != 0)
+			break;
+		if (i < 3) {
+			sock_addr_free(A->addrs[0]);
+			A->addrs[0] = NULL;
+		}
+	}
+	A->addrs[1] = NULL;
+
+	/* Record when we send this attempt. */
+	if (monoclock_get(&A->t_start))
+		goto err1;
+
+	/*
+	 * Launch the duplicate S3 request.  It reads the response into a
+	 * buffer of its own, since the original attempt might be reading into
+	 * the request's response buffer at the same time.
+	 */
+	R->hreq = *R->request;
+	R->hreq.resbuf = NULL;
+	if ((A->http_cookie = s3_request(Q->HP, Q->SC, A->addrs,
+	    Q->key_id, Q->key_secret, Q->region, &R->hreq, R->maxrlen,
+	    callback_reqdone, A)) == NULL)
+		goto err1;
+
+	/* The number of in-progress requests has just increased. */
+	Q->reqsip += 1;
+
+	/* We've spent some of our budget. */
+	Q->hedge_tokens -= 1.0;
+
+done:
+	/* Success! */
+	return (0);
+
+err1:
+	sock_addr_free(A->addrs[0]);
+	A->addrs[0] = NULL;
+err0:
+	/* Failure! */
+	return (-1);
+}
+
 /**
  * callback_reqdone(cookie, res):
- * Process the HTTP response ${res} to the queued S3 request ${cookie}.
+ * Process the HTTP response ${res} to the attempt ${cookie} at performing a
+ * queued S3 request.
  */
 static int
 callback_reqdone(void * cookie, struct http_response * res)
 {
-	struct request * R = cookie;
+	struct attempt * A = cookie;
+	struct request * R = A->R;
 	struct s3_request_queue * Q = R->Q;
+	struct attempt * O = (A == &R->A[0]) ? &R->A[1] : &R->A[0];
 	struct timeval t_end;
 	long t_micros;
 	char * addr;
@@ -71,13 +268,12 @@ callback_reqdone(void * cookie, struct http_response * res)
 	/* Compute how long the request took. */
 	if (monoclock_get(&t_end))
 		rc = -1;
-	t_micros = (t_end.tv_sec - R->t_start.tv_sec) * 1000000 +
-	    (t_end.tv_usec - R->t_start.tv_usec);
+	t_micros = elapsed(A, &t_end);
 
 	/* If we have a log file, log the S3 request. */
 	if (Q->logfile != NULL) {
 		/* Prettyprint the address we used. */
-		addr = sock_addr_prettyprint(R->addrs[0]);
+		addr = sock_addr_prettyprint(A->addrs[0]);
 
 		/* Write to the log file. */
 		if ((res != NULL) && (res->bodylen != (size_t)(-1)))
@@ -95,31 +291,46 @@ callback_reqdone(void * cookie, struct http_response * res)
 		free(addr);
 	}
 
+	/* Keep track of how long GETs take. */
+	if ((A == &R->A[0]) && isget(R->request))
+		recordlatency(Q, t_micros);
+
 	/* This address has been tried. */
-	sock_addr_free(R->addrs[0]);
+	sock_addr_free(A->addrs[0]);
+	A->addrs[0] = NULL;
+	A->http_cookie = NULL;
 
 	/* The number of in-progress requests has just decreased. */
 	Q->reqsip -= 1;
 
-	/* Remove from the in-progress queue. */
-	if (R->next) {
-		R->next->prev = R->prev;
-	} else {
-		Q->reqs_ip_tail = R->prev;
-	}
-	if (R->prev) {
-		R->prev->next = R->next;
-	} else {
-		Q->reqs_ip_head = R->next;
+	/*
+	 * If the HTTP connection failed or we got a 500 or 503 response, try
+	 * this again later -- unless the other attempt at this request is
+	 * still in progress, in which case we'll wait for its response.
+	 */
+	if ((res == NULL) || (res->status == 500) || (res->status == 503)) {
+		if (O->http_cookie != NULL)
+			goto poke;
+		goto tryagain;
 	}
 
-	/* If the HTTP connection failed, try this again later. */
-	if (res == NULL)
-		goto tryagain;
+	/* The other attempt at this request (if any) lost the race. */
+	if (O->http_cookie != NULL) {
+		/*
+		 * If it was the original attempt, it has taken at least this
+		 * long; record that so that slow GETs still count.
+		 */
+		if (O == &R->A[0])
+			recordlatency(Q, elapsed(O, &t_end));
+		attempt_cancel(Q, O);
+	}
+	if (R->hedge_timer != NULL) {
+		events_timer_cancel(R->hedge_timer);
+		R->hedge_timer = NULL;
+	}
 
-	/* If we got a 500 or 503 response, try this again later. */
-	if ((res->status == 500) || (res->status == 503))
-		goto tryagain;
+	/* Remove from the in-progress queue. */
+	ip_remove(Q, R);
 
 	/* Send the response upstream. */
 	rc2 = (R->callback)(R->cookie, res);
@@ -136,7 +347,16 @@ callback_reqdone(void * cookie, struct http_response * res)
 	return (rc);
 
 tryagain:
-	/* Add this request back to the queue. */
+	/* Don't hedge an attempt which is no longer in progress. */
+	if (R->hedge_timer != NULL) {
+		events_timer_cancel(R->hedge_timer);
+		R->hedge_timer = NULL;
+	}
+
+	/* Remove from the in-progress queue... */
+	ip_remove(Q, R);
+
+	/* ... and add this request back to the pending queue. */
 	R->prev = Q->reqs_queued_tail;
 	R->next = NULL;
 	if (R->prev == NULL) {
@@ -146,6 +366,7 @@ tryagain:
 	}
 	Q->reqs_queued_tail = R;
 
+poke:
 	/* Poke the queue. */
 	if (poke(Q))
 		goto err0;
@@ -168,6 +389,8 @@ static int
 poke(struct s3_request_queue * Q)
 {
 	struct request * R;
+	struct attempt * A;
+	double t;
 
 	/* If no requests are queued, do nothing. */
 	if (Q->reqs_queued_head == NULL)
@@ -182,24 +405,40 @@ poke(struct s3_request_queue * Q)
 
 	/* Grab the request at the head of the queue. */
 	R = Q->reqs_queued_head;
+	A = &R->A[0];
 
 	/* Grab an S3 endpoint address. */
-	if ((R->addrs[0] = s3_serverpool_pick(Q->SP)) == NULL)
+	if ((A->addrs[0] = s3_serverpool_pick(Q->SP)) == NULL)
 		goto err0;
-	R->addrs[1] = NULL;
+	A->addrs[1] = NULL;
 
 	/* Record when we send this request. */
-	if (monoclock_get(&R->t_start))
-		goto err0;
+	if (monoclock_get(&A->t_start))
+		goto err1;
+
+	/* If this is a GET, we may want to hedge it later. */
+	if (isget(R->request) && ((t = hedgedelay(Q)) >= 0.0)) {
+		if ((R->hedge_timer = events_timer_register_double(
+		    callback_hedge, R, t)) == NULL)
+			goto err1;
+	}
 
 	/* Launch the S3 request. */
-	if ((R->http_cookie = s3_request(R->addrs, Q->key_id, Q->key_secret,
-	    Q->region, R->request, R->maxrlen, callback_reqdone, R)) == NULL)
-		goto err0;
+	if ((A->http_cookie = s3_request(Q->HP, Q->SC, A->addrs,
+	    Q->key_id, Q->key_secret, Q->region, R->request, R->maxrlen,
+	    callback_reqdone, A)) == NULL)
+		goto err2;
 
 	/* The number of in-progress requests has just increased. */
 	Q->reqsip += 1;
 
+	/* Each GET we send adds to our budget for hedging GETs. */
+	if (isget(R->request)) {
+		Q->hedge_tokens += Q->hedge_budget;
+		if (Q->hedge_tokens > HEDGE_BURST)
+			Q->hedge_tokens = HEDGE_BURST;
+	}
+
 	/* Remove from the pending queue... */
 	if (R->next) {
 		R->next->prev = NULL;
@@ -222,6 +461,14 @@ done:
 	/* Success! */
 	return (0);
 
+err2:
+	if (R->hedge_timer != NULL) {
+		events_timer_cancel(R->hedge_timer);
+		R->hedge_timer = NULL;
+	}
+err1:
+	sock_addr_free(A->addrs[0]);
+	A->addrs[0] = NULL;
 err0:
 	/* Failure! */
 	return (-1);
@@ -257,6 +504,22 @@ s3_request_queue_init(const char * key_id, const char * key_secret,
 	if ((Q->region = strdup(region)) == NULL)
 		goto err4;
 
+	/* Keep up to ${conns} connections open to each S3 endpoint. */
+	if ((Q->HP = http_pool_init(conns)) == NULL)
+		goto err5;
+
+	/* Cache signing keys rather than deriving one for each request. */
+	if ((Q->SC = aws_sign_cache_init()) == NULL)
+		goto err6;
+
+	/* No hedging until asked for; but keep track of GET latencies. */
+	Q->hedge_budget = 0.0;
+	Q->hedge_tokens = 0.0;
+	if ((Q->lat_cur = histogram_init()) == NULL)
+		goto err7;
+	if ((Q->lat_prev = histogram_init()) == NULL)
+		goto err8;
+
 	/* No log file yet. */
 	Q->logfile = NULL;
 
@@ -271,6 +534,14 @@ s3_request_queue_init(const char * key_id, const char * key_secret,
 	/* Success! */
 	return (Q);
 
+err8:
+	histogram_free(Q->lat_cur);
+err7:
+	aws_sign_cache_free(Q->SC);
+err6:
+	http_pool_free(Q->HP);
+err5:
+	free(Q->region);
 err4:
 	free(Q->key_secret);
 err3:
@@ -310,6 +581,21 @@ s3_request_queue_addaddr(struct s3_request_queue * Q,
 	return (s3_serverpool_add(Q->SP, addr, ttl));
 }
 
+/**
+ * s3_request_queue_hedge(Q, budget):
+ * Hedge GET requests made via the S3 request queue ${Q}: if a GET has not
+ * completed within the 95th percentile of recent GET latencies, send a
+ * duplicate to another endpoint and use whichever response arrives first.
+ * Send at most ${budget} hedged requests per GET on average; a ${budget} of
+ * zero (the default) disables hedging.
+ */
+void
+s3_request_queue_hedge(struct s3_request_queue * Q, double budget)
+{
+
+	Q->hedge_budget = budget;
+}
+
 /**
  * s3_request_queue(Q, request, maxrlen, callback, cookie):
  * Using the S3 request queue ${Q}, queue the S3 request ${request} to be
@@ -319,7 +605,9 @@ s3_request_queue_addaddr(struct s3_request_queue * Q,
  * to the HTTP connection breaking or with HTTP 500 or 503 responses are
  * retried.  The S3 request structure ${request} must remain valid until the
  * callback is performed or the request queue is freed.  Behave identically to
- * http_request otherwise.
+ * http_request otherwise, except that if a hedged GET wins the race, the
+ * response body is in a buffer allocated by http_request even if
+ * ${request}->resbuf is not NULL.
  */
 int
 s3_request_queue(struct s3_request_queue * Q, struct s3_request * request,
@@ -336,7 +624,10 @@ s3_request_queue(struct s3_request_queue * Q, struct s3_request * request,
 	R->maxrlen = maxrlen;
 	R->callback = callback;
 	R->cookie = cookie;
-	R->http_cookie = NULL;
+	R->A[0].R = R->A[1].R = R;
+	R->A[0].http_cookie = R->A[1].http_cookie = NULL;
+	R->A[0].addrs[0] = R->A[1].addrs[0] = NULL;
+	R->hedge_timer = NULL;
 
 	/* Add to the end of the pending-requests queue. */
 	R->prev = Q->reqs_queued_tail;
@@ -381,6 +672,7 @@ void
 s3_request_queue_flush(struct s3_request_queue * Q)
 {
 	struct request * R;
+	size_t i;
 
 	/* Free the contents of the pending-requests queue. */
 	while ((R = Q->reqs_queued_head) != NULL) {
@@ -391,9 +683,13 @@ s3_request_queue_flush(struct s3_request_queue * Q)
 
 	/* Cancel in-progress requests and free them. */
 	while ((R = Q->reqs_ip_head) != NULL) {
-		http_request_cancel(R->http_cookie);
+		for (i = 0; i < 2; i++) {
+			if (R->A[i].http_cookie != NULL)
+				attempt_cancel(Q, &R->A[i]);
+		}
+		if (R->hedge_timer != NULL)
+			events_timer_cancel(R->hedge_timer);
 		Q->reqs_ip_head = R->next;
-		sock_addr_free(R->addrs[0]);
 		free(R);
 	}
 	Q->reqs_ip_tail = NULL;
@@ -411,6 +707,16 @@ s3_request_queue_free(struct s3_request_queue * Q)
 	/* Flush the queue. */
 	s3_request_queue_flush(Q);
 
+	/* Close any idle HTTP connections. */
+	http_pool_free(Q->HP);
+
+	/* Free the signing key cache. */
+	aws_sign_cache_free(Q->SC);
+
+	/* Free the GET latency histograms. */
+	histogram_free(Q->lat_prev);
+	histogram_free(Q->lat_cur);
+
 	/* Free string allocated by strdup. */
 	free(Q->region);
 
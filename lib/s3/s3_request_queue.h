@@ -32,6 +32,16 @@ void s3_request_queue_log(struct s3_request_queue *, struct logging_file *);
 int s3_request_queue_addaddr(struct s3_request_queue *,
     const struct sock_addr *, int);
 
+/**
+ * s3_request_queue_hedge(Q, budget):
+ * Hedge GET requests made via the S3 request queue ${Q}: if a GET has not
+ * completed within the 95th percentile of recent GET latencies, send a
+ * duplicate to another endpoint and use whichever response arrives first.
+ * Send at most ${budget} hedged requests per GET on average; a ${budget} of
+ * zero (the default) disables hedging.
+ */
+void s3_request_queue_hedge(struct s3_request_queue *, double);
+
 /**
  * s3_request_queue(Q, request, maxrlen, callback, cookie):
  * Using the S3 request queue ${Q}, queue the S3 request ${request} to be
@@ -41,7 +51,9 @@ int s3_request_queue_addaddr(struct s3_request_queue *,
  * to the HTTP connection breaking or with HTTP 500 or 503 responses are
  * retried.  The S3 request structure ${request} must remain valid until the
  * callback is performed or the request queue is freed.  Behave identically to
- * http_request otherwise.
+ * http_request otherwise, except that if a hedged GET wins the race, the
+ * response body is in a buffer allocated by http_request even if
+ * ${request}->resbuf is not NULL.
  */
 int s3_request_queue(struct s3_request_queue *, struct s3_request *, size_t,
     int (*)(void *, struct http_response *), void *);
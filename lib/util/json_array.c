@@ -0,0 +1,129 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#include "json_array.h"
+
+/* Advance past whitespace, if any. */
+static const uint8_t *
+skip_ws(const uint8_t * buf, const uint8_t * end)
+{
+
+	/* Skip " \t\r\n". */
+	while (buf < end) {
+		if ((buf[0] != 0x09) && (buf[0] != 0x0A) &&
+		    (buf[0] != 0x0D) && (buf[0] != 0x20))
+			break;
+		buf++;
+	}
+
+	/* Return the first non-whitespace character or the buffer end. */
+	return (buf);
+}
+
+/* Advance past the string whose opening '"' is at ${buf}. */
+static const uint8_t *
+skip_string(const uint8_t * buf, const uint8_t * end)
+{
+
+	/* Advance past leading '"'. */
+	buf++;
+
+	/* Scan until we find the terminating '"', skipping escapes. */
+	while (buf < end) {
+		if (buf[0] == '"')
+			return (&buf[1]);
+		if ((buf[0] == '\\') && (++buf == end))
+			break;
+		buf++;
+	}
+
+	/* We ran out of input. */
+	return (end);
+}
+
+/*
+ * Return a pointer to the ',' or ']' which follows the array element at
+ * ${buf}, or ${end} if there is none.  We don't need to parse the element;
+ * we only need to skip over strings (which may contain any characters) and
+ * keep track of how deeply nested inside arrays and objects we are.
+ */
+static const uint8_t *
+skip_element(const uint8_t * buf, const uint8_t * end)
+{
+	size_t depth = 0;
+
+	while (buf < end) {
+		switch (buf[0]) {
+		case '"':
+			buf = skip_string(buf, end);
+			continue;
+		case '[':
+		case '{':
+			depth++;
+			break;
+		case ']':
+		case '}':
+			if (depth == 0)
+				return (buf);
+			depth--;
+			break;
+		case ',':
+			if (depth == 0)
+				return (buf);
+			break;
+		}
+		buf++;
+	}
+
+	/* We ran out of input. */
+	return (end);
+}
+
+/**
+ * json_array_first(buf, end):
+ * If there is a valid JSON array which starts at ${buf} and ends before or
+ * at ${end} and said array is not empty, return a pointer to its first
+ * element.  Otherwise, return ${end}.
+ */
+const uint8_t *
+json_array_first(const uint8_t * buf, const uint8_t * end)
+{
+
+	/* After optional whitespace there should be a '['. */
+	buf = skip_ws(buf, end);
+	if ((buf == end) || (*buf++ != '['))
+		return (end);
+
+	/* Skip whitespace looking for the first element. */
+	buf = skip_ws(buf, end);
+
+	/* If the array is empty, there is no first element. */
+	if ((buf == end) || (buf[0] == ']'))
+		return (end);
+
+	/* Return the first element. */
+	return (buf);
+}
+
+/**
+ * json_array_next(buf, end):
+ * If ${buf} points at an element of a JSON array and said element is
+ * followed by another element, return a pointer to the next element.
+ * Otherwise, return ${end}.
+ */
+const uint8_t *
+json_array_next(const uint8_t * buf, const uint8_t * end)
+{
+
+	/*
+	 * Skip this element; we should then have a ','.  (Or we could hit
+	 * the closing ']' of the array, but that would mean that there are
+	 * no more elements.)
+	 */
+	buf = skip_element(buf, end);
+	if ((buf == end) || (*buf++ != ','))
+		return (end);
+
+	/* Skip whitespace looking for the next element. */
+	return (skip_ws(buf, end));
+}
@@ -0,0 +1,22 @@
+#ifndef _JSON_ARRAY_H_
+#define _JSON_ARRAY_H_
+
+#include <stdint.h>
+
+/**
+ * json_array_first(buf, end):
+ * If there is a valid JSON array which starts at ${buf} and ends before or
+ * at ${end} and said array is not empty, return a pointer to its first
+ * element.  Otherwise, return ${end}.
+ */
+const uint8_t * json_array_first(const uint8_t *, const uint8_t *);
+
+/**
+ * json_array_next(buf, end):
+ * If ${buf} points at an element of a JSON array and said element is
+ * followed by another element, return a pointer to the next element.
+ * Otherwise, return ${end}.
+ */
+const uint8_t * json_array_next(const uint8_t *, const uint8_t *);
+
+#endif /* !_JSON_ARRAY_H_ */
@@ -0,0 +1,529 @@
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "crc32c.h"
+#include "imalloc.h"
+#include "kvldskey.h"
+#include "pool.h"
+#include "proto_kvlds.h"
+#include "sysendian.h"
+
+#include "cache.h"
+
+/*
+ * Each cache entry is associated with a key.  An entry holds a GET response
+ * for the key, or is locked in the pool by tickets for in-flight requests
+ * (or both).  Entries which hold a GET response and have no in-flight
+ * requests sit in the pool's eviction queue.
+ */
+struct cache_entry {
+	struct pool_elem * pool_rec;	/* Record for use by pool code. */
+	struct cache_entry * next;	/* Next entry in hash chain. */
+	struct kvldskey * key;		/* Key (owned by the entry). */
+	uint32_t h;			/* Hash of the key. */
+	uint8_t * res;			/* Cached GET response, or NULL. */
+	size_t reslen;			/* Length of cached response. */
+	uint64_t gen;			/* Bumped by each modifying request. */
+	size_t nmods;			/* # in-flight modifying requests. */
+};
+
+/* Cache state. */
+struct cache {
+	struct cache_entry ** buckets;	/* Hash chains. */
+	size_t nbuckets;		/* # hash chains; a power of 2. */
+	struct pool * P;		/* LRU pool of entries. */
+	uint64_t gen;			/* Last generation number assigned. */
+	uint64_t mgen;			/* Bumped by each MSET. */
+	size_t nmsets;			/* # in-flight MSETs. */
+	size_t nentries;		/* # entries with cached responses. */
+	uint64_t hits;			/* # GETs answered from the cache. */
+	uint64_t misses;		/* # GETs forwarded to the target. */
+};
+
+/* Compute the hash of a key. */
+static uint32_t
+hash(const struct kvldskey * k)
+{
+	CRC32C_CTX ctx;
+	uint32_t h;
+
+	/* Compute CRC32C(k). */
+	CRC32C_Init(&ctx);
+	CRC32C_Update(&ctx, k->buf, k->len);
+	CRC32C_Final((uint8_t *)&h, &ctx);
+
+	/* Return hash value. */
+	return (h);
+}
+
+/* Find the entry for the key ${k} with hash ${h}, or return NULL. */
+static struct cache_entry *
+find(struct cache * C, const struct kvldskey * k, uint32_t h)
+{
+	struct cache_entry * E;
+
+	/* Walk the hash chain. */
+	for (E = C->buckets[h & (C->nbuckets - 1)]; E != NULL; E = E->next) {
+		if ((E->h == h) && (kvldskey_cmp(E->key, k) == 0))
+			break;
+	}
+
+	/* Return the entry we found (if any). */
+	return (E);
+}
+
+/* Remove the entry ${E} from its hash chain and free it. */
+static void
+destroy(struct cache * C, struct cache_entry * E)
+{
+	struct cache_entry ** EP;
+
+	/* Find the pointer to this entry. */
+	for (EP = &C->buckets[E->h & (C->nbuckets - 1)]; *EP != E;
+	    EP = &(*EP)->next)
+		continue;
+
+	/* Remove it from the chain. */
+	*EP = E->next;
+
+	/* If this entry held a response, we have one less cached response. */
+	if (E->res != NULL)
+		C->nentries--;
+
+	/* Free the entry. */
+	free(E->res);
+	kvldskey_free(E->key);
+	free(E);
+}
+
+/*
+ * Create an entry for the key ${k} with hash ${h}, locked into the pool with
+ * lock count 1.  Evict an old entry if the pool has reached its target size.
+ */
+static struct cache_entry *
+create(struct cache * C, const struct kvldskey * k, uint32_t h)
+{
+	struct cache_entry * E;
+	void * evict;
+
+	/* Allocate and initialize an entry. */
+	if ((E = malloc(sizeof(struct cache_entry))) == NULL)
+		goto err0;
+	if ((E->key = kvldskey_dup(k)) == NULL)
+		goto err1;
+	E->h = h;
+	E->res = NULL;
+	E->reslen = 0;
+	E->gen = ++C->gen;
+	E->nmods = 0;
+
+	/* Add the entry to the pool. */
+	if (pool_rec_add(C->P, E, &evict))
+		goto err2;
+
+	/* Insert into the hash chain. */
+	E->next = C->buckets[h & (C->nbuckets - 1)];
+	C->buckets[h & (C->nbuckets - 1)] = E;
+
+	/* If an entry was evicted, get rid of it. */
+	if (evict != NULL)
+		destroy(C, evict);
+
+	/* Success! */
+	return (E);
+
+err2:
+	kvldskey_free(E->key);
+err1:
+	free(E);
+err0:
+	/* Failure! */
+	return (NULL);
+}
+
+/* Drop a ticket's reference to the entry ${E}. */
+static void
+release(struct cache * C, struct cache_entry * E)
+{
+
+	/*
+	 * If this was the last reference and the entry doesn't hold a cached
+	 * response, there's no point keeping it around; otherwise, unlock it
+	 * and let it take its place in the eviction queue.
+	 */
+	if ((pool_rec_lockcount(C->P, E) == 1) && (E->res == NULL)) {
+		pool_rec_free(C->P, E);
+		destroy(C, E);
+	} else {
+		pool_rec_unlock(C->P, E);
+	}
+}
+
+/*
+ * Throw away any cached responses for the keys in the ${buflen}-byte MSET
+ * request ${buf}.  Stop at the end of the packet if it is malformed; the
+ * target will reject it in that case.
+ */
+static void
+msetkeys(struct cache * C, const uint8_t * buf, size_t buflen)
+{
+	const struct kvldskey * k;
+	struct cache_entry * E;
+	size_t bufpos;
+	size_t nkeys;
+	size_t i;
+
+	/* Get the number of key-value pairs. */
+	if (buflen < 8)
+		return;
+	nkeys = be32dec(&buf[4]);
+	bufpos = 8;
+
+	/* Look at each key. */
+	for (i = 0; i < nkeys; i++) {
+		/* Parse the key, and skip the value. */
+		if (bufpos == buflen)
+			return;
+		k = (const struct kvldskey *)&buf[bufpos];
+		if (kvldskey_serial_size(k) > buflen - bufpos)
+			return;
+		bufpos += kvldskey_serial_size(k);
+		if (bufpos == buflen)
+			return;
+		bufpos += buf[bufpos] + 1;
+		if (bufpos > buflen)
+			return;
+
+		/* Do we have a response for this key? */
+		if (((E = find(C, k, hash(k))) == NULL) || (E->res == NULL))
+			continue;
+
+		/*
+		 * Throw the response away; if there are no tickets for this
+		 * entry, it has no reason to exist any more.
+		 */
+		if (pool_rec_lockcount(C->P, E) == 0) {
+			pool_rec_lock(C->P, E);
+			pool_rec_free(C->P, E);
+			destroy(C, E);
+		} else {
+			free(E->res);
+			E->res = NULL;
+			C->nentries--;
+		}
+	}
+}
+
+/* Return non-zero if ${buf} is a valid ${buflen}-byte GET response. */
+static int
+isgetresponse(const uint8_t * buf, size_t buflen)
+{
+
+	/* We need a status. */
+	if (buflen < 4)
+		return (0);
+
+	/* Status 0 means a value follows; status 1 means no value. */
+	switch (be32dec(&buf[0])) {
+	case 0:
+		return ((buflen > 4) && (buflen == 4 + (size_t)buf[4] + 1));
+	case 1:
+		return (buflen == 4);
+	default:
+		return (0);
+	}
+}
+
+/**
+ * cache_init(nmax):
+ * Create a cache which holds responses to up to ${nmax} KVLDS GET requests.
+ */
+struct cache *
+cache_init(size_t nmax)
+{
+	struct cache * C;
+
+	/* Allocate a structure. */
+	if ((C = malloc(sizeof(struct cache))) == NULL)
+		goto err0;
+	C->gen = 0;
+	C->mgen = 0;
+	C->nmsets = 0;
+	C->nentries = 0;
+	C->hits = C->misses = 0;
+
+	/* Use at least as many hash chains as entries we will hold. */
+	for (C->nbuckets = 1; C->nbuckets < nmax; C->nbuckets <<= 1) {
+		if (C->nbuckets > SIZE_MAX / 2)
+			goto err1;
+	}
+	if (IMALLOC(C->buckets, C->nbuckets, struct cache_entry *))
+		goto err1;
+	memset(C->buckets, 0, C->nbuckets * sizeof(struct cache_entry *));
+
+	/* Create the pool which tracks which entry to evict next. */
+	if ((C->P = pool_init(nmax,
+	    offsetof(struct cache_entry, pool_rec))) == NULL)
+		goto err2;
+
+	/* Success! */
+	return (C);
+
+err2:
+	free(C->buckets);
+err1:
+	free(C);
+err0:
+	/* Failure! */
+	return (NULL);
+}
+
+/**
+ * cache_lookup(C, buf, buflen, res, reslen, T):
+ * Examine the ${buflen}-byte KVLDS request ${buf} which is about to be
+ * forwarded via the cache ${C}.  If it is a GET request and a response for
+ * the key is cached, return the response via ${res} and ${reslen}; the
+ * response remains owned by the cache and is only valid until the next call
+ * into the cache.  Otherwise, set ${res} to NULL and fill in the ticket ${T},
+ * which must be passed to cache_response when the response arrives.
+ *
+ * Modifying requests (SET, CAS, ADD, MODIFY, DELETE, CAD, and MSET)
+ * invalidate any cached response for their keys; GET responses are not
+ * cached if any modifying request for the same key, or any MSET, was in
+ * progress when the GET was forwarded or was forwarded before the GET
+ * response arrived.
+ */
+int
+cache_lookup(struct cache * C, const uint8_t * buf, size_t buflen,
+    uint8_t ** res, size_t * reslen, struct cache_ticket * T)
+{
+	const struct kvldskey * k;
+	struct cache_entry * E;
+	uint32_t type;
+	uint32_t h;
+
+	/* Nothing from the cache, and no ticket yet. */
+	*res = NULL;
+	T->entry = NULL;
+	T->modifying = 0;
+	T->mset = 0;
+	T->mgen = C->mgen;
+
+	/*
+	 * An MSET invalidates cached responses for all of its keys, and
+	 * prevents any GET response which is in flight from being cached.
+	 */
+	if ((buflen >= 4) && (be32dec(&buf[0]) == PROTO_KVLDS_MSET)) {
+		msetkeys(C, buf, buflen);
+		C->mgen++;
+		C->nmsets++;
+		T->mset = 1;
+		goto done;
+	}
+
+	/* Every request we're interested in has a type followed by a key. */
+	if (buflen < 5)
+		goto done;
+	type = be32dec(&buf[0]);
+	k = (const struct kvldskey *)&buf[4];
+	if (kvldskey_serial_size(k) > buflen - 4)
+		goto done;
+
+	/* Figure out what sort of request this is. */
+	switch (type) {
+	case PROTO_KVLDS_GET:
+		/* A GET request is just a type and a key. */
+		if (kvldskey_serial_size(k) != buflen - 4)
+			goto done;
+		break;
+	case PROTO_KVLDS_SET:
+	case PROTO_KVLDS_CAS:
+	case PROTO_KVLDS_ADD:
+	case PROTO_KVLDS_MODIFY:
+	case PROTO_KVLDS_DELETE:
+	case PROTO_KVLDS_CAD:
+		T->modifying = 1;
+		break;
+	default:
+		/* We don't care about anything else. */
+		goto done;
+	}
+
+	/* Look for an existing entry. */
+	h = hash(k);
+	E = find(C, k, h);
+
+	/* Handle a GET request. */
+	if (T->modifying == 0) {
+		/* If we have the response, hand it back. */
+		if ((E != NULL) && (E->res != NULL)) {
+			/* Move this entry to the back of the eviction queue. */
+			if (pool_rec_lockcount(C->P, E) == 0) {
+				pool_rec_lock(C->P, E);
+				pool_rec_unlock(C->P, E);
+			}
+
+			/* Return the cached response. */
+			*res = E->res;
+			*reslen = E->reslen;
+			C->hits++;
+			goto done;
+		}
+
+		/* This GET request is going to the target. */
+		C->misses++;
+
+		/*
+		 * If a modifying request is in flight, the response to this
+		 * GET might reflect the value before or after the modifying
+		 * request is applied, so we can't cache it.
+		 */
+		if (((E != NULL) && (E->nmods > 0)) || (C->nmsets > 0))
+			goto done;
+
+		/* Create an entry or take a reference to the existing one. */
+		if (E == NULL) {
+			if ((E = create(C, k, h)) == NULL)
+				goto err0;
+		} else {
+			pool_rec_lock(C->P, E);
+		}
+	} else {
+		/* Create an entry or take a reference to the existing one. */
+		if (E == NULL) {
+			if ((E = create(C, k, h)) == NULL)
+				goto err0;
+		} else {
+			pool_rec_lock(C->P, E);
+		}
+
+		/* Throw away any cached response. */
+		if (E->res != NULL) {
+			free(E->res);
+			E->res = NULL;
+			C->nentries--;
+		}
+
+		/* Prevent any in-flight GET responses from being cached. */
+		E->gen = ++C->gen;
+
+		/* There's a modifying request in flight. */
+		E->nmods++;
+	}
+
+	/* Fill in the ticket. */
+	T->entry = E;
+	T->gen = E->gen;
+
+done:
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/**
+ * cache_response(C, T, buf, buflen):
+ * Record that the ${buflen}-byte response ${buf} has arrived for the request
+ * associated with the ticket ${T} in the cache ${C}.  If ${buf} is NULL, the
+ * request failed.
+ */
+int
+cache_response(struct cache * C, struct cache_ticket * T, const uint8_t * buf,
+    size_t buflen)
+{
+	struct cache_entry * E = T->entry;
+
+	/* An MSET is no longer in flight. */
+	if (T->mset) {
+		assert(C->nmsets > 0);
+		C->nmsets--;
+		goto done;
+	}
+
+	/* If there's no entry, we have nothing to do. */
+	if (E == NULL)
+		goto done;
+
+	if (T->modifying) {
+		/* This modifying request is no longer in flight. */
+		assert(E->nmods > 0);
+		E->nmods--;
+	} else if ((buf != NULL) && (E->gen == T->gen) &&
+	    (C->mgen == T->mgen) && (E->res == NULL) &&
+	    isgetresponse(buf, buflen)) {
+		/*
+		 * No modifying requests for this key (or MSETs) have been
+		 * forwarded since this GET was, so this is the current value;
+		 * cache it.  (If we can't allocate memory, just don't cache
+		 * it.)
+		 */
+		if ((E->res = malloc(buflen)) != NULL) {
+			memcpy(E->res, buf, buflen);
+			E->reslen = buflen;
+			C->nentries++;
+		}
+	}
+
+	/* We're done with this entry. */
+	release(C, E);
+	T->entry = NULL;
+
+done:
+	/* Success! */
+	return (0);
+}
+
+/**
+ * cache_stats(C, hits, misses, nentries):
+ * Return via ${hits} and ${misses} the number of GET requests which have
+ * been answered from the cache ${C} and forwarded to the target respectively,
+ * and via ${nentries} the number of responses currently cached.
+ */
+void
+cache_stats(struct cache * C, uint64_t * hits, uint64_t * misses,
+    size_t * nentries)
+{
+
+	*hits = C->hits;
+	*misses = C->misses;
+	*nentries = C->nentries;
+}
+
+/**
+ * cache_free(C):
+ * Free the cache ${C}.  There must be no outstanding tickets.
+ */
+void
+cache_free(struct cache * C)
+{
+	struct cache_entry * E;
+	size_t i;
+
+	/* Be compatible with free(NULL). */
+	if (C == NULL)
+		return;
+
+	/* Free all the entries. */
+	for (i = 0; i < C->nbuckets; i++) {
+		while ((E = C->buckets[i]) != NULL) {
+			/* Nothing should be in flight. */
+			assert(pool_rec_lockcount(C->P, E) == 0);
+
+			/* Remove the entry from the pool and free it. */
+			pool_rec_lock(C->P, E);
+			pool_rec_free(C->P, E);
+			destroy(C, E);
+		}
+	}
+
+	/* Free the pool and hash chains. */
+	pool_free(C->P);
+	free(C->buckets);
+	free(C);
+}
@@ -0,0 +1,72 @@
+#ifndef _CACHE_H_
+#define _CACHE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Opaque types. */
+struct cache;
+struct cache_entry;
+
+/**
+ * Ticket for a request which has been passed through the cache and forwarded
+ * to the target.  The contents of this structure should be treated as
+ * opaque; it is declared here so that it can be embedded in the state which
+ * the dispatcher keeps for each in-flight request.
+ */
+struct cache_ticket {
+	struct cache_entry * entry;	/* Entry for the key, or NULL. */
+	uint64_t gen;			/* Entry generation when forwarded. */
+	int modifying;			/* Non-zero for SET/CAS/etc. */
+	int mset;			/* Non-zero for MSET. */
+	uint64_t mgen;			/* MSET generation when forwarded. */
+};
+
+/**
+ * cache_init(nmax):
+ * Create a cache which holds responses to up to ${nmax} KVLDS GET requests.
+ */
+struct cache * cache_init(size_t);
+
+/**
+ * cache_lookup(C, buf, buflen, res, reslen, T):
+ * Examine the ${buflen}-byte KVLDS request ${buf} which is about to be
+ * forwarded via the cache ${C}.  If it is a GET request and a response for
+ * the key is cached, return the response via ${res} and ${reslen}; the
+ * response remains owned by the cache and is only valid until the next call
+ * into the cache.  Otherwise, set ${res} to NULL and fill in the ticket ${T},
+ * which must be passed to cache_response when the response arrives.
+ *
+ * Modifying requests (SET, CAS, ADD, MODIFY, DELETE, CAD, and MSET)
+ * invalidate any cached response for their keys; GET responses are not
+ * cached if any modifying request for the same key, or any MSET, was in
+ * progress when the GET was forwarded or was forwarded before the GET
+ * response arrived.
+ */
+int cache_lookup(struct cache *, const uint8_t *, size_t, uint8_t **,
+    size_t *, struct cache_ticket *);
+
+/**
+ * cache_response(C, T, buf, buflen):
+ * Record that the ${buflen}-byte response ${buf} has arrived for the request
+ * associated with the ticket ${T} in the cache ${C}.  If ${buf} is NULL, the
+ * request failed.
+ */
+int cache_response(struct cache *, struct cache_ticket *, const uint8_t *,
+    size_t);
+
+/**
+ * cache_stats(C, hits, misses, nentries):
+ * Return via ${hits} and ${misses} the number of GET requests which have
+ * been answered from the cache ${C} and forwarded to the target respectively,
+ * and via ${nentries} the number of responses currently cached.
+ */
+void cache_stats(struct cache *, uint64_t *, uint64_t *, size_t *);
+
+/**
+ * cache_free(C):
+ * Free the cache ${C}.  There must be no outstanding tickets.
+ */
+void cache_free(struct cache *);
+
+#endif /* !_CACHE_H_ */
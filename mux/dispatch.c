@@ -1,14 +1,21 @@
+#include <sys/time.h>
+
 #include <assert.h>
 #include <fcntl.h>
 #include <stdlib.h>
 #include <unistd.h>
 
+#include "monoclock.h"
 #include "mpool.h"
 #include "netbuf.h"
 #include "network.h"
+#include "opstats.h"
+#include "proto_kvlds.h"
+#include "sysendian.h"
 #include "wire.h"
 #include "warnp.h"
 
+#include "cache.h"
 #include "dispatch.h"
 
 /* Dispatcher state. */
@@ -25,6 +32,12 @@ struct dispatch_state {
 	/* Request queue. */
 	struct wire_requestqueue * Q;		/* Connected to target. */
 	int failed;				/* Q has failed. */
+
+	/* GET response cache. */
+	struct cache * cache;			/* Cache, or NULL. */
+
+	/* Request latency statistics. */
+	struct opstats * stats;			/* Latency histograms. */
 };
 
 /* Listening socket. */
@@ -53,6 +66,10 @@ struct sock_active {
 struct forwardee {
 	struct sock_active * conn;		/* Request origin. */
 	uint64_t ID;				/* Request ID. */
+	struct cache_ticket T;			/* Cache ticket. */
+	uint32_t type;				/* Request type. */
+	struct timeval t_arrive;		/* When the request was read. */
+	struct timeval t_start;			/* When it was forwarded. */
 };
 
 MPOOL(forwardee, struct forwardee, 32768);
@@ -66,6 +83,76 @@ static int callback_gotresponse(void *, uint8_t *, size_t);
 static int reqdone(struct sock_active *);
 static int dropconn(struct sock_active *);
 
+/*
+ * Record that a request of type ${type} which arrived at ${t_arrive} and was
+ * forwarded (or answered from the cache) at ${t_start} has been completed.
+ */
+static int
+record(struct dispatch_state * dstate, uint32_t type,
+    const struct timeval * t_arrive, const struct timeval * t_start)
+{
+	struct timeval t_done;
+
+	/* What time is it now? */
+	if (monoclock_get(&t_done))
+		goto err0;
+
+	/* Record the request latency. */
+	if (opstats_record(dstate->stats, type, t_arrive, t_start, &t_done))
+		goto err0;
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Answer the STATS request ${P} from the connection ${S}. */
+static int
+sendstats(struct sock_active * S, const struct wire_packet * P)
+{
+	uint8_t * buf;
+	size_t buflen;
+	uint64_t hits, misses;
+	size_t nentries;
+
+	/* If we're caching, report how well the cache is doing. */
+	if (S->dstate->cache != NULL) {
+		cache_stats(S->dstate->cache, &hits, &misses, &nentries);
+		if (opstats_counter(S->dstate->stats,
+		    PROTO_KVLDS_CTR_MUX_CACHE_HITS, hits))
+			goto err0;
+		if (opstats_counter(S->dstate->stats,
+		    PROTO_KVLDS_CTR_MUX_CACHE_MISSES, misses))
+			goto err0;
+		if (opstats_counter(S->dstate->stats,
+		    PROTO_KVLDS_CTR_MUX_CACHE_ENTRIES, nentries))
+			goto err0;
+	}
+
+	/* Serialize the statistics we have so far. */
+	if (opstats_serialize(S->dstate->stats, &buf, &buflen))
+		goto err0;
+
+	/* Send the response. */
+	if (proto_kvlds_response_stats(S->writeq, P->ID, buf, buflen))
+		goto err1;
+
+	/* Free the serialized statistics. */
+	free(buf);
+
+	/* Success! */
+	return (0);
+
+err1:
+	free(buf);
+err0:
+	/* Failure! */
+	return (-1);
+}
+
 static void
 accept_stop(struct dispatch_state * dstate)
 {
@@ -250,7 +337,9 @@ callback_gotrequests(void * cookie, int status)
 	struct sock_active * S = cookie;
 	struct dispatch_state * dstate = S->dstate;
 	struct wire_packet P;
+	struct wire_packet RP;
 	struct forwardee * F;
+	struct timeval t_arrive;
 
 	/* We're not waiting for a packet to be available any more. */
 	S->read_cookie = NULL;
@@ -259,6 +348,10 @@ callback_gotrequests(void * cookie, int status)
 	if (status)
 		goto fail;
 
+	/* Requests read now are considered to have arrived now. */
+	if (monoclock_get(&t_arrive))
+		goto err0;
+
 	/* Handle packets until there are no more or we encounter an error. */
 	do {
 		/* Grab a packet. */
@@ -269,16 +362,53 @@ callback_gotrequests(void * cookie, int status)
 		if (P.buf == NULL)
 			break;
 
+		/* STATS requests are answered by us, not by the target. */
+		if ((P.len == 4) && (be32dec(P.buf) == PROTO_KVLDS_STATS)) {
+			if (sendstats(S, &P))
+				goto err0;
+			if (record(dstate, PROTO_KVLDS_STATS,
+			    &t_arrive, &t_arrive))
+				goto err0;
+			wire_readpacket_consume(S->readq, &P);
+			continue;
+		}
+
 		/* Bake a cookie. */
 		if ((F = mpool_forwardee_malloc()) == NULL)
 			goto err0;
 		F->ID = P.ID;
 		F->conn = S;
+		F->T.entry = NULL;
+		F->T.mset = 0;
+		F->type = (P.len >= 4) ? be32dec(P.buf) : PROTO_KVLDS_NONE;
+		F->t_arrive = t_arrive;
+
+		/* If we're caching, see if we already have the response. */
+		if (dstate->cache != NULL) {
+			if (cache_lookup(dstate->cache, P.buf, P.len,
+			    &RP.buf, &RP.len, &F->T))
+				goto err1;
+
+			/* Send a cached response straight back. */
+			if (RP.buf != NULL) {
+				RP.ID = P.ID;
+				if (wire_writepacket(S->writeq, &RP))
+					goto err1;
+				if (record(dstate, F->type, &t_arrive,
+				    &t_arrive))
+					goto err1;
+				mpool_forwardee_free(F);
+				wire_readpacket_consume(S->readq, &P);
+				continue;
+			}
+		}
 
 		/* Send the request to the target. */
+		if (monoclock_get(&F->t_start))
+			goto err2;
 		if (wire_requestqueue_add(dstate->Q, P.buf, P.len,
 		    callback_gotresponse, F))
-			goto err1;
+			goto err2;
 
 		/* We have an additional outstanding request. */
 		S->nrequests++;
@@ -304,6 +434,8 @@ fail:
 	/* Return success; the connection will be reaped later. */
 	return (0);
 
+err2:
+	cache_response(dstate->cache, &F->T, NULL, 0);
 err1:
 	free(F);
 err0:
@@ -320,6 +452,10 @@ callback_gotresponse(void * cookie, uint8_t * buf, size_t buflen)
 	struct dispatch_state * dstate = S->dstate;
 	struct wire_packet P;
 
+	/* Let the cache know about the response. */
+	if (cache_response(dstate->cache, &F->T, buf, buflen))
+		goto err1;
+
 	/* Did this request fail? */
 	if (buf == NULL)
 		goto failed;
@@ -331,6 +467,10 @@ callback_gotresponse(void * cookie, uint8_t * buf, size_t buflen)
 	if (wire_writepacket(S->writeq, &P))
 		goto err1;
 
+	/* Record the request latency. */
+	if (record(dstate, F->type, &F->t_arrive, &F->t_start))
+		goto err1;
+
 	/* Free the cookie. */
 	mpool_forwardee_free(F);
 
@@ -446,14 +586,15 @@ err1:
 }
 
 /**
- * dispatch_init(socks, nsocks, Q, maxconn):
+ * dispatch_init(socks, nsocks, Q, maxconn, cache):
  * Initialize a dispatcher to accept connections from the listening sockets
  * ${socks[0]} ... ${socks[nsocks - 1]} (but no more than ${maxconn} at
- * once) and shuttle requests/responses to/from the request queue ${Q}.
+ * once) and shuttle requests/responses to/from the request queue ${Q}.  If
+ * ${cache} is not NULL, answer GET requests from it where possible.
  */
 struct dispatch_state *
 dispatch_init(const int * socks, size_t nsocks,
-    struct wire_requestqueue * Q, size_t maxconn)
+    struct wire_requestqueue * Q, size_t maxconn, struct cache * cache)
 {
 	struct dispatch_state * dstate;
 	size_t i;
@@ -467,11 +608,16 @@ dispatch_init(const int * socks, size_t nsocks,
 	dstate->nsock_active_max = maxconn;
 	dstate->Q = Q;
 	dstate->failed = 0;
+	dstate->cache = cache;
+
+	/* Create latency statistics. */
+	if ((dstate->stats = opstats_init()) == NULL)
+		goto err1;
 
 	/* Allocate an array of listeners. */
 	if ((dstate->sock_listen =
 	    malloc(nsocks * sizeof(struct sock_listen))) == NULL)
-		goto err1;
+		goto err2;
 	for (i = 0; i < nsocks; i++) {
 		dstate->sock_listen[i].dstate = dstate;
 		dstate->sock_listen[i].s = socks[i];
@@ -480,13 +626,15 @@ dispatch_init(const int * socks, size_t nsocks,
 
 	/* Start accepting connections. */
 	if (accept_start(dstate))
-		goto err2;
+		goto err3;
 
 	/* Success! */
 	return (dstate);
 
-err2:
+err3:
 	free(dstate->sock_listen);
+err2:
+	opstats_free(dstate->stats);
 err1:
 	free(dstate);
 err0:
@@ -524,6 +672,7 @@ dispatch_done(struct dispatch_state * dstate)
 	assert(dstate->nsock_active == 0);
 
 	/* Free memory. */
+	opstats_free(dstate->stats);
 	free(dstate->sock_listen);
 	free(dstate);
 }
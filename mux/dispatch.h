@@ -2,17 +2,19 @@
 #define _DISPATCH_H_
 
 /* Opaque types. */
+struct cache;
 struct dispatch_state;
 struct wire_requestqueue;
 
 /**
- * dispatch_init(socks, nsocks, Q, maxconn):
+ * dispatch_init(socks, nsocks, Q, maxconn, cache):
  * Initialize a dispatcher to accept connections from the listening sockets
  * ${socks[0]} ... ${socks[nsocks - 1]} (but no more than ${maxconn} at
- * once) and shuttle requests/responses to/from the request queue ${Q}.
+ * once) and shuttle requests/responses to/from the request queue ${Q}.  If
+ * ${cache} is not NULL, answer GET requests from it where possible.
  */
-struct dispatch_state *
-dispatch_init(const int *, size_t, struct wire_requestqueue *, size_t);
+struct dispatch_state * dispatch_init(const int *, size_t,
+    struct wire_requestqueue *, size_t, struct cache *);
 
 /**
  * dispatch_alive(dstate):
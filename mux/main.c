@@ -10,20 +10,60 @@
 #include "elasticarray.h"
 #include "events.h"
 #include "getopt.h"
+#include "logging.h"
 #include "sock.h"
 #include "warnp.h"
 #include "wire.h"
 
+#include "cache.h"
 #include "dispatch.h"
 
 ELASTICARRAY_DECL(ADDRLIST, addrlist, struct sock_addr *);
 
+/* State for logging cache statistics. */
+struct logstats {
+	struct cache * cache;
+	struct logging_file * logfile;
+	void * timer_cookie;
+};
+
+/* Write cache statistics to the log file once a minute. */
+static int
+callback_logstats(void * cookie)
+{
+	struct logstats * L = cookie;
+	uint64_t hits, misses;
+	size_t nentries;
+
+	/* The timer is no longer pending. */
+	L->timer_cookie = NULL;
+
+	/* Log the statistics. */
+	cache_stats(L->cache, &hits, &misses, &nentries);
+	if (logging_printf(L->logfile, "|cache|%" PRIu64 "|%" PRIu64 "|%zu",
+	    hits, misses, nentries) == -1)
+		goto err0;
+
+	/* Do it again later. */
+	if ((L->timer_cookie = events_timer_register_double(callback_logstats,
+	    L, 60.0)) == NULL)
+		goto err0;
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
 static void
 usage(void)
 {
 
 	fprintf(stderr, "usage: kivaloo-mux -t <target socket> "
 	    "-s <source socket> [-s <source socket> ...] "
+	    "[-c <# cached GET responses>] [-l <logfile>] "
 	    "[-n <max # connections] [-p <pidfile>]\n");
 	fprintf(stderr, "       kivaloo-mux --version\n");
 	exit(1);
@@ -43,8 +83,12 @@ main(int argc, char * argv[])
 	int sock_t;
 	struct wire_requestqueue * Q_t;
 	struct dispatch_state * dstate;
+	struct cache * cache;
+	struct logstats L;
 
 	/* Command-line parameters. */
+	intmax_t opt_c = 0;
+	char * opt_l = NULL;
 	intmax_t opt_n = 0;
 	char * opt_p = NULL;
 	char * opt_t = NULL;
@@ -68,6 +112,20 @@ main(int argc, char * argv[])
 	/* Parse the command line. */
 	while ((ch = GETOPT(argc, argv)) != NULL) {
 		GETOPT_SWITCH(ch) {
+		GETOPT_OPTARG("-c"):
+			if (opt_c != 0)
+				usage();
+			if ((opt_c = strtoimax(optarg, NULL, 0)) == 0) {
+				warn0("Invalid option: -c %s", optarg);
+				exit(1);
+			}
+			break;
+		GETOPT_OPTARG("-l"):
+			if (opt_l != NULL)
+				usage();
+			if ((opt_l = strdup(optarg)) == NULL)
+				OPT_EPARSE(ch, optarg);
+			break;
 		GETOPT_OPTARG("-n"):
 			if (opt_n != 0)
 				usage();
@@ -132,6 +190,8 @@ main(int argc, char * argv[])
 		usage();
 
 	/* Sanity-check options. */
+	if (opt_c < 0)
+		usage();
 	if ((opt_n < 0) || (opt_n > 65535))
 		usage();
 	if ((opt_s_size = addrlist_getsize(opt_s)) == 0)
@@ -175,13 +235,45 @@ main(int argc, char * argv[])
 			exit(1);
 	}
 
+	/* If requested, create a GET response cache. */
+	if (opt_c != 0) {
+		if ((uintmax_t)opt_c > SIZE_MAX) {
+			warn0("Cache size too large: %jd", opt_c);
+			exit(1);
+		}
+		if ((cache = cache_init((size_t)opt_c)) == NULL) {
+			warnp("Cannot create cache");
+			exit(1);
+		}
+	} else {
+		cache = NULL;
+	}
+
 	/* Initialize the dispatcher. */
 	if ((dstate = dispatch_init(socks_s, opt_s_size,
-	    Q_t, opt_n ? (size_t)opt_n : SIZE_MAX)) == NULL) {
+	    Q_t, opt_n ? (size_t)opt_n : SIZE_MAX, cache)) == NULL) {
 		warnp("Failed to initialize dispatcher");
 		exit(1);
 	}
 
+	/* If requested, log cache statistics periodically. */
+	L.cache = cache;
+	L.timer_cookie = NULL;
+	if (opt_l != NULL) {
+		if ((L.logfile = logging_open(opt_l)) == NULL) {
+			warnp("Cannot open log file");
+			exit(1);
+		}
+		if ((cache != NULL) && ((L.timer_cookie =
+		    events_timer_register_double(callback_logstats,
+		    &L, 60.0)) == NULL)) {
+			warnp("Cannot register statistics timer");
+			exit(1);
+		}
+	} else {
+		L.logfile = NULL;
+	}
+
 	/* Daemonize and write pid. */
 	if (opt_p == NULL) {
 		if (asprintf(&opt_p, "%s.pid", opt_s_1) == -1) {
@@ -205,6 +297,13 @@ main(int argc, char * argv[])
 	/* Clean up the dispatcher. */
 	dispatch_done(dstate);
 
+	/* Stop logging and free the cache. */
+	if (L.timer_cookie != NULL)
+		events_timer_cancel(L.timer_cookie);
+	if (L.logfile != NULL)
+		logging_close(L.logfile);
+	cache_free(cache);
+
 	/* Shut down the request queue. */
 	wire_requestqueue_destroy(Q_t);
 	wire_requestqueue_free(Q_t);
@@ -224,6 +323,7 @@ main(int argc, char * argv[])
 	events_shutdown();
 
 	/* Free option strings. */
+	free(opt_l);
 	free(opt_p);
 	free(opt_s_1);
 	free(opt_t);
@@ -73,9 +73,9 @@ main(int argc, char * argv[])
 	/* Send DescribeTable request. */
 	body = "{ \"TableName\": \"kivaloo-testing\" }";
 	done = 0;
-	(void)dynamodb_request(sas, key_id, key_secret, "us-east-1",
-	    "DescribeTable", (const uint8_t *)body, strlen(body), 1024,
-	    donereq, &done);
+	(void)dynamodb_request(NULL, NULL, sas, key_id, key_secret,
+	    "us-east-1", "DescribeTable", (const uint8_t *)body, strlen(body),
+	    1024, donereq, &done);
 
 	/* Wait for request to complete. */
 	if (events_spin(&done)) {
@@ -93,8 +93,8 @@ main(int argc, char * argv[])
 		"}"
 	    "}";
 	done = 0;
-	(void)dynamodb_request(sas, key_id, key_secret, "us-east-1",
-	    "PutItem", (const uint8_t *)body, strlen(body), 1024,
+	(void)dynamodb_request(NULL, NULL, sas, key_id, key_secret,
+	    "us-east-1", "PutItem", (const uint8_t *)body, strlen(body), 1024,
 	    donereq, &done);
 
 	/* Wait for request to complete. */
@@ -112,8 +112,8 @@ main(int argc, char * argv[])
 		"}"
 	    "}";
 	done = 0;
-	(void)dynamodb_request(sas, key_id, key_secret, "us-east-1",
-	    "GetItem", (const uint8_t *)body, strlen(body), 1024,
+	(void)dynamodb_request(NULL, NULL, sas, key_id, key_secret,
+	    "us-east-1", "GetItem", (const uint8_t *)body, strlen(body), 1024,
 	    donereq, &done);
 
 	/* Wait for request to complete. */
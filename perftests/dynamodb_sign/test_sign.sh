@@ -6,6 +6,9 @@ REGION=us-east-1
 TABLE=kivaloo-testing
 AWSKEY=~/.dynamodb/aws.key
 
+# Measure the cost of signing requests
+./dynamodb_sign bench || exit 1
+
 # If you don't have my AWS keys, you can't run this test.
 if ! [ -f $AWSKEY ]; then
 	echo "Can't run DynamoDB tests without AWS keys"
@@ -0,0 +1,431 @@
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include "dynamodb_kv.h"
+#include "dynamodb_request_queue.h"
+#include "events.h"
+#include "http.h"
+#include "monoclock.h"
+#include "noeintr.h"
+#include "serverpool.h"
+#include "sock.h"
+#include "warnp.h"
+
+/* Maximum number of connections the stand-in endpoint will handle. */
+#define MAXCONNS 128
+
+/* Maximum size of an HTTP request we'll handle. */
+#define MAXREQ 16384
+
+/* Connection to the stand-in endpoint. */
+struct conn {
+	int s;
+	size_t buflen;
+	char buf[MAXREQ + 1];
+};
+
+/* Responses from the stand-in endpoint. */
+static const char * okbody =
+    "{\"ConsumedCapacity\":{\"CapacityUnits\":1.0,\"TableName\":\"t\"}}";
+static const char * throttlebody =
+    "{\"__type\":\"com.amazonaws.dynamodb.v20120810"
+    "#ProvisionedThroughputExceededException\","
+    "\"message\":\"The level of configured provisioned throughput for the "
+    "table was exceeded.\"}";
+
+static volatile sig_atomic_t stopping = 0;
+static int done = 0;
+static size_t inprogress = 0;
+static size_t nfailed = 0;
+
+/* Signal handler for the stand-in endpoint. */
+static void
+stop(int sig)
+{
+
+	(void)sig; /* UNUSED */
+
+	stopping = 1;
+}
+
+/* Return the number of seconds from ${t0} to ${t1}. */
+static double
+tvdiff(const struct timeval * t0, const struct timeval * t1)
+{
+
+	return ((double)(t1->tv_sec - t0->tv_sec) +
+	    (double)(t1->tv_usec - t0->tv_usec) * 0.000001);
+}
+
+/*
+ * Handle any complete requests in the buffer of ${C}, admitting them if the
+ * token bucket (${ptokens} tokens at time ${ptlast}, refilling at ${rate}
+ * tokens per second) has a token available and throttling them otherwise.
+ */
+static int
+handlereqs(struct conn * C, double * ptokens, struct timeval * ptlast,
+    double rate, size_t * pserved, size_t * pthrottled)
+{
+	struct timeval tnow;
+	char resp[512];
+	const char * body;
+	char * eoh;
+	char * cl;
+	size_t reqlen;
+	int status;
+	int len;
+
+	/* Process requests until we don't have a complete one. */
+	C->buf[C->buflen] = '\0';
+	while ((eoh = strstr(C->buf, "\r\n\r\n")) != NULL) {
+		/* Find the Content-Length header. */
+		*eoh = '\0';
+		for (cl = C->buf; (cl = strchr(cl, '\n')) != NULL; cl++) {
+			if (strncasecmp(cl + 1, "Content-Length:", 15) == 0)
+				break;
+		}
+		if (cl == NULL) {
+			warn0("Request has no Content-Length");
+			goto err0;
+		}
+		reqlen = (size_t)(eoh - C->buf) + 4 +
+		    strtoul(cl + 16, NULL, 10);
+		*eoh = '\r';
+
+		/* Do we have the complete request body? */
+		if (reqlen > MAXREQ) {
+			warn0("Request too large");
+			goto err0;
+		}
+		if (C->buflen < reqlen)
+			break;
+
+		/* Top up the token bucket; we allow a 1 second burst. */
+		if (monoclock_get(&tnow))
+			goto err0;
+		*ptokens += tvdiff(ptlast, &tnow) * rate;
+		if (*ptokens > rate)
+			*ptokens = rate;
+		*ptlast = tnow;
+
+		/* Admit or throttle the request. */
+		if (*ptokens >= 1.0) {
+			*ptokens -= 1.0;
+			(*pserved)++;
+			status = 200;
+			body = okbody;
+		} else {
+			(*pthrottled)++;
+			status = 400;
+			body = throttlebody;
+		}
+
+		/* Send the response. */
+		len = snprintf(resp, sizeof(resp), "HTTP/1.1 %d %s\r\n"
+		    "Content-Type: application/x-amz-json-1.0\r\n"
+		    "Content-Length: %zu\r\n\r\n%s", status,
+		    (status == 200) ? "OK" : "Bad Request", strlen(body), body);
+		if (noeintr_write(C->s, resp, (size_t)len) != len) {
+			warnp("write");
+			goto err0;
+		}
+
+		/* Remove the request from the buffer. */
+		memmove(C->buf, &C->buf[reqlen], C->buflen - reqlen + 1);
+		C->buflen -= reqlen;
+	}
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/*
+ * Run a stand-in DynamoDB endpoint on the listening socket ${s} which
+ * accepts ${rate} requests per second and throttles the rest; print
+ * statistics and exit when sent SIGTERM.
+ */
+static void
+standin(int s, double rate)
+{
+	struct conn * conns[MAXCONNS];
+	struct timeval tlast;
+	struct timeval timeo;
+	double tokens = rate;
+	size_t nconns = 0;
+	size_t served = 0;
+	size_t throttled = 0;
+	size_t i;
+	fd_set fds;
+	ssize_t len;
+	int maxfd;
+	int t;
+
+	/* Exit when the load generator is done. */
+	if (signal(SIGTERM, stop) == SIG_ERR) {
+		warnp("signal");
+		_exit(1);
+	}
+
+	/* The token bucket starts full. */
+	if (monoclock_get(&tlast)) {
+		warnp("monoclock_get");
+		_exit(1);
+	}
+
+	/* Handle connections until we're told to stop. */
+	while (!stopping) {
+		/* Wait for something to happen. */
+		FD_ZERO(&fds);
+		FD_SET(s, &fds);
+		maxfd = s;
+		for (i = 0; i < nconns; i++) {
+			FD_SET(conns[i]->s, &fds);
+			if (conns[i]->s > maxfd)
+				maxfd = conns[i]->s;
+		}
+		timeo.tv_sec = 0;
+		timeo.tv_usec = 100000;
+		if (select(maxfd + 1, &fds, NULL, NULL, &timeo) == -1) {
+			if (errno == EINTR)
+				continue;
+			warnp("select");
+			_exit(1);
+		}
+
+		/* Accept a new connection. */
+		if (FD_ISSET(s, &fds) && (nconns < MAXCONNS)) {
+			if ((t = accept(s, NULL, NULL)) == -1) {
+				if ((errno != EAGAIN) && (errno != EWOULDBLOCK)
+				    && (errno != EINTR)) {
+					warnp("accept");
+					_exit(1);
+				}
+			} else {
+				if ((conns[nconns] =
+				    malloc(sizeof(struct conn))) == NULL) {
+					warnp("malloc");
+					_exit(1);
+				}
+				conns[nconns]->s = t;
+				conns[nconns]->buflen = 0;
+				nconns++;
+			}
+		}
+
+		/* Read and handle requests. */
+		for (i = 0; i < nconns; i++) {
+			if (!FD_ISSET(conns[i]->s, &fds))
+				continue;
+			len = recv(conns[i]->s,
+			    &conns[i]->buf[conns[i]->buflen],
+			    MAXREQ - conns[i]->buflen, 0);
+			if ((len == -1) && (errno == EINTR))
+				continue;
+			if (len > 0) {
+				conns[i]->buflen += (size_t)len;
+				if (handlereqs(conns[i], &tokens, &tlast, rate,
+				    &served, &throttled) == 0)
+					continue;
+			}
+
+			/* Connection closed or broken; forget it. */
+			close(conns[i]->s);
+			free(conns[i]);
+			conns[i--] = conns[--nconns];
+		}
+	}
+
+	/* Print statistics. */
+	printf("stand-in endpoint: %zu requests served, %zu throttled"
+	    " (%.1f%%)\n", served, throttled,
+	    (served + throttled) ? 100.0 * throttled / (served + throttled) :
+	    0.0);
+	fflush(stdout);
+
+	/* We're done. */
+	_exit(0);
+}
+
+/* Callback from dynamodb_request_queue. */
+static int
+donereq(void * cookie, struct http_response * R)
+{
+
+	(void)cookie; /* UNUSED */
+
+	/* This request is over. */
+	if (--inprogress == 0)
+		done = 1;
+
+	/* Anything other than a 200 is a failure. */
+	if ((R == NULL) || (R->status != 200))
+		nfailed++;
+
+	/* Free the body. */
+	if (R != NULL)
+		free(R->body);
+
+	/* Success! */
+	return (0);
+}
+
+int
+main(int argc, char * argv[])
+{
+	struct sock_addr ** sas;
+	struct serverpool * SP;
+	struct dynamodb_request_queue * Q;
+	struct timeval tstart, tend;
+	char ** bodies;
+	char keyname[50];
+	char target[64];
+	long port, capacity, nreqs;
+	int ondemand;
+	double t;
+	pid_t pid;
+	int s;
+	long i;
+
+	WARNP_INIT;
+
+	/* Parse command line. */
+	if ((argc != 5) ||
+	    ((port = strtol(argv[1], NULL, 10)) <= 0) || (port > 65535) ||
+	    ((capacity = strtol(argv[2], NULL, 10)) <= 0) ||
+	    ((nreqs = strtol(argv[3], NULL, 10)) <= 0) ||
+	    ((strcmp(argv[4], "provisioned") != 0) &&
+	     (strcmp(argv[4], "on-demand") != 0))) {
+		fprintf(stderr, "usage: test_dynamodb_throttle %s %s %s %s\n",
+		    "<port>", "<capacity>", "<requests>",
+		    "provisioned | on-demand");
+		exit(1);
+	}
+	ondemand = (strcmp(argv[4], "on-demand") == 0);
+
+	/* Create a listening socket for the stand-in endpoint. */
+	snprintf(target, sizeof(target), "[127.0.0.1]:%ld", port);
+	if ((sas = sock_resolve(target)) == NULL) {
+		warnp("Error resolving stand-in endpoint address");
+		exit(1);
+	}
+	if ((s = sock_listener(sas[0])) == -1) {
+		warnp("Error creating stand-in endpoint socket");
+		exit(1);
+	}
+	sock_addr_freelist(sas);
+
+	/* Run the stand-in endpoint in a child process. */
+	fflush(stdout);
+	switch ((pid = fork())) {
+	case -1:
+		warnp("fork");
+		exit(1);
+	case 0:
+		standin(s, (double)capacity);
+	}
+	close(s);
+
+	/* Use the stand-in endpoint as our "DynamoDB" server. */
+	if ((SP = serverpool_create(target, 30, 120)) == NULL) {
+		warnp("Error launching DNS lookups");
+		goto err1;
+	}
+
+	/* Create a request queue. */
+	if ((Q = dynamodb_request_queue_init("AKIAEXAMPLE", "secret",
+	    "us-east-1", SP)) == NULL) {
+		warnp("Error initializing DynamoDB request queue");
+		goto err1;
+	}
+
+	/*
+	 * Tell the queue what capacity the table has, or that it's on-demand;
+	 * in the latter case the queue has to find the endpoint's limit for
+	 * itself.
+	 */
+	dynamodb_request_queue_setcapacity(Q, ondemand ? 0 : (int)capacity);
+
+	/* Construct PutItem requests. */
+	if ((bodies = malloc((size_t)nreqs * sizeof(char *))) == NULL) {
+		warnp("malloc");
+		goto err1;
+	}
+	for (i = 0; i < nreqs; i++) {
+		sprintf(keyname, "key%ld", i);
+		if ((bodies[i] = dynamodb_kv_put("kivaloo-testing", keyname,
+		    (const uint8_t *)"value\n", 6)) == NULL) {
+			warnp("dynamodb_kv_put");
+			goto err1;
+		}
+	}
+
+	/* Queue them all at once, and time how long they take. */
+	if (monoclock_get(&tstart)) {
+		warnp("monoclock_get");
+		goto err1;
+	}
+	for (i = 0; i < nreqs; i++) {
+		inprogress++;
+		if (dynamodb_request_queue(Q, 1, "PutItem", bodies[i], 1024,
+		    NULL, donereq, NULL)) {
+			warnp("Error queuing DynamoDB request");
+			goto err1;
+		}
+	}
+	if (events_spin(&done)) {
+		warnp("Error in event loop");
+		goto err1;
+	}
+	if (monoclock_get(&tend)) {
+		warnp("monoclock_get");
+		goto err1;
+	}
+
+	/* Print statistics. */
+	t = tvdiff(&tstart, &tend);
+	printf("%s table, %ld capacity units/s: %ld requests (%zu failed)"
+	    " in %.2f s = %.1f/s\n", ondemand ? "on-demand" : "provisioned",
+	    capacity, nreqs, nfailed, t, nreqs / t);
+	fflush(stdout);
+
+	/* Shut down the stand-in endpoint and wait for its statistics. */
+	if (kill(pid, SIGTERM) || (waitpid(pid, NULL, 0) == -1)) {
+		warnp("Error stopping stand-in endpoint");
+		exit(1);
+	}
+
+	/* Free requests. */
+	for (i = 0; i < nreqs; i++)
+		free(bodies[i]);
+	free(bodies);
+
+	/* Shut down request queue. */
+	dynamodb_request_queue_free(Q);
+
+	/* Shut down the DNS lookups. */
+	serverpool_free(SP);
+
+	/* Shut down events loop (in case we're checking for memory leaks). */
+	events_shutdown();
+
+	/* Success! */
+	exit(0);
+
+err1:
+	kill(pid, SIGTERM);
+	exit(1);
+}
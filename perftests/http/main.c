@@ -1,5 +1,16 @@
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 #include "asprintf.h"
 #include "events.h"
@@ -7,6 +18,552 @@
 #include "sock.h"
 #include "warnp.h"
 
+/* Stand-in server limits. */
+#define SRV_MAXCONNS	64
+#define SRV_BUFLEN	4096
+
+/* Connections which the pool may hold open to the stand-in server. */
+#define POOL_MAXCONNS	4
+
+/* Body sent with chunked transfer-encoding. */
+#define CHUNKED_BODY	"hello, world\n"
+
+/* Size of request and response bodies in the streaming test. */
+#define ECHO_LEN	(1024 * 1024)
+
+/* Stand-in server connection. */
+struct srv_conn {
+	int fd;
+	size_t id;
+	size_t buflen;
+	char buf[SRV_BUFLEN];
+};
+
+/* State for one phase of the connection pool test. */
+struct pooltest {
+	const char * path;
+	size_t nreqs;
+	size_t ndone;
+	size_t nfailed;
+	size_t * ids;
+	int done;
+};
+
+/* State for the request/response body streaming test. */
+struct echotest {
+	uint8_t * resbuf;
+	const uint8_t * body;
+	size_t len;
+	int failed;
+	int done;
+};
+
+/* Read ${len} bytes into ${buf} from the blocking socket ${fd}. */
+static int
+readall(int fd, uint8_t * buf, size_t len)
+{
+	ssize_t lenread;
+
+	while (len > 0) {
+		if ((lenread = read(fd, buf, len)) <= 0)
+			return (-1);
+		buf += lenread;
+		len -= (size_t)lenread;
+	}
+
+	return (0);
+}
+
+/* Write ${len} bytes from ${buf} to the blocking socket ${fd}. */
+static int
+writeall(int fd, const char * buf, size_t len)
+{
+	ssize_t lenwrit;
+
+	while (len > 0) {
+		if ((lenwrit = write(fd, buf, len)) == -1)
+			return (-1);
+		buf += lenwrit;
+		len -= (size_t)lenwrit;
+	}
+
+	return (0);
+}
+
+/*
+ * Respond to a request for ${path} with the ${bodylen}-byte body ${body} on
+ * ${C}; return non-zero to close the connection.
+ */
+static int
+srv_respond(struct srv_conn * C, const char * path, const uint8_t * body,
+    size_t bodylen)
+{
+	char * res;
+	int len;
+	int closeafter = 0;
+
+	/* Construct a response based on the requested path. */
+	if (strcmp(path, "/echo") == 0) {
+		len = asprintf(&res, "HTTP/1.1 200 OK\r\n"
+		    "X-Connection: %zu\r\n"
+		    "Content-Length: %zu\r\n\r\n", C->id, bodylen);
+	} else if (strcmp(path, "/chunked") == 0) {
+		len = asprintf(&res, "HTTP/1.1 200 OK\r\n"
+		    "X-Connection: %zu\r\n"
+		    "Transfer-Encoding: chunked\r\n\r\n"
+		    "%zx\r\n%s\r\n0\r\n\r\n", C->id,
+		    strlen(CHUNKED_BODY), CHUNKED_BODY);
+	} else if (strcmp(path, "/close") == 0) {
+		len = asprintf(&res, "HTTP/1.1 200 OK\r\n"
+		    "X-Connection: %zu\r\n"
+		    "Connection: close\r\n"
+		    "Content-Length: 0\r\n\r\n", C->id);
+		closeafter = 1;
+	} else {
+		len = asprintf(&res, "HTTP/1.1 200 OK\r\n"
+		    "X-Connection: %zu\r\n"
+		    "Content-Length: 0\r\n\r\n", C->id);
+
+		/* Pretend that we timed out the idle connection. */
+		if (strcmp(path, "/drop") == 0)
+			closeafter = 1;
+	}
+	if (len == -1)
+		return (-1);
+
+	/* Send the response, echoing the request body if appropriate. */
+	if (writeall(C->fd, res, (size_t)len))
+		closeafter = 1;
+	if ((strcmp(path, "/echo") == 0) &&
+	    writeall(C->fd, (const char *)body, bodylen))
+		closeafter = 1;
+	free(res);
+
+	/* Should we close the connection? */
+	return (closeafter);
+}
+
+/* Handle data arriving on ${C}; return non-zero to close. */
+static int
+srv_read(struct srv_conn * C)
+{
+	char path[256];
+	ssize_t lenread;
+	const char * clen;
+	uint8_t * body;
+	size_t bodylen, copylen, reqlen;
+	size_t i;
+	int rc;
+
+	/* Read some data. */
+	if ((lenread = read(C->fd, &C->buf[C->buflen],
+	    SRV_BUFLEN - C->buflen)) <= 0)
+		return (1);
+	C->buflen += (size_t)lenread;
+
+	/* Handle complete requests. */
+	for (i = 0; i + 4 <= C->buflen; i++) {
+		if (memcmp(&C->buf[i], "\r\n\r\n", 4))
+			continue;
+
+		/* Extract the path from the request line. */
+		C->buf[i] = '\0';
+		if (sscanf(C->buf, "%*s %255s", path) != 1)
+			return (1);
+
+		/* Read the request body (if any) with blocking reads. */
+		bodylen = 0;
+		if ((clen = strstr(C->buf, "Content-Length: ")) != NULL)
+			bodylen = strtoul(&clen[16], NULL, 10);
+		if ((body = malloc(bodylen + 1)) == NULL)
+			return (1);
+		reqlen = i + 4;
+		copylen = C->buflen - reqlen;
+		if (copylen > bodylen)
+			copylen = bodylen;
+		memcpy(body, &C->buf[reqlen], copylen);
+		reqlen += copylen;
+		if (readall(C->fd, &body[copylen], bodylen - copylen)) {
+			free(body);
+			return (1);
+		}
+
+		/* Send a response. */
+		rc = srv_respond(C, path, body, bodylen);
+		free(body);
+		if (rc)
+			return (rc);
+
+		/* Shift the rest of the buffer down. */
+		memmove(C->buf, &C->buf[reqlen], C->buflen - reqlen);
+		C->buflen -= reqlen;
+		i = (size_t)(-1);
+	}
+
+	/* Drop clients which send oversized requests. */
+	return (C->buflen == SRV_BUFLEN);
+}
+
+/* Stand-in HTTP server: serve requests on connections accepted on ${s}. */
+static void
+server(int s)
+{
+	struct srv_conn * conns;
+	struct pollfd fds[SRV_MAXCONNS + 1];
+	size_t nconns = 0;
+	size_t nextid = 1;
+	size_t i;
+	int fd;
+
+	/* Allocate connection state. */
+	if ((conns = malloc(SRV_MAXCONNS * sizeof(struct srv_conn))) == NULL)
+		_exit(1);
+
+	do {
+		/* Wait for a connection or data. */
+		fds[0].fd = s;
+		fds[0].events = POLLIN;
+		for (i = 0; i < nconns; i++) {
+			fds[i + 1].fd = conns[i].fd;
+			fds[i + 1].events = POLLIN;
+		}
+		if (poll(fds, nconns + 1, -1) == -1)
+			_exit(1);
+
+		/* Handle data (or EOF) on existing connections. */
+		for (i = nconns; i > 0; i--) {
+			if (fds[i].revents == 0)
+				continue;
+			if (srv_read(&conns[i - 1]) == 0)
+				continue;
+			close(conns[i - 1].fd);
+			conns[i - 1] = conns[--nconns];
+		}
+
+		/* Accept a new connection. */
+		if (fds[0].revents & POLLIN) {
+			if ((fd = accept(s, NULL, NULL)) == -1)
+				_exit(1);
+			if (nconns == SRV_MAXCONNS) {
+				close(fd);
+				continue;
+			}
+			conns[nconns].fd = fd;
+			conns[nconns].id = nextid++;
+			conns[nconns].buflen = 0;
+			nconns++;
+		}
+	} while (1);
+}
+
+/* Callback for requests made by the connection pool test. */
+static int
+callback_pooltest(void * cookie, struct http_response * R)
+{
+	struct pooltest * T = cookie;
+	const char * id;
+
+	/* Did we get a sensible response? */
+	if ((R == NULL) || (R->status != 200) ||
+	    ((id = http_findheader(R->headers, R->nheaders,
+	    "X-Connection")) == NULL)) {
+		T->nfailed++;
+		goto done;
+	}
+
+	/* Record the connection which served this request. */
+	T->ids[T->ndone] = strtoul(id, NULL, 10);
+
+	/* Check the body of chunked responses. */
+	if ((strcmp(T->path, "/chunked") == 0) &&
+	    ((R->bodylen != strlen(CHUNKED_BODY)) ||
+	    memcmp(R->body, CHUNKED_BODY, R->bodylen)))
+		T->nfailed++;
+	free(R->body);
+
+done:
+	/* Are we done? */
+	if (++T->ndone == T->nreqs)
+		T->done = 1;
+
+	/* Success! */
+	return (0);
+}
+
+/*
+ * Send ${nreqs} requests for ${path} via ${P}, ${par} at a time.  Return the
+ * number of distinct connections used and the highest connection ID via
+ * ${nconns} and ${maxid}, or -1 if any request failed.
+ */
+static int
+pooltest(struct http_pool * P, struct sock_addr * const * sas,
+    const char * path, size_t nreqs, size_t par, size_t * nconns,
+    size_t * maxid)
+{
+	struct http_header HH[1];
+	struct http_request R;
+	struct pooltest T;
+	size_t i, j;
+
+	/* Construct the request. */
+	HH[0].header = "Host";
+	HH[0].value = "localhost";
+	R.method = "GET";
+	R.path = path;
+	R.nheaders = 1;
+	R.headers = HH;
+	R.bodylen = 0;
+	R.body = NULL;
+	R.resbuf = NULL;
+
+	/* Initialize test state. */
+	T.path = path;
+	T.ndone = T.nfailed = 0;
+	if ((T.ids = malloc(nreqs * sizeof(size_t))) == NULL)
+		goto err0;
+
+	/* Send requests in batches. */
+	for (i = 0; i < nreqs; i += par) {
+		T.nreqs = (i + par < nreqs) ? i + par : nreqs;
+		T.done = 0;
+		for (j = i; j < T.nreqs; j++) {
+			if (http_pool_request(P, sas, &R, 1024,
+			    callback_pooltest, &T) == NULL)
+				goto err1;
+		}
+		if (events_spin(&T.done))
+			goto err1;
+	}
+
+	/* Count distinct connections. */
+	for (*nconns = *maxid = 0, i = 0; i < nreqs; i++) {
+		for (j = 0; j < i; j++) {
+			if (T.ids[j] == T.ids[i])
+				break;
+		}
+		if (j == i)
+			*nconns += 1;
+		if (T.ids[i] > *maxid)
+			*maxid = T.ids[i];
+	}
+	free(T.ids);
+
+	/* Report results. */
+	printf("%s: %zu requests (%zu at once) over %zu connection(s)\n",
+	    path, nreqs, par, *nconns);
+	if (T.nfailed) {
+		warn0("%zu requests for %s failed", T.nfailed, path);
+		return (-1);
+	}
+
+	/* Success! */
+	return (0);
+
+err1:
+	free(T.ids);
+err0:
+	/* Failure! */
+	warnp("Error sending requests");
+	return (-1);
+}
+
+/* Callback for requests made by the streaming test. */
+static int
+callback_echotest(void * cookie, struct http_response * R)
+{
+	struct echotest * T = cookie;
+
+	/* The body should have been read into our buffer. */
+	if ((R == NULL) || (R->status != 200) || (R->body != T->resbuf) ||
+	    (R->bodylen != T->len) || memcmp(R->body, T->body, T->len))
+		T->failed = 1;
+
+	/* This request is done. */
+	T->done = 1;
+
+	/* Success! */
+	return (0);
+}
+
+/*
+ * Send ${nreqs} requests with ${len}-byte bodies to be echoed back via ${P},
+ * reading the responses into a buffer of our own.
+ */
+static int
+echotest(struct http_pool * P, struct sock_addr * const * sas, size_t len,
+    size_t nreqs)
+{
+	struct http_header HH[2];
+	struct http_request R;
+	struct echotest T;
+	char clen[sizeof(size_t) * 3 + 1];
+	uint8_t * body;
+	size_t i;
+
+	/* Construct a request body and allocate a response buffer. */
+	if ((body = malloc(len)) == NULL)
+		goto err0;
+	for (i = 0; i < len; i++)
+		body[i] = (uint8_t)((i * 7) ^ (i >> 8));
+	if ((T.resbuf = malloc(len)) == NULL)
+		goto err1;
+	T.body = body;
+	T.len = len;
+	T.failed = 0;
+
+	/* Construct the request. */
+	sprintf(clen, "%zu", len);
+	HH[0].header = "Host";
+	HH[0].value = "localhost";
+	HH[1].header = "Content-Length";
+	HH[1].value = clen;
+	R.method = "PUT";
+	R.path = "/echo";
+	R.nheaders = 2;
+	R.headers = HH;
+	R.bodylen = len;
+	R.body = body;
+	R.resbuf = T.resbuf;
+
+	/* Send requests one at a time. */
+	for (i = 0; (i < nreqs) && (T.failed == 0); i++) {
+		memset(T.resbuf, 0, len);
+		T.done = 0;
+		if (http_pool_request(P, sas, &R, len,
+		    callback_echotest, &T) == NULL)
+			goto err2;
+		if (events_spin(&T.done))
+			goto err2;
+	}
+
+	/* Report results. */
+	printf("/echo: %zu requests with %zu-byte bodies\n", i, len);
+	if (T.failed) {
+		warn0("Body was not echoed correctly");
+		goto err2;
+	}
+
+	/* Free buffers. */
+	free(T.resbuf);
+	free(body);
+
+	/* Success! */
+	return (0);
+
+err2:
+	free(T.resbuf);
+err1:
+	free(body);
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Test the connection pool against a local stand-in server. */
+static int
+testpool(void)
+{
+	struct sockaddr_in sin;
+	socklen_t sinlen = sizeof(sin);
+	struct http_pool * P;
+	struct sock_addr ** sas;
+	char * addr;
+	pid_t pid;
+	size_t nconns, maxid;
+	int s;
+	int rc = 1;
+
+	/* Listen on an ephemeral port on the loopback address. */
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (((s = socket(AF_INET, SOCK_STREAM, 0)) == -1) ||
+	    bind(s, (struct sockaddr *)&sin, sizeof(sin)) ||
+	    listen(s, 16) ||
+	    getsockname(s, (struct sockaddr *)&sin, &sinlen)) {
+		warnp("Cannot create listening socket");
+		goto err0;
+	}
+
+	/* Run the stand-in server in a child process. */
+	if ((pid = fork()) == -1) {
+		warnp("fork");
+		goto err0;
+	}
+	if (pid == 0)
+		server(s);
+	close(s);
+
+	/* Resolve the server address. */
+	if (asprintf(&addr, "127.0.0.1:%d", (int)ntohs(sin.sin_port)) == -1)
+		goto err1;
+	if ((sas = sock_resolve(addr)) == NULL) {
+		warnp("Cannot resolve %s", addr);
+		goto err2;
+	}
+
+	/* Create a connection pool. */
+	if ((P = http_pool_init(POOL_MAXCONNS)) == NULL)
+		goto err3;
+
+	/* Sequential requests should all share one connection. */
+	if (pooltest(P, sas, "/", 100, 1, &nconns, &maxid))
+		goto err4;
+	if (nconns != 1) {
+		warn0("Sequential requests were not sent over one connection");
+		goto err4;
+	}
+
+	/* Parallel requests must not exceed the per-endpoint limit. */
+	if (pooltest(P, sas, "/", 100, 10, &nconns, &maxid))
+		goto err4;
+	if (maxid > POOL_MAXCONNS) {
+		warn0("Opened %zu connections with a limit of %d",
+		    maxid, POOL_MAXCONNS);
+		goto err4;
+	}
+
+	/* "Connection: close" must retire the connection. */
+	if (pooltest(P, sas, "/close", 10, 1, &nconns, &maxid))
+		goto err4;
+	if (nconns != 10) {
+		warn0("Connections were reused after Connection: close");
+		goto err4;
+	}
+
+	/* Chunked responses should leave the connection reusable. */
+	if (pooltest(P, sas, "/chunked", 10, 1, &nconns, &maxid))
+		goto err4;
+	if (nconns != 1) {
+		warn0("Connections were not reused after chunked responses");
+		goto err4;
+	}
+
+	/* Connections closed by the server while idle must be retired. */
+	if (pooltest(P, sas, "/drop", 10, 1, &nconns, &maxid))
+		goto err4;
+
+	/* Request and response bodies should be streamed correctly. */
+	if (echotest(P, sas, ECHO_LEN, 10))
+		goto err4;
+
+	/* Success! */
+	rc = 0;
+
+err4:
+	http_pool_free(P);
+err3:
+	sock_addr_freelist(sas);
+err2:
+	free(addr);
+err1:
+	kill(pid, SIGTERM);
+	waitpid(pid, NULL, 0);
+err0:
+	/* Return status. */
+	return (rc);
+}
+
 static int
 donereq(void * cookie, struct http_response * R)
 {
@@ -49,9 +606,17 @@ main(int argc, char * argv[])
 
 	WARNP_INIT;
 
+	/* Test the connection pool if requested. */
+	if ((argc == 2) && (strcmp(argv[1], "pool") == 0)) {
+		if (testpool())
+			exit(1);
+		events_shutdown();
+		exit(0);
+	}
+
 	/* Sanity-check. */
 	if (argc != 3) {
-		warn0("Need two arguments (host, path)");
+		warn0("Need two arguments (host, path) or \"pool\"");
 		exit(1);
 	}
 
@@ -66,6 +631,7 @@ main(int argc, char * argv[])
 	R.headers = HH;
 	R.bodylen = 0;
 	R.body = NULL;
+	R.resbuf = NULL;
 
 	/* Resolve target addresses. */
 	if (asprintf(&s, "%s:80", argv[1]) == -1)
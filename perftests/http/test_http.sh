@@ -2,6 +2,7 @@
 
 set -e
 
+./test_http pool
 ./test_http www.google.com /
 ./test_http s3.amazonaws.com /
 ./test_http www.tarsnap.com /kivaloo.html
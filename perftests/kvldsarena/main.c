@@ -0,0 +1,288 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "crc32c.h"
+#include "events.h"
+#include "kvldskey.h"
+#include "opstats.h"
+#include "proto_kvlds.h"
+#include "sock.h"
+#include "sysendian.h"
+#include "wire.h"
+#include "warnp.h"
+
+/* Number of distinct keys which SETs are spread across. */
+#define NKEYS	1000000
+
+struct setmany_state {
+	struct wire_requestqueue * Q;
+	size_t Nsent;
+	size_t Nmax;
+	size_t Nip;
+	int failed;
+	int done;
+
+	/* Temporary key and value. */
+	struct kvldskey * key;
+	struct kvldskey * val;
+};
+
+struct stats_state {
+	uint64_t nsets;
+	uint64_t nallocs;
+	uint64_t nmallocs;
+	int failed;
+	int done;
+};
+
+static int callback_done(void *, int);
+
+static int
+sendbatch(struct setmany_state * C)
+{
+	CRC32C_CTX ctx;
+	uint8_t h[4];
+	uint8_t nbuf[8];
+
+	while ((C->Nsent < C->Nmax) && (C->Nip < 4096)) {
+		/* Scatter the keys so that batches touch many leaves. */
+		be64enc(nbuf, C->Nsent);
+		CRC32C_Init(&ctx);
+		CRC32C_Update(&ctx, nbuf, 8);
+		CRC32C_Final(h, &ctx);
+		be64enc(C->key->buf, be32dec(h) % NKEYS);
+		be64enc(C->val->buf, C->Nsent);
+
+		/* Send the request. */
+		if (proto_kvlds_request_set(C->Q, C->key, C->val,
+		    callback_done, C))
+			goto err0;
+		C->Nsent += 1;
+		C->Nip += 1;
+	}
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+static int
+callback_done(void * cookie, int failed)
+{
+	struct setmany_state * C = cookie;
+
+	/* This request is no longer in progress. */
+	C->Nip -= 1;
+
+	/* Did we fail? */
+	if (failed)
+		C->failed = 1;
+
+	/* Send more requests if possible. */
+	if (sendbatch(C))
+		goto err0;
+
+	/* Are we done? */
+	if (C->Nip == 0)
+		C->done = 1;
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+static int
+setmany(struct wire_requestqueue * Q, size_t N)
+{
+	struct setmany_state C;
+	uint8_t buf[8];	/* dummy */
+
+	/* Initialize. */
+	C.Q = Q;
+	C.Nsent = 0;
+	C.Nmax = N;
+	C.Nip = 0;
+	C.failed = 0;
+	C.done = 0;
+
+	/* Allocate key and value structures. */
+	if ((C.key = kvldskey_create(buf, 8)) == NULL)
+		goto err0;
+	if ((C.val = kvldskey_create(buf, 8)) == NULL)
+		goto err1;
+
+	/* Send an initial batch of 4096 requests. */
+	if (sendbatch(&C))
+		goto err2;
+
+	/* Wait for N SETs to complete. */
+	if (events_spin(&C.done) || C.failed) {
+		warnp("SET request failed");
+		goto err2;
+	}
+
+	/* Free the key and value structures. */
+	kvldskey_free(C.val);
+	kvldskey_free(C.key);
+
+	/* Success! */
+	return (0);
+
+err2:
+	kvldskey_free(C.val);
+err1:
+	kvldskey_free(C.key);
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+static int
+callback_stats(void * cookie, int failed, const uint8_t * buf, size_t buflen)
+{
+	struct stats_state * C = cookie;
+	struct opstats_summary * sums;
+	struct opstats_counter * ctrs;
+	size_t nsums, nctrs;
+	size_t i;
+
+	/* Parse the statistics and counters. */
+	if (failed)
+		goto done;
+	if (opstats_unserialize(buf, buflen, &sums, &nsums)) {
+		failed = 1;
+		goto done;
+	}
+	if (opstats_unserialize_counters(buf, buflen, &ctrs, &nctrs)) {
+		free(sums);
+		failed = 1;
+		goto done;
+	}
+
+	/* Extract what we want. */
+	for (i = 0; i < nsums; i++) {
+		if (sums[i].op == PROTO_KVLDS_SET)
+			C->nsets = sums[i].count;
+	}
+	for (i = 0; i < nctrs; i++) {
+		if (ctrs[i].id == PROTO_KVLDS_CTR_ARENA_ALLOCS)
+			C->nallocs = ctrs[i].value;
+		if (ctrs[i].id == PROTO_KVLDS_CTR_ARENA_MALLOCS)
+			C->nmallocs = ctrs[i].value;
+	}
+	free(ctrs);
+	free(sums);
+
+done:
+	/* We're done. */
+	C->failed = failed;
+	C->done = 1;
+
+	/* Success! */
+	return (0);
+}
+
+static int
+getstats(struct wire_requestqueue * Q, struct stats_state * C)
+{
+
+	/* Nothing seen yet. */
+	C->nsets = C->nallocs = C->nmallocs = 0;
+	C->failed = C->done = 0;
+
+	/* Send the request and wait for it to finish. */
+	if (proto_kvlds_request_stats(Q, callback_stats, C)) {
+		warnp("Error sending STATS request");
+		goto err0;
+	}
+	if (events_spin(&C->done) || C->failed) {
+		warnp("STATS request failed");
+		goto err0;
+	}
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+int
+main(int argc, char * argv[])
+{
+	struct sock_addr ** sas;
+	int s;
+	struct wire_requestqueue * Q;
+	struct stats_state S0, S1;
+	uint64_t nsets;
+	size_t N;
+
+	WARNP_INIT;
+
+	/* Check number of arguments. */
+	if (argc != 3) {
+		fprintf(stderr, "usage: test_kvldsarena %s %s\n",
+		    "<socketname>", "<nsets>");
+		exit(1);
+	}
+	N = strtoul(argv[2], NULL, 0);
+
+	/* Resolve the socket address and connect. */
+	if ((sas = sock_resolve(argv[1])) == NULL) {
+		warnp("Error resolving socket address: %s", argv[1]);
+		exit(1);
+	}
+	if (sas[0] == NULL) {
+		warn0("No addresses found for %s", argv[1]);
+		exit(1);
+	}
+	if ((s = sock_connect(sas)) == -1)
+		exit(1);
+
+	/* Create a request queue. */
+	if ((Q = wire_requestqueue_init(s)) == NULL) {
+		warnp("Cannot create packet write queue");
+		exit(1);
+	}
+
+	/* Perform N SETs, reading statistics before and after. */
+	if (getstats(Q, &S0))
+		exit(1);
+	if (setmany(Q, N))
+		exit(1);
+	if (getstats(Q, &S1))
+		exit(1);
+
+	/* Report allocations per SET. */
+	if ((nsets = S1.nsets - S0.nsets) == 0) {
+		warn0("No SETs were recorded");
+		exit(1);
+	}
+	printf("SETs committed: %" PRIu64 "\n", nsets);
+	printf("Batch allocations per SET: %.2f\n",
+	    (double)(S1.nallocs - S0.nallocs) / (double)nsets);
+	printf("Batch mallocs per SET: %.6f\n",
+	    (double)(S1.nmallocs - S0.nmallocs) / (double)nsets);
+
+	/* Free the request queue. */
+	wire_requestqueue_destroy(Q);
+	wire_requestqueue_free(Q);
+
+	/* Free socket addresses. */
+	sock_addr_freelist(sas);
+
+	/* Shut down the event subsystem. */
+	events_shutdown();
+
+	/* Success! */
+	exit(0);
+}
@@ -0,0 +1,31 @@
+#!/bin/sh
+
+set -e
+
+# Number of SETs to perform.
+NSETS=${NSETS:-2000000}
+
+# Which kvlds to test; set KVLDS to compare against another build.
+KVLDS=${KVLDS:-../../kvlds/kvlds}
+
+# Print the CPU time used so far by process $1, in seconds.
+cputime() {
+	ps -o time= -p $1 |
+	    awk -F '[-:]' '{ i = 1; if (NF == 4) { $2 += $1 * 24; i = 2 }
+		for (s = 0; i <= NF; i++) s = s * 60 + $i; print s }'
+}
+
+rm -rf stor
+mkdir stor
+[ `uname` = "FreeBSD" ] && chflags nodump stor
+../../lbs/lbs -s `pwd`/stor/sock_lbs -d stor -b 4096
+${KVLDS} -s `pwd`/stor/sock_kvlds -l `pwd`/stor/sock_lbs
+T0=`cputime $(cat stor/sock_kvlds.pid)`
+./test_kvldsarena `pwd`/stor/sock_kvlds ${NSETS}
+T1=`cputime $(cat stor/sock_kvlds.pid)`
+echo "$T0 $T1 ${NSETS}" |
+    awk '{ printf "kvlds CPU per SET: %.2f us\n", ($2 - $1) * 1000000 / $3 }'
+kill `cat stor/sock_kvlds.pid`
+kill `cat stor/sock_lbs.pid`
+rm -f stor/sock*
+rm -r stor
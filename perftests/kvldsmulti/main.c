@@ -0,0 +1,326 @@
+#include <sys/time.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "events.h"
+#include "kvldskey.h"
+#include "monoclock.h"
+#include "proto_kvlds.h"
+#include "sock.h"
+#include "sysendian.h"
+#include "wire.h"
+#include "warnp.h"
+
+/* Maximum number of keys in flight at once. */
+#define MAXIP	4096
+
+/* Ways of accessing keys. */
+#define MODE_SET	0
+#define MODE_MSET	1
+#define MODE_GET	2
+#define MODE_MGET	3
+
+struct multi_state {
+	struct wire_requestqueue * Q;
+	int mode;
+	size_t batchlen;
+	size_t Nsent;
+	size_t Nmax;
+	size_t Nip;
+	int failed;
+	int done;
+
+	/* Temporary keys and values. */
+	struct kvldskey ** keys;
+	struct kvldskey ** vals;
+};
+
+/* Cookie for a single request. */
+struct req_cookie {
+	struct multi_state * C;
+	size_t nkeys;
+};
+
+static int callback_done(void *, int);
+static int callback_get(void *, int, struct kvldskey *);
+static int callback_mget(void *, int, struct kvldskey **);
+
+static int
+sendbatch(struct multi_state * C)
+{
+	struct req_cookie * R;
+	size_t nkeys;
+	size_t i;
+
+	while ((C->Nsent < C->Nmax) && (C->Nip < MAXIP)) {
+		/* How many keys go into this request? */
+		nkeys = C->Nmax - C->Nsent;
+		if ((C->mode == MODE_SET) || (C->mode == MODE_GET))
+			nkeys = 1;
+		else if (nkeys > C->batchlen)
+			nkeys = C->batchlen;
+
+		/* Fill in keys and values. */
+		for (i = 0; i < nkeys; i++) {
+			be64enc(C->keys[i]->buf, C->Nsent + i);
+			be64enc(C->vals[i]->buf, C->Nsent + i);
+		}
+
+		/* Bake a cookie. */
+		if ((R = malloc(sizeof(struct req_cookie))) == NULL)
+			goto err0;
+		R->C = C;
+		R->nkeys = nkeys;
+
+		/* Send the request. */
+		switch (C->mode) {
+		case MODE_SET:
+			if (proto_kvlds_request_set(C->Q, C->keys[0],
+			    C->vals[0], callback_done, R))
+				goto err1;
+			break;
+		case MODE_MSET:
+			if (proto_kvlds_request_mset(C->Q, nkeys,
+			    (const struct kvldskey * const *)C->keys,
+			    (const struct kvldskey * const *)C->vals,
+			    callback_done, R))
+				goto err1;
+			break;
+		case MODE_GET:
+			if (proto_kvlds_request_get(C->Q, C->keys[0],
+			    callback_get, R))
+				goto err1;
+			break;
+		case MODE_MGET:
+			if (proto_kvlds_request_mget(C->Q, nkeys,
+			    (const struct kvldskey * const *)C->keys,
+			    callback_mget, R))
+				goto err1;
+			break;
+		}
+		C->Nsent += nkeys;
+		C->Nip += nkeys;
+	}
+
+	/* Success! */
+	return (0);
+
+err1:
+	free(R);
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* A request covering ${R->nkeys} keys has completed. */
+static int
+reqdone(struct req_cookie * R, int failed)
+{
+	struct multi_state * C = R->C;
+
+	/* These keys are no longer in progress. */
+	C->Nip -= R->nkeys;
+	free(R);
+
+	/* Did we fail? */
+	if (failed)
+		C->failed = 1;
+
+	/* Send more requests if possible. */
+	if (sendbatch(C))
+		goto err0;
+
+	/* Are we done? */
+	if (C->Nip == 0)
+		C->done = 1;
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+static int
+callback_done(void * cookie, int failed)
+{
+
+	return (reqdone(cookie, failed));
+}
+
+static int
+callback_get(void * cookie, int failed, struct kvldskey * value)
+{
+
+	/* Every key should be present. */
+	if ((failed == 0) && (value == NULL))
+		failed = 1;
+	kvldskey_free(value);
+
+	return (reqdone(cookie, failed));
+}
+
+static int
+callback_mget(void * cookie, int failed, struct kvldskey ** values)
+{
+	struct req_cookie * R = cookie;
+	size_t i;
+
+	/* Every key should be present. */
+	if (failed == 0) {
+		for (i = 0; i < R->nkeys; i++) {
+			if (values[i] == NULL)
+				failed = 1;
+			kvldskey_free(values[i]);
+		}
+		free(values);
+	}
+
+	return (reqdone(R, failed));
+}
+
+/* Access ${N} keys in mode ${mode}, and print the time taken per key. */
+static int
+multi(struct wire_requestqueue * Q, int mode, size_t N, size_t batchlen,
+    const char * name)
+{
+	struct multi_state C;
+	struct timeval t0, t1;
+	uint8_t buf[8];	/* dummy */
+	size_t i;
+
+	/* Initialize. */
+	C.Q = Q;
+	C.mode = mode;
+	C.batchlen = batchlen;
+	C.Nsent = 0;
+	C.Nmax = N;
+	C.Nip = 0;
+	C.failed = 0;
+	C.done = 0;
+
+	/* Allocate key and value structures. */
+	if ((C.keys = calloc(batchlen, sizeof(struct kvldskey *))) == NULL)
+		goto err0;
+	if ((C.vals = calloc(batchlen, sizeof(struct kvldskey *))) == NULL)
+		goto err1;
+	for (i = 0; i < batchlen; i++) {
+		if ((C.keys[i] = kvldskey_create(buf, 8)) == NULL)
+			goto err2;
+		if ((C.vals[i] = kvldskey_create(buf, 8)) == NULL)
+			goto err2;
+	}
+
+	/* Send an initial batch of requests and wait for them all. */
+	if (monoclock_get(&t0))
+		goto err2;
+	if (sendbatch(&C))
+		goto err2;
+	if (events_spin(&C.done) || C.failed) {
+		warnp("%s request failed", name);
+		goto err2;
+	}
+	if (monoclock_get(&t1))
+		goto err2;
+
+	/* Report the time per key. */
+	printf("%s: %.2f us per key\n", name,
+	    ((double)(t1.tv_sec - t0.tv_sec) * 1000000.0 +
+	    (double)(t1.tv_usec - t0.tv_usec)) / (double)N);
+
+	/* Free the key and value structures. */
+	for (i = 0; i < batchlen; i++) {
+		kvldskey_free(C.vals[i]);
+		kvldskey_free(C.keys[i]);
+	}
+	free(C.vals);
+	free(C.keys);
+
+	/* Success! */
+	return (0);
+
+err2:
+	for (i = 0; i < batchlen; i++) {
+		kvldskey_free(C.vals[i]);
+		kvldskey_free(C.keys[i]);
+	}
+	free(C.vals);
+err1:
+	free(C.keys);
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+int
+main(int argc, char * argv[])
+{
+	struct sock_addr ** sas;
+	int s;
+	struct wire_requestqueue * Q;
+	size_t N;
+	size_t B;
+
+	WARNP_INIT;
+
+	/* Check number of arguments. */
+	if (argc != 4) {
+		fprintf(stderr, "usage: test_kvldsmulti %s %s %s\n",
+		    "<socketname>", "<nkeys>", "<batchlen>");
+		exit(1);
+	}
+	N = strtoul(argv[2], NULL, 0);
+	B = strtoul(argv[3], NULL, 0);
+	if ((N == 0) || (B == 0) || (B > PROTO_KVLDS_MMAX)) {
+		warn0("Invalid number of keys or batch length");
+		exit(1);
+	}
+
+	/* Resolve the socket address and connect. */
+	if ((sas = sock_resolve(argv[1])) == NULL) {
+		warnp("Error resolving socket address: %s", argv[1]);
+		exit(1);
+	}
+	if (sas[0] == NULL) {
+		warn0("No addresses found for %s", argv[1]);
+		exit(1);
+	}
+	if ((s = sock_connect(sas)) == -1)
+		exit(1);
+
+	/* Create a request queue. */
+	if ((Q = wire_requestqueue_init(s)) == NULL) {
+		warnp("Cannot create packet write queue");
+		exit(1);
+	}
+
+	/*
+	 * Write the keys one at a time and then in batches, and read them
+	 * back the same ways.
+	 */
+	if (multi(Q, MODE_SET, N, B, "SET"))
+		exit(1);
+	if (multi(Q, MODE_MSET, N, B, "MSET"))
+		exit(1);
+	if (multi(Q, MODE_GET, N, B, "GET"))
+		exit(1);
+	if (multi(Q, MODE_MGET, N, B, "MGET"))
+		exit(1);
+
+	/* Free the request queue. */
+	wire_requestqueue_destroy(Q);
+	wire_requestqueue_free(Q);
+
+	/* Free socket addresses. */
+	sock_addr_freelist(sas);
+
+	/* Shut down the event subsystem. */
+	events_shutdown();
+
+	/* Success! */
+	exit(0);
+}
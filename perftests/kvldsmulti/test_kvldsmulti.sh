@@ -0,0 +1,20 @@
+#!/bin/sh
+
+set -e
+
+# Number of keys to write and read.
+NKEYS=${NKEYS:-1000000}
+
+# Number of keys in each MSET or MGET.
+BATCHLEN=${BATCHLEN:-100}
+
+rm -rf stor
+mkdir stor
+[ `uname` = "FreeBSD" ] && chflags nodump stor
+../../lbs/lbs -s `pwd`/stor/sock_lbs -d stor -b 4096
+../../kvlds/kvlds -s `pwd`/stor/sock_kvlds -l `pwd`/stor/sock_lbs
+./test_kvldsmulti `pwd`/stor/sock_kvlds ${NKEYS} ${BATCHLEN}
+kill `cat stor/sock_kvlds.pid`
+kill `cat stor/sock_lbs.pid`
+rm -f stor/sock*
+rm -r stor
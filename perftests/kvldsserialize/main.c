@@ -0,0 +1,292 @@
+#include <sys/time.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "crc32c.h"
+#include "imalloc.h"
+#include "kvldskey.h"
+#include "kvpair.h"
+#include "monoclock.h"
+#include "parsenum.h"
+#include "sysendian.h"
+#include "warnp.h"
+
+#include "node.h"
+#include "serialize.h"
+
+/* Length of the keys and values in the page. */
+#define KEYLEN	8
+#define VALLEN	40
+
+/* Return the number of microseconds per operation since ${tv_start}. */
+static int
+usper(const struct timeval * tv_start, size_t nops, double * us)
+{
+	struct timeval tv_end;
+
+	/* Get the current time. */
+	if (monoclock_get(&tv_end)) {
+		warnp("monoclock_get");
+		goto err0;
+	}
+
+	/* Compute the average time per operation. */
+	*us = ((double)(tv_end.tv_sec - tv_start->tv_sec) * 1000000.0 +
+	    (double)(tv_end.tv_usec - tv_start->tv_usec)) / (double)nops;
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Fill the leaf ${N} with as many key-value pairs as fit into ${pagelen}. */
+static int
+mkleaf(struct node * N, size_t pagelen, struct kvpair_const ** pairs)
+{
+	struct kvldskey * k;
+	struct kvldskey * v;
+	uint8_t kbuf[KEYLEN];
+	uint8_t vbuf[VALLEN];
+	size_t nkeys;
+	size_t i;
+
+	/* Figure out how many pairs fit into the page. */
+	nkeys = (pagelen - SERIALIZE_OVERHEAD) / (KEYLEN + VALLEN + 2);
+
+	/* Allocate arrays of pairs. */
+	if (IMALLOC(N->u.pairs, nkeys, struct kvpair_const))
+		goto err0;
+	if (IMALLOC(*pairs, nkeys, struct kvpair_const))
+		goto err1;
+
+	/* Create the pairs. */
+	memset(vbuf, 'v', VALLEN);
+	for (i = 0; i < nkeys; i++) {
+		be64enc(kbuf, i);
+		be64enc(vbuf, i * 7);
+		if ((k = kvldskey_create(kbuf, KEYLEN)) == NULL)
+			goto err2;
+		if ((v = kvldskey_create(vbuf, VALLEN)) == NULL) {
+			kvldskey_free(k);
+			goto err2;
+		}
+		(*pairs)[i].k = k;
+		(*pairs)[i].v = v;
+	}
+
+	/* This is a dirty non-root leaf. */
+	N->type = NODE_TYPE_LEAF;
+	N->state = NODE_STATE_DIRTY;
+	N->root = 0;
+	N->height = 0;
+	N->nkeys = nkeys;
+	N->mlen_t = 0;
+
+	/* Success! */
+	return (0);
+
+err2:
+	while (i-- > 0) {
+		kvldskey_free((struct kvldskey *)(uintptr_t)(*pairs)[i].k);
+		kvldskey_free((struct kvldskey *)(uintptr_t)(*pairs)[i].v);
+	}
+	free(*pairs);
+err1:
+	free(N->u.pairs);
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Serialize the leaf ${N} ${n} times; leave the last page in ${N}. */
+static int
+bench_serialize(struct node * N, const struct kvpair_const * pairs,
+    size_t pagelen, size_t n, double * us)
+{
+	struct timeval tv_start;
+	size_t i;
+
+	/* Start timing. */
+	if (monoclock_get(&tv_start)) {
+		warnp("monoclock_get");
+		goto err0;
+	}
+
+	/* Serialize the page repeatedly. */
+	for (i = 0; i < n; i++) {
+		/* Point the node back at the keys and values. */
+		free(N->pagebuf);
+		N->pagebuf = NULL;
+		N->pagesize = (uint32_t)(-1);
+		memcpy(N->u.pairs, pairs,
+		    N->nkeys * sizeof(struct kvpair_const));
+
+		/* Serialize it. */
+		if (serialize(NULL, N, pagelen)) {
+			warnp("serialize");
+			goto err0;
+		}
+	}
+
+	/* Compute time per page. */
+	return (usper(&tv_start, n, us));
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Deserialize the ${pagelen}-byte page ${buf} ${n} times. */
+static int
+bench_deserialize(const uint8_t * buf, size_t pagelen, size_t n, double * us)
+{
+	struct timeval tv_start;
+	struct node * N;
+	size_t i;
+
+	/* Start timing. */
+	if (monoclock_get(&tv_start)) {
+		warnp("monoclock_get");
+		goto err0;
+	}
+
+	/* Deserialize the page repeatedly. */
+	for (i = 0; i < n; i++) {
+		/* Create a node which is being read. */
+		if ((N = node_alloc(0, 0, (uint32_t)pagelen)) == NULL) {
+			warnp("node_alloc");
+			goto err0;
+		}
+		N->type = NODE_TYPE_READ;
+
+		/* Deserialize the page into it. */
+		if (deserialize(N, buf, pagelen)) {
+			warnp("deserialize");
+			node_free(N);
+			goto err0;
+		}
+
+		/* Free the node. */
+		free(N->u.pairs);
+		free(N->pagebuf);
+		node_free(N);
+	}
+
+	/* Compute time per page. */
+	return (usper(&tv_start, n, us));
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Compute the CRC32C of the ${pagelen}-byte page ${buf} ${n} times. */
+static int
+bench_crc(const uint8_t * buf, size_t pagelen, size_t n, double * us)
+{
+	struct timeval tv_start;
+	CRC32C_CTX ctx;
+	uint8_t cbuf[4];
+	uint8_t x = 0;
+	size_t i;
+
+	/* Start timing. */
+	if (monoclock_get(&tv_start)) {
+		warnp("monoclock_get");
+		goto err0;
+	}
+
+	/* Checksum the page repeatedly. */
+	for (i = 0; i < n; i++) {
+		CRC32C_Init(&ctx);
+		CRC32C_Update(&ctx, buf, pagelen);
+		CRC32C_Final(cbuf, &ctx);
+		x ^= cbuf[0];
+	}
+
+	/* Don't let the compiler optimize the CRCs away. */
+	if (x == 0xff)
+		printf(" ");
+
+	/* Compute time per page. */
+	return (usper(&tv_start, n, us));
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+int
+main(int argc, char * argv[])
+{
+	struct node * N;
+	struct kvpair_const * pairs;
+	size_t pagelen;
+	size_t n;
+	size_t i;
+	double us_ser, us_deser, us_crc;
+
+	WARNP_INIT;
+
+	/* Check number of arguments. */
+	if (argc != 3) {
+		fprintf(stderr, "usage: test_kvldsserialize %s %s\n",
+		    "<page size>", "<# pages>");
+		exit(1);
+	}
+
+	/* Parse arguments. */
+	if (PARSENUM(&pagelen, argv[1], 512, 131072)) {
+		warnp("Invalid page size: %s", argv[1]);
+		exit(1);
+	}
+	if (PARSENUM(&n, argv[2]) || (n == 0)) {
+		warnp("Invalid number of pages: %s", argv[2]);
+		exit(1);
+	}
+
+	/* Create a full leaf. */
+	if ((N = node_alloc(0, 0, (uint32_t)(-1))) == NULL) {
+		warnp("node_alloc");
+		exit(1);
+	}
+	if (mkleaf(N, pagelen, &pairs)) {
+		warnp("Cannot create leaf");
+		exit(1);
+	}
+
+	/* Serialize the leaf, and deserialize the page it produces. */
+	if (bench_serialize(N, pairs, pagelen, n, &us_ser))
+		exit(1);
+	if (bench_deserialize(N->pagebuf, pagelen, n, &us_deser))
+		exit(1);
+
+	/* How much of that is the CRC32C trailer? */
+	if (bench_crc(N->pagebuf, N->pagesize - 4, n, &us_crc))
+		exit(1);
+
+	/* Print results. */
+	printf("%zu-byte pages holding %zu pairs:\n", pagelen, N->nkeys);
+	printf("serialize: %.3f us/page\n", us_ser);
+	printf("deserialize: %.3f us/page\n", us_deser);
+	printf("CRC32C of page data: %.3f us/page\n", us_crc);
+
+	/* Free the leaf. */
+	for (i = 0; i < N->nkeys; i++) {
+		kvldskey_free((struct kvldskey *)(uintptr_t)pairs[i].k);
+		kvldskey_free((struct kvldskey *)(uintptr_t)pairs[i].v);
+	}
+	free(pairs);
+	free(N->u.pairs);
+	free(N->pagebuf);
+	node_free(N);
+
+	/* Success! */
+	exit(0);
+}
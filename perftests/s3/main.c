@@ -1,14 +1,26 @@
+#include <sys/time.h>
+
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "aws_readkeys.h"
 #include "events.h"
+#include "hexify.h"
 #include "http.h"
+#include "md5.h"
+#include "monoclock.h"
+#include "parsenum.h"
+#include "s3_checksum.h"
 #include "s3_request.h"
+#include "s3_verifyetag.h"
 #include "sock.h"
 #include "warnp.h"
 
+/* Verify at least this many bytes with each method. */
+#define VERIFY_TOTAL	(1024 * 1024 * 1024)
+
 static int
 donereq(void * cookie, struct http_response * R)
 {
@@ -40,6 +52,99 @@ donereq(void * cookie, struct http_response * R)
 	return (0);
 }
 
+/* Verify ${res} until we've covered VERIFY_TOTAL bytes; print the CPU time. */
+static int
+verifyperf(const char * name, int (* verify)(struct http_response *),
+    struct http_response * res)
+{
+	struct timeval tv_start, tv_end;
+	uint64_t total;
+	double t;
+
+	/* Verify the response repeatedly. */
+	if (monoclock_get_cputime(&tv_start))
+		goto err0;
+	for (total = 0; total < VERIFY_TOTAL; total += res->bodylen) {
+		if (verify(res) == 0) {
+			warn0("%s verification failed", name);
+			goto err0;
+		}
+	}
+	if (monoclock_get_cputime(&tv_end))
+		goto err0;
+
+	/* Report the CPU time per GB verified. */
+	t = (double)(tv_end.tv_sec - tv_start.tv_sec) +
+	    (double)(tv_end.tv_usec - tv_start.tv_usec) * 0.000001;
+	printf("%s: %.3f s CPU per GB verified\n", name,
+	    t * (1024 * 1024 * 1024) / (double)total);
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Compare the CPU cost of verifying ${len}-byte objects via MD5 and CRC32C. */
+static int
+verify(size_t len)
+{
+	struct http_response res;
+	struct http_header headers[2];
+	uint8_t md5[16];
+	char etag[35];
+	char crc32c[9];
+	size_t i;
+
+	/* Construct a response with an arbitrary body. */
+	res.status = 200;
+	res.bodylen = len;
+	if ((res.body = malloc(len)) == NULL) {
+		warnp("malloc");
+		goto err0;
+	}
+	for (i = 0; i < len; i++)
+		res.body[i] = (uint8_t)(i * 7 + (i >> 10));
+
+	/* Give it the headers which S3 would. */
+	MD5_Buf(res.body, len, md5);
+	etag[0] = '"';
+	hexify(md5, &etag[1], 16);
+	etag[33] = '"';
+	etag[34] = '\0';
+	s3_checksum_crc32c(res.body, len, crc32c);
+	headers[0].header = "ETag";
+	headers[0].value = etag;
+	headers[1].header = "x-amz-checksum-crc32c";
+	headers[1].value = crc32c;
+
+	/* Verify via the ETag alone. */
+	res.headers = headers;
+	res.nheaders = 1;
+	if (verifyperf("MD5 (ETag)", s3_verifyetag, &res))
+		goto err1;
+
+	/* Verify via the x-amz-checksum-crc32c header. */
+	res.nheaders = 2;
+	if (verifyperf("CRC32C (x-amz-checksum-crc32c)", s3_checksum_verify,
+	    &res))
+		goto err1;
+
+	/* Free the body. */
+	free(res.body);
+
+	/* Success! */
+	return (0);
+
+err1:
+	free(res.body);
+err0:
+	/* Failure! */
+	return (-1);
+}
+
 int
 main(int argc, char * argv[])
 {
@@ -47,13 +152,26 @@ main(int argc, char * argv[])
 	char * key_secret;
 	struct s3_request R;
 	struct sock_addr ** sas;
+	size_t len;
 	int done;
 
 	WARNP_INIT;
 
+	/* Measure the CPU cost of verifying downloaded objects? */
+	if ((argc == 3) && (strcmp(argv[1], "-v") == 0)) {
+		if (PARSENUM(&len, argv[2], 1, SIZE_MAX)) {
+			warnp("Invalid object size: %s", argv[2]);
+			exit(1);
+		}
+		if (verify(len))
+			exit(1);
+		exit(0);
+	}
+
 	/* Sanity-check. */
 	if (argc != 2) {
 		fprintf(stderr, "usage: test_s3 %s\n", "<keyfile>");
+		fprintf(stderr, "       test_s3 -v %s\n", "<object size>");
 		exit(1);
 	}
 
@@ -77,10 +195,11 @@ main(int argc, char * argv[])
 	R.headers = NULL;
 	R.bodylen = strlen("ha-ha\n");
 	R.body = (const uint8_t *)"ha-ha\n";
+	R.resbuf = NULL;
 
 	/* Send PUT request. */
 	done = 0;
-	(void)s3_request(sas, key_id, key_secret, "us-west-2",
+	(void)s3_request(NULL, NULL, sas, key_id, key_secret, "us-west-2",
 	    &R, 0, donereq, &done);
 
 	/* Wait for request to complete. */
@@ -97,10 +216,11 @@ main(int argc, char * argv[])
 	R.headers = NULL;
 	R.bodylen = 0;
 	R.body = NULL;
+	R.resbuf = NULL;
 
 	/* Send PUT request. */
 	done = 0;
-	(void)s3_request(sas, key_id, key_secret, "us-west-2",
+	(void)s3_request(NULL, NULL, sas, key_id, key_secret, "us-west-2",
 	    &R, 6, donereq, &done);
 
 	/* Wait for request to complete. */
@@ -1,3 +1,5 @@
+#include <sys/time.h>
+
 #include <assert.h>
 #include <fcntl.h>
 #include <inttypes.h>
@@ -6,12 +8,15 @@
 
 #include "asprintf.h"
 #include "http.h"
+#include "monoclock.h"
 #include "netbuf.h"
 #include "network.h"
+#include "opstats.h"
 #include "proto_s3.h"
+#include "s3_checksum.h"
+#include "s3_multipart.h"
 #include "s3_request.h"
 #include "s3_request_queue.h"
-#include "s3_verifyetag.h"
 #include "warnp.h"
 #include "wire.h"
 
@@ -24,10 +29,14 @@ struct request {
 	struct request * next;		/* Next request or NULL. */
 	struct proto_s3_request R;	/* kivaloo-S3 protocol request. */
 	struct s3_request req;		/* S3 request. */
+	struct s3_multipart * mpu;	/* Multipart upload, or NULL. */
 	char * path;			/* "/object". */
 	char * range;			/* "bytes=X-Y". */
 	size_t maxrlen;			/* Maximum response length. */
-	struct http_header hdr;		/* For Range: if needed. */
+	struct http_header hdr;		/* Range or checksum header. */
+	char crc32c[9];			/* Base-64 CRC32C of PUT data. */
+	struct timeval t_arrive;	/* When the request was read. */
+	struct timeval t_start;		/* When it was sent to S3. */
 };
 
 /* State of the work dispatcher. */
@@ -35,6 +44,9 @@ struct dispatch_state {
 	/* S3 request queue. */
 	struct s3_request_queue * Q;
 
+	/* Request latency statistics. */
+	struct opstats * stats;
+
 	/* In-progress requests. */
 	struct request * ip_head;
 	struct request * ip_tail;
@@ -49,6 +61,70 @@ struct dispatch_state {
 
 static int callback_accept(void *, int);
 static int callback_response(void *, struct http_response *);
+static int callback_mput(void *, int);
+
+/*
+ * Record that a request of type ${type} which arrived at ${t_arrive} and was
+ * passed to the S3 request queue at ${t_start} has been completed.
+ */
+static int
+record(struct dispatch_state * D, uint32_t type,
+    const struct timeval * t_arrive, const struct timeval * t_start)
+{
+	struct timeval t_done;
+
+	/* What time is it now? */
+	if (monoclock_get(&t_done))
+		goto err0;
+
+	/* Record the request latency. */
+	if (opstats_record(D->stats, type, t_arrive, t_start, &t_done))
+		goto err0;
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Answer the STATS request ${R} and free it. */
+static int
+sendstats(struct dispatch_state * D, struct request * R)
+{
+	uint8_t * buf;
+	size_t buflen;
+
+	/* Serialize the statistics we have so far. */
+	if (opstats_serialize(D->stats, &buf, &buflen))
+		goto err1;
+
+	/* Send the response. */
+	if (proto_s3_response_stats(D->writeq, R->R.ID, buflen, buf))
+		goto err2;
+
+	/* Record the request latency. */
+	if (record(D, PROTO_S3_STATS, &R->t_arrive, &R->t_arrive))
+		goto err2;
+
+	/* Free the serialized statistics and the request. */
+	free(buf);
+	proto_s3_request_free(&R->R);
+	free(R);
+
+	/* Success! */
+	return (0);
+
+err2:
+	free(buf);
+err1:
+	proto_s3_request_free(&R->R);
+	free(R);
+
+	/* Failure! */
+	return (-1);
+}
 
 /* Remove a request from the in-progress list. */
 static void
@@ -58,12 +134,17 @@ request_dequeue(struct dispatch_state * D, struct request * R)
 	/* Sanity-check linked list. */
 	assert(D == R->D);
 
+	/* Free any multipart upload state (the S3 queue has been flushed). */
+	if (R->mpu != NULL)
+		s3_multipart_cancel(R->mpu);
+
 	/* Free the contents of the kivaloo-S3 request structure. */
 	proto_s3_request_free(&R->R);
 
 	/* Free extra allocations in the S3 request structure. */
 	free(R->path);
 	free(R->range);
+	free(R->req.resbuf);
 
 	/* Remove from the linked list. */
 	if (D->ip_head == R) {
@@ -112,12 +193,23 @@ dropconnection(void * cookie)
 	return (0);
 }
 
+/* Should this request be performed as a multipart upload? */
+static int
+ismultipart(struct request * R)
+{
+
+	return ((R->R.type == PROTO_S3_MPUT) &&
+	    (R->R.r.put.partlen >= S3_MULTIPART_MINPART) &&
+	    (R->R.r.put.len > R->R.r.put.partlen));
+}
+
 /* Read and dispatch incoming request(s). */
 static int
 gotrequest(void * cookie, int status)
 {
 	struct dispatch_state * D = cookie;
 	struct request * R;
+	struct timeval t_arrive;
 
 	/* We're no longer waiting for a packet to arrive. */
 	D->read_cookie = NULL;
@@ -126,6 +218,10 @@ gotrequest(void * cookie, int status)
 	if (status)
 		goto drop;
 
+	/* Requests read now are considered to have arrived now. */
+	if (monoclock_get(&t_arrive))
+		goto err0;
+
 	/* Read packets until there are no more or an error occurs. */
 	do {
 		/* Allocate space for a request. */
@@ -140,6 +236,14 @@ gotrequest(void * cookie, int status)
 		/* If we have no request, stop looping. */
 		if (R->R.type == PROTO_S3_NONE)
 			break;
+		R->t_arrive = t_arrive;
+
+		/* STATS requests are answered immediately. */
+		if (R->R.type == PROTO_S3_STATS) {
+			if (sendstats(D, R))
+				goto err0;
+			continue;
+		}
 
 		/* Fill in the bucket and path fields. */
 		R->req.bucket = R->R.bucket;
@@ -152,21 +256,49 @@ gotrequest(void * cookie, int status)
 		R->req.headers = NULL;
 		R->req.bodylen = 0;
 		R->req.body = NULL;
+		R->req.resbuf = NULL;
 		R->maxrlen = 0;
 		R->range = NULL;
+		R->mpu = NULL;
 
 		/* Construct S3 request. */
 		switch (R->R.type) {
 		case PROTO_S3_PUT:
-			/* PUT has a body and body length. */
+		case PROTO_S3_MPUT:
+			/*
+			 * PUT has a body and body length; MPUT is the same if
+			 * the object fits into a single part.
+			 */
 			R->req.method = "PUT";
 			R->req.bodylen = R->R.r.put.len;
 			R->req.body = R->R.r.put.buf;
+
+			/*
+			 * Send the CRC32C of the data so that S3 can check
+			 * it and store it for checking the data when we GET
+			 * it back.  (Multipart uploads send their own.)
+			 */
+			if (ismultipart(R))
+				break;
+			s3_checksum_crc32c(R->req.body, R->req.bodylen,
+			    R->crc32c);
+			R->hdr.header = "x-amz-checksum-crc32c";
+			R->hdr.value = R->crc32c;
+			R->req.nheaders = 1;
+			R->req.headers = &R->hdr;
 			break;
 		case PROTO_S3_GET:
-			/* GET has a maximum read length. */
+			/*
+			 * GET has a maximum read length, and asks S3 to send
+			 * the object's CRC32C (if it has one) so that we can
+			 * check the data without computing its MD5 hash.
+			 */
 			R->req.method = "GET";
 			R->maxrlen = R->R.r.get.maxlen;
+			R->hdr.header = "x-amz-checksum-mode";
+			R->hdr.value = "ENABLED";
+			R->req.nheaders = 1;
+			R->req.headers = &R->hdr;
 			break;
 		case PROTO_S3_RANGE:
 			/* Construct a Range header. */
@@ -183,6 +315,14 @@ gotrequest(void * cookie, int status)
 			R->hdr.value = R->range;
 			R->req.nheaders = 1;
 			R->req.headers = &R->hdr;
+
+			/*
+			 * We know how much data we're going to get, so have
+			 * the body read directly into a buffer of that size.
+			 */
+			if ((R->maxrlen > 0) &&
+			    ((R->req.resbuf = malloc(R->maxrlen)) == NULL))
+				goto err3;
 			break;
 		case PROTO_S3_HEAD:
 			/* HEAD has no parameters. */
@@ -197,10 +337,17 @@ gotrequest(void * cookie, int status)
 			assert(0);
 		}
 
-		/* Add the request to the S3 queue. */
-		if (s3_request_queue(D->Q, &R->req, R->maxrlen,
+		/* Add the request to the S3 queue, or start an upload. */
+		if (monoclock_get(&R->t_start))
+			goto err4;
+		if (ismultipart(R)) {
+			if ((R->mpu = s3_multipart_put(D->Q, R->req.bucket,
+			    R->path, R->R.r.put.len, R->R.r.put.buf,
+			    R->R.r.put.partlen, callback_mput, R)) == NULL)
+				goto err4;
+		} else if (s3_request_queue(D->Q, &R->req, R->maxrlen,
 		    callback_response, R))
-			goto err3;
+			goto err4;
 
 		/* Add to the linked list. */
 		if ((R->prev = D->ip_tail) == NULL) {
@@ -234,6 +381,8 @@ drop:
 	/* All is good. */
 	return (0);
 
+err4:
+	free(R->req.resbuf);
 err3:
 	free(R->range);
 err2:
@@ -257,12 +406,13 @@ callback_response(void * cookie, struct http_response * res)
 	/* Send appropriate response back to the client. */
 	switch (R->R.type) {
 	case PROTO_S3_PUT:
+	case PROTO_S3_MPUT:
 		if (proto_s3_response_put(D->writeq, R->R.ID, res->status))
 			goto err1;
 		break;
 	case PROTO_S3_GET:
-		/* Verify that we have a body and the ETag is correct. */
-		if ((res->body == NULL) || (s3_verifyetag(res) == 0))
+		/* Verify that we have a body and its checksum is correct. */
+		if ((res->body == NULL) || (s3_checksum_verify(res) == 0))
 			res->status = 0;
 
 		/* Send the response. */
@@ -295,8 +445,46 @@ callback_response(void * cookie, struct http_response * res)
 			goto err1;
 	}
 
-	/* Free the response body buffer. */
-	free(res->body);
+	/* Record the request latency. */
+	if (record(D, R->R.type, &R->t_arrive, &R->t_start))
+		goto err1;
+
+	/* Free the response body buffer (unless it's our RANGE buffer). */
+	if (res->body != R->req.resbuf)
+		free(res->body);
+
+	/* Remove this request from the in-progress list. */
+	request_dequeue(D, R);
+
+	/* Success! */
+	return (0);
+
+err1:
+	if (res->body != R->req.resbuf)
+		free(res->body);
+	request_dequeue(D, R);
+
+	/* Failure! */
+	return (-1);
+}
+
+/* A multipart upload has finished. */
+static int
+callback_mput(void * cookie, int status)
+{
+	struct request * R = cookie;
+	struct dispatch_state * D = R->D;
+
+	/* The upload state is freed after we return. */
+	R->mpu = NULL;
+
+	/* Send the response back to the client. */
+	if (proto_s3_response_put(D->writeq, R->R.ID, status))
+		goto err1;
+
+	/* Record the request latency. */
+	if (record(D, R->R.type, &R->t_arrive, &R->t_start))
+		goto err1;
 
 	/* Remove this request from the in-progress list. */
 	request_dequeue(D, R);
@@ -305,7 +493,6 @@ callback_response(void * cookie, struct http_response * res)
 	return (0);
 
 err1:
-	free(res->body);
 	request_dequeue(D, R);
 
 	/* Failure! */
@@ -313,12 +500,13 @@ err1:
 }
 
 /**
- * dispatch_accept(Q, s):
+ * dispatch_accept(Q, s, S):
  * Accept a connection from the listening socket ${s} and return a dispatch
- * state for the S3 request queue ${Q}.
+ * state for the S3 request queue ${Q}.  Request latencies are recorded in
+ * ${S}.
  */
 struct dispatch_state *
-dispatch_accept(struct s3_request_queue * Q, int s)
+dispatch_accept(struct s3_request_queue * Q, int s, struct opstats * S)
 {
 	struct dispatch_state * D;
 
@@ -328,6 +516,7 @@ dispatch_accept(struct s3_request_queue * Q, int s)
 
 	/* Initialize dispatcher. */
 	D->Q = Q;
+	D->stats = S;
 	D->ip_head = D->ip_tail = NULL;
 
 	/* Accept a connection. */
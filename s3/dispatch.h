@@ -3,15 +3,18 @@
 
 #include <stdint.h>
 
-/* Opaque type. */
+/* Opaque types. */
+struct opstats;
 struct s3_request_queue;
 
 /**
- * dispatch_accept(Q, s):
+ * dispatch_accept(Q, s, S):
  * Accept a connection from the listening socket ${s} and return a dispatch
- * state for the S3 request queue ${Q}.
+ * state for the S3 request queue ${Q}.  Request latencies are recorded in
+ * ${S}.
  */
-struct dispatch_state * dispatch_accept(struct s3_request_queue *, int);
+struct dispatch_state * dispatch_accept(struct s3_request_queue *, int,
+    struct opstats *);
 
 /**
  * dispatch_alive(D):
@@ -10,6 +10,7 @@
 #include "events.h"
 #include "getopt.h"
 #include "logging.h"
+#include "opstats.h"
 #include "s3_request_queue.h"
 #include "sock.h"
 #include "warnp.h"
@@ -22,8 +23,8 @@ usage(void)
 {
 
 	fprintf(stderr, "usage: kivaloo-s3 -s <s3 socket> -r <s3 region> "
-	    "-k <keyfile> [-l <logfile>] [-n <max # connections>] [-1] "
-	    "[-p <pidfile>]\n");
+	    "-k <keyfile> [-H <hedge budget>] [-l <logfile>] "
+	    "[-n <max # connections>] [-1] [-p <pidfile>]\n");
 	fprintf(stderr, "       kivaloo-s3 --version\n");
 	exit(1);
 }
@@ -41,9 +42,11 @@ main(int argc, char * argv[])
 	struct s3_request_queue * Q;
 	struct dns_reader * DR;
 	struct dispatch_state * D;
+	struct opstats * S;
 	int s;
 
 	/* Command-line parameters. */
+	double opt_H = -1.0;
 	char * opt_k = NULL;
 	char * opt_l = NULL;
 	char * opt_p = NULL;
@@ -66,6 +69,11 @@ main(int argc, char * argv[])
 	/* Parse the command line. */
 	while ((ch = GETOPT(argc, argv)) != NULL) {
 		GETOPT_SWITCH(ch) {
+		GETOPT_OPTARG("-H"):
+			if (opt_H != -1.0)
+				usage();
+			opt_H = strtod(optarg, NULL);
+			break;
 		GETOPT_OPTARG("-k"):
 			if (opt_k != NULL)
 				usage();
@@ -135,6 +143,12 @@ main(int argc, char * argv[])
 		warn0("Maximum number of connections must be in [1, 250]");
 		exit(1);
 	}
+	if (opt_H == -1.0)
+		opt_H = 0.05;
+	if ((opt_H < 0.0) || (opt_H > 1.0)) {
+		warn0("Hedge budget must be in [0.0, 1.0]: -H %f", opt_H);
+		exit(1);
+	}
 
 	/* Read the key file. */
 	if (aws_readkeys(opt_k, &s3_key_id, &s3_key_secret)) {
@@ -149,6 +163,9 @@ main(int argc, char * argv[])
 		exit(1);
 	}
 
+	/* Hedge slow GETs, within our budget. */
+	s3_request_queue_hedge(Q, opt_H);
+
 	/* Construct the S3 endpoint host name. */
 	if (asprintf(&s3_host, "s3.%s.amazonaws.com:80", opt_r) == -1) {
 		warnp("asprintf");
@@ -195,11 +212,21 @@ main(int argc, char * argv[])
 			warnp("Cannot open log file");
 			exit(1);
 		}
+		if (logging_buffer(logfile, 65536)) {
+			warnp("Cannot allocate log buffer");
+			exit(1);
+		}
 		s3_request_queue_log(Q, logfile);
 	} else {
 		logfile = NULL;
 	}
 
+	/* Create request latency statistics (kept across connections). */
+	if ((S = opstats_init()) == NULL) {
+		warnp("Cannot initialize request statistics");
+		exit(1);
+	}
+
 	/* Daemonize and write pid. */
 	if (opt_p == NULL) {
 		if (asprintf(&opt_p, "%s.pid", opt_s) == -1) {
@@ -221,7 +248,7 @@ main(int argc, char * argv[])
 	/* Handle connections, one at once. */
 	do {
 		/* accept a connection. */
-		if ((D = dispatch_accept(Q, s)) == NULL) {
+		if ((D = dispatch_accept(Q, s, S)) == NULL) {
 			warnp("Error accepting new connection");
 			exit(1);
 		}
@@ -245,6 +272,9 @@ main(int argc, char * argv[])
 	/* Free the S3 request queue. */
 	s3_request_queue_free(Q);
 
+	/* Free the request statistics. */
+	opstats_free(S);
+
 	/* Close the log file, if we have one. */
 	if (logfile != NULL)
 		logging_close(logfile);
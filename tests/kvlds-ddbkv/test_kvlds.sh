@@ -27,8 +27,8 @@ rm -rf $TMPDIR
 mkdir $TMPDIR
 $DDBKV -1 -s $SOCKDDBKV -r $REGION -t $TABLE -k $AWSKEY -l $LOGFILE
 
-# Start LBS
-$LBS -1 -s $SOCKL -t $SOCKDDBKV -b 512
+# Start LBS, keeping recently appended blocks in memory
+$LBS -1 -s $SOCKL -t $SOCKDDBKV -b 512 -r 1
 
 # Start KVLDS (the small number of pages should trigger evictions)
 $KVLDS -s $SOCKK -l $SOCKL -v 104 -k 40 -C 1024
@@ -78,6 +78,35 @@ else
 	exit 1
 fi
 
+# Restart LBS-S3 with a local block cache
+kill `cat $SOCKK.pid`
+rm $SOCKK.pid $SOCKK
+kill `cat $SOCKL.pid`
+rm $SOCKL.pid $SOCKL
+mkdir $TMPDIR/cache
+$LBS -s $SOCKL -t $SOCKS3 -b 512 -B $BUCKET -C 1000 -d $TMPDIR/cache
+$KVLDS -s $SOCKK -l $SOCKL -v 104 -C 1024
+
+# Test operations through the cache, and again after a restart with a
+# ring of recently appended blocks
+printf "Testing KVLDS operations against LBS-S3 with a block cache... "
+if ! $TESTKVLDS $SOCKK; then
+	echo " FAILED!"
+	exit 1
+fi
+kill `cat $SOCKK.pid`
+rm $SOCKK.pid $SOCKK
+kill `cat $SOCKL.pid`
+rm $SOCKL.pid $SOCKL
+$LBS -s $SOCKL -t $SOCKS3 -b 512 -B $BUCKET -C 1000 -d $TMPDIR/cache -r 1
+$KVLDS -s $SOCKK -l $SOCKL -v 104 -C 1024
+if $TESTKVLDS $SOCKK; then
+	echo " PASSED!"
+else
+	echo " FAILED!"
+	exit 1
+fi
+
 # Shut down daemons and and clean up
 kill `cat $SOCKK.pid`
 rm $SOCKK.pid $SOCKK
@@ -1,9 +1,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "events.h"
 #include "kvldskey.h"
+#include "opstats.h"
 #include "proto_kvlds.h"
 #include "sock.h"
 #include "sysendian.h"
@@ -16,6 +18,14 @@ static int op_p = 0;
 static int op_badval = 0;
 static size_t op_count = 0;
 
+/* Number of keys in each MGET; one more than the number of values set. */
+#define MGETLEN	100
+
+/* Cleaner counters read by getcleaning. */
+static uint64_t ctr_cleaned;
+static uint64_t ctr_modified;
+static uint64_t ctr_capped;
+
 static int
 callback_params(void * cookie, int failed, size_t kmax, size_t vmax)
 {
@@ -113,6 +123,51 @@ bad:
 	return (0);
 }
 
+static int
+callback_mget(void * cookie, int failed, struct kvldskey ** values)
+{
+	struct kvldskey ** values_correct = cookie;
+	size_t i;
+
+	/* Record failure status. */
+	if (failed) {
+		op_failed = 1;
+		op_done = 1;
+	}
+
+	/* Check that the values match. */
+	for (i = 0; (failed == 0) && (i < MGETLEN); i++) {
+		if ((values[i] == NULL) ^ (values_correct[i] == NULL))
+			goto bad;
+		if ((values[i] != NULL) &&
+		    (values[i]->len != values_correct[i]->len))
+			goto bad;
+		if ((values[i] != NULL) && memcmp(values[i]->buf,
+		    values_correct[i]->buf, values[i]->len))
+			goto bad;
+	}
+	if (failed == 0) {
+		for (i = 0; i < MGETLEN; i++)
+			kvldskey_free(values[i]);
+		free(values);
+	}
+
+	/* Decrement the counter. */
+	op_count -= 1;
+
+	/* Are we done? */
+	if (op_count == 0)
+		op_done = 1;
+
+	/* Success! */
+	return (0);
+
+bad:
+	op_done = 1;
+	op_badval = 1;
+	return (0);
+}
+
 static int
 callback_range(void * cookie,
     const struct kvldskey * key, const struct kvldskey * value)
@@ -393,6 +448,303 @@ err0:
 	return (-1);
 }
 
+static int
+callback_stats(void * cookie, int failed, const uint8_t * buf, size_t buflen)
+{
+	struct opstats_summary ** sums = cookie;
+	struct opstats_counter * ctrs;
+	size_t nsums;
+	size_t nctrs;
+
+	/* Parse the statistics. */
+	if ((failed == 0) && opstats_unserialize(buf, buflen, sums, &nsums))
+		failed = 1;
+
+	/* Parse the counters. */
+	if ((failed == 0) &&
+	    opstats_unserialize_counters(buf, buflen, &ctrs, &nctrs))
+		failed = 1;
+
+	/*
+	 * Make sure pages were appended, user bytes were written, batch
+	 * state was allocated from the arena, and non-modifying requests
+	 * have a limit on the pages they may touch.
+	 */
+	while ((failed == 0) && (nctrs > 0)) {
+		nctrs--;
+		if (((ctrs[nctrs].id == PROTO_KVLDS_CTR_PAGES_APPENDED) ||
+		    (ctrs[nctrs].id == PROTO_KVLDS_CTR_BYTES_USER) ||
+		    (ctrs[nctrs].id == PROTO_KVLDS_CTR_ARENA_ALLOCS) ||
+		    (ctrs[nctrs].id == PROTO_KVLDS_CTR_NMR_LIMIT)) &&
+		    (ctrs[nctrs].value > 0))
+			op_count--;
+	}
+	if (failed == 0)
+		free(ctrs);
+
+	/* Make sure we saw both GET and SET requests. */
+	while ((failed == 0) && (nsums > 0)) {
+		nsums--;
+		if ((((*sums)[nsums].op == PROTO_KVLDS_GET) ||
+		    ((*sums)[nsums].op == PROTO_KVLDS_SET)) &&
+		    ((*sums)[nsums].count > 0))
+			op_count--;
+	}
+
+	/* We're done! */
+	op_failed = failed;
+	op_done = 1;
+
+	/* Success! */
+	return (0);
+}
+
+static int
+dostats(struct wire_requestqueue * Q)
+{
+	struct opstats_summary * sums = NULL;
+
+	/* Send the request. */
+	op_done = 0;
+	op_count = 6;
+	if (proto_kvlds_request_stats(Q, callback_stats, &sums)) {
+		warnp("Error sending STATS request");
+		goto err0;
+	}
+
+	/* Wait for it to finish. */
+	if (events_spin(&op_done) || op_failed) {
+		warnp("STATS request failed");
+		goto err1;
+	}
+
+	/* We should have seen both GETs and SETs, and some writes. */
+	if (op_count != 0) {
+		warn0("STATS response is missing latencies or counters");
+		goto err1;
+	}
+
+	/* Free the summaries. */
+	free(sums);
+
+	/* Success! */
+	return (0);
+
+err1:
+	free(sums);
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+static int
+callback_cleaning(void * cookie, int failed, const uint8_t * buf,
+    size_t buflen)
+{
+	struct opstats_counter * ctrs;
+	size_t nctrs;
+
+	(void)cookie; /* UNUSED */
+
+	/* Parse the counters. */
+	if ((failed == 0) &&
+	    opstats_unserialize_counters(buf, buflen, &ctrs, &nctrs))
+		failed = 1;
+
+	/* Record the cleaner's counters. */
+	while ((failed == 0) && (nctrs > 0)) {
+		nctrs--;
+		if (ctrs[nctrs].id == PROTO_KVLDS_CTR_PAGES_CLEANED)
+			ctr_cleaned = ctrs[nctrs].value;
+		if (ctrs[nctrs].id == PROTO_KVLDS_CTR_PAGES_MODIFIED)
+			ctr_modified = ctrs[nctrs].value;
+		if (ctrs[nctrs].id == PROTO_KVLDS_CTR_CLEANS_CAPPED)
+			ctr_capped = ctrs[nctrs].value;
+	}
+	if (failed == 0)
+		free(ctrs);
+
+	/* We're done! */
+	op_failed = failed;
+	op_done = 1;
+
+	/* Success! */
+	return (0);
+}
+
+/* Read the cleaner's counters into ctr_*. */
+static int
+getcleaning(struct wire_requestqueue * Q)
+{
+
+	/* Send the request. */
+	op_done = 0;
+	if (proto_kvlds_request_stats(Q, callback_cleaning, NULL)) {
+		warnp("Error sending STATS request");
+		goto err0;
+	}
+
+	/* Wait for it to finish. */
+	if (events_spin(&op_done) || op_failed) {
+		warnp("STATS request failed");
+		goto err0;
+	}
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Store ${N} pairs with 100-byte values, pipelining the requests. */
+static int
+storemany(struct wire_requestqueue * Q, size_t N, uint8_t fill)
+{
+	struct kvldskey * key;
+	struct kvldskey * value;
+	uint8_t keybuf[8];
+	uint8_t valbuf[100];
+	size_t i;
+
+	/* Create the value. */
+	memset(valbuf, fill, 100);
+	if ((value = kvldskey_create(valbuf, 100)) == NULL)
+		goto err0;
+
+	/* Store N key-value pairs. */
+	op_done = 0;
+	op_count = N;
+	for (i = 0; i < N; i++) {
+		be64enc(keybuf, i);
+		if ((key = kvldskey_create(keybuf, 8)) == NULL)
+			goto err1;
+		if (proto_kvlds_request_set(Q, key, value,
+		    callback_done, NULL)) {
+			warnp("Error sending SET request");
+			kvldskey_free(key);
+			goto err1;
+		}
+		kvldskey_free(key);
+	}
+
+	/* Wait for SETs to complete. */
+	if (events_spin(&op_done) || op_failed) {
+		warnp("SET request failed");
+		goto err1;
+	}
+
+	/* Free the value. */
+	kvldskey_free(value);
+
+	/* Success! */
+	return (0);
+
+err1:
+	kvldskey_free(value);
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Overwrite 10 of the ${N} pairs each second for ${nsec} seconds. */
+static int
+trickle(struct wire_requestqueue * Q, size_t N, int nsec)
+{
+	struct kvldskey * key;
+	struct kvldskey * value;
+	uint8_t keybuf[8];
+	uint8_t valbuf[100];
+	size_t i;
+	int t;
+
+	/* Create the value. */
+	memset(valbuf, 'T', 100);
+	if ((value = kvldskey_create(valbuf, 100)) == NULL)
+		goto err0;
+
+	/* Spread the writes across the tree. */
+	for (t = 0; t < nsec; t++) {
+		for (i = 0; i < 10; i++) {
+			be64enc(keybuf, ((size_t)t * 10 + i) * 997 % N);
+			if ((key = kvldskey_create(keybuf, 8)) == NULL)
+				goto err1;
+			if (set(Q, key, value)) {
+				kvldskey_free(key);
+				goto err1;
+			}
+			kvldskey_free(key);
+		}
+		sleep(1);
+	}
+
+	/* Free the value. */
+	kvldskey_free(value);
+
+	/* Success! */
+	return (0);
+
+err1:
+	kvldskey_free(value);
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/*
+ * Check that the cleaning cap (kvlds -r 0.25) still binds after a burst of
+ * writes is followed by a trickle: the cleaner should be held to a fraction
+ * of the pages the trickle dirties, not of the pages the burst dirtied.
+ */
+static int
+capped(struct wire_requestqueue * Q, size_t N)
+{
+	uint64_t cleaned, modified, ncapped;
+
+	/* Write lots of pages quickly, then overwrite them all. */
+	if (storemany(Q, N, 'A') || storemany(Q, N, 'B'))
+		goto err0;
+
+	/* Give the cap a few seconds to notice that the burst is over. */
+	if (trickle(Q, N, 5))
+		goto err0;
+
+	/* Measure how much cleaning happens alongside a trickle of writes. */
+	if (getcleaning(Q))
+		goto err0;
+	cleaned = ctr_cleaned;
+	modified = ctr_modified;
+	ncapped = ctr_capped;
+	if (trickle(Q, N, 10))
+		goto err0;
+	if (getcleaning(Q))
+		goto err0;
+	cleaned = ctr_cleaned - cleaned;
+	modified = ctr_modified - modified;
+	ncapped = ctr_capped - ncapped;
+
+	/*
+	 * The cap should have held cleaning back, and the cleaner should have
+	 * rewritten close to a quarter of the pages the writes dirtied; allow
+	 * up to half, since the cap lags behind changes in the write rate.
+	 */
+	if ((ncapped == 0) || (cleaned > modified / 2)) {
+		warn0("Cleaning was not capped: %ju pages cleaned, "
+		    "%ju pages modified, %ju cleans capped",
+		    (uintmax_t)cleaned, (uintmax_t)modified,
+		    (uintmax_t)ncapped);
+		goto err0;
+	}
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
 static int
 mutate(struct wire_requestqueue * Q)
 {
@@ -574,6 +926,103 @@ createmany(struct wire_requestqueue * Q, size_t N)
 	return (0);
 }
 
+static int
+multi(struct wire_requestqueue * Q, size_t N)
+{
+	struct kvldskey * keys[MGETLEN];
+	struct kvldskey * values[MGETLEN];
+	uint8_t keybuf[9];
+	char valbuf[20];
+	size_t i, j;
+
+	/*
+	 * Store N groups of MGETLEN - 1 key-value pairs using MSET, then read
+	 * them back using MGETs which also ask for a key which is not present.
+	 */
+	op_done = 0;
+	op_failed = 0;
+	op_count = N;
+	for (i = 0; i < N; i++) {
+		for (j = 0; j < MGETLEN - 1; j++) {
+			keybuf[0] = 'm';
+			be64enc(&keybuf[1], i * MGETLEN + j);
+			sprintf(valbuf, "%zu", i * MGETLEN + j);
+			keys[j] = kvldskey_create(keybuf, 9);
+			values[j] = kvldskey_create((uint8_t *)valbuf,
+			    strlen(valbuf));
+		}
+		if (proto_kvlds_request_mset(Q, MGETLEN - 1,
+		    (const struct kvldskey * const *)keys,
+		    (const struct kvldskey * const *)values,
+		    callback_done, NULL)) {
+			warnp("Error sending MSET request");
+			return (-1);
+		}
+		for (j = 0; j < MGETLEN - 1; j++) {
+			kvldskey_free(values[j]);
+			kvldskey_free(keys[j]);
+		}
+	}
+	if (events_spin(&op_done) || op_failed) {
+		warnp("MSET request failed");
+		return (-1);
+	}
+
+	/* Read the values back one MGET at a time. */
+	for (i = 0; i < N; i++) {
+		for (j = 0; j < MGETLEN; j++) {
+			keybuf[0] = 'm';
+			be64enc(&keybuf[1], i * MGETLEN + j);
+			sprintf(valbuf, "%zu", i * MGETLEN + j);
+			keys[j] = kvldskey_create(keybuf, 9);
+			values[j] = kvldskey_create((uint8_t *)valbuf,
+			    strlen(valbuf));
+		}
+		kvldskey_free(values[MGETLEN - 1]);
+		values[MGETLEN - 1] = NULL;
+		op_done = 0;
+		op_count = 1;
+		if (proto_kvlds_request_mget(Q, MGETLEN,
+		    (const struct kvldskey * const *)keys, callback_mget,
+		    values)) {
+			warnp("Error sending MGET request");
+			return (-1);
+		}
+		if (events_spin(&op_done) || op_failed) {
+			warnp("MGET request failed");
+			return (-1);
+		}
+		if (op_badval) {
+			warn0("Bad value returned by MGET!");
+			return (-1);
+		}
+		for (j = 0; j < MGETLEN; j++) {
+			kvldskey_free(values[j]);
+			kvldskey_free(keys[j]);
+		}
+	}
+
+	/* Delete all the values. */
+	keys[0] = kvldskey_create((const uint8_t *)"m", 1);
+	keys[1] = kvldskey_create((const uint8_t *)"n", 1);
+	op_done = 0;
+	op_count = 1;
+	if (proto_kvlds_request_range2(Q, keys[0], keys[1], callback_range,
+	    callback_done, Q))
+		return (-1);
+	kvldskey_free(keys[1]);
+	kvldskey_free(keys[0]);
+
+	/* Wait for RANGEs and DELETEs to complete. */
+	if (events_spin(&op_done) || op_failed) {
+		warnp("RANGE or DELETE request failed");
+		return (-1);
+	}
+
+	/* Success! */
+	return (0);
+}
+
 int
 main(int argc, char * argv[])
 {
@@ -584,8 +1033,10 @@ main(int argc, char * argv[])
 	WARNP_INIT;
 
 	/* Check number of arguments. */
-	if (argc != 2) {
-		fprintf(stderr, "usage: test_kvlds %s\n", "<socketname>");
+	if ((argc != 2) &&
+	    ((argc != 3) || (strcmp(argv[2], "capped") != 0))) {
+		fprintf(stderr, "usage: test_kvlds %s %s\n", "<socketname>",
+		    "[capped]");
 		exit(1);
 	}
 
@@ -611,6 +1062,13 @@ main(int argc, char * argv[])
 	if (doparams(Q))
 		exit(1);
 
+	/* Test the cleaning cap instead if requested. */
+	if (argc == 3) {
+		if (capped(Q, 20000))
+			exit(1);
+		goto done;
+	}
+
 	/* Test B+Tree mutation code paths. */
 	if (mutate(Q))
 		exit(1);
@@ -619,6 +1077,15 @@ main(int argc, char * argv[])
 	if (createmany(Q, 40000))
 		exit(1);
 
+	/* Test setting and getting 100 groups of keys at once. */
+	if (multi(Q, 100))
+		exit(1);
+
+	/* Check that request latencies were recorded. */
+	if (dostats(Q))
+		exit(1);
+
+done:
 	/* Free the request queue. */
 	wire_requestqueue_destroy(Q);
 	wire_requestqueue_free(Q);
@@ -134,10 +134,78 @@ else
 	echo " FAILED!"
 	exit 1
 fi
+kill `cat $SOCKK.pid`
+rm $SOCKK.pid $SOCKK
 
-# Shut down KVLDS and LBS and clean up
+# Check that capping and deferring cleaning doesn't break anything
+printf "Testing KVLDS with capped and deferred cleaning..."
+$KVLDS -s $SOCKK -l $SOCKL -v 104 -C 1024 -r 0.25 -G 0.5
+if $TESTKVLDS $SOCKK; then
+	echo " PASSED!"
+else
+	echo " FAILED!"
+	exit 1
+fi
 kill `cat $SOCKK.pid`
 rm $SOCKK.pid $SOCKK
+
+# Check that the cleaning cap still binds once a burst of writes is over
+printf "Testing KVLDS cleaning cap after a burst of writes..."
+$KVLDS -s $SOCKK -l $SOCKL -v 104 -C 100000 -S 10000000 -r 0.25
+if $TESTKVLDS $SOCKK capped; then
+	echo " PASSED!"
+else
+	echo " FAILED!"
+	exit 1
+fi
+kill `cat $SOCKK.pid`
+rm $SOCKK.pid $SOCKK
+
+# Check that freeing segments doesn't lose any live pages
+printf "Testing KVLDS with cost-benefit cleaning..."
+$KVLDS -s $SOCKK -l $SOCKL -v 104 -C 1024 -S 1000 -B
+$TESTKVLDS $SOCKK 2>/dev/null
+kill `cat $SOCKK.pid`
+rm $SOCKK.pid $SOCKK
+$KVLDS -s $SOCKK -l $SOCKL -v 104 -C 1024 -S 1000 -B
+if $TESTKVLDS $SOCKK; then
+	echo " PASSED!"
+else
+	echo " FAILED!"
+	exit 1
+fi
+
+# Shut down KVLDS
+kill `cat $SOCKK.pid`
+rm $SOCKK.pid $SOCKK
+
+# Check that the hot set file is written, and that prefetching from it is
+# harmless even if the file is stale or damaged or the page pool has shrunk
+printf "Testing KVLDS hot set prefetching..."
+HOTSET=$STOR/hotset
+$KVLDS -s $SOCKK -l $SOCKL -v 104 -C 100000 -H $HOTSET -1
+$TESTKVLDS $SOCKK
+while kill -0 `cat $SOCKK.pid` 2>/dev/null; do sleep 0.1; done
+rm $SOCKK.pid $SOCKK
+if ! [ -s $HOTSET ]; then
+	echo " FAILED!"
+	exit 1
+fi
+# The copy will be stale once the tree has been rewritten by the next run
+cp $HOTSET $HOTSET.stale
+head -c 20 $HOTSET.stale > $HOTSET.short
+for F in $HOTSET $HOTSET.stale $HOTSET.short; do
+	$KVLDS -s $SOCKK -l $SOCKL -v 104 -C 1024 -H $F
+	if ! $TESTKVLDS $SOCKK; then
+		echo " FAILED!"
+		exit 1
+	fi
+	kill `cat $SOCKK.pid`
+	rm $SOCKK.pid $SOCKK
+done
+echo " PASSED!"
+
+# Shut down LBS and clean up
 kill `cat $SOCKL.pid`
 rm $SOCKL.pid $SOCKL
 rm -r $STOR
@@ -3,6 +3,7 @@
 #include <string.h>
 
 #include "events.h"
+#include "opstats.h"
 #include "proto_lbs.h"
 #include "sock.h"
 #include "wire.h"
@@ -27,6 +28,8 @@ static int gets_failed;
 static int gets_ndone;
 static int free_done;
 static int free_failed;
+static int stats_done;
+static int stats_failed;
 
 /* Callback for PARAMS request. */
 static int
@@ -127,6 +130,51 @@ callback_free(void * cookie, int failed)
 	return (0);
 }
 
+/* Callback for STATS request. */
+static int
+callback_stats(void * cookie, int failed, const uint8_t * buf, size_t buflen)
+{
+	struct opstats_summary * sums;
+	struct opstats_counter * ctrs;
+	size_t nsums, nctrs;
+	size_t i;
+	int nops = 0;
+
+	(void)cookie; /* UNUSED */
+
+	/* Parse the statistics and look for GETs and APPENDs. */
+	if ((failed == 0) && (opstats_unserialize(buf, buflen,
+	    &sums, &nsums) == 0)) {
+		for (i = 0; i < nsums; i++) {
+			if (((sums[i].op == PROTO_LBS_GET) ||
+			    (sums[i].op == PROTO_LBS_APPEND)) &&
+			    (sums[i].count > 0))
+				nops++;
+		}
+		free(sums);
+	}
+
+	/* Check that the blocks appended via the cleaner were counted. */
+	if ((failed == 0) && (opstats_unserialize_counters(buf, buflen,
+	    &ctrs, &nctrs) == 0)) {
+		for (i = 0; i < nctrs; i++) {
+			if ((ctrs[i].id == PROTO_LBS_CTR_BLKS_CLEANER) &&
+			    (ctrs[i].value >= 128))
+				nops++;
+		}
+		free(ctrs);
+	}
+
+	/* Record whether we saw latencies for both types and the counter. */
+	stats_failed = (nops != 3);
+
+	/* We're done. */
+	stats_done = 1;
+
+	/* Success! */
+	return (0);
+}
+
 int
 main(int argc, char * argv[])
 {
@@ -134,6 +182,7 @@ main(int argc, char * argv[])
 	int s;
 	struct wire_requestqueue * Q;
 	uint8_t * buf;
+	const uint8_t * bufv[1];
 	size_t i, j, k;
 
 	WARNP_INIT;
@@ -197,11 +246,15 @@ main(int argc, char * argv[])
 		}
 	}
 
-	/* Write 256 pages individually. */
+	/* Write 256 pages individually, alternating between streams. */
 	memset(buf, 0, params_blklen);
+	bufv[0] = buf;
 	for (i = 0; i < 256; i++) {
 		append_done = append_failed = 0;
-		if (proto_lbs_request_append(Q, 1, params_nextblk,
+		if ((i % 2) ? proto_lbs_request_append_stream(Q, 1,
+		    params_nextblk, params_blklen, bufv,
+		    PROTO_LBS_STREAM_CLEANER, callback_append, NULL) :
+		    proto_lbs_request_append(Q, 1, params_nextblk,
 		    params_blklen, buf, callback_append, NULL)) {
 			warnp("Failed to send APPEND request");
 			exit(1);
@@ -246,6 +299,34 @@ main(int argc, char * argv[])
 		exit(1);
 	}
 
+	/* Free a range of blocks in the middle. */
+	free_done = free_failed = 0;
+	if (proto_lbs_request_free_range(Q, params_nextblk - 512 + 64, 64,
+	    callback_free, NULL)) {
+		warnp("Failed to send FREERANGE request");
+		exit(1);
+	}
+	if (events_spin(&free_done) || free_failed) {
+		warnp("FREERANGE request failed");
+		exit(1);
+	}
+
+	/* Make sure blocks after the range are still intact. */
+	get_done = get_failed = 0;
+	if (proto_lbs_request_get(Q, params_nextblk - 512 + 200,
+	    params_blklen, callback_get, buf)) {
+		warnp("Failed to send GET request");
+		exit(1);
+	}
+	if (events_spin(&get_done) || get_failed) {
+		warnp("GET request failed");
+		exit(1);
+	}
+	if (buf[0] != 200) {
+		warn0("GET data after FREERANGE is incorrect");
+		exit(1);
+	}
+
 	/* Free blocks. */
 	free_done = free_failed = 0;
 	if (proto_lbs_request_free(Q, params_nextblk, callback_free, NULL)) {
@@ -257,6 +338,17 @@ main(int argc, char * argv[])
 		exit(1);
 	}
 
+	/* Check that request latencies were recorded. */
+	stats_done = stats_failed = 0;
+	if (proto_lbs_request_stats(Q, callback_stats, NULL)) {
+		warnp("Failed to send STATS request");
+		exit(1);
+	}
+	if (events_spin(&stats_done) || stats_failed) {
+		warnp("STATS request failed");
+		exit(1);
+	}
+
 	/* Free the request queue. */
 	wire_requestqueue_destroy(Q);
 	wire_requestqueue_free(Q);
@@ -4,6 +4,7 @@
 
 #include "events.h"
 #include "kvldskey.h"
+#include "opstats.h"
 #include "proto_kvlds.h"
 #include "sock.h"
 #include "sysendian.h"
@@ -144,6 +145,34 @@ err0:
 	return (-1);
 }
 
+static int
+mset(struct wire_requestqueue * Q,
+    const struct kvldskey * key, const struct kvldskey * value)
+{
+
+	/* Send the request. */
+	op_done = 0;
+	op_count = 1;
+	if (proto_kvlds_request_mset(Q, 1, &key, &value, callback_done,
+	    NULL)) {
+		warnp("Error sending MSET request");
+		goto err0;
+	}
+
+	/* Wait for it to finish. */
+	if (events_spin(&op_done) || op_failed) {
+		warnp("MSET request failed");
+		goto err0;
+	}
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
 static int
 cas(struct wire_requestqueue * Q,
     const struct kvldskey * key, const struct kvldskey * oval,
@@ -199,6 +228,146 @@ err0:
 	return (-1);
 }
 
+static int
+get(struct wire_requestqueue * Q,
+    const struct kvldskey * key, const struct kvldskey * value)
+{
+
+	/* Send the request. */
+	op_done = 0;
+	op_count = 1;
+	if (proto_kvlds_request_get(Q, key, callback_get, (void *)value)) {
+		warnp("Error sending GET request");
+		goto err0;
+	}
+
+	/* Wait for it to finish. */
+	if (events_spin(&op_done) || op_failed) {
+		warnp("GET request failed");
+		goto err0;
+	}
+	if (op_badval) {
+		warnp("Bad value returned by GET!");
+		goto err0;
+	}
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+static int
+callback_stats(void * cookie, int failed, const uint8_t * buf, size_t buflen)
+{
+	struct opstats_counter * ctrs;
+	size_t nctrs;
+
+	(void)cookie; /* UNUSED */
+
+	/* Parse the counters. */
+	if ((failed == 0) &&
+	    opstats_unserialize_counters(buf, buflen, &ctrs, &nctrs))
+		failed = 1;
+
+	/* Make sure the cache has both answered and forwarded GETs. */
+	while ((failed == 0) && (nctrs > 0)) {
+		nctrs--;
+		if (((ctrs[nctrs].id == PROTO_KVLDS_CTR_MUX_CACHE_HITS) ||
+		    (ctrs[nctrs].id == PROTO_KVLDS_CTR_MUX_CACHE_MISSES)) &&
+		    (ctrs[nctrs].value > 0))
+			op_count--;
+	}
+	if (failed == 0)
+		free(ctrs);
+
+	/* We're done! */
+	op_failed = failed;
+	op_done = 1;
+
+	/* Success! */
+	return (0);
+}
+
+static int
+cachestats(struct wire_requestqueue * Q)
+{
+
+	/* Send the request. */
+	op_done = 0;
+	op_count = 2;
+	if (proto_kvlds_request_stats(Q, callback_stats, NULL)) {
+		warnp("Error sending STATS request");
+		goto err0;
+	}
+
+	/* Wait for it to finish. */
+	if (events_spin(&op_done) || op_failed) {
+		warnp("STATS request failed");
+		goto err0;
+	}
+
+	/* The mux should have reported cache hits and misses. */
+	if (op_count != 0) {
+		warn0("STATS response is missing cache counters");
+		goto err0;
+	}
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+static int
+overwrite(struct wire_requestqueue * Q, const char * key, size_t N)
+{
+	struct kvldskey * k;
+	struct kvldskey * v;
+	char valbuf[20];
+	size_t i;
+
+	/* Create key. */
+	if ((k = kvldskey_create((const uint8_t *)key, strlen(key))) == NULL)
+		return (-1);
+
+	/*
+	 * Repeatedly overwrite the value, alternating between SET and MSET,
+	 * and read it back (twice).
+	 */
+	for (i = 0; i < N; i++) {
+		sprintf(valbuf, "%zu", i);
+		if ((v = kvldskey_create((uint8_t *)valbuf,
+		    strlen(valbuf))) == NULL)
+			return (-1);
+		if ((i & 1) ? mset(Q, k, v) : set(Q, k, v))
+			return (-1);
+		if (get(Q, k, v) || get(Q, k, v))
+			return (-1);
+		kvldskey_free(v);
+	}
+
+	/* Delete the key and make sure it's gone. */
+	op_done = 0;
+	op_count = 1;
+	if (proto_kvlds_request_delete(Q, k, callback_done, NULL))
+		return (-1);
+	if (events_spin(&op_done) || op_failed)
+		return (-1);
+	if (get(Q, k, NULL))
+		return (-1);
+
+	/* Free the key. */
+	kvldskey_free(k);
+
+	/* Success! */
+	return (0);
+}
+
 static int
 pingpong(struct wire_requestqueue * Q, const char * key, const char * to,
     const char * from, int start)
@@ -350,7 +519,7 @@ main(int argc, char * argv[])
 	/* Check number of arguments. */
 	if (argc != 3) {
 		fprintf(stderr, "usage: test_mux %s %s\n",
-		    "<socketname>", "{ping | pong | <prefix>}");
+		    "<socketname>", "{ping | pong | overwrite | <prefix>}");
 		exit(1);
 	}
 
@@ -378,6 +547,11 @@ main(int argc, char * argv[])
 	} else if (strcmp(argv[2], "pong") == 0) {
 		if (pingpong(Q, "pingpong", "pong", "ping", 0))
 			exit(1);
+	} else if (strcmp(argv[2], "overwrite") == 0) {
+		if (overwrite(Q, "overwrite", 1000))
+			exit(1);
+		if (cachestats(Q))
+			exit(1);
 	} else if (strcmp(argv[2], "loop") == 0) {
 		/* Repeatedly create/read/delete 10^4 pairs until we die. */
 		do {
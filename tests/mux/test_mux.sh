@@ -114,6 +114,42 @@ fi
 kill `cat $SOCKM.pid`
 rm $SOCKM $SOCKM.pid
 
+# Check that caching GET responses doesn't break anything
+printf "Testing KVLDS via caching MUX... "
+$MUX -t $SOCKK -s $SOCKM -c 1000
+if $TESTMUX $SOCKM 0.; then
+	echo " PASSED!"
+else
+	echo " FAILED!"
+	exit 1
+fi
+
+# Check that cached responses are invalidated by modifications
+printf "Testing overwrites via caching MUX... "
+if $TESTMUX $SOCKM overwrite; then
+	echo " PASSED!"
+else
+	echo " FAILED!"
+	exit 1
+fi
+
+# Check that CAS works with a cache in the way
+printf "Testing ping-pong via caching MUX... "
+( $TESTMUX $SOCKM ping || touch .failed ) &
+( $TESTMUX $SOCKM pong || touch .failed ) &
+sleep 2
+if pgrep test_mux | grep -q .; then
+	touch .failed;
+fi
+if [ -f .failed ]; then
+	echo " FAILED!"
+	exit 1
+else
+	echo " PASSED!"
+fi
+kill `cat $SOCKM.pid`
+rm $SOCKM $SOCKM.pid
+
 # If we're not running on FreeBSD, we can't use utrace and jemalloc to
 # check for memory leaks
 if ! [ `uname` = "FreeBSD" ]; then